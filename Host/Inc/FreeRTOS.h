@@ -0,0 +1,42 @@
+/**
+ ******************************************************************************
+ * @file           : FreeRTOS.h
+ * @brief          : Host stand-in for the FreeRTOS kernel. There is no scheduler,
+ *                   host_rtos.c keeps a tick the harness advances, latches task
+ *                   notifications for the harness to deliver and turns critical
+ *                   sections into a recursive mutex.
+ ******************************************************************************
+ */
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef void *TaskHandle_t;
+
+#define pdFALSE					((BaseType_t)0)
+#define pdTRUE					((BaseType_t)1)
+#define pdPASS					pdTRUE
+#define pdFAIL					pdFALSE
+
+#define portTICK_PERIOD_MS		((TickType_t)1)
+#define portMAX_DELAY			((TickType_t)0xFFFFFFFFUL)
+#define pdMS_TO_TICKS(xTimeInMs)	((TickType_t)(xTimeInMs))
+
+void Host_Enter_Critical(void);
+void Host_Exit_Critical(void);
+
+#define taskENTER_CRITICAL()					Host_Enter_Critical()
+#define taskEXIT_CRITICAL()						Host_Exit_Critical()
+#define portSET_INTERRUPT_MASK_FROM_ISR()		(Host_Enter_Critical(), (UBaseType_t)0)
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(x)	((void)(x), Host_Exit_Critical())
+#define portYIELD_FROM_ISR(x)					((void)(x))
+
+#define configASSERT(x)
+
+#endif /* FREERTOS_H */
@@ -0,0 +1,16 @@
+/**
+ ******************************************************************************
+ * @file           : cmsis_os.h
+ * @brief          : Host stand-in for the CMSIS-RTOS wrapper
+ ******************************************************************************
+ */
+
+#ifndef CMSIS_OS_H_
+#define CMSIS_OS_H_
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+typedef TaskHandle_t osThreadId;
+
+#endif /* CMSIS_OS_H_ */
@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * @file           : host_hal.h
+ * @brief          : Header for host_hal.c file. State of the stand-in peripherals
+ *                   the harness reads and drives.
+ ******************************************************************************
+ */
+
+#ifndef HOST_HAL_H_
+#define HOST_HAL_H_
+
+#include "stm32g0xx_hal.h"
+
+/* OTP and engineering area, one 4K mapping holds both */
+#define HOST_OTP_BASE					0x1FFF7000UL
+#define HOST_OTP_MAP_BYTES				0x1000
+
+/* Typical factory values at 3.0V, VREFINT 1.212V, TS 0.76V at 30C rising 2.5mV/C */
+#define HOST_VREFINT_CAL				1655
+#define HOST_TS_CAL1					1037
+#define HOST_TS_CAL2					1379
+
+#define HOST_TIM6_CLOCK_HZ				1000000
+#define HOST_ADC_WATCHDOGS				3
+
+/* BQ25703A registers the model acts on */
+#define HOST_BQ_CHARGE_CURRENT_ADDR		0x02
+#define HOST_BQ_MAX_CHARGE_VOLTAGE_ADDR	0x04
+#define HOST_BQ_CHARGE_STATUS_ADDR		0x20
+#define HOST_BQ_VBUS_ADC_ADDR			0x27
+#define HOST_BQ_ICHG_ADC_ADDR			0x29
+#define HOST_BQ_IIN_ADC_ADDR			0x2B
+#define HOST_BQ_VBAT_ADC_ADDR			0x2C
+#define HOST_BQ_VSYS_ADC_ADDR			0x2D
+#define HOST_BQ_MANUFACTURER_ID_ADDR	0x2E
+#define HOST_BQ_DEVICE_ID_ADDR			0x2F
+#define HOST_BQ_ADC_OPTION_MSB_ADDR		0x3B
+#define HOST_BQ_ADC_START_BIT			(1 << 6)
+#define HOST_BQ_MANUFACTURER_ID			0x40
+#define HOST_BQ_DEVICE_ID				0x78
+
+struct Host_Hal {
+	uint8_t verbose;
+	/* Programs and erases left before flash stops accepting them, -1 for no limit */
+	int32_t flash_program_budget;
+	uint32_t flash_programs;
+	uint32_t flash_erases;
+	uint16_t *adc_dma_buffer;
+	uint32_t adc_dma_length;
+	uint32_t adc_dma_index;
+	uint8_t adc_running;
+	ADC_AnalogWDGConfTypeDef adc_awd[HOST_ADC_WATCHDOGS];
+	uint32_t adc_awd_trips[HOST_ADC_WATCHDOGS];
+	uint8_t bq25703a[256];
+	uint8_t bq25703a_pointer;
+	uint8_t bq25703a_absent;
+};
+
+extern struct Host_Hal host_hal;
+
+extern ADC_HandleTypeDef hadc1;
+extern TIM_HandleTypeDef htim6;
+
+void Host_Hal_Reset(void);
+
+void Host_Write_OTP_Scalars(const uint32_t *scalars, uint32_t count);
+
+void Host_ADC_Watchdog_Check(uint32_t channel, uint16_t code);
+
+uint32_t Host_ADC_Trigger_Rate(void);
+
+#endif /* HOST_HAL_H_ */
@@ -0,0 +1,20 @@
+/**
+ ******************************************************************************
+ * @file           : host_rtos.h
+ * @brief          : Header for host_rtos.c file. The tick and task notifications
+ *                   the harness owns in place of the scheduler.
+ ******************************************************************************
+ */
+
+#ifndef HOST_RTOS_H_
+#define HOST_RTOS_H_
+
+#include "FreeRTOS.h"
+
+void Host_Set_Tick(TickType_t tick);
+
+void Host_Advance_Tick(TickType_t ticks);
+
+uint32_t Host_Take_Notification(void);
+
+#endif /* HOST_RTOS_H_ */
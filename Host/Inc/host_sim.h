@@ -0,0 +1,98 @@
+/**
+ ******************************************************************************
+ * @file           : host_sim.h
+ * @brief          : Header for host_sim.c file. Drives the firmware ADC and
+ *                   regulator paths on the host, from a pack model or from
+ *                   recorded scan sequences.
+ ******************************************************************************
+ */
+
+#ifndef HOST_SIM_H_
+#define HOST_SIM_H_
+
+#include <stdint.h>
+
+#include "adc_interface.h"
+
+/* Calibration written to OTP at start up, Q16 microvolts per code at the nominal VDDA */
+#define HOST_SIM_XT60_SCALAR			(4900UL << 16)
+#define HOST_SIM_TAP_SCALAR(tap)		((1200UL * (tap)) << 16)
+
+#define HOST_SIM_CELLS					4
+#define HOST_SIM_REGULATOR_POLL_MS		250
+
+/* VBAT, VSYS and ICHG ADC steps of the BQ25703A */
+#define HOST_SIM_BQ_VBAT_STEP_MV		64
+#define HOST_SIM_BQ_VBAT_OFFSET_MV		2880
+#define HOST_SIM_BQ_VBUS_STEP_MV		64
+#define HOST_SIM_BQ_VBUS_OFFSET_MV		3200
+#define HOST_SIM_BQ_ICHG_STEP_MA		64
+#define HOST_SIM_BQ_IIN_STEP_MA			50
+
+/*
+ * Pack model. Each cell is an open circuit voltage from its state of charge behind a series resistance, the XT60 adds the
+ * lead resistance. Bleeds load their cell through bleed_ohm while the balancing GPIO is set. The charger follows the
+ * BQ25703A registers: constant current at the charge current register up to the charge voltage register, nothing in HI-Z
+ */
+struct Host_Sim_Pack {
+	uint8_t cells;
+	uint8_t xt60_connected;
+	uint8_t balance_connected;
+	double soc[HOST_SIM_CELLS];
+	double capacity_mah;
+	double cell_ohm;
+	double lead_ohm;
+	double bleed_ohm;
+};
+
+struct Host_Sim {
+	/* Model inputs */
+	struct Host_Sim_Pack pack;
+	double temperature_c;
+	double vdda_v;
+	double vdda_ripple_v;
+	double vdda_ripple_hz;
+	double noise_codes;
+	/* Set to drive the inputs directly, the pack model is skipped */
+	uint8_t override;
+	double xt60_v;
+	double tap_v[HOST_SIM_CELLS];
+	uint8_t regulator_enabled;
+	/* Time per sequence, 0 follows TIM6 or the conversion time. Replays set the recording's rate */
+	uint64_t sequence_ns;
+
+	/* Model outputs */
+	double charge_current_a;
+	double bleed_current_a[HOST_SIM_CELLS];
+
+	/* Harness counters */
+	uint64_t time_ns;
+	uint32_t sequences;
+	uint32_t blocks;
+	uint32_t windows;
+	uint64_t process_ns;
+	uint64_t block_process_ns_max;
+	uint32_t regulator_polls;
+};
+
+extern struct Host_Sim host_sim;
+
+void Host_Sim_Init(void);
+
+void Host_Sim_Set_Pack(uint8_t cells, double cell_v);
+
+double Host_Sim_OCV(double soc);
+
+void Host_Sim_Sequence(const uint16_t *codes);
+
+void Host_Sim_Model_Sequence(uint16_t *codes);
+
+void Host_Sim_Run_Ms(uint32_t ms);
+
+void Host_Sim_Run_Windows(uint32_t windows);
+
+uint32_t Host_Sim_Now_Ms(void);
+
+void Host_Set_USB_PD(uint8_t power_ready, uint32_t voltage_mv, uint32_t current_ma);
+
+#endif /* HOST_SIM_H_ */
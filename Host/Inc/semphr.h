@@ -0,0 +1,24 @@
+/**
+ ******************************************************************************
+ * @file           : semphr.h
+ * @brief          : Host stand-in for the FreeRTOS semaphore API. The host build is
+ *                   single threaded around the mutexes, so takes always succeed
+ ******************************************************************************
+ */
+
+#ifndef SEMAPHORE_H
+#define SEMAPHORE_H
+
+#include "FreeRTOS.h"
+
+typedef void *SemaphoreHandle_t;
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime) {
+	return pdPASS;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore) {
+	return pdPASS;
+}
+
+#endif /* SEMAPHORE_H */
@@ -0,0 +1,249 @@
+/**
+ ******************************************************************************
+ * @file           : stm32g0xx_hal.h
+ * @brief          : Host stand-in for the STM32G0 HAL. Declares only what the
+ *                   firmware modules in the host build use. Peripherals are plain
+ *                   structs in RAM, flash and the factory OTP area are mapped at
+ *                   their real addresses by host_hal.c.
+ ******************************************************************************
+ */
+
+#ifndef STM32G0XX_HAL_H
+#define STM32G0XX_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define __IO	volatile
+
+#define ENABLE		1
+#define DISABLE		0
+
+typedef enum {
+	HAL_OK = 0,
+	HAL_ERROR,
+	HAL_BUSY,
+	HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+/* Cortex-M0+ intrinsics used by the firmware */
+#define __DMB()				__sync_synchronize()
+#define __DSB()				__sync_synchronize()
+#define __ISB()				__sync_synchronize()
+
+/* SysTick, counts down from LOAD at the CPU clock */
+typedef struct {
+	__IO uint32_t CTRL;
+	__IO uint32_t LOAD;
+	__IO uint32_t VAL;
+	__IO uint32_t CALIB;
+} SysTick_Type;
+
+extern SysTick_Type host_systick;
+#define SysTick				(&host_systick)
+
+/* Flash, mapped at FLASH_BASE by host_hal.c */
+#define FLASH_BASE						0x08000000UL
+#define FLASH_SIZE						(128 * 1024)
+#define FLASH_PAGE_SIZE					0x800
+#define FLASH_TYPEERASE_PAGES			0
+#define FLASH_TYPEPROGRAM_DOUBLEWORD	1
+
+typedef struct {
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t Page;
+	uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError);
+
+/* Factory calibration values in the engineering area, mapped with the OTP by host_hal.c */
+#define VREFINT_CAL_ADDR				((uint16_t *) (0x1FFF75AAUL))
+#define VREFINT_CAL_VREF				(3000UL)
+#define TEMPSENSOR_CAL1_ADDR			((uint16_t *) (0x1FFF75A8UL))
+#define TEMPSENSOR_CAL2_ADDR			((uint16_t *) (0x1FFF75CAUL))
+#define TEMPSENSOR_CAL1_TEMP			((int32_t) 30)
+#define TEMPSENSOR_CAL2_TEMP			((int32_t) 130)
+#define TEMPSENSOR_CAL_VREFANALOG		(3000UL)
+
+/* GPIO */
+typedef struct {
+	__IO uint32_t ODR;
+	__IO uint32_t IDR;
+} GPIO_TypeDef;
+
+typedef enum {
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+extern GPIO_TypeDef host_gpioa, host_gpiob;
+#define GPIOA		(&host_gpioa)
+#define GPIOB		(&host_gpiob)
+
+#define GPIO_PIN_0		((uint16_t)0x0001)
+#define GPIO_PIN_1		((uint16_t)0x0002)
+#define GPIO_PIN_2		((uint16_t)0x0004)
+#define GPIO_PIN_3		((uint16_t)0x0008)
+#define GPIO_PIN_4		((uint16_t)0x0010)
+#define GPIO_PIN_5		((uint16_t)0x0020)
+#define GPIO_PIN_6		((uint16_t)0x0040)
+#define GPIO_PIN_7		((uint16_t)0x0080)
+#define GPIO_PIN_8		((uint16_t)0x0100)
+#define GPIO_PIN_9		((uint16_t)0x0200)
+#define GPIO_PIN_10		((uint16_t)0x0400)
+#define GPIO_PIN_11		((uint16_t)0x0800)
+#define GPIO_PIN_12		((uint16_t)0x1000)
+#define GPIO_PIN_13		((uint16_t)0x2000)
+#define GPIO_PIN_14		((uint16_t)0x4000)
+#define GPIO_PIN_15		((uint16_t)0x8000)
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+
+/* ADC */
+typedef struct {
+	__IO uint32_t ISR;
+	__IO uint32_t IER;
+	__IO uint32_t SMPR;
+	__IO uint32_t DR;
+} ADC_TypeDef;
+
+typedef struct {
+	uint32_t ClockPrescaler;
+	uint32_t Resolution;
+	uint32_t ContinuousConvMode;
+	uint32_t NbrOfConversion;
+	uint32_t ExternalTrigConv;
+	uint32_t ExternalTrigConvEdge;
+	uint32_t SamplingTimeCommon1;
+	uint32_t SamplingTimeCommon2;
+	uint32_t OversamplingMode;
+} ADC_InitTypeDef;
+
+typedef struct {
+	ADC_TypeDef *Instance;
+	ADC_InitTypeDef Init;
+} ADC_HandleTypeDef;
+
+typedef struct {
+	uint32_t WatchdogNumber;
+	uint32_t WatchdogMode;
+	uint32_t Channel;
+	uint32_t ITMode;
+	uint32_t HighThreshold;
+	uint32_t LowThreshold;
+} ADC_AnalogWDGConfTypeDef;
+
+#define ADC_CHANNEL_0					0
+#define ADC_CHANNEL_1					1
+#define ADC_CHANNEL_2					2
+#define ADC_CHANNEL_3					3
+#define ADC_CHANNEL_4					4
+#define ADC_CHANNEL_TEMPSENSOR			12
+#define ADC_CHANNEL_VREFINT				13
+
+#define ADC_RESOLUTION_12B				0
+
+/* Sampling time codes, the SMPR field values */
+#define ADC_SAMPLETIME_1CYCLE_5			0
+#define ADC_SAMPLETIME_3CYCLES_5		1
+#define ADC_SAMPLETIME_7CYCLES_5		2
+#define ADC_SAMPLETIME_12CYCLES_5		3
+#define ADC_SAMPLETIME_19CYCLES_5		4
+#define ADC_SAMPLETIME_39CYCLES_5		5
+#define ADC_SAMPLETIME_79CYCLES_5		6
+#define ADC_SAMPLETIME_160CYCLES_5		7
+
+#define LL_ADC_SAMPLINGTIME_COMMON_1	0
+#define LL_ADC_SAMPLINGTIME_COMMON_2	1
+
+#define ADC_SOFTWARE_START				0
+#define ADC_EXTERNALTRIG_T6_TRGO		1
+#define ADC_EXTERNALTRIGCONVEDGE_NONE	0
+#define ADC_EXTERNALTRIGCONVEDGE_RISING	1
+
+#define ADC_ANALOGWATCHDOG_1			0
+#define ADC_ANALOGWATCHDOG_2			1
+#define ADC_ANALOGWATCHDOG_3			2
+#define ADC_ANALOGWATCHDOG_SINGLE_REG	1
+
+#define ADC_IT_AWD1						(1UL << 7)
+#define ADC_IT_AWD2						(1UL << 8)
+#define ADC_IT_AWD3						(1UL << 9)
+#define ADC_FLAG_AWD1					ADC_IT_AWD1
+#define ADC_FLAG_AWD2					ADC_IT_AWD2
+#define ADC_FLAG_AWD3					ADC_IT_AWD3
+
+#define __HAL_ADC_ENABLE_IT(__HANDLE__, __INTERRUPT__)		((__HANDLE__)->Instance->IER |= (__INTERRUPT__))
+#define __HAL_ADC_DISABLE_IT(__HANDLE__, __INTERRUPT__)		((__HANDLE__)->Instance->IER &= ~(__INTERRUPT__))
+#define __HAL_ADC_CLEAR_FLAG(__HANDLE__, __FLAG__)			((__HANDLE__)->Instance->ISR &= ~(__FLAG__))
+
+/* Same formulas as the LL helpers, 12 bit data only */
+#define __HAL_ADC_CALC_VREFANALOG_VOLTAGE(__VREFINT_ADC_DATA__, __ADC_RESOLUTION__) \
+	(((uint32_t)(*VREFINT_CAL_ADDR) * VREFINT_CAL_VREF) / (__VREFINT_ADC_DATA__))
+
+#define __HAL_ADC_CALC_TEMPERATURE(__VREFANALOG_VOLTAGE__, __TEMPSENSOR_ADC_DATA__, __ADC_RESOLUTION__) \
+	(((((int32_t)(((__TEMPSENSOR_ADC_DATA__) * (__VREFANALOG_VOLTAGE__)) / TEMPSENSOR_CAL_VREFANALOG) \
+	- (int32_t)*TEMPSENSOR_CAL1_ADDR) * (int32_t)(TEMPSENSOR_CAL2_TEMP - TEMPSENSOR_CAL1_TEMP)) \
+	/ (int32_t)((int32_t)*TEMPSENSOR_CAL2_ADDR - (int32_t)*TEMPSENSOR_CAL1_ADDR)) + TEMPSENSOR_CAL1_TEMP)
+
+HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADCEx_Calibration_Start(ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef *hadc, uint32_t *pData, uint32_t Length);
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADC_AnalogWDGConfig(ADC_HandleTypeDef *hadc, ADC_AnalogWDGConfTypeDef *AnalogWDGConfig);
+void LL_ADC_SetChannelSamplingTime(ADC_TypeDef *ADCx, uint32_t Channel, uint32_t SamplingTimeY);
+
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc);
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc);
+void HAL_ADC_LevelOutOfWindowCallback(ADC_HandleTypeDef *hadc);
+void HAL_ADCEx_LevelOutOfWindow2Callback(ADC_HandleTypeDef *hadc);
+void HAL_ADCEx_LevelOutOfWindow3Callback(ADC_HandleTypeDef *hadc);
+
+/* Timers */
+typedef struct {
+	__IO uint32_t CR1;
+	__IO uint32_t CNT;
+	__IO uint32_t PSC;
+	__IO uint32_t ARR;
+} TIM_TypeDef;
+
+typedef struct {
+	TIM_TypeDef *Instance;
+} TIM_HandleTypeDef;
+
+#define __HAL_TIM_SET_AUTORELOAD(__HANDLE__, __AUTORELOAD__)	((__HANDLE__)->Instance->ARR = (__AUTORELOAD__))
+#define __HAL_TIM_SET_COUNTER(__HANDLE__, __COUNTER__)			((__HANDLE__)->Instance->CNT = (__COUNTER__))
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef *htim);
+
+/* I2C */
+typedef enum {
+	HAL_I2C_STATE_RESET = 0,
+	HAL_I2C_STATE_READY = 0x20
+} HAL_I2C_StateTypeDef;
+
+#define HAL_I2C_ERROR_NONE		0
+#define HAL_I2C_ERROR_AF		0x04
+
+typedef struct {
+	void *Instance;
+} I2C_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_I2C_Master_Transmit_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Master_Receive_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size);
+HAL_I2C_StateTypeDef HAL_I2C_GetState(I2C_HandleTypeDef *hi2c);
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef *hi2c);
+
+/* UART, only referenced by printf.c */
+typedef struct {
+	void *Instance;
+} UART_HandleTypeDef;
+
+#endif /* STM32G0XX_HAL_H */
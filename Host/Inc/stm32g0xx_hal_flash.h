@@ -0,0 +1,13 @@
+/**
+ ******************************************************************************
+ * @file           : stm32g0xx_hal_flash.h
+ * @brief          : Host stand-in, the flash API is declared in stm32g0xx_hal.h
+ ******************************************************************************
+ */
+
+#ifndef STM32G0XX_HAL_FLASH_H
+#define STM32G0XX_HAL_FLASH_H
+
+#include "stm32g0xx_hal.h"
+
+#endif /* STM32G0XX_HAL_FLASH_H */
@@ -0,0 +1,11 @@
+/**
+ ******************************************************************************
+ * @file           : stm32g0xx_ll_system.h
+ * @brief          : Host stand-in, included by main.h but not used by the host build
+ ******************************************************************************
+ */
+
+#ifndef STM32G0XX_LL_SYSTEM_H
+#define STM32G0XX_LL_SYSTEM_H
+
+#endif /* STM32G0XX_LL_SYSTEM_H */
@@ -0,0 +1,11 @@
+/**
+ ******************************************************************************
+ * @file           : stm32g0xx_ll_ucpd.h
+ * @brief          : Host stand-in, included by main.h but not used by the host build
+ ******************************************************************************
+ */
+
+#ifndef STM32G0XX_LL_UCPD_H
+#define STM32G0XX_LL_UCPD_H
+
+#endif /* STM32G0XX_LL_UCPD_H */
@@ -0,0 +1,24 @@
+/**
+ ******************************************************************************
+ * @file           : usbpd.h
+ * @brief          : Host stand-in for Inc/usbpd.h without the ST USB-PD stack.
+ *                   The supply state is set by the harness through host_usbpd.c
+ ******************************************************************************
+ */
+
+#ifndef __usbpd_H
+#define __usbpd_H
+
+#include <stdint.h>
+
+/* Same values as Inc/usbpd.h */
+#define NO_USB_PD_SUPPLY 2
+#define READY 1
+#define NOT_READY 0
+
+uint8_t Get_Input_Power_Ready(void);
+uint32_t Get_Max_Input_Power(void);
+uint32_t Get_Max_Input_Current(void);
+uint32_t Get_Input_Voltage(void);
+
+#endif /*__usbpd_H */
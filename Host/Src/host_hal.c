@@ -0,0 +1,311 @@
+/**
+ ******************************************************************************
+ * @file           : host_hal.c
+ * @brief          : Host stand-in for the HAL calls the firmware modules make.
+ *                   Flash and the OTP/engineering area are mapped at their STM32G071
+ *                   addresses, the BQ25703A is a register file behind the I2C calls.
+ ******************************************************************************
+ */
+
+#define _GNU_SOURCE
+
+#include "host_hal.h"
+#include "printf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Peripherals and handles main.c would own ---------------------------------*/
+SysTick_Type host_systick = { 0, 63999, 63999, 0 };
+GPIO_TypeDef host_gpioa, host_gpiob;
+static ADC_TypeDef host_adc1;
+static TIM_TypeDef host_tim6;
+
+ADC_HandleTypeDef hadc1 = { &host_adc1, { 0 } };
+TIM_HandleTypeDef htim6 = { &host_tim6 };
+I2C_HandleTypeDef hi2c1;
+UART_HandleTypeDef huart1;
+
+struct Host_Hal host_hal;
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t host_flash_locked = 1;
+
+/**
+ * @brief  Maps one region at a fixed address, the firmware casts 32 bit addresses to pointers
+ * @param  address: Start of the region
+ * @param  length: Bytes, a multiple of the page size
+ */
+static void Host_Map(uintptr_t address, size_t length) {
+	void *mapped = mmap((void *)address, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (mapped != (void *)address) {
+		fprintf(stderr, "host: could not map 0x%08lx\n", (unsigned long)address);
+		exit(2);
+	}
+}
+
+/**
+ * @brief  Maps flash and the OTP area before main runs
+ */
+__attribute__((constructor)) static void Host_Hal_Map(void) {
+	Host_Map(FLASH_BASE, FLASH_SIZE);
+	Host_Map(HOST_OTP_BASE, HOST_OTP_MAP_BYTES);
+	Host_Hal_Reset();
+}
+
+/**
+ * @brief  Puts every peripheral, flash and the OTP back to power on. Flash and OTP are erased,
+ * the factory values are written and the BQ25703A answers with its ids
+ */
+void Host_Hal_Reset(void) {
+	memset((void *)FLASH_BASE, 0xFF, FLASH_SIZE);
+	memset((void *)HOST_OTP_BASE, 0xFF, HOST_OTP_MAP_BYTES);
+
+	*VREFINT_CAL_ADDR = HOST_VREFINT_CAL;
+	*TEMPSENSOR_CAL1_ADDR = HOST_TS_CAL1;
+	*TEMPSENSOR_CAL2_ADDR = HOST_TS_CAL2;
+
+	memset(&host_hal, 0, sizeof(host_hal));
+	host_hal.flash_program_budget = -1;
+	host_hal.bq25703a[HOST_BQ_MANUFACTURER_ID_ADDR] = HOST_BQ_MANUFACTURER_ID;
+	host_hal.bq25703a[HOST_BQ_DEVICE_ID_ADDR] = HOST_BQ_DEVICE_ID;
+
+	memset(&host_gpioa, 0, sizeof(host_gpioa));
+	memset(&host_gpiob, 0, sizeof(host_gpiob));
+	memset(&host_adc1, 0, sizeof(host_adc1));
+	memset(&host_tim6, 0, sizeof(host_tim6));
+	host_flash_locked = 1;
+}
+
+/**
+ * @brief  Writes calibration scalars to OTP the way cal_save does, XT60 first
+ * @param  scalars: SCALAR_ARRAY_SIZE Q16 microvolts per code
+ * @param  count: Number of scalars
+ */
+void Host_Write_OTP_Scalars(const uint32_t *scalars, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		((volatile uint32_t *)HOST_OTP_BASE)[i] = scalars[i];
+	}
+}
+
+/* Flash ---------------------------------------------------------------------*/
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) {
+	host_flash_locked = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void) {
+	host_flash_locked = 1;
+	return HAL_OK;
+}
+
+/**
+ * @brief  Programs a double word. Like the hardware it fails on locked flash or a double word that is not erased.
+ * Once flash_program_budget programs have been made every further one fails, as if power was cut
+ */
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data) {
+	if ((host_flash_locked == 1) || (TypeProgram != FLASH_TYPEPROGRAM_DOUBLEWORD) || ((Address & 7) != 0) ||
+			(Address < FLASH_BASE) || (Address >= (FLASH_BASE + FLASH_SIZE))) {
+		return HAL_ERROR;
+	}
+
+	if (host_hal.flash_program_budget == 0) {
+		return HAL_ERROR;
+	}
+	if (host_hal.flash_program_budget > 0) {
+		host_hal.flash_program_budget--;
+	}
+
+	volatile uint64_t *target = (volatile uint64_t *)(uintptr_t)Address;
+	if (*target != UINT64_MAX) {
+		return HAL_ERROR;
+	}
+
+	*target = Data;
+	host_hal.flash_programs++;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError) {
+	*PageError = 0xFFFFFFFF;
+
+	if ((host_flash_locked == 1) || (pEraseInit->TypeErase != FLASH_TYPEERASE_PAGES) ||
+			((pEraseInit->Page + pEraseInit->NbPages) > (FLASH_SIZE / FLASH_PAGE_SIZE))) {
+		return HAL_ERROR;
+	}
+
+	if (host_hal.flash_program_budget == 0) {
+		*PageError = pEraseInit->Page;
+		return HAL_ERROR;
+	}
+	if (host_hal.flash_program_budget > 0) {
+		host_hal.flash_program_budget--;
+	}
+
+	memset((void *)(uintptr_t)(FLASH_BASE + (pEraseInit->Page * FLASH_PAGE_SIZE)), 0xFF, pEraseInit->NbPages * FLASH_PAGE_SIZE);
+	host_hal.flash_erases++;
+
+	return HAL_OK;
+}
+
+/* GPIO ----------------------------------------------------------------------*/
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+	if (PinState == GPIO_PIN_SET) {
+		GPIOx->ODR |= GPIO_Pin;
+	}
+	else {
+		GPIOx->ODR &= ~(uint32_t)GPIO_Pin;
+	}
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+	return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+/* ADC -----------------------------------------------------------------------*/
+HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef *hadc) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADCEx_Calibration_Start(ADC_HandleTypeDef *hadc) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef *hadc, uint32_t *pData, uint32_t Length) {
+	host_hal.adc_dma_buffer = (uint16_t *)pData;
+	host_hal.adc_dma_length = Length;
+	host_hal.adc_dma_index = 0;
+	host_hal.adc_running = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef *hadc) {
+	host_hal.adc_running = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_AnalogWDGConfig(ADC_HandleTypeDef *hadc, ADC_AnalogWDGConfTypeDef *AnalogWDGConfig) {
+	if (AnalogWDGConfig->WatchdogNumber >= HOST_ADC_WATCHDOGS) {
+		return HAL_ERROR;
+	}
+	host_hal.adc_awd[AnalogWDGConfig->WatchdogNumber] = *AnalogWDGConfig;
+	return HAL_OK;
+}
+
+void LL_ADC_SetChannelSamplingTime(ADC_TypeDef *ADCx, uint32_t Channel, uint32_t SamplingTimeY) {
+	if (SamplingTimeY == LL_ADC_SAMPLINGTIME_COMMON_2) {
+		ADCx->SMPR |= (1UL << Channel);
+	}
+	else {
+		ADCx->SMPR &= ~(1UL << Channel);
+	}
+}
+
+/**
+ * @brief  Runs one conversion through the analog watchdogs and calls the callback of each that trips,
+ * as the ADC interrupt would
+ * @param  channel: ADC_CHANNEL_x of the conversion
+ * @param  code: Converted code
+ */
+void Host_ADC_Watchdog_Check(uint32_t channel, uint16_t code) {
+	static const uint32_t watchdog_it[HOST_ADC_WATCHDOGS] = { ADC_IT_AWD1, ADC_IT_AWD2, ADC_IT_AWD3 };
+
+	for (int i = 0; i < HOST_ADC_WATCHDOGS; i++) {
+		const ADC_AnalogWDGConfTypeDef *awd = &host_hal.adc_awd[i];
+
+		if ((awd->WatchdogMode == 0) || (awd->Channel != channel) || ((host_adc1.IER & watchdog_it[i]) == 0)) {
+			continue;
+		}
+
+		if ((code > awd->HighThreshold) || (code < awd->LowThreshold)) {
+			host_adc1.ISR |= watchdog_it[i];
+			host_hal.adc_awd_trips[i]++;
+
+			if (i == 0) {
+				HAL_ADC_LevelOutOfWindowCallback(&hadc1);
+			}
+			else if (i == 1) {
+				HAL_ADCEx_LevelOutOfWindow2Callback(&hadc1);
+			}
+			else {
+				HAL_ADCEx_LevelOutOfWindow3Callback(&hadc1);
+			}
+		}
+	}
+}
+
+/* Timers --------------------------------------------------------------------*/
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim) {
+	htim->Instance->CR1 |= 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef *htim) {
+	htim->Instance->CR1 &= ~1UL;
+	return HAL_OK;
+}
+
+/**
+ * @brief  Gets the rate TIM6 triggers scan sequences at
+ * @retval Rate in Hz, 0 if the timer is stopped and the ADC converts back to back
+ */
+uint32_t Host_ADC_Trigger_Rate(void) {
+	if ((host_tim6.CR1 & 1) == 0) {
+		return 0;
+	}
+	return HOST_TIM6_CLOCK_HZ / (host_tim6.ARR + 1);
+}
+
+/* I2C, a BQ25703A register file ---------------------------------------------*/
+HAL_StatusTypeDef HAL_I2C_Master_Transmit_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size) {
+	if (host_hal.bq25703a_absent == 1) {
+		return HAL_OK;
+	}
+
+	host_hal.bq25703a_pointer = pData[0];
+
+	for (uint16_t i = 1; i < Size; i++) {
+		uint8_t address = (uint8_t)(host_hal.bq25703a_pointer + i - 1);
+		host_hal.bq25703a[address] = pData[i];
+
+		/* Conversions finish at once, the start bit reads back clear */
+		if (address == HOST_BQ_ADC_OPTION_MSB_ADDR) {
+			host_hal.bq25703a[address] &= ~HOST_BQ_ADC_START_BIT;
+		}
+	}
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Receive_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size) {
+	for (uint16_t i = 0; i < Size; i++) {
+		pData[i] = (host_hal.bq25703a_absent == 1) ? 0 : host_hal.bq25703a[(uint8_t)(host_hal.bq25703a_pointer + i)];
+	}
+	return HAL_OK;
+}
+
+HAL_I2C_StateTypeDef HAL_I2C_GetState(I2C_HandleTypeDef *hi2c) {
+	return HAL_I2C_STATE_READY;
+}
+
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef *hi2c) {
+	return HAL_I2C_ERROR_NONE;
+}
+
+/* main.c --------------------------------------------------------------------*/
+void Error_Handler(void) {
+	fprintf(stderr, "host: Error_Handler\n");
+	abort();
+}
+
+/**
+ * @brief  Firmware printf output, dropped unless host_hal.verbose is set
+ */
+void _putchar(char character) {
+	if (host_hal.verbose == 1) {
+		fputc(character, stdout);
+	}
+}
@@ -0,0 +1,83 @@
+/**
+ ******************************************************************************
+ * @file           : host_rtos.c
+ * @brief          : Host stand-in for the FreeRTOS calls the firmware modules make.
+ *                   Time only moves when the harness advances it.
+ ******************************************************************************
+ */
+
+#define _GNU_SOURCE
+
+#include "host_rtos.h"
+#include "task.h"
+#include "semphr.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+/* Mutexes main.c creates */
+SemaphoreHandle_t xTxMutex_Regulator;
+SemaphoreHandle_t xMutex_Flash_Store;
+
+/* Private variables ---------------------------------------------------------*/
+static volatile TickType_t host_tick;
+static volatile uint32_t host_notification;
+static pthread_mutex_t host_critical = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/**
+ * @brief  Critical sections hold one recursive mutex, so a writer thread and a reader thread exclude each other
+ * the way interrupts masked on the MCU would
+ */
+void Host_Enter_Critical(void) {
+	pthread_mutex_lock(&host_critical);
+}
+
+void Host_Exit_Critical(void) {
+	pthread_mutex_unlock(&host_critical);
+}
+
+void Host_Set_Tick(TickType_t tick) {
+	host_tick = tick;
+}
+
+void Host_Advance_Tick(TickType_t ticks) {
+	host_tick += ticks;
+}
+
+TickType_t xTaskGetTickCount(void) {
+	return host_tick;
+}
+
+TickType_t xTaskGetTickCountFromISR(void) {
+	return host_tick;
+}
+
+/**
+ * @brief  Delays do not move time, the harness does. Yield so a reader thread can run
+ */
+void vTaskDelay(const TickType_t xTicksToDelay) {
+	sched_yield();
+}
+
+/**
+ * @brief  Latches notification bits for the harness to hand to ADC_Task_Process
+ */
+BaseType_t xTaskNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction, BaseType_t *pxHigherPriorityTaskWoken) {
+	__atomic_fetch_or(&host_notification, ulValue, __ATOMIC_SEQ_CST);
+	return pdPASS;
+}
+
+/**
+ * @brief  No task waits on the host, blocking calls time out at once
+ */
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit, uint32_t *pulNotificationValue, TickType_t xTicksToWait) {
+	return pdFALSE;
+}
+
+/**
+ * @brief  Takes the latched notification bits, as xTaskNotifyWait clearing all bits on exit would
+ * @retval Notification bits, 0 if none were set
+ */
+uint32_t Host_Take_Notification(void) {
+	return __atomic_exchange_n(&host_notification, 0, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,407 @@
+/**
+ ******************************************************************************
+ * @file           : host_sim.c
+ * @brief          : Feeds scan sequences to the firmware the way the DMA and
+ *                   TIM6 would, delivers the ADC task notifications and polls
+ *                   the regulator on simulated time.
+ ******************************************************************************
+ */
+
+#define _GNU_SOURCE
+
+#include "host_sim.h"
+#include "host_hal.h"
+#include "host_rtos.h"
+#include "bq25703a_regulator.h"
+#include "measurement.h"
+#include "main.h"
+#include "usbpd.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct Host_Sim host_sim;
+
+/* Private variables ---------------------------------------------------------*/
+/* ADC channel of each rank, as MX_ADC1_Init sets them */
+static const uint32_t host_sim_channels[ADC_NUMBER_OF_CHANNELS] = {ADC_CHANNEL_4, ADC_CHANNEL_3, ADC_CHANNEL_2, ADC_CHANNEL_1,
+		ADC_CHANNEL_0, ADC_CHANNEL_TEMPSENSOR, ADC_CHANNEL_VREFINT};
+static const uint16_t host_sim_bleed_pins[HOST_SIM_CELLS] = {CELL_1S_DIS_EN_Pin, CELL_2S_DIS_EN_Pin, CELL_3S_DIS_EN_Pin,
+		CELL_4S_DIS_EN_Pin};
+/* Open circuit voltage against state of charge, a generic LiPo curve */
+static const double host_sim_ocv_soc[] = {0.0, 0.05, 0.1, 0.5, 0.9, 1.0};
+static const double host_sim_ocv_v[] = {3.0, 3.45, 3.6, 3.8, 4.1, 4.2};
+#define HOST_SIM_OCV_POINTS		(sizeof(host_sim_ocv_soc) / sizeof(host_sim_ocv_soc[0]))
+
+static uint64_t host_sim_next_poll_ns;
+static uint32_t host_sim_battery_sequence;
+
+/* Private function prototypes -----------------------------------------------*/
+static double Host_Sim_Gaussian(void);
+static double Host_Sim_Pack_Step(double dt_s, double *tap_v);
+static void Host_Sim_Regulator_Registers(void);
+static uint64_t Host_Sim_Sequence_Ns(void);
+static uint64_t Host_Sim_Clock_Ns(void);
+static void Host_Sim_Deliver(void);
+
+/**
+ * @brief  Maps the peripherals, writes the OTP calibration and runs the task start up code of vRead_ADC and vRegulator.
+ * Firmware state is static, so this is called once per process
+ */
+void Host_Sim_Init(void) {
+	Host_Hal_Reset();
+
+	const uint32_t scalars[SCALAR_ARRAY_SIZE] = {HOST_SIM_XT60_SCALAR, HOST_SIM_TAP_SCALAR(1), HOST_SIM_TAP_SCALAR(2),
+			HOST_SIM_TAP_SCALAR(3), HOST_SIM_TAP_SCALAR(4)};
+	Host_Write_OTP_Scalars(scalars, SCALAR_ARRAY_SIZE);
+
+	/* VBUS is in range */
+	host_gpiob.IDR |= CHRG_OK_Pin;
+
+	memset(&host_sim, 0, sizeof(host_sim));
+	host_sim.temperature_c = 25.0;
+	host_sim.vdda_v = 3.3;
+	host_sim.noise_codes = 0.7;
+	host_sim.regulator_enabled = 1;
+	host_sim.pack.capacity_mah = 2200.0;
+	host_sim.pack.cell_ohm = 0.02;
+	host_sim.pack.lead_ohm = 0.01;
+	host_sim.pack.bleed_ohm = 39.0;
+	srand48(1);
+
+	Host_Set_Tick(0);
+	host_sim_next_poll_ns = 0;
+	host_sim_battery_sequence = 0;
+
+	ADC_Task_Init();
+	Regulator_Init();
+}
+
+/**
+ * @brief  Connects a pack with every cell at the same open circuit voltage, 0 cells unplugs it
+ * @param  cells: Number of cells 0-4
+ * @param  cell_v: Open circuit voltage of each cell
+ */
+void Host_Sim_Set_Pack(uint8_t cells, double cell_v) {
+	host_sim.pack.cells = cells;
+	host_sim.pack.xt60_connected = (cells > 0) ? 1 : 0;
+	host_sim.pack.balance_connected = (cells > 0) ? 1 : 0;
+
+	double soc = 0.0;
+	for (uint32_t i = 1; i < HOST_SIM_OCV_POINTS; i++) {
+		if (cell_v <= host_sim_ocv_v[i]) {
+			soc = host_sim_ocv_soc[i - 1] + ((cell_v - host_sim_ocv_v[i - 1]) * (host_sim_ocv_soc[i] - host_sim_ocv_soc[i - 1]) /
+					(host_sim_ocv_v[i] - host_sim_ocv_v[i - 1]));
+			break;
+		}
+		soc = 1.0;
+	}
+	if (soc < 0.0) {
+		soc = 0.0;
+	}
+
+	for (int i = 0; i < HOST_SIM_CELLS; i++) {
+		host_sim.pack.soc[i] = soc;
+	}
+}
+
+/**
+ * @brief  Open circuit voltage of a cell
+ * @param  soc: State of charge 0-1, limited to that range
+ * @retval Volts
+ */
+double Host_Sim_OCV(double soc) {
+	if (soc <= 0.0) {
+		return host_sim_ocv_v[0];
+	}
+	for (uint32_t i = 1; i < HOST_SIM_OCV_POINTS; i++) {
+		if (soc <= host_sim_ocv_soc[i]) {
+			return host_sim_ocv_v[i - 1] + ((soc - host_sim_ocv_soc[i - 1]) * (host_sim_ocv_v[i] - host_sim_ocv_v[i - 1]) /
+					(host_sim_ocv_soc[i] - host_sim_ocv_soc[i - 1]));
+		}
+	}
+	return host_sim_ocv_v[HOST_SIM_OCV_POINTS - 1];
+}
+
+static double Host_Sim_Gaussian(void) {
+	double u1 = drand48();
+	double u2 = drand48();
+	if (u1 < 1e-12) {
+		u1 = 1e-12;
+	}
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/**
+ * @brief  Moves the pack model on by one step and works out the voltages on the XT60 and the balance taps
+ * @param  dt_s: Step in seconds
+ * @param  tap_v: Filled with the voltage on each balance tap, 0 for taps with no cell
+ * @retval XT60 voltage
+ */
+static double Host_Sim_Pack_Step(double dt_s, double *tap_v) {
+	struct Host_Sim_Pack *pack = &host_sim.pack;
+	double ocv_sum = 0.0;
+
+	for (int i = 0; i < pack->cells; i++) {
+		ocv_sum += Host_Sim_OCV(pack->soc[i]);
+	}
+
+	/* Charger, HI-Z while the ILIM_HIZ pin is low */
+	double current_a = 0.0;
+	if ((pack->xt60_connected == 1) && (pack->cells > 0) && ((host_gpiob.ODR & ILIM_HIZ_Pin) != 0) &&
+			((host_gpiob.IDR & CHRG_OK_Pin) != 0)) {
+		double voltage_limit_v = (double)((host_hal.bq25703a[HOST_BQ_MAX_CHARGE_VOLTAGE_ADDR + 1] << 8) |
+				host_hal.bq25703a[HOST_BQ_MAX_CHARGE_VOLTAGE_ADDR]) / 1000.0;
+		double current_limit_a = (double)((host_hal.bq25703a[HOST_BQ_CHARGE_CURRENT_ADDR + 1] << 8) |
+				host_hal.bq25703a[HOST_BQ_CHARGE_CURRENT_ADDR]) / 1000.0;
+		double resistance = (pack->cells * pack->cell_ohm) + pack->lead_ohm;
+
+		current_a = (voltage_limit_v - ocv_sum) / resistance;
+		if (current_a > current_limit_a) {
+			current_a = current_limit_a;
+		}
+		if (current_a < 0.0) {
+			current_a = 0.0;
+		}
+	}
+	host_sim.charge_current_a = current_a;
+
+	double stack_v = 0.0;
+	for (int i = 0; i < HOST_SIM_CELLS; i++) {
+		host_sim.bleed_current_a[i] = 0.0;
+
+		if (i >= pack->cells) {
+			tap_v[i] = 0.0;
+			continue;
+		}
+
+		double ocv = Host_Sim_OCV(pack->soc[i]);
+		double terminal_v = ocv + (current_a * pack->cell_ohm);
+
+		/* The bleed resistor loads the cell through its series resistance */
+		if ((pack->balance_connected == 1) && ((host_gpiob.ODR & host_sim_bleed_pins[i]) != 0)) {
+			terminal_v = terminal_v / (1.0 + (pack->cell_ohm / pack->bleed_ohm));
+			host_sim.bleed_current_a[i] = terminal_v / pack->bleed_ohm;
+		}
+
+		pack->soc[i] += ((current_a - host_sim.bleed_current_a[i]) * dt_s) / (3.6 * pack->capacity_mah);
+
+		stack_v += terminal_v;
+		tap_v[i] = (pack->balance_connected == 1) ? stack_v : 0.0;
+	}
+
+	if (pack->xt60_connected == 0) {
+		return 0.0;
+	}
+
+	return stack_v + (current_a * pack->lead_ohm);
+}
+
+/**
+ * @brief  Converts the model inputs to one scan sequence of codes. Each conversion sees VDDA at its own time in the
+ * sequence, so ripple faster than a sequence is not cancelled by VREFINT. Hardware oversampling averages
+ * ADC_SEQUENCE_OVERSAMPLING conversions per rank with rounding
+ * @param  codes: Filled with ADC_NUMBER_OF_CHANNELS codes in rank order
+ */
+void Host_Sim_Model_Sequence(uint16_t *codes) {
+	uint64_t sequence_ns = Host_Sim_Sequence_Ns();
+	double tap_v[HOST_SIM_CELLS];
+	double xt60_v;
+
+	if (host_sim.override == 1) {
+		xt60_v = host_sim.xt60_v;
+		memcpy(tap_v, host_sim.tap_v, sizeof(tap_v));
+	}
+	else {
+		xt60_v = Host_Sim_Pack_Step((double)sequence_ns * 1e-9, tap_v);
+	}
+
+	/* Volts on each rank, and the microvolts per code at the nominal VDDA for the divided inputs */
+	const double input_v[ADC_NUMBER_OF_VOLTAGE_CHANNELS] = {xt60_v, tap_v[0], tap_v[1], tap_v[2], tap_v[3]};
+	const double scalar_uv[ADC_NUMBER_OF_VOLTAGE_CHANNELS] = {HOST_SIM_XT60_SCALAR / 65536.0, HOST_SIM_TAP_SCALAR(1) / 65536.0,
+			HOST_SIM_TAP_SCALAR(2) / 65536.0, HOST_SIM_TAP_SCALAR(3) / 65536.0, HOST_SIM_TAP_SCALAR(4) / 65536.0};
+	const double conversion_ns = (double)Host_Sim_Sequence_Ns() / (ADC_SEQUENCE_OVERSAMPLING * ADC_NUMBER_OF_CHANNELS);
+	const double ts_slope = (double)(HOST_TS_CAL2 - HOST_TS_CAL1) / (TEMPSENSOR_CAL2_TEMP - TEMPSENSOR_CAL1_TEMP);
+
+	for (int rank = 0; rank < ADC_NUMBER_OF_CHANNELS; rank++) {
+		double sum = 0.0;
+
+		for (int k = 0; k < ADC_SEQUENCE_OVERSAMPLING; k++) {
+			double t_s = ((double)host_sim.time_ns + (((k * ADC_NUMBER_OF_CHANNELS) + rank) * conversion_ns)) * 1e-9;
+			double vdda_v = host_sim.vdda_v + (host_sim.vdda_ripple_v * sin(2.0 * M_PI * host_sim.vdda_ripple_hz * t_s));
+			double code;
+
+			if (rank < ADC_NUMBER_OF_VOLTAGE_CHANNELS) {
+				code = ((input_v[rank] * 1e6) / scalar_uv[rank]) * ((ADC_VDDA_NOMINAL_MV / 1000.0) / vdda_v);
+			}
+			else if (rank == 5) {
+				code = (HOST_TS_CAL1 + ((host_sim.temperature_c - TEMPSENSOR_CAL1_TEMP) * ts_slope)) * ((TEMPSENSOR_CAL_VREFANALOG / 1000.0) / vdda_v);
+			}
+			else {
+				code = HOST_VREFINT_CAL * ((VREFINT_CAL_VREF / 1000.0) / vdda_v);
+			}
+
+			code = round(code + (host_sim.noise_codes * Host_Sim_Gaussian()));
+			if (code < 0.0) {
+				code = 0.0;
+			}
+			if (code > 4095.0) {
+				code = 4095.0;
+			}
+			sum += code;
+		}
+
+		codes[rank] = (uint16_t)(((uint32_t)sum + (ADC_SEQUENCE_OVERSAMPLING / 2)) / ADC_SEQUENCE_OVERSAMPLING);
+	}
+}
+
+/**
+ * @brief  Hands one scan sequence to the firmware. The analog watchdogs see every conversion, the DMA half and full
+ * transfer callbacks fire as the buffer fills and each notification is processed before the next sequence, as the
+ * ADC task would at its priority. Time moves on by one sequence and the regulator is polled every HOST_SIM_REGULATOR_POLL_MS
+ * @param  codes: ADC_NUMBER_OF_CHANNELS codes in rank order
+ */
+void Host_Sim_Sequence(const uint16_t *codes) {
+	host_sim.time_ns += Host_Sim_Sequence_Ns();
+	Host_Set_Tick((TickType_t)(host_sim.time_ns / 1000000));
+
+	for (int rank = 0; rank < ADC_NUMBER_OF_CHANNELS; rank++) {
+		Host_ADC_Watchdog_Check(host_sim_channels[rank], codes[rank]);
+	}
+
+	if ((host_hal.adc_running == 1) && (host_hal.adc_dma_buffer != NULL)) {
+		memcpy(&host_hal.adc_dma_buffer[host_hal.adc_dma_index], codes, ADC_NUMBER_OF_CHANNELS * sizeof(uint16_t));
+		host_hal.adc_dma_index += ADC_NUMBER_OF_CHANNELS;
+		host_sim.sequences++;
+
+		if (host_hal.adc_dma_index == (host_hal.adc_dma_length / 2)) {
+			uint64_t start = Host_Sim_Clock_Ns();
+			HAL_ADC_ConvHalfCpltCallback(&hadc1);
+			Host_Sim_Deliver();
+			host_sim.process_ns += Host_Sim_Clock_Ns() - start;
+		}
+		else if (host_hal.adc_dma_index >= host_hal.adc_dma_length) {
+			host_hal.adc_dma_index = 0;
+			uint64_t start = Host_Sim_Clock_Ns();
+			HAL_ADC_ConvCpltCallback(&hadc1);
+			Host_Sim_Deliver();
+			host_sim.process_ns += Host_Sim_Clock_Ns() - start;
+		}
+	}
+
+	if ((host_sim.regulator_enabled == 1) && (host_sim.time_ns >= host_sim_next_poll_ns)) {
+		host_sim_next_poll_ns = host_sim.time_ns + (HOST_SIM_REGULATOR_POLL_MS * 1000000ULL);
+		Host_Sim_Regulator_Registers();
+		Regulator_Poll();
+		host_sim.regulator_polls++;
+	}
+}
+
+/**
+ * @brief  Runs the ADC task for the notification the block callback raised and counts blocks and filter windows
+ */
+static void Host_Sim_Deliver(void) {
+	uint32_t notification = Host_Take_Notification();
+	if (notification == 0) {
+		return;
+	}
+
+	uint64_t start = Host_Sim_Clock_Ns();
+	ADC_Task_Process(notification);
+	uint64_t elapsed = Host_Sim_Clock_Ns() - start;
+	if (elapsed > host_sim.block_process_ns_max) {
+		host_sim.block_process_ns_max = elapsed;
+	}
+	host_sim.blocks++;
+
+	struct Measurement_Snapshot snapshot;
+	Get_Measurement_Snapshot(&snapshot);
+	if (snapshot.battery_sequence != host_sim_battery_sequence) {
+		host_sim_battery_sequence = snapshot.battery_sequence;
+		host_sim.windows++;
+	}
+}
+
+/**
+ * @brief  Loads the BQ25703A ADC and status registers from the pack model before a regulator poll
+ */
+static void Host_Sim_Regulator_Registers(void) {
+	uint32_t vbat_mv = Get_Battery_Voltage() / (BATTERY_ADC_MULTIPLIER / 1000);
+	uint32_t vbus_mv = ((host_gpiob.IDR & CHRG_OK_Pin) != 0) ? Get_Input_Voltage() : 0;
+	uint32_t charge_ma = (uint32_t)(host_sim.charge_current_a * 1000.0);
+
+	uint32_t vbat = (vbat_mv > HOST_SIM_BQ_VBAT_OFFSET_MV) ? (vbat_mv - HOST_SIM_BQ_VBAT_OFFSET_MV) / HOST_SIM_BQ_VBAT_STEP_MV : 0;
+	uint32_t vbus = (vbus_mv > HOST_SIM_BQ_VBUS_OFFSET_MV) ? (vbus_mv - HOST_SIM_BQ_VBUS_OFFSET_MV) / HOST_SIM_BQ_VBUS_STEP_MV : 0;
+	uint32_t input_ma = (vbus_mv > 0) ? (uint32_t)(((uint64_t)charge_ma * vbat_mv * 100) / ((uint64_t)vbus_mv * ASSUME_EFFICIENCY_PERCENT)) : 0;
+
+	host_hal.bq25703a[HOST_BQ_VBAT_ADC_ADDR] = (uint8_t)((vbat > 255) ? 255 : vbat);
+	host_hal.bq25703a[HOST_BQ_VSYS_ADC_ADDR] = host_hal.bq25703a[HOST_BQ_VBAT_ADC_ADDR];
+	host_hal.bq25703a[HOST_BQ_VBUS_ADC_ADDR] = (uint8_t)((vbus > 255) ? 255 : vbus);
+	host_hal.bq25703a[HOST_BQ_ICHG_ADC_ADDR] = (uint8_t)(((charge_ma / HOST_SIM_BQ_ICHG_STEP_MA) > 127) ? 127 : (charge_ma / HOST_SIM_BQ_ICHG_STEP_MA));
+	host_hal.bq25703a[HOST_BQ_IIN_ADC_ADDR] = (uint8_t)(((input_ma / HOST_SIM_BQ_IIN_STEP_MA) > 127) ? 127 : (input_ma / HOST_SIM_BQ_IIN_STEP_MA));
+	host_hal.bq25703a[HOST_BQ_CHARGE_STATUS_ADDR + 1] = (charge_ma > 0) ? CHARGING_ENABLED_MASK : 0;
+}
+
+/**
+ * @brief  Time one scan sequence takes, the TIM6 period or the conversion time when converting back to back, unless set
+ * @retval Nanoseconds
+ */
+static uint64_t Host_Sim_Sequence_Ns(void) {
+	if (host_sim.sequence_ns != 0) {
+		return host_sim.sequence_ns;
+	}
+
+	uint64_t conversion_ns = Get_ADC_Sequence_Time();
+	uint32_t rate = Host_ADC_Trigger_Rate();
+
+	if (rate == 0) {
+		return conversion_ns;
+	}
+
+	uint64_t period_ns = 1000000000ULL / rate;
+	return (period_ns > conversion_ns) ? period_ns : conversion_ns;
+}
+
+static uint64_t Host_Sim_Clock_Ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief  Runs the pack model for a time
+ * @param  ms: Simulated milliseconds
+ */
+void Host_Sim_Run_Ms(uint32_t ms) {
+	uint64_t end_ns = host_sim.time_ns + ((uint64_t)ms * 1000000ULL);
+	uint16_t codes[ADC_NUMBER_OF_CHANNELS];
+
+	while (host_sim.time_ns < end_ns) {
+		Host_Sim_Model_Sequence(codes);
+		Host_Sim_Sequence(codes);
+	}
+}
+
+/**
+ * @brief  Runs the pack model until the ADC task has published a number of filter windows
+ * @param  windows: Filter windows to wait for
+ */
+void Host_Sim_Run_Windows(uint32_t windows) {
+	uint32_t target = host_sim.windows + windows;
+	uint16_t codes[ADC_NUMBER_OF_CHANNELS];
+
+	while (host_sim.windows < target) {
+		Host_Sim_Model_Sequence(codes);
+		Host_Sim_Sequence(codes);
+	}
+}
+
+/**
+ * @brief  Simulated time since Host_Sim_Init
+ * @retval Milliseconds
+ */
+uint32_t Host_Sim_Now_Ms(void) {
+	return (uint32_t)(host_sim.time_ns / 1000000);
+}
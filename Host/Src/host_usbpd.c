@@ -0,0 +1,45 @@
+/**
+ ******************************************************************************
+ * @file           : host_usbpd.c
+ * @brief          : Host stand-in for the USB-PD supply. The harness sets the
+ *                   negotiated contract directly.
+ ******************************************************************************
+ */
+
+#include "usbpd.h"
+#include "host_sim.h"
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t host_power_ready = NO_USB_PD_SUPPLY;
+static uint32_t host_max_power_mw;
+static uint32_t host_max_current_ma;
+static uint32_t host_voltage_mv = 5000;
+
+/**
+ * @brief  Sets the supply the charger sees
+ * @param  power_ready: READY, NOT_READY or NO_USB_PD_SUPPLY
+ * @param  voltage_mv: Contract voltage
+ * @param  current_ma: Contract current
+ */
+void Host_Set_USB_PD(uint8_t power_ready, uint32_t voltage_mv, uint32_t current_ma) {
+	host_power_ready = power_ready;
+	host_voltage_mv = voltage_mv;
+	host_max_current_ma = current_ma;
+	host_max_power_mw = (voltage_mv * current_ma) / 1000;
+}
+
+uint8_t Get_Input_Power_Ready(void) {
+	return host_power_ready;
+}
+
+uint32_t Get_Max_Input_Power(void) {
+	return host_max_power_mw;
+}
+
+uint32_t Get_Max_Input_Current(void) {
+	return host_max_current_ma;
+}
+
+uint32_t Get_Input_Voltage(void) {
+	return host_voltage_mv;
+}
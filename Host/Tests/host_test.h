@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * @file           : host_test.h
+ * @brief          : Checks shared by the host tests. A test is a program, it
+ *                   prints every failed check and exits non zero if any failed.
+ ******************************************************************************
+ */
+
+#ifndef HOST_TEST_H_
+#define HOST_TEST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+static int host_test_failures;
+static int host_test_checks;
+
+#define TEST_CHECK(condition) do { \
+	host_test_checks++; \
+	if (!(condition)) { \
+		host_test_failures++; \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+	} \
+} while (0)
+
+#define TEST_CHECK_NEAR(value, expected, tolerance) do { \
+	double test_value = (double)(value), test_expected = (double)(expected); \
+	host_test_checks++; \
+	if ((test_value < (test_expected - (tolerance))) || (test_value > (test_expected + (tolerance)))) { \
+		host_test_failures++; \
+		fprintf(stderr, "%s:%d: check failed: %s = %g, expected %g +/- %g\n", __FILE__, __LINE__, #value, test_value, \
+				test_expected, (double)(tolerance)); \
+	} \
+} while (0)
+
+/**
+ * @brief  Prints the result line and gives the exit status for main
+ */
+static inline int Test_Finish(const char *name) {
+	printf("%s: %d checks, %d failed\n", name, host_test_checks, host_test_failures);
+	return (host_test_failures == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Host time for benchmarks
+ * @retval Nanoseconds
+ */
+static inline uint64_t Test_Clock_Ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief  Host cycle counter for benchmarks, the TSC on x86 and nanoseconds elsewhere. Host cycles compare the cost of
+ * two paths, they are not Cortex-M0+ cycles
+ * @retval Cycles
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t Test_Cycles(void) {
+	return __rdtsc();
+}
+#else
+static inline uint64_t Test_Cycles(void) {
+	return Test_Clock_Ns();
+}
+#endif
+
+#endif /* HOST_TEST_H_ */
@@ -0,0 +1,131 @@
+/**
+ ******************************************************************************
+ * @file           : test_balance_connection.c
+ * @brief          : Replays balance lead plug, unplug and contact bounce
+ *                   block by block through the firmware and checks the
+ *                   connects, disconnects and bounces counters and that no
+ *                   cell count short of the pack is ever reported.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "host_sim.h"
+#include "battery.h"
+#include "measurement.h"
+
+#define TEST_CELL_V				3.9
+/* Contact bounce, on and off times well inside BALANCE_CONNECT_BLOCKS */
+#define TEST_BOUNCES			5
+#define TEST_BOUNCE_ON_BLOCKS	3
+#define TEST_BOUNCE_OFF_BLOCKS	2
+/* A lead going in at an angle, each further tap makes contact this many blocks after the one below it */
+#define TEST_STAGGER_BLOCKS		4
+#define TEST_SETTLE_BLOCKS		(4 * BALANCE_CONNECT_BLOCKS)
+
+/* Cell counts the firmware reported, a bit per count */
+static uint8_t test_counts_seen;
+
+/**
+ * @brief  Sets the taps of the first connected_taps cells of the pack, the others read nothing
+ */
+static void Test_Set_Taps(uint8_t connected_taps) {
+	for (int i = 0; i < HOST_SIM_CELLS; i++) {
+		host_sim.tap_v[i] = (i < connected_taps) ? (TEST_CELL_V * (i + 1)) : 0.0;
+	}
+}
+
+/**
+ * @brief  Runs whole DMA blocks so every block sees one tap state
+ */
+static void Test_Run_Blocks(uint32_t blocks) {
+	uint16_t codes[ADC_NUMBER_OF_CHANNELS];
+
+	for (uint32_t b = 0; b < blocks; b++) {
+		for (uint32_t s = 0; s < ADC_DMA_BLOCK_SEQUENCES; s++) {
+			Host_Sim_Model_Sequence(codes);
+			Host_Sim_Sequence(codes);
+		}
+		test_counts_seen |= (uint8_t)(1 << Get_Number_Of_Cells());
+	}
+}
+
+static void Test_Check_Stats(const char *step, uint32_t connects, uint32_t disconnects, uint32_t bounces, uint8_t cells) {
+	struct Balance_Connection_Stats stats;
+	Get_Balance_Connection_Stats(&stats);
+
+	printf("%-28s %8lu %11lu %7lu %5u\n", step, (unsigned long)stats.connects, (unsigned long)stats.disconnects,
+			(unsigned long)stats.bounces, Get_Number_Of_Cells());
+
+	TEST_CHECK(stats.connects == connects);
+	TEST_CHECK(stats.disconnects == disconnects);
+	TEST_CHECK(stats.bounces == bounces);
+	TEST_CHECK(Get_Number_Of_Cells() == cells);
+}
+
+int main(void) {
+	Host_Sim_Init();
+	host_sim.regulator_enabled = 0;
+	host_sim.override = 1;
+	host_sim.xt60_v = 0.0;
+
+	printf("%-28s %8s %11s %7s %5s\n", "step", "connects", "disconnects", "bounces", "cells");
+
+	Test_Set_Taps(0);
+	Test_Run_Blocks(TEST_SETTLE_BLOCKS);
+	Test_Check_Stats("unplugged", 0, 0, 0, 0);
+
+	Test_Set_Taps(HOST_SIM_CELLS);
+	Test_Run_Blocks(TEST_SETTLE_BLOCKS);
+	Test_Check_Stats("clean plug", 1, 0, 0, HOST_SIM_CELLS);
+
+	/* A disconnect is taken from one block */
+	Test_Set_Taps(0);
+	Test_Run_Blocks(1);
+	Test_Check_Stats("unplug, one block later", 1, 1, 0, 0);
+	Test_Run_Blocks(TEST_SETTLE_BLOCKS);
+
+	/* Each contact that breaks before the debounce is a bounce, only the final one connects */
+	for (int i = 0; i < TEST_BOUNCES; i++) {
+		Test_Set_Taps(HOST_SIM_CELLS);
+		Test_Run_Blocks(TEST_BOUNCE_ON_BLOCKS);
+		Test_Set_Taps(0);
+		Test_Run_Blocks(TEST_BOUNCE_OFF_BLOCKS);
+	}
+	Test_Check_Stats("bouncing plug", 1, 1, TEST_BOUNCES, 0);
+	Test_Set_Taps(HOST_SIM_CELLS);
+	Test_Run_Blocks(TEST_SETTLE_BLOCKS);
+	Test_Check_Stats("bouncing plug settled", 2, 1, TEST_BOUNCES, HOST_SIM_CELLS);
+
+	/* A contact dropping out while connected is a disconnect and a new connection, not a bounce */
+	Test_Set_Taps(0);
+	Test_Run_Blocks(TEST_BOUNCE_OFF_BLOCKS);
+	Test_Set_Taps(HOST_SIM_CELLS);
+	Test_Run_Blocks(TEST_SETTLE_BLOCKS);
+	Test_Check_Stats("drop out while connected", 3, 2, TEST_BOUNCES, HOST_SIM_CELLS);
+
+	/* Tap 1 alone reads no pack, 2S and 3S are passing counts and bounce, only 4S connects */
+	Test_Set_Taps(0);
+	Test_Run_Blocks(TEST_SETTLE_BLOCKS);
+	for (uint8_t taps = 1; taps <= HOST_SIM_CELLS; taps++) {
+		Test_Set_Taps(taps);
+		Test_Run_Blocks(TEST_STAGGER_BLOCKS);
+	}
+	Test_Run_Blocks(TEST_SETTLE_BLOCKS);
+	Test_Check_Stats("staggered plug", 4, 3, TEST_BOUNCES + 2, HOST_SIM_CELLS);
+
+	/* Bouncing on the way out, the first break disconnects and every contact after it is a bounce */
+	for (int i = 0; i < TEST_BOUNCES; i++) {
+		Test_Set_Taps(0);
+		Test_Run_Blocks(TEST_BOUNCE_OFF_BLOCKS);
+		Test_Set_Taps(HOST_SIM_CELLS);
+		Test_Run_Blocks(TEST_BOUNCE_ON_BLOCKS);
+	}
+	Test_Set_Taps(0);
+	Test_Run_Blocks(TEST_SETTLE_BLOCKS);
+	Test_Check_Stats("bouncing unplug", 4, 4, (2 * TEST_BOUNCES) + 2, 0);
+
+	/* The firmware never reported a count short of the pack */
+	TEST_CHECK(test_counts_seen == ((1 << 0) | (1 << HOST_SIM_CELLS)));
+
+	return Test_Finish("test_balance_connection");
+}
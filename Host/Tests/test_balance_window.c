@@ -0,0 +1,168 @@
+/**
+ ******************************************************************************
+ * @file           : test_balance_window.c
+ * @brief          : Balancing PWM schedule over its period of filtered windows.
+ *                   The bleeds must be off for the last two windows, and the
+ *                   cell voltages the duties are worked out from must come
+ *                   only from the last one, whatever the tap filters are set to.
+ *                   The balance leads sag the tap while its bleed is on and
+ *                   recover slowly once it is off.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "host_sim.h"
+#include "battery.h"
+#include "measurement.h"
+#include "main.h"
+
+#include <math.h>
+
+#define TEST_CELL_V				3.90
+#define TEST_CELL_1_V			3.95
+/* Bleed current through the balance lead, and how long the tap takes to recover once the bleed is off */
+#define TEST_LEAD_SAG_V			0.050
+#define TEST_RECOVERY_MS		20.0
+/* Published readings are whole codes, 1.2 mV on tap 1. The duty window may be a code off the reading with no lead sag */
+#define TEST_MAX_ERROR_V		0.0015
+#define TEST_SETTLE_WINDOWS		30
+#define TEST_WINDOWS			200
+
+static const uint16_t test_bleed_pins[HOST_SIM_CELLS] = {CELL_1S_DIS_EN_Pin, CELL_2S_DIS_EN_Pin, CELL_3S_DIS_EN_Pin,
+		CELL_4S_DIS_EN_Pin};
+
+struct Test_Config {
+	const char *name;
+	struct Adc_Filter_Config config;
+};
+
+static const struct Test_Config test_configs[] = {
+	{"default", {ADC_FILTER_DEFAULT_VOLTAGE_MEDIAN, ADC_FILTER_DEFAULT_VOLTAGE_BOXCAR_SHIFT, ADC_FILTER_DEFAULT_IIR_SHIFT}},
+	{"median 3, boxcar 32", {3, 5, 0}},
+	{"median 3, boxcar 16, IIR 1/8", {3, 4, 3}},
+	{"median 5, boxcar 32, IIR 1/16", {5, 5, 4}},
+};
+
+static double test_lead_sag_v;
+static double test_sag_v[HOST_SIM_CELLS];
+
+/**
+ * @brief  Runs sequence by sequence to the end of the next filtered window, sagging each tap while its bleed is on
+ * @retval 1 if any bleed was on during the window
+ */
+static uint8_t Test_Run_Window(void) {
+	uint16_t codes[ADC_NUMBER_OF_CHANNELS];
+	uint32_t windows = host_sim.windows;
+	uint8_t bleed = 0;
+
+	while (host_sim.windows == windows) {
+		uint64_t start_ns = host_sim.time_ns;
+		double tap_v = 0.0;
+
+		/* The GPIO as the sequence converts, the window's output switches them after its last sequence */
+		for (int i = 0; i < HOST_SIM_CELLS; i++) {
+			if ((host_gpiob.ODR & test_bleed_pins[i]) != 0) {
+				test_sag_v[i] = test_lead_sag_v;
+				bleed = 1;
+			}
+			tap_v += ((i == 0) ? TEST_CELL_1_V : TEST_CELL_V) - test_sag_v[i];
+			host_sim.tap_v[i] = tap_v;
+		}
+		host_sim.xt60_v = 0.0;
+
+		Host_Sim_Model_Sequence(codes);
+		Host_Sim_Sequence(codes);
+
+		double recovery = exp(-((host_sim.time_ns - start_ns) / 1e6) / TEST_RECOVERY_MS);
+		for (int i = 0; i < HOST_SIM_CELLS; i++) {
+			test_sag_v[i] *= recovery;
+		}
+	}
+
+	return bleed;
+}
+
+/**
+ * @brief  Runs the balancing with one setting of the tap filters
+ * @param  reference_v: Cell 1 reading in the duty windows with no lead sag, 0 to measure it
+ * @retval Cell 1 reading in the last duty window
+ */
+static double Test_Schedule(const struct Test_Config *config, double reference_v) {
+	for (uint8_t channel = 1; channel <= HOST_SIM_CELLS; channel++) {
+		TEST_CHECK(Set_ADC_Filter(channel, &config->config) == 1);
+	}
+
+	uint8_t history = 0;
+	for (uint32_t window = 0; window < TEST_SETTLE_WINDOWS; window++) {
+		history = (uint8_t)((history << 1) | Test_Run_Window());
+	}
+
+	uint32_t on_run = 0, off_run = 0, bad_runs = 0, measurements = 0;
+	double max_error = 0.0, max_previous_error = 0.0, last_v = 0.0;
+
+	for (uint32_t window = 0; window < TEST_WINDOWS; window++) {
+		uint8_t bleed = Test_Run_Window();
+		history = (uint8_t)((history << 1) | bleed);
+
+		struct Measurement_Snapshot snapshot;
+		Get_Measurement_Snapshot(&snapshot);
+		double reading = (double)snapshot.cell_voltage[0] / BATTERY_ADC_MULTIPLIER;
+		double error = fabs(reading - reference_v);
+
+		/* Runs of windows with and without a bleed on, checked when each run ends */
+		if (bleed == 1) {
+			if ((off_run != 0) && (off_run != BALANCE_OFF_WINDOWS)) {
+				bad_runs++;
+			}
+			off_run = 0;
+			on_run++;
+		}
+		else {
+			if ((on_run != 0) && (on_run != (BALANCE_PERIOD_WINDOWS - BALANCE_OFF_WINDOWS))) {
+				bad_runs++;
+			}
+			on_run = 0;
+			off_run++;
+		}
+
+		/* The second unloaded window after loaded ones is the one the duties come from */
+		if ((history & 0b111) == 0b100) {
+			max_error = fmax(max_error, error);
+			measurements++;
+			last_v = reading;
+		}
+		else if ((history & 0b11) == 0b10) {
+			max_previous_error = fmax(max_previous_error, error);
+		}
+	}
+
+	/* The bleed stays on through the run, cell 1 is never caught up */
+	TEST_CHECK(measurements >= ((TEST_WINDOWS / BALANCE_PERIOD_WINDOWS) - 1));
+	TEST_CHECK(bad_runs == 0);
+	if (reference_v == 0.0) {
+		return last_v;
+	}
+
+	TEST_CHECK(max_error < TEST_MAX_ERROR_V);
+
+	printf("%-32s %6u %12.2f mV %12.2f mV\n", config->name, measurements, max_previous_error * 1000.0, max_error * 1000.0);
+	return last_v;
+}
+
+int main(void) {
+	Host_Sim_Init();
+	host_sim.regulator_enabled = 0;
+	host_sim.override = 1;
+
+	/* The window the taps settle in still reads the recovery, the one after must not */
+	printf("%-32s %6s %15s %15s\n", "tap filters", "periods", "settling error", "duty error");
+	for (size_t i = 0; i < (sizeof(test_configs) / sizeof(test_configs[0])); i++) {
+		test_lead_sag_v = 0.0;
+		double reference_v = Test_Schedule(&test_configs[i], 0.0);
+
+		test_lead_sag_v = TEST_LEAD_SAG_V;
+		Test_Schedule(&test_configs[i], reference_v);
+	}
+
+	return Test_Finish("test_balance_window");
+}
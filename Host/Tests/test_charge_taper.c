@@ -0,0 +1,159 @@
+/**
+ ******************************************************************************
+ * @file           : test_charge_taper.c
+ * @brief          : Charge current taper while the pack is balancing. The
+ *                   current falls linearly to zero over CHARGE_TAPER_WINDOW_V
+ *                   below CELL_VOLTAGE_TO_ENABLE_CHARGING on the highest cell,
+ *                   and a balanced pack is left at the full current. Then an
+ *                   unbalanced pack is charged through the model with the
+ *                   bleeds working against the high cell.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "host_hal.h"
+#include "host_sim.h"
+#include "battery.h"
+#include "charger.h"
+#include "measurement.h"
+#include "usbpd.h"
+
+#include <math.h>
+
+#define TEST_FULL_MA			3000
+#define TEST_LOW_CELL_V			3.95
+/* Enough lead on the high cell to balance with the thresholds widened for charging */
+#define TEST_HIGH_LEAD_V		0.100
+#define TEST_SETTLE_WINDOWS		(3 * BALANCE_PERIOD_WINDOWS)
+/* The ideal taper from the true cell voltage, the reading is within a couple of mV of it at 30 mA per mV */
+#define TEST_TAPER_TOLERANCE_MA	90
+
+/* The charged pack is small so it fills in a short run */
+#define TEST_PACK_MAH			60.0
+#define TEST_CHARGE_MS			(20 * 60 * 1000)
+/* Open circuit voltage the high cell may reach, CELL_VOLTAGE_TO_ENABLE_CHARGING plus the reading and regulator steps */
+#define TEST_HIGH_CELL_MAX_V	4.20
+
+static void Test_Set_Taps(double high_cell_v, double low_cell_v) {
+	double tap_v = 0.0;
+	for (int i = 0; i < HOST_SIM_CELLS; i++) {
+		tap_v += (i == 0) ? high_cell_v : low_cell_v;
+		host_sim.tap_v[i] = tap_v;
+	}
+	host_sim.xt60_v = tap_v;
+}
+
+/**
+ * @brief  Tapers the full current from a snapshot, as Control_Charger_Output does
+ */
+static uint32_t Test_Taper(const struct Measurement_Snapshot *snapshot) {
+	uint32_t max_cell_voltage = 0;
+	for (int i = 0; i < snapshot->number_of_cells; i++) {
+		if (snapshot->cell_voltage[i] > max_cell_voltage) {
+			max_cell_voltage = snapshot->cell_voltage[i];
+		}
+	}
+	return Taper_Charge_Current(TEST_FULL_MA, max_cell_voltage, (snapshot->balancing_state != 0) ? 1 : 0);
+}
+
+/**
+ * @brief  Sweeps the highest cell through the taper window with the other cells held low
+ */
+static void Test_Taper_Sweep(void) {
+	uint32_t last_ma = TEST_FULL_MA;
+
+	printf("%10s %10s %10s %10s\n", "cell 1 V", "balancing", "taper mA", "ideal mA");
+	for (uint32_t step = 0; step <= 22; step++) {
+		double high_cell_v = 4.00 + (0.01 * step);
+		Test_Set_Taps(high_cell_v, high_cell_v - TEST_HIGH_LEAD_V);
+		Host_Sim_Run_Windows(TEST_SETTLE_WINDOWS);
+
+		struct Measurement_Snapshot snapshot;
+		Get_Measurement_Snapshot(&snapshot);
+		uint32_t taper_ma = Test_Taper(&snapshot);
+
+		double limit_v = (double)CELL_VOLTAGE_TO_ENABLE_CHARGING / BATTERY_ADC_MULTIPLIER;
+		double window_v = (double)CHARGE_TAPER_WINDOW_V / BATTERY_ADC_MULTIPLIER;
+		double ideal_ma = TEST_FULL_MA * fmin(1.0, fmax(0.0, (limit_v - high_cell_v) / window_v));
+
+		printf("%10.2f %10u %10u %10.0f\n", high_cell_v, snapshot.balancing_state, taper_ma, ideal_ma);
+
+		TEST_CHECK(snapshot.balancing_state != 0);
+		TEST_CHECK_NEAR(taper_ma, ideal_ma, TEST_TAPER_TOLERANCE_MA);
+		TEST_CHECK(taper_ma <= last_ma);
+		last_ma = taper_ma;
+	}
+
+	/* Full current well below the window and none over the limit */
+	TEST_CHECK(last_ma == 0);
+
+	/* A balanced pack near the limit is left to the constant voltage stage */
+	Test_Set_Taps(4.15, 4.15);
+	Host_Sim_Run_Windows(TEST_SETTLE_WINDOWS);
+	struct Measurement_Snapshot snapshot;
+	Get_Measurement_Snapshot(&snapshot);
+	TEST_CHECK(snapshot.balancing_state == 0);
+	TEST_CHECK(Test_Taper(&snapshot) == TEST_FULL_MA);
+}
+
+static uint32_t Test_Charge_Current_Register(void) {
+	return (uint32_t)((host_hal.bq25703a[HOST_BQ_CHARGE_CURRENT_ADDR + 1] << 8) | host_hal.bq25703a[HOST_BQ_CHARGE_CURRENT_ADDR]);
+}
+
+/**
+ * @brief  Charges a pack with one cell ahead through the model, the high cell must not be pushed past the limit
+ */
+static void Test_Unbalanced_Charge(void) {
+	host_sim.override = 0;
+	host_sim.regulator_enabled = 1;
+	host_sim.pack.capacity_mah = TEST_PACK_MAH;
+	Host_Sim_Set_Pack(HOST_SIM_CELLS, 3.90);
+	host_sim.pack.soc[0] = 0.85;
+	Host_Set_USB_PD(READY, 20000, 3000);
+
+	double start_low_soc = host_sim.pack.soc[1];
+	double max_high_v = 0.0;
+	uint32_t full_ma = 0, min_tapered_ma = UINT32_MAX, tapered_polls = 0;
+
+	for (uint32_t ms = 0; ms < TEST_CHARGE_MS; ms += 100) {
+		Host_Sim_Run_Ms(100);
+
+		double high_v = Host_Sim_OCV(host_sim.pack.soc[0]);
+		max_high_v = fmax(max_high_v, high_v);
+
+		struct Measurement_Snapshot snapshot;
+		Get_Measurement_Snapshot(&snapshot);
+		uint32_t current_ma = Test_Charge_Current_Register();
+		if (current_ma > full_ma) {
+			full_ma = current_ma;
+		}
+		if ((snapshot.balancing_state != 0) && (current_ma > 0) && (current_ma < full_ma)) {
+			tapered_polls++;
+			if (current_ma < min_tapered_ma) {
+				min_tapered_ma = current_ma;
+			}
+		}
+	}
+
+	double end_low_soc = host_sim.pack.soc[1];
+
+	/* The current was tapered rather than cut, the high cell stayed under the limit and the low cells kept charging */
+	TEST_CHECK(tapered_polls > 0);
+	TEST_CHECK(min_tapered_ma < (full_ma / 2));
+	TEST_CHECK(max_high_v < TEST_HIGH_CELL_MAX_V);
+	TEST_CHECK(end_low_soc > (start_low_soc + 0.2));
+
+	printf("Unbalanced charge: full %u mA, tapered to %u mA over %u polls, high cell peaked at %.3f V, low cells %.0f%% to %.0f%%, state %u\n",
+			full_ma, min_tapered_ma, tapered_polls, max_high_v, start_low_soc * 100.0, end_low_soc * 100.0, Get_Charger_State());
+}
+
+int main(void) {
+	Host_Sim_Init();
+	host_sim.regulator_enabled = 0;
+	host_sim.override = 1;
+
+	Test_Taper_Sweep();
+	Test_Unbalanced_Charge();
+
+	return Test_Finish("test_charge_taper");
+}
@@ -0,0 +1,234 @@
+/**
+ ******************************************************************************
+ * @file           : test_charger.c
+ * @brief          : The charger state machine on its own, driven with inputs
+ *                   like vRegulator builds every poll. The charge current
+ *                   input follows the output of the poll before, zero while
+ *                   the output is off or in its HI-Z rest, as the regulator
+ *                   ADC reads it.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "charger.h"
+
+#define TEST_POLL_MS			250
+#define TEST_CELLS				4
+#define TEST_CC_MA				3000
+
+static struct Charger_Inputs test_inputs;
+static uint32_t test_now_ms;
+/* Current the pack takes while the output is on */
+static uint32_t test_current_ma;
+
+static void Test_Set_Cells(double min_cell_v, double max_cell_v) {
+	test_inputs.min_cell_voltage = (uint32_t)(min_cell_v * CHARGER_UV_PER_V);
+	test_inputs.max_cell_voltage = (uint32_t)(max_cell_v * CHARGER_UV_PER_V);
+}
+
+static void Test_Plug(void) {
+	test_inputs.xt60_connected = 1;
+	test_inputs.balance_port_connected = 1;
+	test_inputs.number_of_cells = TEST_CELLS;
+	test_inputs.power_ready = 1;
+}
+
+/**
+ * @brief  Polls the charger for a while
+ * @retval Number of polls with the output on
+ */
+static uint32_t Test_Run(uint32_t ms) {
+	uint32_t enabled = 0;
+
+	for (uint32_t elapsed = 0; elapsed < ms; elapsed += TEST_POLL_MS) {
+		struct Charger_Output output;
+		Get_Charger_Output(&output);
+		test_inputs.charge_current_ma = (output.charge_enable == 1) ? test_current_ma : 0;
+		if ((output.charge_enable == 1) && (output.current_limit_ma != 0) && (test_inputs.charge_current_ma > output.current_limit_ma)) {
+			test_inputs.charge_current_ma = output.current_limit_ma;
+		}
+		enabled += output.charge_enable;
+
+		test_now_ms += TEST_POLL_MS;
+		Charger_Update(&test_inputs, test_now_ms);
+	}
+
+	return enabled;
+}
+
+/**
+ * @brief  Polls until the charger enters a state
+ * @retval Time taken in ms, UINT32_MAX if it did not get there
+ */
+static uint32_t Test_Run_Until(uint8_t state, uint32_t timeout_ms) {
+	for (uint32_t elapsed = 0; elapsed < timeout_ms; elapsed += TEST_POLL_MS) {
+		if (Get_Charger_State() == state) {
+			return elapsed;
+		}
+		Test_Run(TEST_POLL_MS);
+	}
+	return (Get_Charger_State() == state) ? timeout_ms : UINT32_MAX;
+}
+
+/**
+ * @brief  Holds the state for a run of polls
+ * @retval 1 if it never left it
+ */
+static uint8_t Test_Holds(uint8_t state, uint32_t ms) {
+	for (uint32_t elapsed = 0; elapsed < ms; elapsed += TEST_POLL_MS) {
+		Test_Run(TEST_POLL_MS);
+		if (Get_Charger_State() != state) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * @brief  Deep discharged pack through precharge, CC and CV to termination and the recharge hysteresis
+ */
+static void Test_Charge_Cycle(void) {
+	TEST_CHECK(Get_Charger_State() == CHARGER_DISCONNECTED);
+
+	Test_Plug();
+	Test_Set_Cells(2.9, 2.95);
+	test_inputs.requires_charging = 1;
+	test_current_ma = TEST_CC_MA;
+
+	TEST_CHECK(Test_Run_Until(CHARGER_PRECHARGE, 5000) != UINT32_MAX);
+
+	/* Precharge is limited to its own current */
+	Test_Run(3000);
+	TEST_CHECK(test_inputs.charge_current_ma == CHARGER_PRECHARGE_CURRENT_MA);
+
+	Test_Set_Cells(3.15, 3.2);
+	TEST_CHECK(Test_Run_Until(CHARGER_CC, 10000) != UINT32_MAX);
+	Test_Run(1000);
+	TEST_CHECK(test_inputs.charge_current_ma == TEST_CC_MA);
+
+	/* A cell reaching CHARGER_CV_CELL_V under the charge current */
+	Test_Set_Cells(4.05, 4.16);
+	TEST_CHECK(Test_Run_Until(CHARGER_CV, 10000) != UINT32_MAX);
+
+	/* The pack reads full under the charge current, the current is still high so charging carries on */
+	test_inputs.requires_charging = 0;
+	test_current_ma = 1500;
+	TEST_CHECK(Test_Holds(CHARGER_CV, 2 * CHARGER_CYCLE_MS) == 1);
+
+	/* The HI-Z rests read no current, they must not end the charge */
+	uint32_t enabled = Test_Run(CHARGER_CYCLE_MS);
+	TEST_CHECK(enabled < (CHARGER_CYCLE_MS / TEST_POLL_MS));
+	TEST_CHECK(Get_Charger_State() == CHARGER_CV);
+
+	/* Below the termination current for long enough */
+	test_current_ma = CHARGER_TERMINATION_CURRENT_MA + 50;
+	TEST_CHECK(Test_Holds(CHARGER_CV, CHARGER_CYCLE_MS) == 1);
+	test_current_ma = CHARGER_TERMINATION_CURRENT_MA - 50;
+	uint32_t termination_ms = Test_Run_Until(CHARGER_DONE, 2 * CHARGER_CYCLE_MS);
+	TEST_CHECK(termination_ms >= CHARGER_TERMINATION_MS);
+	TEST_CHECK(termination_ms != UINT32_MAX);
+
+	/* Off the charger the pack relaxes and reads as needing charge, it is not topped up until under CHARGER_RECHARGE_CELL_V */
+	test_inputs.requires_charging = 1;
+	Test_Set_Cells(4.12, 4.14);
+	TEST_CHECK(Test_Holds(CHARGER_DONE, 5 * 60 * 1000) == 1);
+	TEST_CHECK(Test_Run(1000) == 0);
+
+	Test_Set_Cells(4.05, 4.09);
+	uint32_t recharge_ms = Test_Run_Until(CHARGER_NEGOTIATING, 2 * 60 * 1000);
+	TEST_CHECK(recharge_ms != UINT32_MAX);
+	TEST_CHECK(recharge_ms >= 60000);
+	TEST_CHECK(Test_Run_Until(CHARGER_CC, 5000) != UINT32_MAX);
+
+	printf("CV terminated %.1f s after the current fell, recharged %.1f s after the highest cell fell below %.2f V\n",
+			termination_ms / 1000.0, recharge_ms / 1000.0, (double)CHARGER_RECHARGE_CELL_V / CHARGER_UV_PER_V);
+}
+
+/**
+ * @brief  Termination with the bleeds still on goes to BALANCING, which waits for the recharge threshold too
+ */
+static void Test_Balancing(void) {
+	TEST_CHECK(Get_Charger_State() == CHARGER_CC);
+
+	test_current_ma = TEST_CC_MA;
+	test_inputs.balancing = 1;
+	Test_Set_Cells(4.05, 4.16);
+	TEST_CHECK(Test_Run_Until(CHARGER_CV, 10000) != UINT32_MAX);
+
+	test_current_ma = 100;
+	TEST_CHECK(Test_Run_Until(CHARGER_BALANCING, 2 * CHARGER_CYCLE_MS) != UINT32_MAX);
+
+	test_inputs.requires_charging = 1;
+	Test_Set_Cells(4.08, 4.12);
+	TEST_CHECK(Test_Holds(CHARGER_BALANCING, 60000) == 1);
+
+	/* Balanced above the recharge threshold is done, below it charges again */
+	test_inputs.balancing = 0;
+	TEST_CHECK(Test_Run_Until(CHARGER_DONE, 10000) != UINT32_MAX);
+
+	test_inputs.balancing = 1;
+	TEST_CHECK(Test_Run_Until(CHARGER_BALANCING, 10000) != UINT32_MAX);
+	Test_Set_Cells(4.05, 4.08);
+	TEST_CHECK(Test_Run_Until(CHARGER_NEGOTIATING, 10000) != UINT32_MAX);
+	test_inputs.balancing = 0;
+	test_current_ma = TEST_CC_MA;
+	TEST_CHECK(Test_Run_Until(CHARGER_CC, 5000) != UINT32_MAX);
+}
+
+/**
+ * @brief  Supply loss and ADC tuning right after CC is entered, a fault while charging and a precharge that times out
+ */
+static void Test_Faults(void) {
+	TEST_CHECK(Get_Charger_State() == CHARGER_CC);
+
+	/* Losing the supply is not a fault, the output is off at the next poll without waiting out the minimum time of CC */
+	test_inputs.power_ready = 0;
+	Test_Run(TEST_POLL_MS);
+	TEST_CHECK(Get_Charger_State() == CHARGER_NEGOTIATING);
+	TEST_CHECK(Test_Run(5000) == 0);
+	test_inputs.power_ready = 1;
+	TEST_CHECK(Test_Run_Until(CHARGER_CC, 5000) != UINT32_MAX);
+
+	/* Tuning holds the output in HI-Z from the poll it starts on */
+	test_inputs.adc_tuning = 1;
+	Test_Run(TEST_POLL_MS);
+	TEST_CHECK(Get_Charger_State() == CHARGER_NEGOTIATING);
+	TEST_CHECK(Test_Run(10000) == 0);
+	test_inputs.adc_tuning = 0;
+	TEST_CHECK(Test_Run_Until(CHARGER_CC, 5000) != UINT32_MAX);
+
+	/* A fault skips the minimum time and the output is off at once */
+	test_inputs.error_state = 1;
+	Test_Run(TEST_POLL_MS);
+	TEST_CHECK(Get_Charger_State() == CHARGER_FAULT);
+	TEST_CHECK(Test_Run(10000) == 0);
+	test_inputs.error_state = 0;
+	TEST_CHECK(Test_Run_Until(CHARGER_DISCONNECTED, 5000) != UINT32_MAX);
+	TEST_CHECK(Test_Run_Until(CHARGER_CC, 10000) != UINT32_MAX);
+
+	test_inputs.cell_over_voltage = 1;
+	Test_Run(TEST_POLL_MS);
+	TEST_CHECK(Get_Charger_State() == CHARGER_FAULT);
+	test_inputs.cell_over_voltage = 0;
+
+	/* A cell that never recovers times precharge out, the fault holds until the pack is unplugged */
+	Test_Set_Cells(2.5, 2.6);
+	TEST_CHECK(Test_Run_Until(CHARGER_PRECHARGE, 10000) != UINT32_MAX);
+	uint32_t timeout_ms = Test_Run_Until(CHARGER_FAULT, CHARGER_PRECHARGE_TIMEOUT_MS + 10000);
+	TEST_CHECK(timeout_ms != UINT32_MAX);
+	TEST_CHECK(timeout_ms >= CHARGER_PRECHARGE_TIMEOUT_MS);
+	TEST_CHECK(Test_Holds(CHARGER_FAULT, 60000) == 1);
+
+	test_inputs.xt60_connected = 0;
+	TEST_CHECK(Test_Run_Until(CHARGER_DISCONNECTED, 5000) != UINT32_MAX);
+
+	printf("Precharge timed out after %.1f min, %u transitions in all\n", timeout_ms / 60000.0, Get_Charger_Transition_Count());
+}
+
+int main(void) {
+	Test_Charge_Cycle();
+	Test_Balancing();
+	Test_Faults();
+
+	return Test_Finish("test_charger");
+}
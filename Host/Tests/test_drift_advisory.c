@@ -0,0 +1,89 @@
+/**
+ ******************************************************************************
+ * @file           : test_drift_advisory.c
+ * @brief          : An XT60 reading that drifts from the cell sum raises
+ *                   ADC_DRIFT_ERROR, which is reported without stopping the
+ *                   charger or the balancing. Any other error still faults it.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "host_sim.h"
+#include "battery.h"
+#include "charger.h"
+#include "error.h"
+#include "measurement.h"
+#include "usbpd.h"
+
+#define TEST_CELL_V				3.9
+/* Over ADC_XCAL_CELL_SUM_LIMIT with room for the confidence bound */
+#define TEST_XT60_OFFSET_V		0.15
+/* Far enough over the others to balance with the thresholds widened for charging */
+#define TEST_CELL_1_LEAD_V		0.2
+#define TEST_DRIFT_TIMEOUT_MS	(120 * 1000)
+
+/**
+ * @brief  Balanced pack except for cell 1, with the XT60 reading TEST_XT60_OFFSET_V over the cell sum
+ */
+static void Test_Set_Pack(double cell_1_v) {
+	double tap_v = 0.0;
+	for (int i = 0; i < HOST_SIM_CELLS; i++) {
+		tap_v += (i == 0) ? cell_1_v : TEST_CELL_V;
+		host_sim.tap_v[i] = tap_v;
+	}
+	host_sim.xt60_v = tap_v + TEST_XT60_OFFSET_V;
+}
+
+static uint8_t Test_Charging(uint8_t state) {
+	return ((state == CHARGER_CC) || (state == CHARGER_CV) || (state == CHARGER_BALANCING)) ? 1 : 0;
+}
+
+int main(void) {
+	Host_Sim_Init();
+	Host_Set_USB_PD(READY, 20000, 3000);
+
+	host_sim.override = 1;
+	Test_Set_Pack(TEST_CELL_V);
+
+	/* The drift is judged after 1 << ADC_XCAL_SHIFT windows without balancing, the charger must not stop meanwhile */
+	uint32_t charging_ms = 0, lost_ms = 0, drift_ms = 0;
+	for (uint32_t ms = 0; (ms < TEST_DRIFT_TIMEOUT_MS) && (drift_ms == 0); ms += 100) {
+		Host_Sim_Run_Ms(100);
+
+		uint8_t state = Get_Charger_State();
+		if ((charging_ms == 0) && (Test_Charging(state) == 1)) {
+			charging_ms = ms;
+		}
+		else if ((charging_ms != 0) && (Test_Charging(state) == 0) && (lost_ms == 0)) {
+			lost_ms = ms;
+		}
+		if ((Get_Error_State() & ADC_DRIFT_ERROR) != 0) {
+			drift_ms = ms;
+		}
+	}
+
+	TEST_CHECK(charging_ms != 0);
+	TEST_CHECK(drift_ms != 0);
+	TEST_CHECK(lost_ms == 0);
+
+	/* Drift is the only error and neither the charger nor the balancing stop for it */
+	Test_Set_Pack(TEST_CELL_V + TEST_CELL_1_LEAD_V);
+	Host_Sim_Run_Ms(10000);
+
+	struct Measurement_Snapshot snapshot;
+	Get_Measurement_Snapshot(&snapshot);
+	TEST_CHECK(snapshot.error_state == ADC_DRIFT_ERROR);
+	TEST_CHECK(Test_Charging(Get_Charger_State()) == 1);
+	TEST_CHECK(snapshot.balancing_state != 0);
+
+	printf("Charging at %.1f s, ADC drift at %.1f s, state %u with balancing %u\n", charging_ms / 1000.0, drift_ms / 1000.0,
+			Get_Charger_State(), snapshot.balancing_state);
+
+	/* A real error alongside it still stops charging */
+	host_sim.temperature_c = 90.0;
+	Host_Sim_Run_Ms(5000);
+	TEST_CHECK((Get_Error_State() & MCU_OVER_TEMP) != 0);
+	TEST_CHECK(Get_Charger_State() == CHARGER_FAULT);
+
+	return Test_Finish("test_drift_advisory");
+}
@@ -0,0 +1,174 @@
+/**
+ ******************************************************************************
+ * @file           : test_fault_latency.c
+ * @brief          : Time from a step on the XT60 or a balance tap to the
+ *                   charger output going HI-Z, through the fast per-block
+ *                   safety path and through the filtered window and regulator
+ *                   poll that were the only path before it. A short pulse
+ *                   the filtered mean does not confirm, or a single
+ *                   conversion spike only AWD2 sees, must still fault the
+ *                   charger. Every fault is stepped at several points
+ *                   between regulator polls, and once HI-Z the output must
+ *                   not be turned back on by a poll acting on a stale
+ *                   snapshot.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "host_sim.h"
+#include "battery.h"
+#include "charger.h"
+#include "measurement.h"
+#include "main.h"
+#include "usbpd.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define TEST_CELL_V				3.9
+#define TEST_TIMEOUT_MS			2000
+
+/* One block of the fast path plus the task wake up, with a block of margin */
+#define TEST_FAST_LIMIT_MS		((3 * ADC_DMA_BLOCK_SEQUENCES * 1000) / ADC_SAMPLE_RATE_DEFAULT_HZ)
+/* Steps spread over a regulator poll */
+#define TEST_PHASES				5
+#define TEST_PHASE_MS			(HOST_SIM_REGULATOR_POLL_MS / TEST_PHASES)
+
+/* A few blocks, well short of a filter window */
+#define TEST_PULSE_US			20000
+/* One sequence, too short to move the block mean over the limit */
+#define TEST_SPIKE_US			(1000000 / ADC_SAMPLE_RATE_DEFAULT_HZ)
+
+struct Test_Fault {
+	const char *name;
+	double xt60_v;
+	double cell_v[HOST_SIM_CELLS];
+	/* 0 for a step, otherwise the inputs go back to normal after this long */
+	uint32_t pulse_us;
+	/* State the charger must be in once the filtered path has caught up */
+	uint8_t state;
+};
+
+static const struct Test_Fault test_faults[] = {
+	{"cell 3 over voltage", 0.0, {TEST_CELL_V, TEST_CELL_V, 4.40, TEST_CELL_V}, 0, CHARGER_FAULT},
+	{"cell 3 over voltage pulse", 0.0, {TEST_CELL_V, TEST_CELL_V, 4.40, TEST_CELL_V}, TEST_PULSE_US, CHARGER_FAULT},
+	{"cell 1 over voltage spike", 0.0, {4.60, TEST_CELL_V, TEST_CELL_V, TEST_CELL_V}, TEST_SPIKE_US, CHARGER_FAULT},
+	{"cell 2 under voltage", 0.0, {TEST_CELL_V, 1.80, TEST_CELL_V, TEST_CELL_V}, 0, CHARGER_FAULT},
+	{"XT60 disconnect", -1.0, {TEST_CELL_V, TEST_CELL_V, TEST_CELL_V, TEST_CELL_V}, 0, CHARGER_DISCONNECTED},
+	{"balance disconnect", 0.0, {0.0, 0.0, 0.0, 0.0}, 0, CHARGER_DISCONNECTED},
+};
+
+static void Test_Set_Inputs(double xt60_v, const double *cell_v) {
+	double tap_v = 0.0;
+	for (int i = 0; i < HOST_SIM_CELLS; i++) {
+		tap_v += cell_v[i];
+		host_sim.tap_v[i] = tap_v;
+	}
+	host_sim.xt60_v = (xt60_v < 0.0) ? 0.0 : ((xt60_v == 0.0) ? tap_v : xt60_v);
+}
+
+static uint8_t Test_Output_HI_Z(void) {
+	return ((host_gpiob.ODR & ILIM_HIZ_Pin) == 0) ? 1 : 0;
+}
+
+/**
+ * @brief  Steps the inputs and runs sequence by sequence until the output is HI-Z and the charger has left CC
+ * @param  fault: Fault to step to
+ * @param  phase_ms: Time from the first step point to this one
+ * @retval Number of failed checks
+ */
+static int Test_Fault_Latency(const struct Test_Fault *fault, uint32_t phase_ms) {
+	uint16_t codes[ADC_NUMBER_OF_CHANNELS];
+	Host_Sim_Run_Ms(phase_ms);
+	uint64_t start_ns = host_sim.time_ns;
+	uint64_t hi_z_ns = 0, state_ns = 0;
+	uint32_t reenabled = 0;
+
+	TEST_CHECK(Get_Charger_State() == CHARGER_CC);
+	TEST_CHECK(Test_Output_HI_Z() == 0);
+
+	Test_Set_Inputs(fault->xt60_v, fault->cell_v);
+
+	const double cell_v[HOST_SIM_CELLS] = {TEST_CELL_V, TEST_CELL_V, TEST_CELL_V, TEST_CELL_V};
+	uint8_t pulse_ended = 0;
+
+	while (((hi_z_ns == 0) || (state_ns == 0)) && ((host_sim.time_ns - start_ns) < (TEST_TIMEOUT_MS * 1000000ULL))) {
+		Host_Sim_Model_Sequence(codes);
+		Host_Sim_Sequence(codes);
+
+		if ((fault->pulse_us != 0) && (pulse_ended == 0) && ((host_sim.time_ns - start_ns) >= (fault->pulse_us * 1000ULL))) {
+			Test_Set_Inputs(0.0, cell_v);
+			pulse_ended = 1;
+		}
+
+		if ((hi_z_ns == 0) && (Test_Output_HI_Z() == 1)) {
+			hi_z_ns = host_sim.time_ns - start_ns;
+		}
+		if ((hi_z_ns != 0) && (Test_Output_HI_Z() == 0)) {
+			reenabled++;
+		}
+		if ((state_ns == 0) && (Get_Charger_State() != CHARGER_CC)) {
+			state_ns = host_sim.time_ns - start_ns;
+		}
+	}
+
+	TEST_CHECK(hi_z_ns != 0);
+	TEST_CHECK(state_ns != 0);
+	TEST_CHECK(hi_z_ns <= (TEST_FAST_LIMIT_MS * 1000000ULL));
+	TEST_CHECK(hi_z_ns < state_ns);
+	TEST_CHECK(reenabled == 0);
+
+	/* Still off once the filtered path has caught up, and after the next regulator poll */
+	TEST_CHECK(Test_Output_HI_Z() == 1);
+	TEST_CHECK(Get_Charger_State() == fault->state);
+	Host_Sim_Run_Ms(HOST_SIM_REGULATOR_POLL_MS);
+	TEST_CHECK(Test_Output_HI_Z() == 1);
+	TEST_CHECK(Get_Charger_State() == fault->state);
+
+	printf("%-26s %5u ms %8.1f ms fast path %8.1f ms to leave CC\n", fault->name, phase_ms, hi_z_ns / 1e6, state_ns / 1e6);
+
+	return host_test_failures;
+}
+
+int main(void) {
+	Host_Sim_Init();
+	Host_Set_USB_PD(READY, 20000, 3000);
+
+	host_sim.override = 1;
+	const double cell_v[HOST_SIM_CELLS] = {TEST_CELL_V, TEST_CELL_V, TEST_CELL_V, TEST_CELL_V};
+	Test_Set_Inputs(0.0, cell_v);
+	Host_Sim_Run_Ms(3000);
+
+	/* Step part way between regulator polls and clear of a HI-Z rest */
+	for (int i = 0; (i < 1000) && ((Get_Charger_State() != CHARGER_CC) || (Test_Output_HI_Z() == 1)); i++) {
+		Host_Sim_Run_Ms(100);
+	}
+	Host_Sim_Run_Ms(HOST_SIM_REGULATOR_POLL_MS / 2);
+
+	TEST_CHECK(Get_Charger_State() == CHARGER_CC);
+
+	printf("%-26s %8s\n", "fault", "step");
+
+	/* Every fault starts from the same charging state, each in its own copy of the firmware */
+	for (uint32_t phase = 0; phase < TEST_PHASES; phase++) {
+		for (size_t i = 0; i < (sizeof(test_faults) / sizeof(test_faults[0])); i++) {
+			fflush(stdout);
+			pid_t child = fork();
+
+			if (child == 0) {
+				/* Each copy reports only its own failures */
+				host_test_failures = 0;
+				int failures = Test_Fault_Latency(&test_faults[i], phase * TEST_PHASE_MS);
+				fflush(stdout);
+				_exit((failures == 0) ? 0 : 1);
+			}
+
+			int status = 0;
+			TEST_CHECK((child > 0) && (waitpid(child, &status, 0) == child));
+			TEST_CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+		}
+	}
+
+	return Test_Finish("test_fault_latency");
+}
@@ -0,0 +1,151 @@
+/**
+ ******************************************************************************
+ * @file           : test_filter_chain.c
+ * @brief          : Noise, spike rejection, bias and cost of each stage of the
+ *                   ADC filter chain on block sums like the DMA interrupt makes.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "adc_filter.h"
+#include "adc_interface.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define TEST_BLOCKS				200000
+#define TEST_SETTLE_BLOCKS		64
+#define TEST_CODE				2000
+#define TEST_NOISE_CODES		0.7
+/* A buck switching spike lifts every sample of one block in every TEST_SPIKE_BLOCKS by TEST_SPIKE_CODES */
+#define TEST_SPIKE_BLOCKS		64
+#define TEST_SPIKE_CODES		40
+
+struct Test_Stage {
+	const char *name;
+	struct Adc_Filter_Config config;
+};
+
+static const struct Test_Stage test_stages[] = {
+	{"none", {1, 0, 0}},
+	{"median 3", {3, 0, 0}},
+	{"median 5", {5, 0, 0}},
+	{"boxcar 16", {1, 4, 0}},
+	{"boxcar 32", {1, 5, 0}},
+	{"IIR 1/16", {1, 0, 4}},
+	{"median 3, boxcar 16", {ADC_FILTER_DEFAULT_VOLTAGE_MEDIAN, 4, 0}},
+	{"median 3, boxcar 16, IIR 1/4", {3, 4, 2}},
+};
+
+#define TEST_STAGES		(sizeof(test_stages) / sizeof(test_stages[0]))
+
+struct Test_Result {
+	double variance;
+	double bias;
+	double max_error;
+	double cycles;
+};
+
+static uint16_t test_clean[TEST_BLOCKS];
+static uint16_t test_spiky[TEST_BLOCKS];
+
+static double Test_Gaussian(void) {
+	double u1 = drand48(), u2 = drand48();
+	return sqrt(-2.0 * log(u1 + 1e-300)) * cos(2.0 * M_PI * u2);
+}
+
+/**
+ * @brief  Block sums of ADC_DMA_BLOCK_SEQUENCES noisy conversions of the same voltage
+ */
+static void Test_Make_Inputs(void) {
+	srand48(8);
+	for (uint32_t block = 0; block < TEST_BLOCKS; block++) {
+		uint32_t sum = 0;
+		for (uint32_t s = 0; s < ADC_DMA_BLOCK_SEQUENCES; s++) {
+			sum += (uint32_t)lround(TEST_CODE + (TEST_NOISE_CODES * Test_Gaussian()));
+		}
+		test_clean[block] = (uint16_t)sum;
+		test_spiky[block] = (uint16_t)sum;
+		if ((block % TEST_SPIKE_BLOCKS) == (TEST_SPIKE_BLOCKS / 2)) {
+			test_spiky[block] = (uint16_t)(sum + (TEST_SPIKE_CODES * ADC_DMA_BLOCK_SEQUENCES));
+		}
+	}
+}
+
+/**
+ * @brief  Runs a stage over the inputs. Errors are in codes of one conversion, the block sum over the sequences in it
+ */
+static void Test_Run_Stage(const struct Test_Stage *stage, const uint16_t *inputs, struct Test_Result *result) {
+	struct Adc_Filter filter;
+	static uint32_t outputs[TEST_BLOCKS];
+
+	TEST_CHECK(ADC_Filter_Init(&filter, &stage->config) == 1);
+
+	uint64_t start = Test_Cycles();
+	for (uint32_t block = 0; block < TEST_BLOCKS; block++) {
+		outputs[block] = ADC_Filter_Run(&filter, inputs[block]);
+	}
+	result->cycles = (double)(Test_Cycles() - start) / TEST_BLOCKS;
+
+	double sum = 0.0, sum_squares = 0.0;
+	result->max_error = 0.0;
+	for (uint32_t block = TEST_SETTLE_BLOCKS; block < TEST_BLOCKS; block++) {
+		double error = ((double)outputs[block] / ADC_DMA_BLOCK_SEQUENCES) - TEST_CODE;
+		sum += error;
+		sum_squares += error * error;
+		if (fabs(error) > result->max_error) {
+			result->max_error = fabs(error);
+		}
+	}
+
+	uint32_t count = TEST_BLOCKS - TEST_SETTLE_BLOCKS;
+	result->bias = sum / count;
+	result->variance = (sum_squares / count) - (result->bias * result->bias);
+}
+
+int main(void) {
+	struct Test_Result clean[TEST_STAGES], spiky[TEST_STAGES];
+
+	Test_Make_Inputs();
+
+	printf("%-30s %12s %10s %12s %12s %10s\n", "stage", "variance", "bias", "max error", "with spikes", "cycles");
+	for (size_t i = 0; i < TEST_STAGES; i++) {
+		Test_Run_Stage(&test_stages[i], test_clean, &clean[i]);
+		Test_Run_Stage(&test_stages[i], test_spiky, &spiky[i]);
+
+		printf("%-30s %12.6f %10.4f %12.3f %12.3f %10.1f\n", test_stages[i].name, clean[i].variance, clean[i].bias,
+				clean[i].max_error, spiky[i].max_error, clean[i].cycles);
+	}
+	printf("variance and bias in codes^2 and codes of one conversion, cycles are host cycles per block\n");
+
+	const double raw = clean[0].variance;
+
+	/* The block sum is already an average of ADC_DMA_BLOCK_SEQUENCES conversions */
+	TEST_CHECK_NEAR(raw, (TEST_NOISE_CODES * TEST_NOISE_CODES + (1.0 / 12.0)) / ADC_DMA_BLOCK_SEQUENCES, raw * 0.1);
+
+	/* A boxcar of N divides the variance by N, rounding the output to a whole block sum adds 1/12 of a sum code */
+	const double rounding = 1.0 / (12.0 * ADC_DMA_BLOCK_SEQUENCES * ADC_DMA_BLOCK_SEQUENCES);
+	TEST_CHECK_NEAR(clean[3].variance, (raw / 16) + rounding, raw / 16 * 0.25);
+	TEST_CHECK_NEAR(clean[4].variance, (raw / 32) + rounding, raw / 32 * 0.25);
+
+	/* An IIR of 1/2^k divides it by about 2^(k+1) - 1, the truncated output adds some back */
+	TEST_CHECK(clean[5].variance < (raw / 16));
+
+	/* Medians trade a little noise reduction for spike rejection */
+	TEST_CHECK(clean[1].variance < raw);
+	TEST_CHECK(clean[2].variance < clean[1].variance);
+
+	/* No stage moves the mean by more than a code */
+	for (size_t i = 0; i < TEST_STAGES; i++) {
+		TEST_CHECK(fabs(clean[i].bias) < 1.0);
+	}
+
+	/* A single block spike passes straight through, is spread by the boxcar and is removed by a median */
+	TEST_CHECK(spiky[0].max_error > (TEST_SPIKE_CODES * 0.9));
+	TEST_CHECK(spiky[3].max_error > ((TEST_SPIKE_CODES / 16.0) * 0.9));
+	TEST_CHECK(spiky[1].max_error < (clean[0].max_error * 1.5));
+	TEST_CHECK(spiky[6].max_error < (clean[0].max_error / 2));
+	TEST_CHECK(spiky[6].max_error < (spiky[3].max_error / 2));
+
+	return Test_Finish("test_filter_chain");
+}
@@ -0,0 +1,258 @@
+/**
+ ******************************************************************************
+ * @file           : test_fixed_point.c
+ * @brief          : The integer charge power, charge current and Q16 code
+ *                   conversions against the float formulas they replaced, and
+ *                   what each costs.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "host_sim.h"
+#include "adc_interface.h"
+#include "adc_filter.h"
+#include "bq25703a_regulator.h"
+#include "usbpd.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define TEST_BENCHMARK_CALLS	100000
+
+/* Not in the headers, private to bq25703a_regulator.c */
+uint32_t Calculate_Max_Charge_Power(void);
+uint32_t Calculate_Charge_Current(uint32_t charging_power_mw);
+
+/* Keeps the benchmarked results live */
+static volatile uint32_t test_sink;
+static volatile float test_float_sink;
+
+/*
+ * The float formulas of the baseline. The baseline divided the readings by their multipliers in integer arithmetic
+ * before the float conversion, so it worked in whole volts. The references divide in float, the whole volt versions
+ * are kept to show the error the integer paths no longer have.
+ */
+static float Baseline_Max_Charge_Power(float vbus_volts, uint32_t max_input_current_ma, uint32_t max_input_power_mw,
+		int32_t temperature_c) {
+	uint32_t charging_power_mw = ((vbus_volts * max_input_current_ma) * 0.85f);
+
+	if (charging_power_mw > MAX_CHARGING_POWER) {
+		charging_power_mw = MAX_CHARGING_POWER;
+	}
+
+	if (charging_power_mw > max_input_power_mw) {
+		charging_power_mw = max_input_power_mw * 0.85f;
+	}
+
+	if (temperature_c > TEMP_THROTTLE_THRESH_C) {
+		float temperature = (float)temperature_c;
+
+		float power_scalar = 1.0f - ((float)(0.0333 * temperature) - 1.33f);
+
+		if (power_scalar > 1.0f) {
+			power_scalar = 1.0f;
+		}
+		if (power_scalar < 0.00f) {
+			power_scalar = 0.00f;
+		}
+
+		charging_power_mw = charging_power_mw * power_scalar;
+	}
+
+	return charging_power_mw;
+}
+
+static float Baseline_Charge_Current(uint32_t charging_power_mw, float battery_volts) {
+	return charging_power_mw / battery_volts;
+}
+
+/**
+ * @brief  Runs the simulation until the filtered MCU temperature has settled
+ */
+static void Test_Settle_Temperature(double temperature_c) {
+	host_sim.temperature_c = temperature_c;
+	int32_t previous = INT32_MIN;
+	for (int i = 0; (i < 200) && (Get_MCU_Temperature() != previous); i++) {
+		previous = Get_MCU_Temperature();
+		Host_Sim_Run_Windows(4);
+	}
+}
+
+static void Test_Code_Conversion(void) {
+	double max_error_uv = 0.0, max_whole_uv_error_uv = 0.0;
+
+	srand48(3);
+	for (int scalar_uv = ADC_SCALAR_MIN + 1; scalar_uv < ADC_SCALAR_MAX; scalar_uv += 7) {
+		uint32_t scalar = ((uint32_t)scalar_uv << ADC_SCALAR_FRACTIONAL_BITS) | (uint32_t)(lrand48() & 0xFFFF);
+		uint32_t offset = (uint32_t)(lrand48() % 16);
+		struct Adc_Calibration calibration = {scalar, -(int32_t)(lrand48() % 20000), 0};
+
+		for (uint32_t code = 0; code < 4096; code++) {
+			double reference = (code > offset) ? ((double)(code - offset) * scalar) / (1 << ADC_SCALAR_FRACTIONAL_BITS) : 0.0;
+			double error = fabs((double)ADC_Scale_Code(code, offset, scalar) - reference);
+			if (error > max_error_uv) {
+				max_error_uv = error;
+			}
+
+			/* The baseline stored whole microvolts per code */
+			double whole_uv = (code > offset) ? ((double)(code - offset) * (scalar >> ADC_SCALAR_FRACTIONAL_BITS)) : 0.0;
+			if (fabs(whole_uv - reference) > max_whole_uv_error_uv) {
+				max_whole_uv_error_uv = fabs(whole_uv - reference);
+			}
+
+			/* A linear calibration is the scaled code plus the intercept */
+			double calibrated = ((double)code * scalar) / (1 << ADC_SCALAR_FRACTIONAL_BITS) + calibration.intercept;
+			TEST_CHECK_NEAR(ADC_Calibrated_Voltage(code, &calibration), (calibrated > 0.0) ? calibrated : 0.0, 1.0);
+		}
+	}
+
+	/* Truncating the fractional product loses under a microvolt */
+	TEST_CHECK(max_error_uv < 1.0);
+	printf("Q16 conversion: max error %.3f uV, %.0f uV with whole microvolt scalars\n", max_error_uv, max_whole_uv_error_uv);
+}
+
+static void Test_Max_Charge_Power(void) {
+	static const uint32_t supplies[][2] = {{5000, 3000}, {9000, 3000}, {15000, 3000}, {20000, 2250}, {20000, 3250}, {20000, 5000}};
+	uint32_t throttled = 0;
+	double max_error_mw = 0.0, max_whole_volt_error_mw = 0.0;
+
+	for (size_t supply = 0; supply < (sizeof(supplies) / sizeof(supplies[0])); supply++) {
+		Host_Set_USB_PD(READY, supplies[supply][0], supplies[supply][1]);
+		Test_Settle_Temperature(25.0);
+		Host_Sim_Run_Ms(600);
+
+		for (double temperature_c = 30.0; temperature_c <= 80.0; temperature_c += 1.0) {
+			Test_Settle_Temperature(temperature_c);
+
+			int32_t temperature = Get_MCU_Temperature();
+			uint32_t vbus = Get_VBUS_ADC_Reading();
+			float reference = Baseline_Max_Charge_Power((float)vbus / REG_ADC_MULTIPLIER, Get_Max_Input_Current(),
+					Get_Max_Input_Power(), temperature);
+			float whole_volts = Baseline_Max_Charge_Power((float)(vbus / REG_ADC_MULTIPLIER), Get_Max_Input_Current(),
+					Get_Max_Input_Power(), temperature);
+			uint32_t power_mw = Calculate_Max_Charge_Power();
+
+			/* Whole millivolts on VBUS and the truncating divides, a few mW of a 60 W budget */
+			TEST_CHECK_NEAR(power_mw, reference, 10.0);
+			TEST_CHECK(power_mw <= MAX_CHARGING_POWER);
+
+			if (fabs(power_mw - reference) > max_error_mw) {
+				max_error_mw = fabs(power_mw - reference);
+			}
+			if (fabs(whole_volts - reference) > max_whole_volt_error_mw) {
+				max_whole_volt_error_mw = fabs(whole_volts - reference);
+			}
+			if (temperature > TEMP_THROTTLE_THRESH_C) {
+				throttled++;
+			}
+		}
+	}
+
+	/* The sweep reached the throttled range, including full shut off at 70 C and above */
+	TEST_CHECK(throttled > 100);
+	Test_Settle_Temperature(75.0);
+	TEST_CHECK(Calculate_Max_Charge_Power() == 0);
+	Test_Settle_Temperature(25.0);
+
+	printf("Charge power: max error %.1f mW, %.1f mW for the baseline in whole volts\n", max_error_mw, max_whole_volt_error_mw);
+}
+
+static void Test_Charge_Current(void) {
+	double max_error_ma = 0.0, max_whole_volt_error_ma = 0.0;
+
+	for (uint8_t cells = 1; cells <= 4; cells++) {
+		for (double cell_v = 3.0; cell_v <= 4.2; cell_v += 0.1) {
+			Host_Sim_Set_Pack(cells, cell_v);
+			Host_Sim_Run_Windows(40);
+
+			/* Read under charge, the reference uses the same reading */
+			uint32_t battery = Get_Battery_Voltage();
+			TEST_CHECK(battery > (uint32_t)(cells * cell_v * BATTERY_ADC_MULTIPLIER * 0.95));
+
+			for (uint32_t power_mw = 0; power_mw <= MAX_CHARGING_POWER; power_mw += 1250) {
+				float reference = Baseline_Charge_Current(power_mw, (float)battery / BATTERY_ADC_MULTIPLIER);
+				float whole_volts = Baseline_Charge_Current(power_mw, (float)(battery / BATTERY_ADC_MULTIPLIER));
+				uint32_t current_ma = Calculate_Charge_Current(power_mw);
+
+				/* Whole millivolts on the battery voltage, under 0.1 % */
+				TEST_CHECK_NEAR(current_ma, reference, 1.0 + (reference * 0.001));
+
+				if (fabs(current_ma - reference) > max_error_ma) {
+					max_error_ma = fabs(current_ma - reference);
+				}
+				if (fabs(whole_volts - reference) > max_whole_volt_error_ma) {
+					max_whole_volt_error_ma = fabs(whole_volts - reference);
+				}
+			}
+		}
+	}
+
+	printf("Charge current: max error %.1f mA, %.1f mA for the baseline in whole volts\n", max_error_ma, max_whole_volt_error_ma);
+
+	/* No battery reading gives no current, the baseline divided by zero */
+	Host_Sim_Set_Pack(0, 0.0);
+	host_sim.pack.xt60_connected = 0;
+	Host_Sim_Run_Windows(40);
+	TEST_CHECK(Get_Battery_Voltage() == 0);
+	TEST_CHECK(Calculate_Charge_Current(MAX_CHARGING_POWER) == 0);
+}
+
+/**
+ * @brief  Host cycles per call of the integer paths and the float baselines. The host has a floating point unit, the
+ * Cortex-M0+ does not and calls the soft float library for every float operation, so on the target the gap is wider
+ */
+static void Test_Benchmark(void) {
+	Host_Set_USB_PD(READY, 20000, 3250);
+	Host_Sim_Set_Pack(4, 3.8);
+	host_sim.pack.xt60_connected = 1;
+	Test_Settle_Temperature(55.0);
+	Host_Sim_Run_Ms(600);
+
+	uint32_t vbus = Get_VBUS_ADC_Reading();
+	uint32_t battery = Get_Battery_Voltage();
+	volatile int32_t temperature = Get_MCU_Temperature();
+	volatile uint32_t scalar = HOST_SIM_XT60_SCALAR | 0x1234;
+
+	uint64_t start = Test_Cycles();
+	for (uint32_t i = 0; i < TEST_BENCHMARK_CALLS; i++) {
+		test_sink = Calculate_Charge_Current(Calculate_Max_Charge_Power());
+	}
+	uint64_t integer_cycles = Test_Cycles() - start;
+
+	start = Test_Cycles();
+	for (uint32_t i = 0; i < TEST_BENCHMARK_CALLS; i++) {
+		float power = Baseline_Max_Charge_Power((float)vbus / REG_ADC_MULTIPLIER, Get_Max_Input_Current(), Get_Max_Input_Power(),
+				temperature);
+		test_float_sink = Baseline_Charge_Current((uint32_t)power, (float)battery / BATTERY_ADC_MULTIPLIER);
+	}
+	uint64_t float_cycles = Test_Cycles() - start;
+
+	start = Test_Cycles();
+	for (uint32_t i = 0; i < TEST_BENCHMARK_CALLS; i++) {
+		test_sink = ADC_Scale_Code(i & 0xFFF, 3, scalar);
+	}
+	uint64_t q16_cycles = Test_Cycles() - start;
+
+	start = Test_Cycles();
+	for (uint32_t i = 0; i < TEST_BENCHMARK_CALLS; i++) {
+		test_float_sink = (float)((i & 0xFFF) - 3) * ((float)scalar / (1 << ADC_SCALAR_FRACTIONAL_BITS));
+	}
+	uint64_t float_code_cycles = Test_Cycles() - start;
+
+	printf("Host cycles per call: charge power and current %.1f integer, %.1f float; code conversion %.1f Q16, %.1f float\n",
+			(double)integer_cycles / TEST_BENCHMARK_CALLS, (double)float_cycles / TEST_BENCHMARK_CALLS,
+			(double)q16_cycles / TEST_BENCHMARK_CALLS, (double)float_code_cycles / TEST_BENCHMARK_CALLS);
+}
+
+int main(void) {
+	Host_Sim_Init();
+	Host_Sim_Set_Pack(4, 3.8);
+	Host_Sim_Run_Windows(40);
+
+	Test_Code_Conversion();
+	Test_Max_Charge_Power();
+	Test_Charge_Current();
+	Test_Benchmark();
+
+	return Test_Finish("test_fixed_point");
+}
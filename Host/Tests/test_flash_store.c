@@ -0,0 +1,133 @@
+/**
+ ******************************************************************************
+ * @file           : test_flash_store.c
+ * @brief          : Flash store records survive a reset at any point of a write,
+ *                   including every program step of a compaction.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "host_hal.h"
+#include "flash_store.h"
+
+#include <string.h>
+
+#define TEST_RECORD_BYTES		200
+#define TEST_KEYS				3
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t test_pages[FLASH_STORE_PAGES * FLASH_PAGE_SIZE];
+
+static void Test_Fill(uint8_t *record, uint8_t key, uint32_t value) {
+	for (uint32_t i = 0; i < TEST_RECORD_BYTES; i++) {
+		record[i] = (uint8_t)((key * 37) + value + i);
+	}
+}
+
+/**
+ * @brief  Reads a key back
+ * @retval The value it was written with, UINT32_MAX if missing or not a value that was written
+ */
+static uint32_t Test_Read_Value(uint8_t key, uint32_t max_value) {
+	uint8_t record[TEST_RECORD_BYTES], expected[TEST_RECORD_BYTES];
+
+	if (Flash_Store_Read(key, 1, record, sizeof(record)) == 0) {
+		return UINT32_MAX;
+	}
+	for (uint32_t value = 0; value <= max_value; value++) {
+		Test_Fill(expected, key, value);
+		if (memcmp(record, expected, sizeof(record)) == 0) {
+			return value;
+		}
+	}
+	return UINT32_MAX;
+}
+
+static uint8_t Test_Write(uint8_t key, uint32_t value) {
+	uint8_t record[TEST_RECORD_BYTES];
+	Test_Fill(record, key, value);
+	return Flash_Store_Write(key, 1, record, sizeof(record));
+}
+
+int main(void) {
+	Host_Hal_Reset();
+	Flash_Store_Init();
+
+	uint32_t values[TEST_KEYS] = {0};
+
+	/* The first write formats a page, then fill it round robin until the next write has to compact */
+	struct Flash_Store_Stats stats;
+	values[0]++;
+	TEST_CHECK(Test_Write(0, values[0]) == 1);
+	for (uint32_t i = 1;; i++) {
+		uint8_t key = i % TEST_KEYS;
+
+		Get_Flash_Store_Stats(&stats);
+		if ((stats.used_bytes + FLASH_STORE_HEADER_BYTES + TEST_RECORD_BYTES) > FLASH_PAGE_SIZE) {
+			break;
+		}
+
+		values[key]++;
+		TEST_CHECK(Test_Write(key, values[key]) == 1);
+	}
+	TEST_CHECK(stats.compactions == 1);
+	TEST_CHECK(stats.records == TEST_KEYS);
+
+	/* Cut the power after every number of programs and erases the compacting write makes */
+	memcpy(test_pages, (const void *)FLASH_STORE_PAGE_ADDR(0), sizeof(test_pages));
+
+	const uint8_t key = 0;
+	uint32_t steps = 0;
+	uint32_t new_seen = 0;
+
+	for (int32_t budget = 0;; budget++) {
+		memcpy((void *)FLASH_STORE_PAGE_ADDR(0), test_pages, sizeof(test_pages));
+		Flash_Store_Init();
+
+		host_hal.flash_program_budget = budget;
+		uint8_t written = Test_Write(key, values[key] + 1);
+		host_hal.flash_program_budget = -1;
+
+		/* Power back, the store is found again from flash */
+		Flash_Store_Init();
+
+		uint32_t read = Test_Read_Value(key, values[key] + 1);
+		TEST_CHECK((read == values[key]) || (read == (values[key] + 1)));
+		if (read == (values[key] + 1)) {
+			new_seen++;
+		}
+
+		for (uint8_t other = 1; other < TEST_KEYS; other++) {
+			TEST_CHECK(Test_Read_Value(other, values[other]) == values[other]);
+		}
+
+		/* A write that reported success is there after the reset */
+		if (written == 1) {
+			TEST_CHECK(read == (values[key] + 1));
+		}
+
+		steps++;
+		if (written == 1) {
+			break;
+		}
+	}
+
+	Get_Flash_Store_Stats(&stats);
+	TEST_CHECK(stats.compactions == 2);
+	TEST_CHECK(new_seen == 1);
+	printf("compaction cut at %u points\n", steps);
+
+	/* The store keeps working from the compacted page */
+	values[key]++;
+	for (uint32_t i = 0; i < 40; i++) {
+		uint8_t k = i % TEST_KEYS;
+		values[k]++;
+		TEST_CHECK(Test_Write(k, values[k]) == 1);
+	}
+	Flash_Store_Init();
+	for (uint8_t k = 0; k < TEST_KEYS; k++) {
+		TEST_CHECK(Test_Read_Value(k, values[k]) == values[k]);
+	}
+
+	return Test_Finish("test_flash_store");
+}
@@ -0,0 +1,117 @@
+#!/bin/sh
+# ------------------------------------------------
+# Replays the same raw recordings through the software accumulate and hardware
+# oversampling builds and compares the filtered code of every channel window by
+# window. Both builds must publish the same windows at the same times and detect
+# the same number of cells in each.
+#
+# The two paths round differently, so a window may differ by up to
+#   1 code                    each path rounds its mean to a whole code once,
+#                             the oversampler per sequence and the software
+#                             path at the filter output, half a code each
+#   + code / (2 * vrefint)    on the XT60 and taps only. The ratiometric
+#                             correction divides by VREFINT, a whole oversampled
+#                             code in the hardware build against a 16 sequence
+#                             block sum in the software one, so half a VREFINT
+#                             code carries through scaled by code / vrefint.
+#                             About 1.1 codes on a 4.2 V tap
+# Temperature and VREFINT are not corrected and get the 1 code alone.
+#
+#   Tests/test_oversampling.sh build_dir [recording ...]
+#
+# Recordings given on the command line, adc_capture output, raw or CSV as replay
+# reads them, are compared as well as the generated ones.
+# ------------------------------------------------
+
+set -e
+
+BUILD_DIR=${1:-build}
+[ $# -gt 0 ] && shift
+WORK=$(mktemp -d)
+trap 'rm -fR "$WORK"' EXIT
+
+FAILED=0
+CHECKS=0
+
+# Compares the two CSV outputs of one recording, prints the checks made and failed
+compare() {
+	awk -F, -v name="$1" '
+		FNR == 1 { file++; next }
+		# Skip the first 20 windows while the filters settle and the pack is detected
+		FNR <= 21 { next }
+		{
+			window = FNR - 21
+			time[file, window] = $1
+			cells[file, window] = $9
+			for (column = 13; column <= 19; column++) {
+				code[file, window, column] = $column
+			}
+			windows[file] = window
+		}
+		END {
+			checks = 1
+			failed = 0
+			if (windows[1] != windows[2] || windows[1] == 0) {
+				printf "%s: software %d windows, hardware %d windows\n", name, windows[1], windows[2] > "/dev/stderr"
+				printf "%d %d\n", checks, 1
+				exit
+			}
+			for (window = 1; window <= windows[1]; window++) {
+				checks += 2
+				if (time[1, window] != time[2, window]) {
+					printf "%s: window %d at %d ms software, %d ms hardware\n", name, window, time[1, window], time[2, window] > "/dev/stderr"
+					failed++
+				}
+				if (cells[1, window] != cells[2, window]) {
+					printf "%s: window %d software %d cells, hardware %d cells\n", name, window, cells[1, window], cells[2, window] > "/dev/stderr"
+					failed++
+				}
+				vrefint = code[2, window, 19]
+				for (column = 13; column <= 19; column++) {
+					checks++
+					sw = code[1, window, column]
+					hw = code[2, window, column]
+					bound = 1
+					if (column <= 17 && vrefint > 0) {
+						bound += hw / (2 * vrefint)
+					}
+					difference = sw - hw
+					if (difference < 0) difference = -difference
+					if (difference / bound > worst[column]) worst[column] = difference / bound
+					if (difference > bound) {
+						printf "%s: window %d channel %d software %d, hardware %d, bound %.2f codes\n", name, window, column - 13, sw, hw, bound > "/dev/stderr"
+						failed++
+					}
+				}
+			}
+			printf "%s: %d windows, worst difference as a fraction of its bound", name, windows[1] > "/dev/stderr"
+			for (column = 13; column <= 19; column++) {
+				printf " %.2f", worst[column] > "/dev/stderr"
+			}
+			printf "\n" > "/dev/stderr"
+			printf "%d %d\n", checks, failed
+		}' "$2" "$3"
+}
+
+run() {
+	"$BUILD_DIR/replay" -c "$2" > "$WORK/sw.csv"
+	"$BUILD_DIR/replay_hw" -c "$2" > "$WORK/hw.csv"
+
+	result=$(compare "$1" "$WORK/sw.csv" "$WORK/hw.csv")
+
+	CHECKS=$((CHECKS + ${result% *}))
+	FAILED=$((FAILED + ${result#* }))
+}
+
+# cells:volts:sequences, 256 sequences to a window
+for spec in 4:3.9:65536 3:4.15:65536 2:3.6:65536 1:3.3:65536; do
+	"$BUILD_DIR/replay" -g "$spec" > "$WORK/recording.raw"
+	run "$spec" "$WORK/recording.raw"
+done
+
+for recording in "$@"; do
+	run "$recording" "$recording"
+done
+
+echo "test_oversampling: $CHECKS checks, $FAILED failed"
+[ "$FAILED" -eq 0 ]
@@ -0,0 +1,116 @@
+/**
+ ******************************************************************************
+ * @file           : test_ratiometric.c
+ * @brief          : Cell voltage error with VDDA sag and ripple, with the
+ *                   VREFINT ratiometric correction and without it. The
+ *                   uncorrected reading is the corrected one scaled by the
+ *                   VDDA the firmware measured for the same window. VDDA is
+ *                   the simulated supply, the taps are fixed voltages.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "host_sim.h"
+#include "measurement.h"
+
+#include <math.h>
+
+#define TEST_CELL_V				3.9
+#define TEST_SETTLE_WINDOWS		20
+#define TEST_WINDOWS			60
+
+/* The corrected error stays within TEST_MAX_ERROR_V, 4 codes of the top tap */
+#define TEST_MAX_ERROR_V		0.0050
+
+/* How a supply is checked */
+#define TEST_CORRECTED			0
+/* VDDA sags or moves slower than a window, the correction takes out most of the uncorrected error */
+#define TEST_REDUCED			1
+/* Ripple faster than a sequence reaches every rank at a different VDDA and VREFINT cannot see it, it is only reported.
+ * In step with the sequence rate it aliases to a fixed error on every rank */
+#define TEST_REPORTED			2
+
+struct Test_Supply {
+	const char *name;
+	double vdda_v;
+	double ripple_v;
+	double ripple_hz;
+	uint8_t check;
+};
+
+static const struct Test_Supply test_supplies[] = {
+	{"3.30 V", 3.30, 0.0, 0.0, TEST_CORRECTED},
+	{"3.20 V", 3.20, 0.0, 0.0, TEST_REDUCED},
+	{"3.00 V", 3.00, 0.0, 0.0, TEST_REDUCED},
+	{"3.30 V, 150 mV at 0.5 Hz", 3.30, 0.15, 0.5, TEST_REDUCED},
+	{"3.20 V, 100 mV at 3 Hz", 3.20, 0.10, 3.0, TEST_REDUCED},
+	{"3.30 V, 100 mV at 100 Hz", 3.30, 0.10, 100.0, TEST_CORRECTED},
+	{"3.30 V, 100 mV at 12.3 kHz", 3.30, 0.10, 12345.0, TEST_REPORTED},
+	{"3.30 V, 100 mV at 20 kHz", 3.30, 0.10, 20000.0, TEST_REPORTED},
+};
+
+int main(void) {
+	Host_Sim_Init();
+	host_sim.regulator_enabled = 0;
+	host_sim.override = 1;
+	for (int i = 0; i < HOST_SIM_CELLS; i++) {
+		host_sim.tap_v[i] = TEST_CELL_V * (i + 1);
+	}
+	host_sim.xt60_v = TEST_CELL_V * HOST_SIM_CELLS;
+
+	printf("%-28s %10s %12s %12s %12s %12s\n", "VDDA", "VDDA p-p", "max error", "rms error", "uncorrected", "rms");
+
+	for (size_t s = 0; s < (sizeof(test_supplies) / sizeof(test_supplies[0])); s++) {
+		const struct Test_Supply *supply = &test_supplies[s];
+
+		host_sim.vdda_v = supply->vdda_v;
+		host_sim.vdda_ripple_v = supply->ripple_v;
+		host_sim.vdda_ripple_hz = supply->ripple_hz;
+		Host_Sim_Run_Windows(TEST_SETTLE_WINDOWS);
+
+		double max_error = 0.0, sum_squares = 0.0;
+		double max_uncorrected = 0.0, sum_squares_uncorrected = 0.0;
+		double vdda_min = 10.0, vdda_max = 0.0;
+		uint32_t readings = 0;
+
+		for (uint32_t window = 0; window < TEST_WINDOWS; window++) {
+			Host_Sim_Run_Windows(1);
+
+			struct Measurement_Snapshot snapshot;
+			Get_Measurement_Snapshot(&snapshot);
+
+			double vdda = (double)snapshot.vdda / BATTERY_ADC_MULTIPLIER;
+			vdda_min = fmin(vdda_min, vdda);
+			vdda_max = fmax(vdda_max, vdda);
+
+			for (int i = 0; i < HOST_SIM_CELLS; i++) {
+				double cell = (double)snapshot.cell_voltage[i] / BATTERY_ADC_MULTIPLIER;
+				double uncorrected = cell * vdda / (ADC_VDDA_NOMINAL_MV / 1000.0);
+
+				max_error = fmax(max_error, fabs(cell - TEST_CELL_V));
+				max_uncorrected = fmax(max_uncorrected, fabs(uncorrected - TEST_CELL_V));
+				sum_squares += (cell - TEST_CELL_V) * (cell - TEST_CELL_V);
+				sum_squares_uncorrected += (uncorrected - TEST_CELL_V) * (uncorrected - TEST_CELL_V);
+				readings++;
+			}
+		}
+
+		double rms_error = sqrt(sum_squares / readings);
+		double rms_uncorrected = sqrt(sum_squares_uncorrected / readings);
+
+		printf("%-28s %7.1f mV %9.2f mV %9.2f mV %9.2f mV %9.2f mV\n", supply->name, (vdda_max - vdda_min) * 1000.0,
+				max_error * 1000.0, rms_error * 1000.0, max_uncorrected * 1000.0, rms_uncorrected * 1000.0);
+
+		if (supply->check != TEST_REPORTED) {
+			TEST_CHECK(max_error < TEST_MAX_ERROR_V);
+		}
+
+		/* Uncorrected, the cell reads off by the VDDA error as a fraction of 3.3 V */
+		if (supply->check == TEST_REDUCED) {
+			TEST_CHECK(max_uncorrected > 0.050);
+			TEST_CHECK(rms_error < (rms_uncorrected / 20.0));
+		}
+	}
+
+	return Test_Finish("test_ratiometric");
+}
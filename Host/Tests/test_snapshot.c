@@ -0,0 +1,174 @@
+/**
+ ******************************************************************************
+ * @file           : test_snapshot.c
+ * @brief          : Stress test of the measurement snapshot. The ADC task and
+ *                   the regulator poll publish from their own threads while
+ *                   reader threads take snapshots and check that every field
+ *                   of a half came from the same publish.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "host_hal.h"
+#include "host_sim.h"
+#include "measurement.h"
+#include "bq25703a_regulator.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define TEST_WINDOWS			3000
+#define TEST_READERS			3
+
+struct Test_Reader {
+	pthread_t thread;
+	uint64_t snapshots;
+	uint64_t torn_battery;
+	uint64_t torn_regulator;
+	uint64_t sequence_errors;
+	/* Field by field reads through the getters, as the readers did before the snapshot */
+	uint64_t getter_reads;
+	uint64_t torn_getters;
+};
+
+static atomic_int test_running = 1;
+static struct Test_Reader test_readers[TEST_READERS];
+static uint32_t test_regulator_polls;
+
+/**
+ * @brief  Tap and pack voltages are derived from each other in one window, a snapshot mixing two windows breaks the sums
+ */
+static uint8_t Test_Battery_Consistent(uint32_t cell_0, uint32_t cell_1, uint32_t cell_2, uint32_t cell_3, uint32_t two_s,
+		uint32_t three_s, uint32_t four_s) {
+	if ((cell_0 == 0) || (cell_1 == 0) || (cell_2 == 0) || (cell_3 == 0)) {
+		return 1;
+	}
+	return ((two_s == (cell_0 + cell_1)) && (three_s == (two_s + cell_2)) && (four_s == (three_s + cell_3))) ? 1 : 0;
+}
+
+/**
+ * @brief  The regulator thread loads the same code into every BQ25703A ADC register, so the readings of one poll agree
+ */
+static uint8_t Test_Regulator_Consistent(const struct Measurement_Snapshot *snapshot) {
+	if (snapshot->regulator_sequence == 0) {
+		return 1;
+	}
+	uint32_t code = (snapshot->regulator_vbat_voltage - VBAT_ADC_OFFSET) / VBAT_ADC_SCALE;
+
+	return ((snapshot->regulator_vbus_voltage == ((code * VBUS_ADC_SCALE) + VBUS_ADC_OFFSET)) &&
+			(snapshot->regulator_charge_current == (code * ICHG_ADC_SCALE)) &&
+			(snapshot->regulator_input_current == (code * IIN_ADC_SCALE))) ? 1 : 0;
+}
+
+static void *Test_Reader_Thread(void *argument) {
+	struct Test_Reader *reader = argument;
+	uint32_t battery_sequence = 0, regulator_sequence = 0;
+
+	while (atomic_load(&test_running) == 1) {
+		struct Measurement_Snapshot snapshot;
+		Get_Measurement_Snapshot(&snapshot);
+		reader->snapshots++;
+
+		if (Test_Battery_Consistent(snapshot.cell_voltage[0], snapshot.cell_voltage[1], snapshot.cell_voltage[2],
+				snapshot.cell_voltage[3], snapshot.two_s_voltage, snapshot.three_s_voltage, snapshot.four_s_voltage) == 0) {
+			reader->torn_battery++;
+		}
+		if (Test_Regulator_Consistent(&snapshot) == 0) {
+			reader->torn_regulator++;
+		}
+		if ((snapshot.battery_sequence < battery_sequence) || (snapshot.regulator_sequence < regulator_sequence)) {
+			reader->sequence_errors++;
+		}
+		battery_sequence = snapshot.battery_sequence;
+		regulator_sequence = snapshot.regulator_sequence;
+
+		uint32_t cells[4];
+		for (int i = 0; i < 4; i++) {
+			cells[i] = Get_Cell_Voltage(i);
+		}
+		uint32_t two_s = Get_Two_S_Voltage(), three_s = Get_Three_S_Voltage(), four_s = Get_Four_S_Voltage();
+		reader->getter_reads++;
+		if (Test_Battery_Consistent(cells[0], cells[1], cells[2], cells[3], two_s, three_s, four_s) == 0) {
+			reader->torn_getters++;
+		}
+	}
+
+	return NULL;
+}
+
+static void *Test_Regulator_Thread(void *argument) {
+	(void)argument;
+	uint8_t code = 0;
+
+	while (atomic_load(&test_running) == 1) {
+		code = (code + 37) & 0x7F;
+		host_hal.bq25703a[HOST_BQ_VBAT_ADC_ADDR] = code;
+		host_hal.bq25703a[HOST_BQ_VSYS_ADC_ADDR] = code;
+		host_hal.bq25703a[HOST_BQ_VBUS_ADC_ADDR] = code;
+		host_hal.bq25703a[HOST_BQ_ICHG_ADC_ADDR] = code;
+		host_hal.bq25703a[HOST_BQ_IIN_ADC_ADDR] = code;
+
+		Regulator_Poll();
+		test_regulator_polls++;
+	}
+
+	return NULL;
+}
+
+int main(void) {
+	Host_Sim_Init();
+
+	/* The regulator runs in its own thread instead of from the simulation */
+	host_sim.regulator_enabled = 0;
+	host_sim.override = 1;
+
+	pthread_t regulator_thread;
+	TEST_CHECK(pthread_create(&regulator_thread, NULL, Test_Regulator_Thread, NULL) == 0);
+	for (int i = 0; i < TEST_READERS; i++) {
+		TEST_CHECK(pthread_create(&test_readers[i].thread, NULL, Test_Reader_Thread, &test_readers[i]) == 0);
+	}
+
+	/* This thread is the ADC task, every window publishes a different pack */
+	for (uint32_t window = 0; window < TEST_WINDOWS; window++) {
+		double tap_v = 0.0;
+		for (int i = 0; i < HOST_SIM_CELLS; i++) {
+			tap_v += 3.0 + (0.1 * ((window + (3 * i)) % 12));
+			host_sim.tap_v[i] = tap_v;
+		}
+		host_sim.xt60_v = tap_v;
+
+		Host_Sim_Run_Windows(1);
+	}
+
+	atomic_store(&test_running, 0);
+	pthread_join(regulator_thread, NULL);
+
+	struct Test_Reader total = {0};
+	for (int i = 0; i < TEST_READERS; i++) {
+		pthread_join(test_readers[i].thread, NULL);
+		total.snapshots += test_readers[i].snapshots;
+		total.torn_battery += test_readers[i].torn_battery;
+		total.torn_regulator += test_readers[i].torn_regulator;
+		total.sequence_errors += test_readers[i].sequence_errors;
+		total.getter_reads += test_readers[i].getter_reads;
+		total.torn_getters += test_readers[i].torn_getters;
+	}
+
+	struct Measurement_Snapshot snapshot;
+	Get_Measurement_Snapshot(&snapshot);
+
+	/* Both halves were published many times over while being read */
+	TEST_CHECK(snapshot.battery_sequence >= TEST_WINDOWS);
+	TEST_CHECK(test_regulator_polls > 100);
+	TEST_CHECK(total.snapshots > 10000);
+
+	TEST_CHECK(total.torn_battery == 0);
+	TEST_CHECK(total.torn_regulator == 0);
+	TEST_CHECK(total.sequence_errors == 0);
+
+	printf("%u battery and %u regulator publishes, %lu snapshots with none torn; %lu of %lu field by field reads torn\n",
+			snapshot.battery_sequence, test_regulator_polls, (unsigned long)total.snapshots, (unsigned long)total.torn_getters,
+			(unsigned long)total.getter_reads);
+
+	return Test_Finish("test_snapshot");
+}
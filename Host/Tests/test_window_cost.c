@@ -0,0 +1,201 @@
+/**
+ ******************************************************************************
+ * @file           : test_window_cost.c
+ * @brief          : Cost of the power of two boxcar against a boxcar that
+ *                   divides by its length, and the window length and update
+ *                   rate of every channel with the default filter settings.
+ ******************************************************************************
+ */
+
+#include "host_test.h"
+#include "host_sim.h"
+#include "adc_filter.h"
+#include "measurement.h"
+
+#include <math.h>
+
+#define TEST_BLOCKS				100000
+/* The window the boxcar replaced, 380 sequences is 24 blocks rounded up */
+#define TEST_DIVIDE_LENGTH		24
+
+/* Not in the header, the boxcar stage of ADC_Filter_Run */
+uint32_t ADC_Filter_Boxcar(struct Adc_Filter *filter, uint16_t input);
+
+/* Keeps the benchmarked results live */
+static volatile uint32_t test_sink;
+
+static const char *const test_channel_names[ADC_NUMBER_OF_CHANNELS] = {"XT60", "tap 1", "tap 2", "tap 3", "tap 4", "temperature", "VREFINT"};
+
+/**
+ * @brief  Unsigned divide a bit at a time, as the Cortex-M0+ run time library does it with no hardware divider
+ */
+static __attribute__((noinline)) uint32_t Test_Soft_Divide(uint32_t dividend, uint32_t divisor) {
+	uint32_t quotient = 0, remainder = 0;
+	for (int bit = 31; bit >= 0; bit--) {
+		remainder = (remainder << 1) | ((dividend >> bit) & 1);
+		if (remainder >= divisor) {
+			remainder -= divisor;
+			quotient |= 1UL << bit;
+		}
+	}
+	return quotient;
+}
+
+/**
+ * @brief  Running mean of the last length inputs by division, what the boxcar did before its lengths were powers of two
+ */
+struct Test_Divide_Boxcar {
+	uint16_t history[ADC_FILTER_BOXCAR_MAX];
+	uint32_t length;
+	uint32_t index;
+	uint32_t sum;
+};
+
+static __attribute__((noinline)) uint32_t Test_Divide_Boxcar_Run(struct Test_Divide_Boxcar *boxcar, uint16_t input, uint8_t soft) {
+	boxcar->sum -= boxcar->history[boxcar->index];
+	boxcar->history[boxcar->index] = input;
+	boxcar->sum += input;
+	boxcar->index++;
+	if (boxcar->index >= boxcar->length) {
+		boxcar->index = 0;
+	}
+
+	uint32_t rounded = boxcar->sum + (boxcar->length >> 1);
+	return (soft == 1) ? Test_Soft_Divide(rounded, boxcar->length) : (rounded / boxcar->length);
+}
+
+static void Test_Divide_Boxcar_Init(struct Test_Divide_Boxcar *boxcar, uint32_t length, uint16_t first) {
+	boxcar->length = length;
+	boxcar->index = 0;
+	boxcar->sum = first * length;
+	for (uint32_t i = 0; i < length; i++) {
+		boxcar->history[i] = first;
+	}
+}
+
+static void Test_Boxcar_Cost(void) {
+	static uint16_t inputs[TEST_BLOCKS];
+	srand48(12);
+	for (uint32_t i = 0; i < TEST_BLOCKS; i++) {
+		inputs[i] = (uint16_t)(32000 + (lrand48() % 64));
+	}
+
+	/* The shift gives the same means as dividing by the same power of two */
+	struct Adc_Filter filter;
+	struct Adc_Filter_Config config = {1, 4, 0};
+	struct Test_Divide_Boxcar divide;
+	ADC_Filter_Init(&filter, &config);
+	Test_Divide_Boxcar_Init(&divide, 16, inputs[0]);
+	uint32_t mismatches = 0;
+	for (uint32_t i = 0; i < TEST_BLOCKS; i++) {
+		uint32_t shifted = ADC_Filter_Run(&filter, inputs[i]);
+		if (shifted != Test_Divide_Boxcar_Run(&divide, inputs[i], 1)) {
+			mismatches++;
+		}
+	}
+	TEST_CHECK(mismatches == 0);
+
+	ADC_Filter_Init(&filter, &config);
+	uint64_t start = Test_Cycles();
+	for (uint32_t i = 0; i < TEST_BLOCKS; i++) {
+		test_sink = ADC_Filter_Boxcar(&filter, inputs[i]);
+	}
+	double shift_cycles = (double)(Test_Cycles() - start) / TEST_BLOCKS;
+
+	Test_Divide_Boxcar_Init(&divide, TEST_DIVIDE_LENGTH, inputs[0]);
+	start = Test_Cycles();
+	for (uint32_t i = 0; i < TEST_BLOCKS; i++) {
+		test_sink = Test_Divide_Boxcar_Run(&divide, inputs[i], 0);
+	}
+	double divide_cycles = (double)(Test_Cycles() - start) / TEST_BLOCKS;
+
+	Test_Divide_Boxcar_Init(&divide, TEST_DIVIDE_LENGTH, inputs[0]);
+	start = Test_Cycles();
+	for (uint32_t i = 0; i < TEST_BLOCKS; i++) {
+		test_sink = Test_Divide_Boxcar_Run(&divide, inputs[i], 1);
+	}
+	double soft_cycles = (double)(Test_Cycles() - start) / TEST_BLOCKS;
+
+	/* A shift beats a bit at a time divide on any core */
+	TEST_CHECK(shift_cycles < soft_cycles);
+
+	printf("Boxcar, host cycles per block and channel: %.1f shift, %.1f hardware divide, %.1f software divide\n", shift_cycles,
+			divide_cycles, soft_cycles);
+	printf("Per filter output, %u blocks of %u channels: %.0f shift, %.0f software divide\n", ADC_FILTER_OUTPUT_BLOCKS,
+			ADC_NUMBER_OF_CHANNELS, shift_cycles * ADC_FILTER_OUTPUT_BLOCKS * ADC_NUMBER_OF_CHANNELS,
+			soft_cycles * ADC_FILTER_OUTPUT_BLOCKS * ADC_NUMBER_OF_CHANNELS);
+}
+
+/**
+ * @brief  Windows until a step on the input is read within tolerance
+ */
+static uint32_t Test_Settle_Windows(uint8_t channel, double tolerance) {
+	for (uint32_t windows = 1; windows <= 20; windows++) {
+		Host_Sim_Run_Windows(1);
+
+		struct Measurement_Snapshot snapshot;
+		Get_Measurement_Snapshot(&snapshot);
+
+		double error = (channel == 5) ? fabs(snapshot.mcu_temperature - host_sim.temperature_c) :
+				fabs((snapshot.cell_voltage[0] / (double)BATTERY_ADC_MULTIPLIER) - host_sim.tap_v[0]);
+		if (error <= tolerance) {
+			return windows;
+		}
+	}
+	return UINT32_MAX;
+}
+
+static void Test_Channel_Rates(void) {
+	double block_ms = (ADC_DMA_BLOCK_SEQUENCES * 1000.0) / ADC_SAMPLE_RATE_DEFAULT_HZ;
+	double output_ms = ADC_FILTER_OUTPUT_BLOCKS * block_ms;
+
+	printf("%-12s %8s %8s %10s %10s %10s\n", "channel", "median", "boxcar", "window ms", "output ms", "update Hz");
+	for (uint8_t channel = 0; channel < ADC_NUMBER_OF_CHANNELS; channel++) {
+		struct Adc_Filter_Config config;
+		TEST_CHECK(Get_ADC_Filter(channel, &config) == 1);
+
+		uint32_t blocks = 1UL << config.boxcar_shift;
+		printf("%-12s %8u %8lu %10.1f %10.1f %10.2f\n", test_channel_names[channel], config.median_length, (unsigned long)blocks,
+				blocks * block_ms, output_ms, 1000.0 / output_ms);
+
+		/* Lengths are powers of two, voltages span one output and the slow internal channels two */
+		TEST_CHECK(blocks == ((channel < ADC_NUMBER_OF_VOLTAGE_CHANNELS) ? ADC_FILTER_OUTPUT_BLOCKS : (2 * ADC_FILTER_OUTPUT_BLOCKS)));
+	}
+
+	/* The simulation publishes at the computed rate */
+	uint32_t windows = host_sim.windows;
+	uint64_t start_ns = host_sim.time_ns;
+	Host_Sim_Run_Windows(50);
+	double measured_ms = ((host_sim.time_ns - start_ns) / 1e6) / (host_sim.windows - windows);
+	TEST_CHECK_NEAR(measured_ms, output_ms, 0.5);
+
+	/* A step settles within the boxcar plus the median delay and the output it lands in */
+	host_sim.tap_v[0] = 3.6;
+	for (int i = 1; i < HOST_SIM_CELLS; i++) {
+		host_sim.tap_v[i] = host_sim.tap_v[0] + (3.9 * i);
+	}
+	uint32_t voltage_windows = Test_Settle_Windows(1, 0.002);
+
+	host_sim.temperature_c = 45.0;
+	uint32_t temperature_windows = Test_Settle_Windows(5, 1.0);
+
+	TEST_CHECK(voltage_windows <= 2);
+	TEST_CHECK(temperature_windows <= 3);
+	printf("Step settles in %u outputs on a tap, %u on temperature\n", voltage_windows, temperature_windows);
+}
+
+int main(void) {
+	Host_Sim_Init();
+	host_sim.regulator_enabled = 0;
+	host_sim.override = 1;
+	for (int i = 0; i < HOST_SIM_CELLS; i++) {
+		host_sim.tap_v[i] = 3.9 * (i + 1);
+	}
+	host_sim.xt60_v = 3.9 * HOST_SIM_CELLS;
+	Host_Sim_Run_Windows(10);
+
+	Test_Boxcar_Cost();
+	Test_Channel_Rates();
+
+	return Test_Finish("test_window_cost");
+}
@@ -0,0 +1,333 @@
+/**
+ ******************************************************************************
+ * @file           : replay.c
+ * @brief          : Replays recorded ADC scan sequences through the firmware ADC,
+ *                   filter, battery and charger code on the host and prints what
+ *                   it made of them every filter window.
+ *
+ * Recordings are adc_capture output saved from the UART, the "ADC Capture Result"
+ * line followed by the binary samples, any number of them back to back. Plain
+ * little endian uint16 files and CSV with one sequence of ADC_NUMBER_OF_CHANNELS
+ * codes per line are read as well. Codes are in rank order: XT60, taps 1-4,
+ * temperature, VREFINT.
+ *
+ * Built for hardware oversampling (replay_hw) every ADC_SEQUENCE_OVERSAMPLING
+ * recorded sequences are averaged with rounding into one, as the oversampler would.
+ ******************************************************************************
+ */
+
+#define _GNU_SOURCE
+
+#include "host_sim.h"
+#include "host_hal.h"
+#include "battery.h"
+#include "charger.h"
+#include "measurement.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define REPLAY_HEADER				"ADC Capture Result:"
+#define REPLAY_DEFAULT_RATE_HZ		2500
+
+/* Private variables ---------------------------------------------------------*/
+static uint16_t *replay_samples;
+static size_t replay_sequences;
+static size_t replay_capacity;
+
+/* Private function prototypes -----------------------------------------------*/
+static void Replay_Usage(const char *name);
+static void Replay_Append(const uint16_t *codes, size_t sequences);
+static int Replay_Load(const char *path);
+static int Replay_Generate(const char *spec, uint32_t rate_hz);
+static void Replay_Print_Window(uint8_t csv, uint64_t process_ns, uint32_t sequences);
+
+static void Replay_Usage(const char *name) {
+	fprintf(stderr,
+			"usage: %s [-r rate_hz] [-n repeats] [-c] [-v] recording\n"
+			"       %s -g cells:cell_volts:sequences [-r rate_hz] > recording\n"
+			"  -r  rate the recording was taken at, default %u Hz\n"
+			"  -n  replay the recording this many times, default 1\n"
+			"  -c  print CSV, with the filtered code of every channel\n"
+			"  -v  show firmware printf output\n"
+			"  -g  write a raw recording of a resting pack from the pack model\n",
+			name, name, REPLAY_DEFAULT_RATE_HZ);
+}
+
+static void Replay_Append(const uint16_t *codes, size_t sequences) {
+	if ((replay_sequences + sequences) > replay_capacity) {
+		replay_capacity = (replay_capacity == 0) ? 4096 : replay_capacity * 2;
+		if (replay_capacity < (replay_sequences + sequences)) {
+			replay_capacity = replay_sequences + sequences;
+		}
+		replay_samples = realloc(replay_samples, replay_capacity * ADC_NUMBER_OF_CHANNELS * sizeof(uint16_t));
+		if (replay_samples == NULL) {
+			fprintf(stderr, "replay: out of memory\n");
+			exit(2);
+		}
+	}
+
+	memcpy(&replay_samples[replay_sequences * ADC_NUMBER_OF_CHANNELS], codes, sequences * ADC_NUMBER_OF_CHANNELS * sizeof(uint16_t));
+	replay_sequences += sequences;
+}
+
+/**
+ * @brief  Reads a recording in any of the three formats into replay_samples
+ * @param  path: File to read, - for stdin
+ * @retval 0 if successful, -1 if the file could not be read or holds no sequences
+ */
+static int Replay_Load(const char *path) {
+	FILE *file = (strcmp(path, "-") == 0) ? stdin : fopen(path, "rb");
+	if (file == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	size_t length = 0, size = 65536;
+	uint8_t *data = malloc(size);
+	size_t got;
+	while ((got = fread(&data[length], 1, size - length, file)) > 0) {
+		length += got;
+		if (length == size) {
+			size *= 2;
+			data = realloc(data, size);
+		}
+	}
+	if (file != stdin) {
+		fclose(file);
+	}
+
+	size_t header_length = strlen(REPLAY_HEADER);
+	uint8_t *header = memmem(data, length, REPLAY_HEADER, header_length);
+
+	if (header != NULL) {
+		/* adc_capture output, the samples follow the end of each result line */
+		while (header != NULL) {
+			unsigned result = 0, sequences = 0, channels = 0, bytes = 0;
+			char line[128] = {0};
+			size_t line_length = (size_t)((data + length) - header);
+			memcpy(line, header, (line_length < sizeof(line) - 1) ? line_length : sizeof(line) - 1);
+
+			uint8_t *end = memchr(header, '\n', line_length);
+			if ((end == NULL) || (sscanf(line, REPLAY_HEADER " %u Sequences: %u Channels: %u Bytes: %u", &result, &sequences, &channels, &bytes) != 4)) {
+				break;
+			}
+
+			uint8_t *samples = end + 1;
+			if ((result == 1) && (channels == ADC_NUMBER_OF_CHANNELS) && ((samples + bytes) <= (data + length))) {
+				uint16_t *codes = malloc(bytes);
+				memcpy(codes, samples, bytes);
+				Replay_Append(codes, bytes / (ADC_NUMBER_OF_CHANNELS * sizeof(uint16_t)));
+				free(codes);
+				samples += bytes;
+			}
+
+			header = memmem(samples, (size_t)((data + length) - samples), REPLAY_HEADER, header_length);
+		}
+	}
+	else {
+		/* Text if every byte is printable, CSV then, raw samples otherwise */
+		uint8_t text = 1;
+		for (size_t i = 0; i < length; i++) {
+			if ((data[i] != '\n') && (data[i] != '\r') && (data[i] != '\t') && ((data[i] < ' ') || (data[i] > '~'))) {
+				text = 0;
+				break;
+			}
+		}
+
+		if (text == 1) {
+			char *line = strtok((char *)data, "\n");
+			while (line != NULL) {
+				uint16_t codes[ADC_NUMBER_OF_CHANNELS];
+				char *cursor = line;
+				int channel;
+				for (channel = 0; channel < ADC_NUMBER_OF_CHANNELS; channel++) {
+					char *next;
+					unsigned long value = strtoul(cursor, &next, 10);
+					if (next == cursor) {
+						break;
+					}
+					codes[channel] = (uint16_t)((value > 4095) ? 4095 : value);
+					cursor = next + strspn(next, ", \t");
+				}
+				if (channel == ADC_NUMBER_OF_CHANNELS) {
+					Replay_Append(codes, 1);
+				}
+				line = strtok(NULL, "\n");
+			}
+		}
+		else {
+			Replay_Append((const uint16_t *)data, length / (ADC_NUMBER_OF_CHANNELS * sizeof(uint16_t)));
+		}
+	}
+
+	free(data);
+
+	if (replay_sequences == 0) {
+		fprintf(stderr, "%s: no scan sequences\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief  Writes raw scan sequences of a resting pack to stdout, one conversion per rank as the ADC delivers them in
+ * software accumulate mode
+ * @param  spec: cells:cell_volts:sequences
+ * @param  rate_hz: Sequence rate
+ * @retval 0 if successful, -1 if the spec is invalid
+ */
+static int Replay_Generate(const char *spec, uint32_t rate_hz) {
+	unsigned cells = 0, sequences = 0;
+	double cell_v = 0.0;
+
+	if ((sscanf(spec, "%u:%lf:%u", &cells, &cell_v, &sequences) != 3) || (cells > HOST_SIM_CELLS)) {
+		return -1;
+	}
+
+#if (ADC_ACQUISITION_MODE == ADC_ACQUISITION_HW_OVERSAMPLING)
+	fprintf(stderr, "replay: recordings are raw conversions, generate them with the software accumulate build\n");
+	return -1;
+#else
+	host_sim.regulator_enabled = 0;
+	host_sim.sequence_ns = 1000000000ULL / rate_hz;
+	Host_Sim_Set_Pack((uint8_t)cells, cell_v);
+
+	for (unsigned i = 0; i < sequences; i++) {
+		uint16_t codes[ADC_NUMBER_OF_CHANNELS];
+		Host_Sim_Model_Sequence(codes);
+		host_sim.time_ns += host_sim.sequence_ns;
+		fwrite(codes, sizeof(codes), 1, stdout);
+	}
+	return 0;
+#endif
+}
+
+/**
+ * @brief  Prints the measurements published for the latest filter window
+ * @param  csv: 1 for CSV
+ * @param  process_ns: Host time spent in the DMA callback and ADC task since the last window
+ * @param  sequences: Sequences fed since the last window
+ */
+static void Replay_Print_Window(uint8_t csv, uint64_t process_ns, uint32_t sequences) {
+	struct Measurement_Snapshot snapshot;
+	Get_Measurement_Snapshot(&snapshot);
+
+	double ns_per_sequence = (sequences != 0) ? ((double)process_ns / sequences) : 0.0;
+	const char *format = (csv == 1) ? "%u,%.4f,%.4f,%.4f,%.4f,%.4f,%u,%u,%u,0x%x,%s,%.1f" :
+			"%8u %8.4f %8.4f %8.4f %8.4f %8.4f %5u %5u %5u   0x%x  %-12s %8.1f\n";
+
+	printf(format, Host_Sim_Now_Ms(), snapshot.battery_voltage / (double)BATTERY_ADC_MULTIPLIER,
+			snapshot.cell_voltage[0] / (double)BATTERY_ADC_MULTIPLIER, snapshot.cell_voltage[1] / (double)BATTERY_ADC_MULTIPLIER,
+			snapshot.cell_voltage[2] / (double)BATTERY_ADC_MULTIPLIER, snapshot.cell_voltage[3] / (double)BATTERY_ADC_MULTIPLIER,
+			snapshot.xt60_connected, snapshot.balance_port_connected, snapshot.number_of_cells, snapshot.balancing_state,
+			Get_Charger_State_Name(Get_Charger_State()), ns_per_sequence);
+
+	if (csv == 1) {
+		for (uint8_t channel = 0; channel < ADC_NUMBER_OF_CHANNELS; channel++) {
+			printf(",%u", (unsigned)Get_ADC_Filtered_Code(channel));
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv) {
+	uint32_t rate_hz = REPLAY_DEFAULT_RATE_HZ;
+	uint32_t repeats = 1;
+	uint8_t csv = 0;
+	const char *generate = NULL;
+	int option;
+
+	while ((option = getopt(argc, argv, "r:n:cvg:")) != -1) {
+		switch (option) {
+			case 'r':
+				rate_hz = (uint32_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'n':
+				repeats = (uint32_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'c':
+				csv = 1;
+				break;
+			case 'v':
+				host_hal.verbose = 1;
+				break;
+			case 'g':
+				generate = optarg;
+				break;
+			default:
+				Replay_Usage(argv[0]);
+				return 2;
+		}
+	}
+
+	if ((rate_hz == 0) || ((generate == NULL) && (optind >= argc))) {
+		Replay_Usage(argv[0]);
+		return 2;
+	}
+
+	uint8_t verbose = host_hal.verbose;
+	Host_Sim_Init();
+	host_hal.verbose = verbose;
+
+	if (generate != NULL) {
+		if (Replay_Generate(generate, rate_hz) != 0) {
+			Replay_Usage(argv[0]);
+			return 2;
+		}
+		return 0;
+	}
+
+	if (Replay_Load(argv[optind]) != 0) {
+		return 1;
+	}
+
+	/* Time moves on by the recording's rate, ADC_SEQUENCE_OVERSAMPLING recorded sequences make one replayed one */
+	host_sim.sequence_ns = (1000000000ULL * ADC_SEQUENCE_OVERSAMPLING) / rate_hz;
+
+	if (csv == 1) {
+		printf("time_ms,xt60_v,cell1_v,cell2_v,cell3_v,cell4_v,xt60_connected,balance_connected,cells,balancing,charger,ns_per_sequence,"
+				"xt60_code,tap1_code,tap2_code,tap3_code,tap4_code,temperature_code,vrefint_code\n");
+	}
+	else {
+		printf("    time     xt60    cell1    cell2    cell3    cell4  xt60   bal cells  bleed  charger       ns/seq\n");
+	}
+
+	uint32_t windows = host_sim.windows;
+	uint64_t process_ns = host_sim.process_ns;
+	uint32_t sequences = host_sim.sequences;
+
+	for (uint32_t repeat = 0; repeat < repeats; repeat++) {
+		for (size_t i = 0; (i + ADC_SEQUENCE_OVERSAMPLING) <= replay_sequences; i += ADC_SEQUENCE_OVERSAMPLING) {
+			uint16_t codes[ADC_NUMBER_OF_CHANNELS];
+
+			for (int channel = 0; channel < ADC_NUMBER_OF_CHANNELS; channel++) {
+				uint32_t sum = 0;
+				for (int k = 0; k < ADC_SEQUENCE_OVERSAMPLING; k++) {
+					sum += replay_samples[((i + k) * ADC_NUMBER_OF_CHANNELS) + channel];
+				}
+				codes[channel] = (uint16_t)((sum + (ADC_SEQUENCE_OVERSAMPLING / 2)) / ADC_SEQUENCE_OVERSAMPLING);
+			}
+
+			Host_Sim_Sequence(codes);
+
+			if (host_sim.windows != windows) {
+				windows = host_sim.windows;
+				Replay_Print_Window(csv, host_sim.process_ns - process_ns, (host_sim.sequences - sequences) * ADC_SEQUENCE_OVERSAMPLING);
+				process_ns = host_sim.process_ns;
+				sequences = host_sim.sequences;
+			}
+		}
+	}
+
+	if (csv == 0) {
+		printf("%u sequences, %u blocks, %u windows, %.1f ns per sequence, %.1f us worst block\n",
+				(unsigned)(host_sim.sequences * ADC_SEQUENCE_OVERSAMPLING), host_sim.blocks, host_sim.windows,
+				(host_sim.sequences != 0) ? ((double)host_sim.process_ns / (host_sim.sequences * ADC_SEQUENCE_OVERSAMPLING)) : 0.0,
+				host_sim.block_process_ns_max / 1000.0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+/**
+ ******************************************************************************
+ * @file           : adc_filter.h
+ * @brief          : Header for adc_filter.c file.
+ ******************************************************************************
+ */
+
+#ifndef ADC_FILTER_H_
+#define ADC_FILTER_H_
+
+#include <stdint.h>
+
+/*
+ * Everything in adc_filter.c is plain C with no HAL or FreeRTOS dependencies so the
+ * processing between the DMA buffer and volts can be built and exercised off target.
+ * The per block path is integer only, the calibration fit runs once per calibration and uses doubles.
+ */
+
+/**
+ * @brief  ADC scalars are microvolts per ADC code in Q16.16 fixed point
+ */
+#define ADC_SCALAR_FRACTIONAL_BITS	16
+
+/**
+ * @brief  Filter chain limits. Median lengths are 1 (off), 3 or 5. Boxcar lengths are powers of two, 1 << boxcar_shift,
+ * so the mean is a shift on a core without a divider. A boxcar shift of 0 and an IIR shift of 0 turn those stages off
+ */
+#define ADC_FILTER_MEDIAN_MAX		5
+#define ADC_FILTER_BOXCAR_SHIFT_MAX	5
+#define ADC_FILTER_BOXCAR_MAX		(1 << ADC_FILTER_BOXCAR_SHIFT_MAX)
+#define ADC_FILTER_IIR_SHIFT_MAX	8
+
+/**
+ * @brief  Statistics of one channel over a run of raw sequences. The histogram splits the 12 bit range into equal bins
+ */
+#define ADC_STATISTICS_HISTOGRAM_BINS	16
+#define ADC_STATISTICS_HISTOGRAM_SHIFT	8
+#define ADC_STATISTICS_FRACTIONAL_BITS	8
+
+/**
+ * @brief  Points kept by the slope estimator, power of two. The slope spans the oldest to newest point
+ */
+#define ADC_SLOPE_HISTORY		8
+
+/**
+ * @brief  A fitted calibration is microvolts = scalar * code + intercept + curvature * code^2, with the scalar in Q16
+ * and the curvature in Q32 so a small second order term keeps its precision. Up to ADC_CALIBRATION_MAX_POINTS are fitted
+ */
+#define ADC_CURVATURE_FRACTIONAL_BITS	32
+#define ADC_CALIBRATION_MAX_POINTS		8
+
+/**
+ * @brief  Bound of a drift estimate in standard errors of the mean
+ */
+#define ADC_DRIFT_BOUND_SIGMA			2
+
+struct Adc_Filter_Config {
+	uint8_t median_length;
+	uint8_t boxcar_shift;
+	uint8_t iir_shift;
+};
+
+/**
+ * @brief  State of one channel's filter chain: median -> boxcar -> IIR. Inputs are 16 bit block sums
+ */
+struct Adc_Filter {
+	struct Adc_Filter_Config config;
+	uint16_t median_history[ADC_FILTER_MEDIAN_MAX];
+	uint8_t median_index;
+	uint8_t median_count;
+	uint16_t boxcar_history[ADC_FILTER_BOXCAR_MAX];
+	uint8_t boxcar_index;
+	uint8_t boxcar_primed;
+	uint32_t boxcar_sum;
+	uint32_t iir_accumulator;
+	uint8_t iir_primed;
+};
+
+struct Adc_Channel_Statistics {
+	uint16_t min;
+	uint16_t max;
+	uint32_t mean;
+	uint32_t variance;
+	uint16_t histogram[ADC_STATISTICS_HISTOGRAM_BINS];
+};
+
+struct Adc_Slope {
+	uint32_t value[ADC_SLOPE_HISTORY];
+	uint32_t timestamp[ADC_SLOPE_HISTORY];
+	uint8_t index;
+	uint8_t count;
+	int32_t rate;
+};
+
+/**
+ * @brief  Running mean and variance of the difference between two measurements of the same voltage
+ */
+struct Adc_Drift {
+	int32_t mean;
+	int64_t variance;
+	uint32_t samples;
+	uint32_t bound;
+};
+
+struct Adc_Calibration {
+	uint32_t scalar;
+	int32_t intercept;
+	int32_t curvature;
+};
+
+uint8_t ADC_Filter_Config_Valid(const struct Adc_Filter_Config *config);
+
+uint8_t ADC_Filter_Init(struct Adc_Filter *filter, const struct Adc_Filter_Config *config);
+
+uint32_t ADC_Filter_Run(struct Adc_Filter *filter, uint16_t input);
+
+void ADC_Sum_Sequences(const uint16_t *samples, uint32_t sequences, uint32_t channels, uint32_t *sums);
+
+uint32_t ADC_Scale_Code(uint32_t adc_reading, uint32_t offset, uint32_t scalar);
+
+uint32_t ADC_Calibrated_Voltage(uint32_t adc_reading, const struct Adc_Calibration *calibration);
+
+uint32_t ADC_Calibrated_Code(uint32_t voltage, const struct Adc_Calibration *calibration, uint32_t code_max);
+
+uint8_t ADC_Calibration_Fit(const uint32_t *codes, uint32_t code_scale, const uint32_t *voltages, uint32_t points, uint8_t order,
+		struct Adc_Calibration *calibration, uint32_t *max_residual, uint32_t *rms_residual);
+
+uint32_t ADC_Ratiometric_Correct(uint32_t adc_reading, uint32_t vrefint_reading, uint32_t vrefint_reference);
+
+void ADC_Channel_Statistics(const uint16_t *samples, uint32_t sequences, uint32_t channels, uint32_t channel, struct Adc_Channel_Statistics *stats);
+
+uint32_t ADC_Select_Sampling(const uint8_t *required, uint32_t channels, const uint16_t *cycles, uint8_t *common_1, uint8_t *common_2);
+
+void ADC_Slope_Init(struct Adc_Slope *slope);
+
+int32_t ADC_Slope_Update(struct Adc_Slope *slope, uint32_t value, uint32_t timestamp_ms, uint32_t interval_ms);
+
+void ADC_Drift_Init(struct Adc_Drift *drift);
+
+void ADC_Drift_Update(struct Adc_Drift *drift, int32_t difference, uint8_t shift);
+
+#endif /* ADC_FILTER_H_ */
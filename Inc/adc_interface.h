@@ -15,8 +15,182 @@ extern "C" {
 #include "stm32g0xx_hal.h"
 #include "FreeRTOS.h"
 #include "cmsis_os.h"
+#include "adc_filter.h"
 
-#define ADC_FILTER_SUM_COUNT		380
+/**
+ * @brief  ADC acquisition modes
+ * ADC_ACQUISITION_SW_ACCUMULATE: every scan sequence is summed in the DMA interrupt and divided by ADC_FILTER_SUM_COUNT
+ * ADC_ACQUISITION_HW_OVERSAMPLING: the ADC oversampler averages each channel, one scan sequence is one filtered block
+ */
+#define ADC_ACQUISITION_SW_ACCUMULATE	0
+#define ADC_ACQUISITION_HW_OVERSAMPLING	1
+
+#ifndef ADC_ACQUISITION_MODE
+#define ADC_ACQUISITION_MODE		ADC_ACQUISITION_SW_ACCUMULATE
+#endif
+
+/* Hardware oversampler settings. Shift must equal log2(ratio) so filtered codes stay 12 bit */
+#define ADC_HW_OVERSAMPLING_RATIO	ADC_OVERSAMPLING_RATIO_256
+#define ADC_HW_OVERSAMPLING_SHIFT	ADC_RIGHTBITSHIFT_8
+#define ADC_HW_OVERSAMPLING_FACTOR	256
+
+#define ADC_NUMBER_OF_CHANNELS		7
+/* XT60 and balance taps are the first ranks, MCU temperature and VREFINT follow */
+#define ADC_NUMBER_OF_VOLTAGE_CHANNELS	5
+
+/**
+ * @brief  Each channel uses SamplingTimeCommon1 or SamplingTimeCommon2. Sampling codes 0-7 are the SMPR values,
+ * 1.5 to 160.5 ADC clock cycles, and every conversion adds 12.5 cycles.
+ * By default the XT60 and taps sit behind high impedance dividers and use Common1 at 160.5 cycles. TEMPSENSOR and
+ * VREFINT only need the datasheet minimum of 5us and use Common2 at 39.5 cycles. adc_tune replaces both from measurements
+ * tCONV = (160.5 + 12.5) x 1/(16MHz/4) = 43.25us
+ * tCONV = (39.5 + 12.5) x 1/(16MHz/4) = 13us
+ */
+#define ADC_CLOCK_HZ						4000000
+#define ADC_CONVERSION_HALF_CYCLES			25
+#define ADC_SAMPLING_CODES					8
+#define ADC_SAMPLING_DEFAULT_COMMON_1		ADC_SAMPLETIME_160CYCLES_5
+#define ADC_SAMPLING_DEFAULT_COMMON_2		ADC_SAMPLETIME_39CYCLES_5
+/* Channels on SamplingTimeCommon2, bit 0 XT60 to bit 6 VREFINT */
+#define ADC_SAMPLING_DEFAULT_COMMON_2_MASK	(((1 << ADC_NUMBER_OF_CHANNELS) - 1) & ~((1 << ADC_NUMBER_OF_VOLTAGE_CHANNELS) - 1))
+
+/**
+ * @brief  Number of scan sequences summed per DMA half/full transfer interrupt. The circular DMA buffer holds two blocks.
+ * vRead_ADC runs each block sum through the channel's filter chain and converts the output to volts every
+ * ADC_FILTER_SUM_COUNT sequences (102.4ms at 2.5kHz, ~62ms hardware). Sample age is reported by Get_ADC_Max_Latency()
+ *
+ * Every block also produces a fast average of its last ADC_FAST_WINDOW_SEQUENCES sequences (1.6ms at 2.5kHz) used for
+ * over/under voltage and disconnect checks, so faults are seen within one block (6.4ms at 2.5kHz)
+ */
+#if (ADC_ACQUISITION_MODE == ADC_ACQUISITION_HW_OVERSAMPLING)
+#define ADC_DMA_BLOCK_SEQUENCES		1
+#define ADC_FILTER_SUM_COUNT		1
+#define ADC_SEQUENCE_OVERSAMPLING	ADC_HW_OVERSAMPLING_FACTOR
+#define ADC_SAMPLE_RATE_MIN_HZ		1
+#define ADC_SAMPLE_RATE_DEFAULT_HZ	0
+#else
+#define ADC_DMA_BLOCK_SEQUENCES		16
+/* Power of two, no larger than ADC_DMA_BLOCK_SEQUENCES */
+#define ADC_FAST_WINDOW_SEQUENCES	4
+/* Power of two multiple of ADC_DMA_BLOCK_SEQUENCES. Block sums must fit 16 bits, 16 x 4095 */
+#define ADC_FILTER_SUM_COUNT		256
+#define ADC_SEQUENCE_OVERSAMPLING	1
+#define ADC_SAMPLE_RATE_MIN_HZ		500
+/* Keeps the ADC converting ~60% of the time with the default sampling times, 242.25us of every 400us */
+#define ADC_SAMPLE_RATE_DEFAULT_HZ	2500
+#endif
+
+/**
+ * @brief  Scan sequences are started by TIM6 TRGO at the sample rate, 0 Hz runs the ADC continuously.
+ * The fastest rate is limited by the time it takes to convert one sequence, see Get_ADC_Sequence_Time()
+ */
+#define ADC_TRIGGER_TIMER_CLOCK_HZ	1000000
+
+#define ADC_DMA_BUFFER_SEQUENCES	(2 * ADC_DMA_BLOCK_SEQUENCES)
+
+/* vRead_ADC task notification bits */
+#define ADC_NOTIFY_BLOCK			(1UL << 0)
+#define ADC_NOTIFY_ALL				(ADC_NOTIFY_BLOCK)
+
+/**
+ * @brief  Blocks between filtered outputs and the default filter chains. The voltage boxcar default spans one
+ * output so the filtered readings match a plain average over ADC_FILTER_SUM_COUNT sequences, with a median of
+ * 3 blocks to reject switching spikes. Temperature and VREFINT move slowly and average over two outputs
+ */
+#define ADC_FILTER_OUTPUT_BLOCKS					(ADC_FILTER_SUM_COUNT / ADC_DMA_BLOCK_SEQUENCES)
+#define ADC_FILTER_DEFAULT_VOLTAGE_MEDIAN			3
+#define ADC_FILTER_DEFAULT_INTERNAL_MEDIAN			1
+#if (ADC_ACQUISITION_MODE == ADC_ACQUISITION_HW_OVERSAMPLING)
+#define ADC_FILTER_DEFAULT_VOLTAGE_BOXCAR_SHIFT		0
+#define ADC_FILTER_DEFAULT_INTERNAL_BOXCAR_SHIFT	0
+#else
+/* 1 << 4 = ADC_FILTER_OUTPUT_BLOCKS */
+#define ADC_FILTER_DEFAULT_VOLTAGE_BOXCAR_SHIFT		4
+#define ADC_FILTER_DEFAULT_INTERNAL_BOXCAR_SHIFT	5
+#endif
+#define ADC_FILTER_DEFAULT_IIR_SHIFT				0
+
+/**
+ * @brief  Raw capture copies whole DMA blocks into a RAM buffer from the DMA interrupt while filtering continues.
+ * Requested lengths are rounded up to whole blocks, so the maximum must be a multiple of ADC_DMA_BLOCK_SEQUENCES
+ */
+#define ADC_CAPTURE_MAX_SEQUENCES	256
+#define ADC_CAPTURE_IDLE			0
+#define ADC_CAPTURE_RUNNING			1
+#define ADC_CAPTURE_DONE			2
+
+/**
+ * @brief  adc_tune captures ADC_TUNE_SEQUENCES at each sampling code with every channel on that code and compares each
+ * channel against the capture at the longest code. A code is acceptable for a channel when its mean is within
+ * ADC_TUNE_MAX_ERROR and its variance is no more than ADC_TUNE_NOISE_RATIO times the reference plus ADC_TUNE_NOISE_FLOOR.
+ * Errors and variances are in codes with ADC_STATISTICS_FRACTIONAL_BITS fractional bits
+ */
+#define ADC_TUNE_SEQUENCES			(ADC_DMA_BLOCK_SEQUENCES * 16)
+#define ADC_TUNE_SETTLE_MS			20
+#define ADC_TUNE_MAX_ERROR			(1 << (ADC_STATISTICS_FRACTIONAL_BITS - 1))
+#define ADC_TUNE_NOISE_RATIO		2
+#define ADC_TUNE_NOISE_FLOOR		(1 << ADC_STATISTICS_FRACTIONAL_BITS)
+
+/**
+ * @brief  Tuned sampling times and the fitted calibration are records in the flash store. The versions change with the layout
+ * of struct Adc_Sampling and struct Adc_Calibration_Record, a record of another version is ignored
+ */
+#define ADC_SAMPLING_RECORD_VERSION		1
+#define ADC_CALIBRATION_RECORD_VERSION	1
+
+/**
+ * @brief  Analog watchdogs trip the regulator into HI-Z straight from the ADC interrupt.
+ * AWD1 watches the XT60 for pack over voltage and AWD3 watches it for a disconnect, so each trip has its own cause.
+ * AWD2 watches the first balance tap for cell over voltage. Thresholds sit a margin above the software limits so
+ * single conversion noise does not trip them. XT60_VOLTAGE_ERROR from an AWD1 trip and the cell over voltage latched by an
+ * AWD2 trip are released by the filtered checks in battery.c, not by re-arming
+ */
+#define ADC_AWD_XT60_CHANNEL			ADC_CHANNEL_4
+#define ADC_AWD_CELL_ONE_CHANNEL		ADC_CHANNEL_3
+#define ADC_AWD_OVER_VOLTAGE_MARGIN		(uint32_t)( 0.02 * BATTERY_ADC_MULTIPLIER )
+#define ADC_AWD_CODE_MAX				0xFFF
+
+/**
+ * @brief  XT60 and balance tap readings are rescaled every block to what they would read at the nominal VDDA,
+ * using the VREFINT reading of the same block, so supply drift does not show up as cell voltage error
+ */
+#define ADC_VDDA_NOMINAL_MV			3300
+
+/**
+ * @brief  Integrity checks run on every block. A fault sets its own error bit and puts the regulator in HI-Z at once,
+ * the bits clear after ADC_FILTER_OUTPUT_BLOCKS blocks in a row without a fault.
+ * Saturation: a channel reads full scale for a whole block.
+ * Stuck: a channel above ADC_DIAG_STUCK_MIN_CODE returns the same block sum ADC_DIAG_STUCK_BLOCKS times in a row,
+ * real inputs always carry some noise. Hardware oversampled blocks are too quiet to check, so it is off there.
+ * Tap order: a tap that is present reads more than a margin below the tap beneath it.
+ * VREFINT: VDDA worked out from VREFINT is outside the supply tolerance, so ratiometric correction cannot be trusted
+ */
+#define ADC_DIAG_SATURATION_CODE		4095
+#define ADC_DIAG_STUCK_MIN_CODE			16
+#if (ADC_ACQUISITION_MODE == ADC_ACQUISITION_HW_OVERSAMPLING)
+#define ADC_DIAG_STUCK_BLOCKS			0
+#else
+#define ADC_DIAG_STUCK_BLOCKS			ADC_FILTER_OUTPUT_BLOCKS
+#endif
+#define ADC_DIAG_TAP_PRESENT_VOLTAGE	(uint32_t)( 1.0 * BATTERY_ADC_MULTIPLIER )
+#define ADC_DIAG_TAP_ORDER_MARGIN		(uint32_t)( 0.2 * BATTERY_ADC_MULTIPLIER )
+#define ADC_DIAG_VDDA_MIN_MV			3000
+#define ADC_DIAG_VDDA_MAX_MV			3600
+
+/**
+ * @brief  Cross-calibration compares the XT60 reading with the regulator VBAT ADC and with the sum of the cells whenever
+ * the pack is quiet: not charging or balancing and pack dV/dt within ADC_XCAL_QUIET_DVDT. Each difference is tracked by
+ * an Adc_Drift spanning 1 << ADC_XCAL_SHIFT filtered windows. Once that many have been seen ADC_DRIFT_ERROR is set when
+ * a mean is past its limit by more than its bound, and cleared when every mean is inside its limit by more than its bound.
+ * The VBAT ADC has 64 mV steps so its limit is the wider one
+ */
+#define ADC_XCAL_SHIFT					8
+#define ADC_XCAL_QUIET_DVDT				(int32_t)( 0.001 * BATTERY_ADC_MULTIPLIER )
+#define ADC_XCAL_REGULATOR_LIMIT		(uint32_t)( 0.2 * BATTERY_ADC_MULTIPLIER )
+#define ADC_XCAL_CELL_SUM_LIMIT			(uint32_t)( 0.05 * BATTERY_ADC_MULTIPLIER )
+#define ADC_XCAL_REGULATOR				0
+#define ADC_XCAL_CELL_SUM				1
+#define ADC_XCAL_REFERENCES				2
 
 #define BATTERY_ADC_MULTIPLIER 		1000000
 
@@ -37,6 +211,24 @@ extern "C" {
 
 #define SCALAR_ARRAY_SIZE			5
 
+/**
+ * @brief  Pack and cell dV/dt store one filtered point per interval, the slope spans ADC_SLOPE_HISTORY - 1 intervals
+ */
+#define ADC_DVDT_INTERVAL_MS		1000
+
+/**
+ * @brief  ADC scalars are stored as microvolts per ADC code in Q16.16 fixed point, see ADC_SCALAR_FRACTIONAL_BITS
+ */
+#define ADC_SCALAR_MIN				750
+#define ADC_SCALAR_MAX				5000
+#define ADC_SCALAR_Q16_MIN			((uint32_t)ADC_SCALAR_MIN << ADC_SCALAR_FRACTIONAL_BITS)
+#define ADC_SCALAR_Q16_MAX			((uint32_t)ADC_SCALAR_MAX << ADC_SCALAR_FRACTIONAL_BITS)
+
+/**
+ * @brief  Highest reference voltage accepted by cal and cal_point
+ */
+#define ADC_CALIBRATION_MAX_MV		4200.0f
+
 /**
  * @brief  OTP memory start address
  */
@@ -59,12 +251,31 @@ extern "C" {
 
 void vRead_ADC(void const *pvParameters);
 
+/* vRead_ADC is split so the host build can drive the ADC path one notification at a time */
+void ADC_Task_Init(void);
+
+void ADC_Task_Process(uint32_t notification);
+
 uint8_t Calibrate_ADC(float reference_voltage_mv);
 
+uint8_t Add_ADC_Calibration_Point(float reference_voltage_mv);
+
+void Clear_ADC_Calibration_Points(void);
+
+uint8_t Get_ADC_Calibration_Points(void);
+
+uint8_t Fit_ADC_Calibration(uint8_t order);
+
+uint8_t Write_Calibration_To_Flash(void);
+
 uint32_t Get_Battery_Voltage(void);
 
 uint32_t Get_Cell_Voltage(uint8_t cell_number);
 
+uint32_t Get_Fast_Battery_Voltage(void);
+
+uint32_t Get_Fast_Cell_Voltage(uint8_t cell_number);
+
 uint32_t Get_Two_S_Voltage(void);
 
 uint32_t Get_Three_S_Voltage(void);
@@ -75,8 +286,52 @@ int32_t Get_MCU_Temperature(void);
 
 uint32_t Get_VDDa(void);
 
+uint32_t Get_ADC_Filtered_Code(uint8_t channel);
+
+uint32_t Get_ADC_Timestamp(void);
+
+int32_t Get_Battery_dVdt(void);
+
+int32_t Get_Cell_dVdt(uint8_t cell_number);
+
+uint32_t Get_ADC_Max_Latency(void);
+
+uint32_t Get_ADC_Block_Overruns(void);
+
+uint32_t Get_ADC_Watchdog_Trip_Count(void);
+
+uint8_t Set_ADC_Sample_Rate(uint32_t sample_rate_hz);
+
+uint32_t Get_ADC_Sample_Rate(void);
+
+uint32_t Get_ADC_Conversion_Time(uint8_t channel);
+
+uint32_t Get_ADC_Sequence_Time(void);
+
+uint8_t Tune_ADC_Sampling(void);
+
+uint8_t Get_ADC_Tuning_State(void);
+
+uint8_t Start_ADC_Capture(uint32_t sequences);
+
+uint8_t Get_ADC_Capture_State(void);
+
+const uint16_t *Get_ADC_Capture(uint32_t *sequences);
+
+void Release_ADC_Capture(void);
+
+uint8_t Set_ADC_Filter(uint8_t channel, const struct Adc_Filter_Config *config);
+
+uint8_t Get_ADC_Filter(uint8_t channel, struct Adc_Filter_Config *config);
+
+void Reset_ADC_Filters(uint8_t channel_mask);
+
 uint8_t Write_Cal_To_OTP_Flash(void);
 
+void ADC_Cross_Calibrate(void);
+
+uint8_t Get_ADC_Cross_Calibration(uint8_t reference, int32_t *difference, uint32_t *bound, uint32_t *samples);
+
 osThreadId adcTaskHandle;
 
 #ifdef __cplusplus
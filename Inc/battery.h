@@ -20,13 +20,40 @@ extern "C" {
 #define VOLTAGE_CONNECTED_THRESHOLD			(uint32_t)( 0.1 * BATTERY_ADC_MULTIPLIER )
 #define CELL_DELTA_V_ENABLE_BALANCING		(uint32_t)( 0.015 * BATTERY_ADC_MULTIPLIER )
 #define CELL_BALANCING_HYSTERESIS_V			(uint32_t)( 0.010 * BATTERY_ADC_MULTIPLIER )
+#define CELL_BALANCING_FULL_DUTY_V			(uint32_t)( 0.030 * BATTERY_ADC_MULTIPLIER )
 #define CELL_BALANCING_SCALAR_MAX			(uint8_t)25
+#define BALANCING_SCALAR_BITS				8
+#define BALANCING_SCALAR_ONE				(1UL << BALANCING_SCALAR_BITS)
 #define MIN_CELL_V_FOR_BALANCING			(uint32_t)( 3.0 * BATTERY_ADC_MULTIPLIER )
 #define CELL_VOLTAGE_TO_ENABLE_CHARGING		(uint32_t)( 4.18 * BATTERY_ADC_MULTIPLIER )
 #define CELL_OVER_VOLTAGE_ENABLE_DISCHARGE	(uint32_t)( 4.205 * BATTERY_ADC_MULTIPLIER )
 #define CELL_OVER_VOLTAGE_DISABLE_CHARGING	(uint32_t)( 4.22 * BATTERY_ADC_MULTIPLIER )
 #define MIN_CELL_VOLTAGE_SAFE_LIMIT			(uint32_t)( 2.0 * BATTERY_ADC_MULTIPLIER )
 
+/*
+ * A cell over voltage trip from the fast window or AWD2 is held for CELL_OVER_VOLTAGE_HOLD_MS after the last block over the limit,
+ * longer than a regulator poll, so the charger faults on a trip the filtered mean does not confirm
+ */
+#define CELL_OVER_VOLTAGE_HOLD_MS			1000
+
+/*
+ * Bleed resistors are PWMed over a period of BALANCE_PERIOD_WINDOWS filtered ADC windows. Every bleed is off for the last
+ * BALANCE_OFF_WINDOWS, the first lets the taps settle and the second is the unloaded reading the next duties come from.
+ * In the other windows a cell's bleed is on for the first duty blocks of the window. The duty rises from the hysteresis
+ * threshold to full at CELL_BALANCING_FULL_DUTY_V over the lowest cell, scaled like the other thresholds
+ */
+#define BALANCE_PERIOD_WINDOWS				10
+#define BALANCE_OFF_WINDOWS					2
+#define BALANCE_PWM_BLOCKS					ADC_FILTER_OUTPUT_BLOCKS
+/* ADC channels 1-4, the balance taps */
+#define BALANCE_TAP_CHANNELS				0b11110
+
+/*
+ * Balancing carries on while charging. Until the pack is balanced the charge current falls linearly to zero over the last
+ * CHARGE_TAPER_WINDOW_V below CELL_VOLTAGE_TO_ENABLE_CHARGING on the highest cell, so the low cells keep charging while the bleeds catch up
+ */
+#define CHARGE_TAPER_WINDOW_V				(uint32_t)( 0.100 * BATTERY_ADC_MULTIPLIER )
+
 #define MAX_MCU_TEMP_C_FOR_OPERATION	75
 #define MCU_TEMP_C_RECOVERY				65
 
@@ -34,16 +61,42 @@ extern "C" {
 #define TWO_S_BITMASK			0b0011
 #define ONE_S_BITMASK			0b0001
 
+/*
+ * A lower cell count or a disconnect is taken from a single reading. A higher count, or a tap pattern that is not a pack,
+ * is only accepted once the fast readings have agreed on it for BALANCE_CONNECT_BLOCKS blocks, so a lead being plugged in
+ * can not briefly report fewer cells than the pack has
+ */
+#define BALANCE_CONNECT_BLOCKS		(2 * ADC_FILTER_OUTPUT_BLOCKS)
+#define BALANCE_CELLS_INVALID		0xFF
+
+struct Balance_Connection_Stats {
+	uint32_t connects;
+	uint32_t disconnects;
+	uint32_t bounces;
+};
+
 void Battery_Connection_State();
 
+void Battery_Fast_Safety_Check();
+
+void Cell_Over_Voltage_Trip_From_ISR();
+
+void Balance_PWM_Update();
+
 uint8_t Get_XT60_Connection_State(void);
 
 uint8_t Get_Balance_Connection_State(void);
 
+void Get_Balance_Connection_Stats(struct Balance_Connection_Stats *stats);
+
 uint8_t Get_Number_Of_Cells(void);
 
 uint8_t Get_Balancing_State(void);
 
+uint8_t Get_Balancing_Duty(uint8_t cell_number);
+
+uint32_t Taper_Charge_Current(uint32_t charge_current_ma, uint32_t max_cell_voltage, uint8_t balancing);
+
 uint8_t Get_Requires_Charging_State(void);
 
 uint8_t Get_Cell_Over_Voltage_State(void);
@@ -90,12 +90,16 @@ extern "C" {
 #define IIN_ADC_SCALE				(uint32_t)(0.050 * REG_ADC_MULTIPLIER)
 
 #define MAX_CHARGE_CURRENT_MA		6000
-#define ASSUME_EFFICIENCY			0.85f
+#define ASSUME_EFFICIENCY_PERCENT	85
 #define BATTERY_DISCONNECT_THRESH	(uint32_t)(4.215 * REG_ADC_MULTIPLIER)
 #define MAX_CHARGING_POWER			60000
 #define NON_USB_PD_CHARGE_POWER		2500
 
 #define TEMP_THROTTLE_THRESH_C		40
+/* Power scalar = 2.33 - 0.0333 * temperature, scaled by TEMP_THROTTLE_SCALE */
+#define TEMP_THROTTLE_SCALE			10000
+#define TEMP_THROTTLE_INTERCEPT		23300
+#define TEMP_THROTTLE_SLOPE			333
 
 uint8_t Get_Regulator_Connection_State(void);
 uint8_t Get_Regulator_Charging_State(void);
@@ -105,7 +109,10 @@ uint32_t Get_PSYS_ADC_Reading(void);
 uint32_t Get_Input_Current_ADC_Reading(void);
 uint32_t Get_Charge_Current_ADC_Reading(void);
 uint32_t Get_Max_Charge_Current(void);
+void Regulator_HI_Z(uint8_t hi_z_en);
 void vRegulator(void const *pvParameters);
+void Regulator_Init(void);
+void Regulator_Poll(void);
 
 /* Used to guard access to the I2C in case messages are sent to the UART from
  more than one task. */
@@ -0,0 +1,102 @@
+/**
+ ******************************************************************************
+ * @file           : charger.h
+ * @brief          : Header for charger.c file.
+ ******************************************************************************
+ */
+
+#ifndef CHARGER_H_
+#define CHARGER_H_
+
+#include <stdint.h>
+
+/*
+ * Charger states. The state machine in charger.c moves between them from a transition table, a transition fires once
+ * its condition has held for the row's debounce time. Apart from the moves to FAULT and DISCONNECTED and out of charging
+ * when the supply goes or the ADC is tuned, a state is held for at least its minimum time before it is left. It has no
+ * hardware access and no firmware headers, vRegulator feeds it inputs and applies its output so it can be built and
+ * exercised on a host.
+ */
+#define CHARGER_DISCONNECTED		0
+#define CHARGER_DETECTING			1
+#define CHARGER_NEGOTIATING			2
+#define CHARGER_PRECHARGE			3
+#define CHARGER_CC					4
+#define CHARGER_CV					5
+#define CHARGER_BALANCING			6
+#define CHARGER_DONE				7
+#define CHARGER_FAULT				8
+#define CHARGER_STATES				9
+
+/* Match every state, or every state with the charger output on, in the from column of the transition table */
+#define CHARGER_ANY					0xFF
+#define CHARGER_CHARGING			0xFE
+
+/* Cell voltages are in uV, the units of BATTERY_ADC_MULTIPLIER. bq25703a_regulator.c checks that they match */
+#define CHARGER_UV_PER_V				1000000
+
+/* Cells below CHARGER_PRECHARGE_CELL_V are charged at CHARGER_PRECHARGE_CURRENT_MA until they recover past CHARGER_PRECHARGE_EXIT_CELL_V */
+#define CHARGER_PRECHARGE_CELL_V		(uint32_t)( 3.0 * CHARGER_UV_PER_V )
+#define CHARGER_PRECHARGE_EXIT_CELL_V	(uint32_t)( 3.1 * CHARGER_UV_PER_V )
+#define CHARGER_PRECHARGE_CURRENT_MA	500
+#define CHARGER_PRECHARGE_TIMEOUT_MS	(30 * 60 * 1000UL)
+
+/* The regulator is treated as in constant voltage once the highest cell passes CHARGER_CV_CELL_V */
+#define CHARGER_CV_CELL_V				(uint32_t)( 4.15 * CHARGER_UV_PER_V )
+#define CHARGER_CV_EXIT_CELL_V			(uint32_t)( 4.10 * CHARGER_UV_PER_V )
+
+/*
+ * Charging ends once the charge current has stayed below CHARGER_TERMINATION_CURRENT_MA for CHARGER_TERMINATION_MS. The
+ * current is only judged with the output on for CHARGER_TERMINATION_SETTLE_MS, not in or just after a HI-Z rest
+ */
+#define CHARGER_TERMINATION_CURRENT_MA	256
+#define CHARGER_TERMINATION_MS			10000
+#define CHARGER_TERMINATION_SETTLE_MS	2000
+
+/* A finished pack is only charged again once its highest cell has fallen below CHARGER_RECHARGE_CELL_V */
+#define CHARGER_RECHARGE_CELL_V			(uint32_t)( 4.10 * CHARGER_UV_PER_V )
+
+/* While charging, the output is put in HI-Z for CHARGER_REST_MS out of every CHARGER_CYCLE_MS so the XT60 reads the pack alone */
+#define CHARGER_CYCLE_MS				25000
+#define CHARGER_REST_MS					3000
+
+/**
+ * @brief  Measurements and flags the transitions are decided from. Flags are 1 for true
+ */
+struct Charger_Inputs {
+	uint8_t xt60_connected;
+	uint8_t balance_port_connected;
+	uint8_t number_of_cells;
+	/* The supply can charge, a ready USB PD contract or a supply without USB PD */
+	uint8_t power_ready;
+	uint8_t requires_charging;
+	uint8_t balancing;
+	uint8_t cell_over_voltage;
+	uint8_t adc_tuning;
+	uint32_t error_state;
+	uint32_t min_cell_voltage;
+	uint32_t max_cell_voltage;
+	uint32_t charge_current_ma;
+};
+
+/**
+ * @brief  What the regulator should do in the current state
+ */
+struct Charger_Output {
+	uint8_t charge_enable;
+	uint32_t current_limit_ma;
+};
+
+void Charger_Update(const struct Charger_Inputs *inputs, uint32_t now_ms);
+
+void Get_Charger_Output(struct Charger_Output *output);
+
+uint8_t Get_Charger_State(void);
+
+uint32_t Get_Charger_Time_In_State(void);
+
+uint32_t Get_Charger_Transition_Count(void);
+
+const char *Get_Charger_State_Name(uint8_t state);
+
+#endif /* CHARGER_H_ */
@@ -21,6 +21,17 @@
 #define MCU_OVER_TEMP					0b001000
 #define REGULATOR_COMMUNICATION_ERROR	0b010000
 #define VOLTAGE_INPUT_ERROR				0b100000
+#define ADC_SATURATION_ERROR			0b0001000000
+#define ADC_STUCK_CHANNEL_ERROR			0b0010000000
+#define TAP_ORDER_ERROR					0b0100000000
+#define VREFINT_ERROR					0b1000000000
+#define ADC_DRIFT_ERROR					0b10000000000
+
+/* Errors raised by the ADC integrity checks */
+#define ADC_DIAGNOSTIC_ERRORS			(ADC_SATURATION_ERROR | ADC_STUCK_CHANNEL_ERROR | TAP_ORDER_ERROR | VREFINT_ERROR)
+
+/* Errors that are reported but do not stop charging or balancing */
+#define ADC_ADVISORY_ERRORS				(ADC_DRIFT_ERROR)
 
 uint32_t Get_Error_State(void);
 
@@ -0,0 +1,63 @@
+/**
+ ******************************************************************************
+ * @file           : flash_store.h
+ * @brief          : Header for flash_store.c file.
+ ******************************************************************************
+ */
+
+#ifndef FLASH_STORE_H_
+#define FLASH_STORE_H_
+
+#include "stm32g0xx_hal.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+/*
+ * Log structured key/value store in the SETTINGS pages the linker script leaves out of FLASH.
+ * One page is active at a time. Records are appended to it, a newer record for a key replaces the older one.
+ * When the active page is full the latest record of every other key is copied to the other page and the new record is
+ * written after them. The page header goes last, so the other page only becomes active with the new record already in
+ * it and erases alternate between the pages. Each page starts with a header of FLASH_STORE_MAGIC and a generation that
+ * counts compactions, the page with the highest generation is active.
+ * A record is a double word header, the key, format version and length then a CRC32 of the header word and the data,
+ * followed by the data padded to double words. The header is programmed last so a record cut short by a reset is never valid.
+ * Erasing stalls the CPU for the length of the erase, write from tasks that can tolerate that, never from the ADC path.
+ */
+#define FLASH_STORE_FIRST_PAGE		62
+#define FLASH_STORE_PAGES			2
+#define FLASH_STORE_PAGE_ADDR(page)	(FLASH_BASE + ((FLASH_STORE_FIRST_PAGE + (page)) * FLASH_PAGE_SIZE))
+#define FLASH_STORE_MAGIC			0x4C4F4753
+#define FLASH_STORE_HEADER_BYTES	8
+#define FLASH_STORE_MAX_DATA		(FLASH_PAGE_SIZE / 4)
+
+/**
+ * @brief  Keys of the records in the store. The RAM index has one entry per key
+ */
+#define FLASH_STORE_KEY_CALIBRATION	0
+#define FLASH_STORE_KEY_SAMPLING	1
+#define FLASH_STORE_KEYS			8
+
+struct Flash_Store_Stats {
+	uint8_t active_page;
+	uint32_t generation;
+	uint32_t used_bytes;
+	uint32_t records;
+	uint32_t compactions;
+	uint32_t init_time_us;
+	uint32_t write_time_us;
+};
+
+uint8_t Flash_Store_Init(void);
+
+uint8_t Flash_Store_Read(uint8_t key, uint8_t version, void *data, uint32_t length);
+
+uint8_t Flash_Store_Write(uint8_t key, uint8_t version, const void *data, uint32_t length);
+
+void Get_Flash_Store_Stats(struct Flash_Store_Stats *stats);
+
+uint32_t Flash_Store_Time_Us(void);
+
+/* Guards the store so records can be written from more than one task */
+extern SemaphoreHandle_t xMutex_Flash_Store;
+
+#endif /* FLASH_STORE_H_ */
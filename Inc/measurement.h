@@ -0,0 +1,58 @@
+/**
+ ******************************************************************************
+ * @file           : measurement.h
+ * @brief          : Header for measurement.c file.
+ ******************************************************************************
+ */
+
+#ifndef MEASUREMENT_H_
+#define MEASUREMENT_H_
+
+#include "stm32g0xx_hal.h"
+#include "FreeRTOS.h"
+
+/**
+ * @brief  Coherent copy of the ADC, battery and regulator state.
+ * ADC and battery values are from the same filtered window, regulator values are from the same regulator poll.
+ * The connection, cell count, balancing and over voltage flags can be newer, the fast path republishes them when they change.
+ * battery_sequence counts filtered windows
+ */
+struct Measurement_Snapshot {
+	uint32_t battery_voltage;
+	uint32_t cell_voltage[4];
+	uint32_t two_s_voltage;
+	uint32_t three_s_voltage;
+	uint32_t four_s_voltage;
+	uint32_t vdda;
+	int32_t mcu_temperature;
+	uint32_t adc_timestamp;
+	int32_t battery_dvdt;
+	int32_t cell_dvdt[4];
+	uint8_t xt60_connected;
+	uint8_t balance_port_connected;
+	uint8_t number_of_cells;
+	uint8_t balancing_state;
+	uint8_t requires_charging;
+	uint8_t cell_over_voltage;
+	uint8_t adc_tuning;
+	uint8_t regulator_connected;
+	uint8_t regulator_charging;
+	uint32_t regulator_vbat_voltage;
+	uint32_t regulator_vbus_voltage;
+	uint32_t regulator_charge_current;
+	uint32_t regulator_input_current;
+	uint32_t regulator_max_charge_current;
+	uint32_t error_state;
+	uint32_t battery_sequence;
+	uint32_t regulator_sequence;
+};
+
+void Publish_Battery_Measurements(void);
+
+void Publish_Battery_State(void);
+
+void Publish_Regulator_Measurements(void);
+
+void Get_Measurement_Snapshot(struct Measurement_Snapshot *snapshot);
+
+#endif /* MEASUREMENT_H_ */
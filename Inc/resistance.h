@@ -0,0 +1,36 @@
+/**
+ ******************************************************************************
+ * @file           : resistance.h
+ * @brief          : Header for resistance.c file.
+ ******************************************************************************
+ */
+
+#ifndef RESISTANCE_H_
+#define RESISTANCE_H_
+
+#include "stm32g0xx_hal.h"
+#include "measurement.h"
+
+/*
+ * The charger's HI-Z rest (CHARGER_REST_MS of every CHARGER_CYCLE_MS) is a current step from the charge current to zero.
+ * The cell and XT60 voltages from the last poll before the step are compared with those RESISTANCE_SETTLE_MS into the rest.
+ * Each cell's drop over the charge current is its internal resistance, the XT60 drop less the sum of the cells is the
+ * resistance of the main leads and connector. Estimates are smoothed by 1 / (1 << RESISTANCE_SHIFT) per step and cleared
+ * when the pack is unplugged.
+ */
+#define RESISTANCE_SETTLE_MS			750
+#define RESISTANCE_MIN_CURRENT_MA		500
+#define RESISTANCE_SHIFT				2
+
+struct Cell_Resistance {
+	uint32_t cell_uohm[4];
+	uint32_t lead_uohm;
+	uint32_t samples;
+	uint32_t rejected;
+};
+
+void Resistance_Update(const struct Measurement_Snapshot *snapshot, uint8_t charge_enable, uint32_t now_ms);
+
+void Get_Cell_Resistance(struct Cell_Resistance *resistance);
+
+#endif /* RESISTANCE_H_ */
@@ -37,8 +37,12 @@
 
 #include "adc_interface.h"
 #include "battery.h"
+#include "charger.h"
 #include "bq25703a_regulator.h"
 #include "error.h"
+#include "flash_store.h"
+#include "measurement.h"
+#include "resistance.h"
 #include "UARTCommandConsole.h"
 #include "usbpd.h"
 #include <stdlib.h>
@@ -49,6 +53,31 @@
  */
 static BaseType_t prvStatsCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
 
+/*
+ * Implements the adc_rate command.
+ */
+static BaseType_t prvADCRateCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
+/*
+ * Implements the adc_filter command.
+ */
+static BaseType_t prvADCFilterCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
+/*
+ * Implements the adc_capture command.
+ */
+static BaseType_t prvADCCaptureCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
+/*
+ * Implements the adc_budget command.
+ */
+static BaseType_t prvADCBudgetCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
+/*
+ * Implements the adc_tune command.
+ */
+static BaseType_t prvADCTuneCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
 /*
  * Implements the task-stats command.
  */
@@ -64,6 +93,36 @@ static BaseType_t prvCalibrateCommand( char *pcWriteBuffer, size_t xWriteBufferL
  */
 static BaseType_t prvWriteOTPFlashCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
 
+/*
+ * Implements the cal_point command.
+ */
+static BaseType_t prvCalPointCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
+/*
+ * Implements the cal_clear command.
+ */
+static BaseType_t prvCalClearCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
+/*
+ * Implements the cal_fit command.
+ */
+static BaseType_t prvCalFitCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
+/*
+ * Implements the cal_save command.
+ */
+static BaseType_t prvCalSaveCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
+/*
+ * Implements the flash_store command.
+ */
+static BaseType_t prvFlashStoreCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
+/*
+ * Implements the resistance command.
+ */
+static BaseType_t prvResistanceCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString );
+
 /*
  * Implements the run-time-stats command.
  */
@@ -93,11 +152,111 @@ static const CLI_Command_Definition_t xCal =
 static const CLI_Command_Definition_t xOTP =
 {
 	"write_otp", /* The command string to type. */
-	"\r\nwrite_otp:\r\n Writes the calibration scalars to OTP flash. Will fail if scalars not set or out of range. Must run cal first with known accurate voltage. Can run up to ~32 times.\r\n",
+	"\r\nwrite_otp:\r\n Writes the calibration scalars to OTP flash. Will fail if scalars not set or out of range. Must run cal first with known accurate voltage. Can run up to ~32 times. cal_save has no such limit and is used in place of OTP at boot.\r\n",
 	prvWriteOTPFlashCommand, /* The function to run. */
 	0 /* No parameters are expected. */
 };
 
+/* Structure that defines the "cal_point" command line command. */
+static const CLI_Command_Definition_t xCalPoint =
+{
+	"cal_point", /* The command string to type. */
+	"\r\ncal_point:\r\n Records the ADC readings against a known input voltage as one point of a multi-point calibration, up to 8 points. Expects one argument as a float in milivolts, 0 - 4200. Connect input voltage to cells 1-4 and the XT60 battery output.\r\n",
+	prvCalPointCommand, /* The function to run. */
+	1 /* One parameter is expected. */
+};
+
+/* Structure that defines the "cal_clear" command line command. */
+static const CLI_Command_Definition_t xCalClear =
+{
+	"cal_clear", /* The command string to type. */
+	"\r\ncal_clear:\r\n Discards the points recorded by cal_point.\r\n",
+	prvCalClearCommand, /* The function to run. */
+	0 /* No parameters are expected. */
+};
+
+/* Structure that defines the "cal_fit" command line command. */
+static const CLI_Command_Definition_t xCalFit =
+{
+	"cal_fit", /* The command string to type. */
+	"\r\ncal_fit:\r\n Least squares fit of the cal_point points and applies it. Expects one integer argument, 1 for gain and offset (2+ points) or 2 to add a second order correction (3+ points). Prints the residuals of each channel.\r\n",
+	prvCalFitCommand, /* The function to run. */
+	1 /* One parameter is expected. */
+};
+
+/* Structure that defines the "cal_save" command line command. */
+static const CLI_Command_Definition_t xCalSave =
+{
+	"cal_save", /* The command string to type. */
+	"\r\ncal_save:\r\n Writes the applied calibration, from cal or cal_fit, and the residuals of the last cal_fit to the flash store. Used in place of the OTP scalars at boot.\r\n",
+	prvCalSaveCommand, /* The function to run. */
+	0 /* No parameters are expected. */
+};
+
+/* Structure that defines the "flash_store" command line command. */
+static const CLI_Command_Definition_t xFlashStore =
+{
+	"flash_store", /* The command string to type. */
+	"\r\nflash_store:\r\n Displays the state of the flash store and the time the boot scan and the last write took.\r\n",
+	prvFlashStoreCommand, /* The function to run. */
+	0 /* No parameters are expected. */
+};
+
+/* Structure that defines the "resistance" command line command. */
+static const CLI_Command_Definition_t xResistance =
+{
+	"resistance", /* The command string to type. */
+	"\r\nresistance:\r\n Displays the internal resistance of each cell and of the XT60 leads, estimated from the voltage step when charging pauses. Reset when the pack is unplugged.\r\n",
+	prvResistanceCommand, /* The function to run. */
+	0 /* No parameters are expected. */
+};
+
+/* Structure that defines the "adc_rate" command line command. */
+static const CLI_Command_Definition_t xADCRate =
+{
+	"adc_rate", /* The command string to type. */
+	"\r\nadc_rate:\r\n Sets the rate ADC scan sequences are triggered at. Expects one argument as an integer in Hz, 500 up to the max rate shown by adc_budget. 0 runs the ADC continuously.\r\n",
+	prvADCRateCommand, /* The function to run. */
+	1 /* One parameter is expected. */
+};
+
+/* Structure that defines the "adc_filter" command line command. */
+static const CLI_Command_Definition_t xADCFilter =
+{
+	"adc_filter", /* The command string to type. */
+	"\r\nadc_filter:\r\n Sets the filter chain of one ADC channel. Expects four integer arguments: channel (0 XT60, 1-4 taps, 5 temperature, 6 VREFINT), median length (1, 3 or 5), boxcar length in blocks (1, 2, 4, 8, 16 or 32) and IIR shift (0-8, 0 off).\r\n",
+	prvADCFilterCommand, /* The function to run. */
+	4 /* Four parameters are expected. */
+};
+
+/* Structure that defines the "adc_capture" command line command. */
+static const CLI_Command_Definition_t xADCCapture =
+{
+	"adc_capture", /* The command string to type. */
+	"\r\nadc_capture:\r\n Captures raw ADC scan sequences while filtering continues. Expects one argument as an integer number of sequences, 1 - 256.\r\n"
+	" Sends a header line, the samples as little endian uint16 with 7 channels per sequence, then per channel statistics.\r\n",
+	prvADCCaptureCommand, /* The function to run. */
+	1 /* One parameter is expected. */
+};
+
+/* Structure that defines the "adc_budget" command line command. */
+static const CLI_Command_Definition_t xADCBudget =
+{
+	"adc_budget", /* The command string to type. */
+	"\r\nadc_budget:\r\n Displays the conversion time of each ADC channel, its share of a scan sequence and its conversions per second.\r\n",
+	prvADCBudgetCommand, /* The function to run. */
+	0 /* No parameters are expected. */
+};
+
+/* Structure that defines the "adc_tune" command line command. */
+static const CLI_Command_Definition_t xADCTune =
+{
+	"adc_tune", /* The command string to type. */
+	"\r\nadc_tune:\r\n Finds the shortest ADC sampling time for each channel that matches the noise and mean of the longest, then saves it to flash. Connect a stable voltage to cells 1-4 and the XT60 as for cal. Charging is stopped while tuning.\r\n",
+	prvADCTuneCommand, /* The function to run. */
+	0 /* No parameters are expected. */
+};
+
 /* Structure that defines the "task-stats" command line command.  This generates
 a table that gives information on each task in the system. */
 static const CLI_Command_Definition_t xTaskStats =
@@ -130,6 +289,28 @@ void vRegisterCLICommands(void) {
 
 	FreeRTOS_CLIRegisterCommand(&xOTP);
 
+	FreeRTOS_CLIRegisterCommand(&xCalPoint);
+
+	FreeRTOS_CLIRegisterCommand(&xCalClear);
+
+	FreeRTOS_CLIRegisterCommand(&xCalFit);
+
+	FreeRTOS_CLIRegisterCommand(&xCalSave);
+
+	FreeRTOS_CLIRegisterCommand(&xFlashStore);
+
+	FreeRTOS_CLIRegisterCommand(&xResistance);
+
+	FreeRTOS_CLIRegisterCommand(&xADCRate);
+
+	FreeRTOS_CLIRegisterCommand(&xADCFilter);
+
+	FreeRTOS_CLIRegisterCommand(&xADCCapture);
+
+	FreeRTOS_CLIRegisterCommand(&xADCBudget);
+
+	FreeRTOS_CLIRegisterCommand(&xADCTune);
+
 	FreeRTOS_CLIRegisterCommand(&xTaskStats);
 
 	#if( configGENERATE_RUN_TIME_STATS == 1 )
@@ -148,25 +329,38 @@ static BaseType_t prvStatsCommand(char *pcWriteBuffer, size_t xWriteBufferLen, c
 	(void) xWriteBufferLen;
 	configASSERT(pcWriteBuffer);
 
+	struct Measurement_Snapshot snapshot;
+	Get_Measurement_Snapshot(&snapshot);
+
 	float cell_voltage_float[4];
 	for (int i = 0; i < 4; i++) {
-		cell_voltage_float[i] = ((float)Get_Cell_Voltage(i)/BATTERY_ADC_MULTIPLIER);
+		cell_voltage_float[i] = ((float)snapshot.cell_voltage[i]/BATTERY_ADC_MULTIPLIER);
 	}
 
-	float vdda_float = (float)Get_VDDa()/BATTERY_ADC_MULTIPLIER;
+	float vdda_float = (float)snapshot.vdda/BATTERY_ADC_MULTIPLIER;
 
-	float battery_voltage = ((float)Get_Battery_Voltage()/BATTERY_ADC_MULTIPLIER);
-	float charge_current = ((float)Get_Charge_Current_ADC_Reading()/REG_ADC_MULTIPLIER);
+	float battery_voltage = ((float)snapshot.battery_voltage/BATTERY_ADC_MULTIPLIER);
+	float charge_current = ((float)snapshot.regulator_charge_current/REG_ADC_MULTIPLIER);
 	float output_power = battery_voltage * charge_current;
 
-	float regulator_vbat_voltage = ((float)Get_VBAT_ADC_Reading()/REG_ADC_MULTIPLIER);
-	float vbus_voltage = ((float)Get_VBUS_ADC_Reading()/REG_ADC_MULTIPLIER);
-	float input_current = ((float)Get_Input_Current_ADC_Reading()/REG_ADC_MULTIPLIER);
+	float regulator_vbat_voltage = ((float)snapshot.regulator_vbat_voltage/REG_ADC_MULTIPLIER);
+	float vbus_voltage = ((float)snapshot.regulator_vbus_voltage/REG_ADC_MULTIPLIER);
+	float input_current = ((float)snapshot.regulator_input_current/REG_ADC_MULTIPLIER);
 	float input_power = vbus_voltage * input_current;
 
 	float efficiency = output_power/input_power;
 
-	float max_charge_current = (float)Get_Max_Charge_Current()/1000.0f;
+	float max_charge_current = (float)snapshot.regulator_max_charge_current/1000.0f;
+
+	int32_t xcal_difference[ADC_XCAL_REFERENCES];
+	uint32_t xcal_bound[ADC_XCAL_REFERENCES];
+	uint32_t xcal_samples[ADC_XCAL_REFERENCES];
+	for (int i = 0; i < ADC_XCAL_REFERENCES; i++) {
+		Get_ADC_Cross_Calibration(i, &xcal_difference[i], &xcal_bound[i], &xcal_samples[i]);
+	}
+
+	struct Balance_Connection_Stats connection_stats;
+	Get_Balance_Connection_Stats(&connection_stats);
 
 	/* Generate a table of stats. */
 	sprintf(pcWriteBuffer,
@@ -183,15 +377,26 @@ static BaseType_t prvStatsCommand(char *pcWriteBuffer, size_t xWriteBufferLen, c
 			"2 Series Voltage (V)         %.3f\r\n"
 			"3 Series Voltage (V)         %.3f\r\n"
 			"4 Series Voltage (V)         %.3f\r\n"
+			"Battery dV/dt (mV/s)         %.3f\r\n"
+			"Cell dV/dt (mV/s)            %.3f %.3f %.3f %.3f\r\n"
+			"XT60 - Reg VBAT (mV)         %.1f +/- %.1f n=%u\r\n"
+			"XT60 - Cell Sum (mV)         %.1f +/- %.1f n=%u\r\n"
 			"MCU Temperature (C)          %d\r\n"
 			"VDDa (V)                     %.3f\r\n"
+			"ADC Sample Rate (Hz)         %u\r\n"
+			"ADC Max Latency (ms)         %u\r\n"
+			"ADC Block Overruns           %u\r\n"
+			"ADC Watchdog Trips           %u\r\n"
 			"XT60 Connected               %u\r\n"
 			"Balance Connection State     %u\r\n"
+			"Balance Conn/Drop/Bounce     %u/%u/%u\r\n"
 			"Number of Cells              %u\r\n"
 			"Battery Requires Charging    %u\r\n"
 			"Balancing State/Bitmask      %b\r\n"
+			"Balancing Duty (%%)           %u %u %u %u\r\n"
 			"Regulator Connection State   %d\r\n"
 			"Charging State               %u\r\n"
+			"Charger State                %s %us\r\n"
 			"Max Charge Current           %.3f\r\n"
 			"Vbus Voltage (V)             %.3f\r\n"
 			"Input Current (A)            %.3f\r\n"
@@ -206,24 +411,48 @@ static BaseType_t prvStatsCommand(char *pcWriteBuffer, size_t xWriteBufferLen, c
 			cell_voltage_float[1],
 			cell_voltage_float[2],
 			cell_voltage_float[3],
-			(float)Get_Two_S_Voltage()/BATTERY_ADC_MULTIPLIER,
-			(float)Get_Three_S_Voltage()/BATTERY_ADC_MULTIPLIER,
-			(float)Get_Four_S_Voltage()/BATTERY_ADC_MULTIPLIER,
-			Get_MCU_Temperature(),
+			(float)snapshot.two_s_voltage/BATTERY_ADC_MULTIPLIER,
+			(float)snapshot.three_s_voltage/BATTERY_ADC_MULTIPLIER,
+			(float)snapshot.four_s_voltage/BATTERY_ADC_MULTIPLIER,
+			(float)snapshot.battery_dvdt/(BATTERY_ADC_MULTIPLIER/1000),
+			(float)snapshot.cell_dvdt[0]/(BATTERY_ADC_MULTIPLIER/1000),
+			(float)snapshot.cell_dvdt[1]/(BATTERY_ADC_MULTIPLIER/1000),
+			(float)snapshot.cell_dvdt[2]/(BATTERY_ADC_MULTIPLIER/1000),
+			(float)snapshot.cell_dvdt[3]/(BATTERY_ADC_MULTIPLIER/1000),
+			(float)xcal_difference[ADC_XCAL_REGULATOR]/(BATTERY_ADC_MULTIPLIER/1000),
+			(float)xcal_bound[ADC_XCAL_REGULATOR]/(BATTERY_ADC_MULTIPLIER/1000),
+			xcal_samples[ADC_XCAL_REGULATOR],
+			(float)xcal_difference[ADC_XCAL_CELL_SUM]/(BATTERY_ADC_MULTIPLIER/1000),
+			(float)xcal_bound[ADC_XCAL_CELL_SUM]/(BATTERY_ADC_MULTIPLIER/1000),
+			xcal_samples[ADC_XCAL_CELL_SUM],
+			snapshot.mcu_temperature,
 			vdda_float,
-			Get_XT60_Connection_State(),
-			Get_Balance_Connection_State(),
-			Get_Number_Of_Cells(),
-			Get_Requires_Charging_State(),
-			Get_Balancing_State(),
-			Get_Regulator_Connection_State(),
-			Get_Regulator_Charging_State(),
+			Get_ADC_Sample_Rate(),
+			Get_ADC_Max_Latency(),
+			Get_ADC_Block_Overruns(),
+			Get_ADC_Watchdog_Trip_Count(),
+			snapshot.xt60_connected,
+			snapshot.balance_port_connected,
+			connection_stats.connects,
+			connection_stats.disconnects,
+			connection_stats.bounces,
+			snapshot.number_of_cells,
+			snapshot.requires_charging,
+			snapshot.balancing_state,
+			Get_Balancing_Duty(0),
+			Get_Balancing_Duty(1),
+			Get_Balancing_Duty(2),
+			Get_Balancing_Duty(3),
+			snapshot.regulator_connected,
+			snapshot.regulator_charging,
+			Get_Charger_State_Name(Get_Charger_State()),
+			Get_Charger_Time_In_State()/1000,
 			max_charge_current,
 			vbus_voltage,
 			input_current,
 			input_power,
 			efficiency,
-			Get_Error_State());
+			snapshot.error_state);
 
 	/* There is no more data to return after this single string, so return
 	 pdFALSE. */
@@ -282,6 +511,398 @@ static BaseType_t prvWriteOTPFlashCommand(char *pcWriteBuffer, size_t xWriteBuff
 }
 /*-----------------------------------------------------------*/
 
+static BaseType_t prvCalPointCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	const char *pcParameter1;
+	BaseType_t xParameter1StringLength;
+
+	pcParameter1 = FreeRTOS_CLIGetParameter
+						(
+						  /* The command string itself. */
+						  pcCommandString,
+						  /* Return the first parameter. */
+						  1,
+						  /* Store the parameter string length. */
+						  &xParameter1StringLength
+						);
+
+	float input_voltage_mv = strtof(pcParameter1, NULL);
+
+	uint8_t result = Add_ADC_Calibration_Point(input_voltage_mv);
+
+	sprintf(pcWriteBuffer, "Calibration Point Result: %u Points: %u\r\n", result, Get_ADC_Calibration_Points());
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvCalClearCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) pcCommandString;
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	Clear_ADC_Calibration_Points();
+
+	sprintf(pcWriteBuffer, "Calibration Points: %u\r\n", Get_ADC_Calibration_Points());
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvCalFitCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	const char *pcParameter1;
+	BaseType_t xParameter1StringLength;
+
+	pcParameter1 = FreeRTOS_CLIGetParameter
+						(
+						  /* The command string itself. */
+						  pcCommandString,
+						  /* Return the first parameter. */
+						  1,
+						  /* Store the parameter string length. */
+						  &xParameter1StringLength
+						);
+
+	uint8_t order = (uint8_t)strtoul(pcParameter1, NULL, 10);
+
+	uint8_t result = Fit_ADC_Calibration(order);
+
+	sprintf(pcWriteBuffer, "Calibration Fit Result: %u\r\n", result);
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvCalSaveCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) pcCommandString;
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	uint8_t result = Write_Calibration_To_Flash();
+
+	sprintf(pcWriteBuffer, "Calibration Save Result: %u\r\n", result);
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvFlashStoreCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) pcCommandString;
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	struct Flash_Store_Stats stats;
+	Get_Flash_Store_Stats(&stats);
+
+	sprintf(pcWriteBuffer,
+			"Variable                    Value\r\n"
+			"************************************************\r\n"
+			"Active Page                  %u\r\n"
+			"Generation                   %u\r\n"
+			"Used (bytes)                 %u of %u\r\n"
+			"Records                      %u\r\n"
+			"Compactions Since Boot       %u\r\n"
+			"Boot Scan Time (us)          %u\r\n"
+			"Last Write Time (us)         %u\r\n",
+			stats.active_page,
+			stats.generation,
+			stats.used_bytes,
+			FLASH_PAGE_SIZE,
+			stats.records,
+			stats.compactions,
+			stats.init_time_us,
+			stats.write_time_us);
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvResistanceCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) pcCommandString;
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	struct Cell_Resistance resistance;
+	Get_Cell_Resistance(&resistance);
+
+	sprintf(pcWriteBuffer,
+			"Variable                    Value\r\n"
+			"************************************************\r\n"
+			"Cell One (mOhm)              %.1f\r\n"
+			"Cell Two (mOhm)              %.1f\r\n"
+			"Cell Three (mOhm)            %.1f\r\n"
+			"Cell Four (mOhm)             %.1f\r\n"
+			"XT60 Leads (mOhm)            %.1f\r\n"
+			"Steps Used                   %u\r\n"
+			"Steps Rejected               %u\r\n",
+			(float)resistance.cell_uohm[0]/1000.0f,
+			(float)resistance.cell_uohm[1]/1000.0f,
+			(float)resistance.cell_uohm[2]/1000.0f,
+			(float)resistance.cell_uohm[3]/1000.0f,
+			(float)resistance.lead_uohm/1000.0f,
+			resistance.samples,
+			resistance.rejected);
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvADCRateCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	const char *pcParameter1;
+	BaseType_t xParameter1StringLength;
+
+	pcParameter1 = FreeRTOS_CLIGetParameter
+						(
+						  /* The command string itself. */
+						  pcCommandString,
+						  /* Return the first parameter. */
+						  1,
+						  /* Store the parameter string length. */
+						  &xParameter1StringLength
+						);
+
+	/* Only a whole number changes the rate, "abc" or "2k" would otherwise read as 0 and run the ADC continuously */
+	char *pcEnd;
+	uint32_t sample_rate_hz = strtoul(pcParameter1, &pcEnd, 10);
+
+	uint8_t result = 0;
+	if ((pcEnd != pcParameter1) && (pcEnd == (pcParameter1 + xParameter1StringLength))) {
+		result = Set_ADC_Sample_Rate(sample_rate_hz);
+	}
+
+	sprintf(pcWriteBuffer, "ADC Sample Rate Result: %u Rate (Hz): %u\r\n", result, Get_ADC_Sample_Rate());
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvADCFilterCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	const char *pcParameter;
+	BaseType_t xParameterStringLength;
+	uint32_t parameters[4];
+
+	for (int i = 0; i < 4; i++) {
+		pcParameter = FreeRTOS_CLIGetParameter
+							(
+							  /* The command string itself. */
+							  pcCommandString,
+							  /* Return the next parameter. */
+							  i + 1,
+							  /* Store the parameter string length. */
+							  &xParameterStringLength
+							);
+
+		parameters[i] = strtoul(pcParameter, NULL, 10);
+	}
+
+	/* Boxcar lengths are powers of two, stored as a shift */
+	uint8_t boxcar_shift = 0;
+	while ((boxcar_shift < 31) && ((1UL << boxcar_shift) < parameters[2])) {
+		boxcar_shift++;
+	}
+
+	struct Adc_Filter_Config config;
+	config.median_length = (uint8_t)parameters[1];
+	config.boxcar_shift = boxcar_shift;
+	config.iir_shift = (uint8_t)parameters[3];
+
+	uint8_t result = 0;
+	if ((parameters[0] <= UINT8_MAX) && (parameters[1] <= UINT8_MAX) && ((1UL << boxcar_shift) == parameters[2]) && (parameters[3] <= UINT8_MAX)) {
+		result = Set_ADC_Filter((uint8_t)parameters[0], &config);
+	}
+
+	if (Get_ADC_Filter((uint8_t)parameters[0], &config) == 1) {
+		sprintf(pcWriteBuffer, "ADC Filter Result: %u Channel: %u Median: %u Boxcar: %u IIR Shift: %u\r\n", result, parameters[0], config.median_length, (1U << config.boxcar_shift), config.iir_shift);
+	}
+	else {
+		sprintf(pcWriteBuffer, "ADC Filter Result: %u\r\n", result);
+	}
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvADCCaptureCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	const char *pcParameter1;
+	BaseType_t xParameter1StringLength;
+
+	pcParameter1 = FreeRTOS_CLIGetParameter
+						(
+						  /* The command string itself. */
+						  pcCommandString,
+						  /* Return the first parameter. */
+						  1,
+						  /* Store the parameter string length. */
+						  &xParameter1StringLength
+						);
+
+	uint32_t sequences = strtoul(pcParameter1, NULL, 10);
+
+	if (Start_ADC_Capture(sequences) == 0) {
+		sprintf(pcWriteBuffer, "ADC Capture Result: 0\r\n");
+		return pdFALSE;
+	}
+
+	/* The capture fills from the DMA interrupt, allow for the slowest sample rate */
+	TickType_t xtimeout_start = xTaskGetTickCount();
+	const TickType_t xCaptureTimeout = pdMS_TO_TICKS(((ADC_CAPTURE_MAX_SEQUENCES * 1000) / ADC_SAMPLE_RATE_MIN_HZ) + 500);
+
+	while (Get_ADC_Capture_State() != ADC_CAPTURE_DONE) {
+		if ((xTaskGetTickCount() - xtimeout_start) > xCaptureTimeout) {
+			Release_ADC_Capture();
+			sprintf(pcWriteBuffer, "ADC Capture Result: 0\r\n");
+			return pdFALSE;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+
+	const uint16_t *samples = Get_ADC_Capture(&sequences);
+	uint16_t bytes = (uint16_t)(sequences * ADC_NUMBER_OF_CHANNELS * sizeof(uint16_t));
+
+	/* Stream the samples straight out of the capture buffer */
+	sprintf(pcWriteBuffer, "ADC Capture Result: 1 Sequences: %u Channels: %u Bytes: %u\r\n", sequences, ADC_NUMBER_OF_CHANNELS, bytes);
+	UART_Transfer((uint8_t *)pcWriteBuffer, (uint16_t)strlen(pcWriteBuffer));
+	UART_Transfer((uint8_t *)samples, bytes);
+
+	char *pcLine = pcWriteBuffer;
+	pcLine += sprintf(pcLine, "\r\nChannel  Min   Max   Mean      Variance  Histogram\r\n");
+
+	for (uint32_t channel = 0; channel < ADC_NUMBER_OF_CHANNELS; channel++) {
+		struct Adc_Channel_Statistics stats;
+		ADC_Channel_Statistics(samples, sequences, ADC_NUMBER_OF_CHANNELS, channel, &stats);
+
+		pcLine += sprintf(pcLine, "%-8u %-5u %-5u %-9.2f %-9.2f", channel, stats.min, stats.max,
+				(float)stats.mean / (1 << ADC_STATISTICS_FRACTIONAL_BITS), (float)stats.variance / (1 << ADC_STATISTICS_FRACTIONAL_BITS));
+
+		for (int bin = 0; bin < ADC_STATISTICS_HISTOGRAM_BINS; bin++) {
+			pcLine += sprintf(pcLine, " %u", stats.histogram[bin]);
+		}
+		pcLine += sprintf(pcLine, "\r\n");
+	}
+
+	Release_ADC_Capture();
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvADCBudgetCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) pcCommandString;
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	uint32_t sequence_ns = 0;
+	for (uint8_t channel = 0; channel < ADC_NUMBER_OF_CHANNELS; channel++) {
+		sequence_ns += Get_ADC_Conversion_Time(channel);
+	}
+
+	uint32_t max_rate_hz = 1000000000UL / Get_ADC_Sequence_Time();
+
+	/* 0 Hz converts back to back */
+	uint32_t sample_rate_hz = Get_ADC_Sample_Rate();
+	if (sample_rate_hz == 0) {
+		sample_rate_hz = max_rate_hz;
+	}
+
+	float busy = ((float)Get_ADC_Sequence_Time() * sample_rate_hz) / 1e7f;
+
+	char *pcLine = pcWriteBuffer;
+	pcLine += sprintf(pcLine, "Sequence (us): %.3f Rate (Hz): %u Max Rate (Hz): %u ADC Busy (%%): %.1f\r\n", (float)sequence_ns / 1000, sample_rate_hz, max_rate_hz, busy);
+	pcLine += sprintf(pcLine, "Channel  Conversion (us)  Share (%%)  Conversions/s\r\n");
+
+	for (uint8_t channel = 0; channel < ADC_NUMBER_OF_CHANNELS; channel++) {
+		uint32_t conversion_ns = Get_ADC_Conversion_Time(channel);
+
+		pcLine += sprintf(pcLine, "%-8u %-16.3f %-10.1f %u\r\n", channel, (float)conversion_ns / 1000,
+				((float)conversion_ns * 100) / sequence_ns, sample_rate_hz);
+	}
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvADCTuneCommand(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString) {
+	/* Remove compile time warnings about unused parameters, and check the
+	 write buffer is not NULL.  NOTE - for simplicity, this example assumes the
+	 write buffer length is adequate, so does not check for buffer overflows. */
+	(void) pcCommandString;
+	(void) xWriteBufferLen;
+	configASSERT(pcWriteBuffer);
+
+	uint8_t result = Tune_ADC_Sampling();
+
+	sprintf(pcWriteBuffer, "ADC Tune Result: %u Sequence (us): %.3f\r\n", result, (float)Get_ADC_Sequence_Time() / 1000);
+
+	/* There is no more data to return after this single string, so return
+	 pdFALSE. */
+	return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
 static BaseType_t prvTaskStatsCommand( char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString )
 {
 const char *const pcHeader = "State   Priority  Stack    #\r\n************************************************\r\n";
@@ -0,0 +1,567 @@
+/**
+ ******************************************************************************
+ * @file           : adc_filter.c
+ * @brief          : Integer ADC processing between the DMA buffer and volts: block sums, filter chains, scaling and slopes
+ ******************************************************************************
+ */
+
+#include "adc_filter.h"
+
+#include "string.h"
+#include "math.h"
+
+/* Private function prototypes -----------------------------------------------*/
+uint32_t ADC_Filter_Median(struct Adc_Filter *filter, uint16_t input);
+uint32_t ADC_Filter_Boxcar(struct Adc_Filter *filter, uint16_t input);
+uint32_t ADC_Filter_IIR(struct Adc_Filter *filter, uint32_t input);
+uint32_t ADC_Square_Root(uint64_t value);
+
+/**
+ * @brief  Checks the stage settings are within the supported limits
+ * @param  config: Filter chain settings
+ * @retval uint8_t 1 if valid, 0 if not
+ */
+uint8_t ADC_Filter_Config_Valid(const struct Adc_Filter_Config *config) {
+	if ((config->median_length != 1) && (config->median_length != 3) && (config->median_length != 5)) {
+		return 0;
+	}
+	if (config->boxcar_shift > ADC_FILTER_BOXCAR_SHIFT_MAX) {
+		return 0;
+	}
+	if (config->iir_shift > ADC_FILTER_IIR_SHIFT_MAX) {
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief  Clears the filter history and applies new settings
+ * @param  filter: Filter chain to reset
+ * @param  config: Filter chain settings
+ * @retval uint8_t 1 if successful, 0 if the settings are invalid
+ */
+uint8_t ADC_Filter_Init(struct Adc_Filter *filter, const struct Adc_Filter_Config *config) {
+	if (ADC_Filter_Config_Valid(config) == 0) {
+		return 0;
+	}
+
+	memset(filter, 0, sizeof(struct Adc_Filter));
+	filter->config = *config;
+
+	return 1;
+}
+
+/**
+ * @brief  Runs one input through the median, boxcar and IIR stages
+ * @param  filter: Filter chain
+ * @param  input: Block sum for the channel
+ * @retval Filtered block sum
+ */
+uint32_t ADC_Filter_Run(struct Adc_Filter *filter, uint16_t input) {
+	uint32_t output = ADC_Filter_Median(filter, input);
+
+	output = ADC_Filter_Boxcar(filter, (uint16_t)output);
+
+	return ADC_Filter_IIR(filter, output);
+}
+
+/**
+ * @brief  Median of the last 3 or 5 inputs, rejects single block spikes
+ */
+uint32_t ADC_Filter_Median(struct Adc_Filter *filter, uint16_t input) {
+	uint8_t length = filter->config.median_length;
+
+	if (length <= 1) {
+		return input;
+	}
+
+	filter->median_history[filter->median_index] = input;
+	filter->median_index++;
+	if (filter->median_index >= length) {
+		filter->median_index = 0;
+	}
+	if (filter->median_count < length) {
+		filter->median_count++;
+	}
+
+	/* Insertion sort of at most five values */
+	uint16_t sorted[ADC_FILTER_MEDIAN_MAX];
+	for (int i = 0; i < filter->median_count; i++) {
+		uint16_t value = filter->median_history[i];
+		int j = i;
+		while ((j > 0) && (sorted[j-1] > value)) {
+			sorted[j] = sorted[j-1];
+			j--;
+		}
+		sorted[j] = value;
+	}
+
+	return sorted[filter->median_count / 2];
+}
+
+/**
+ * @brief  Running mean of the last 1 << boxcar_shift inputs. The history starts filled with the first input
+ */
+uint32_t ADC_Filter_Boxcar(struct Adc_Filter *filter, uint16_t input) {
+	uint8_t shift = filter->config.boxcar_shift;
+
+	if (shift == 0) {
+		return input;
+	}
+
+	uint32_t length = 1UL << shift;
+
+	if (filter->boxcar_primed == 0) {
+		for (uint32_t i = 0; i < length; i++) {
+			filter->boxcar_history[i] = input;
+		}
+		filter->boxcar_sum = (uint32_t)input << shift;
+		filter->boxcar_primed = 1;
+	}
+
+	filter->boxcar_sum -= filter->boxcar_history[filter->boxcar_index];
+	filter->boxcar_history[filter->boxcar_index] = input;
+	filter->boxcar_sum += input;
+	filter->boxcar_index = (filter->boxcar_index + 1) & (length - 1);
+
+	return (filter->boxcar_sum + (length >> 1)) >> shift;
+}
+
+/**
+ * @brief  First order IIR with a coefficient of 1/2^iir_shift. Starts at the first input
+ */
+uint32_t ADC_Filter_IIR(struct Adc_Filter *filter, uint32_t input) {
+	uint8_t shift = filter->config.iir_shift;
+
+	if (shift == 0) {
+		return input;
+	}
+
+	if (filter->iir_primed == 0) {
+		filter->iir_accumulator = input << shift;
+		filter->iir_primed = 1;
+	}
+	else {
+		filter->iir_accumulator = filter->iir_accumulator - (filter->iir_accumulator >> shift) + input;
+	}
+
+	return filter->iir_accumulator >> shift;
+}
+
+/**
+ * @brief  Adds interleaved scan sequences into per channel sums
+ * @param  samples: First sample of the first sequence, channels samples per sequence
+ * @param  sequences: Number of sequences to add
+ * @param  channels: Number of channels in each sequence
+ * @param  sums: Per channel sums to add to
+ */
+void ADC_Sum_Sequences(const uint16_t *samples, uint32_t sequences, uint32_t channels, uint32_t *sums) {
+	for (uint32_t s = 0; s < sequences; s++) {
+		for (uint32_t i = 0; i < channels; i++) {
+			sums[i] += samples[i];
+		}
+		samples += channels;
+	}
+}
+
+/**
+ * @brief  Converts an ADC code to microvolts using an offset and Q16 scalar
+ * @param  adc_reading: ADC code
+ * @param  offset: Code that reads as zero volts
+ * @param  scalar: Microvolts per code in Q16
+ * @retval Voltage in microvolts
+ */
+uint32_t ADC_Scale_Code(uint32_t adc_reading, uint32_t offset, uint32_t scalar) {
+	uint32_t code = 0;
+	if (adc_reading > offset) {
+		code = adc_reading - offset;
+	}
+
+	/* Split the multiply so the 12 bit code times the Q16 scalar never overflows 32 bits */
+	return (code * (scalar >> ADC_SCALAR_FRACTIONAL_BITS)) + ((code * (scalar & ((1UL << ADC_SCALAR_FRACTIONAL_BITS) - 1))) >> ADC_SCALAR_FRACTIONAL_BITS);
+}
+
+/**
+ * @brief  Converts an ADC code to microvolts using a fitted calibration
+ * @param  adc_reading: ADC code
+ * @param  calibration: Fitted scalar, intercept and curvature
+ * @retval Voltage in microvolts, 0 if the calibration gives a negative voltage
+ */
+uint32_t ADC_Calibrated_Voltage(uint32_t adc_reading, const struct Adc_Calibration *calibration) {
+	int64_t voltage = (int64_t)ADC_Scale_Code(adc_reading, 0, calibration->scalar) + calibration->intercept;
+
+	/* Most channels are linear, only pay for the 64 bit multiply when there is a second order term */
+	if (calibration->curvature != 0) {
+		voltage += ((int64_t)calibration->curvature * (int64_t)((uint64_t)adc_reading * adc_reading)) >> ADC_CURVATURE_FRACTIONAL_BITS;
+	}
+
+	if (voltage < 0) {
+		return 0;
+	}
+	if (voltage > UINT32_MAX) {
+		return UINT32_MAX;
+	}
+	return (uint32_t)voltage;
+}
+
+/**
+ * @brief  Converts microvolts to the ADC code that would read as it. Inverse of ADC_Calibrated_Voltage,
+ * the second order term is taken out by fixed point iteration from the linear answer
+ * @param  voltage: Voltage in microvolts
+ * @param  calibration: Fitted scalar, intercept and curvature
+ * @param  code_max: Largest code to return
+ * @retval ADC code
+ */
+uint32_t ADC_Calibrated_Code(uint32_t voltage, const struct Adc_Calibration *calibration, uint32_t code_max) {
+	if (calibration->scalar == 0) {
+		return code_max;
+	}
+
+	int64_t code = 0;
+	for (int i = 0; i < 8; i++) {
+		int64_t previous = code;
+		int64_t linear = (int64_t)voltage - calibration->intercept;
+		linear -= ((int64_t)calibration->curvature * code * code) >> ADC_CURVATURE_FRACTIONAL_BITS;
+
+		if (linear <= 0) {
+			return 0;
+		}
+
+		code = (linear << ADC_SCALAR_FRACTIONAL_BITS) / calibration->scalar;
+		if (code > code_max) {
+			return code_max;
+		}
+
+		if ((calibration->curvature == 0) || (code == previous)) {
+			break;
+		}
+	}
+	return (uint32_t)code;
+}
+
+/**
+ * @brief  Rescales a reading taken against the current VDDA to the VDDA where VREFINT reads vrefint_reference.
+ * Both readings must come from the same sequences and be 16 bits or less so the product fits 32 bits
+ * @param  adc_reading: Reading to correct
+ * @param  vrefint_reading: VREFINT reading taken with adc_reading
+ * @param  vrefint_reference: VREFINT reading at the reference VDDA, on the same scale as vrefint_reading
+ * @retval Corrected reading, the input reading if vrefint_reading is 0
+ */
+uint32_t ADC_Ratiometric_Correct(uint32_t adc_reading, uint32_t vrefint_reading, uint32_t vrefint_reference) {
+	if (vrefint_reading == 0) {
+		return adc_reading;
+	}
+
+	return ((adc_reading * vrefint_reference) + (vrefint_reading / 2)) / vrefint_reading;
+}
+
+/**
+ * @brief  Computes min, max, mean, variance and a histogram of one channel of interleaved scan sequences
+ * @param  samples: First sample of the first sequence, channels samples per sequence
+ * @param  sequences: Number of sequences
+ * @param  channels: Number of channels in each sequence
+ * @param  channel: Channel to compute
+ * @param  stats: Mean and variance are in codes with ADC_STATISTICS_FRACTIONAL_BITS fractional bits
+ */
+void ADC_Channel_Statistics(const uint16_t *samples, uint32_t sequences, uint32_t channels, uint32_t channel, struct Adc_Channel_Statistics *stats) {
+	memset(stats, 0, sizeof(struct Adc_Channel_Statistics));
+
+	if (sequences == 0) {
+		return;
+	}
+
+	uint64_t sum = 0;
+	uint64_t sum_of_squares = 0;
+	stats->min = UINT16_MAX;
+
+	for (uint32_t s = 0; s < sequences; s++) {
+		uint16_t sample = samples[(s * channels) + channel];
+
+		sum += sample;
+		sum_of_squares += (uint32_t)sample * sample;
+
+		if (sample < stats->min) {
+			stats->min = sample;
+		}
+		if (sample > stats->max) {
+			stats->max = sample;
+		}
+
+		uint32_t bin = sample >> ADC_STATISTICS_HISTOGRAM_SHIFT;
+		if (bin >= ADC_STATISTICS_HISTOGRAM_BINS) {
+			bin = ADC_STATISTICS_HISTOGRAM_BINS - 1;
+		}
+		if (stats->histogram[bin] < UINT16_MAX) {
+			stats->histogram[bin]++;
+		}
+	}
+
+	stats->mean = (uint32_t)((sum << ADC_STATISTICS_FRACTIONAL_BITS) / sequences);
+	stats->variance = (uint32_t)((((sum_of_squares * sequences) - (sum * sum)) << ADC_STATISTICS_FRACTIONAL_BITS) / ((uint64_t)sequences * sequences));
+}
+
+/**
+ * @brief  Picks two common sampling times that give every channel at least its shortest acceptable time for the
+ * least total sampling time. Common 1 is the longest required time, common 2 the shorter time that saves the most
+ * @param  required: Shortest acceptable sampling code of each channel
+ * @param  channels: Number of channels
+ * @param  cycles: Sampling time of each code, increasing with the code
+ * @param  common_1: Selected code for the channels not in the returned mask
+ * @param  common_2: Selected code for the channels in the returned mask
+ * @retval Bitmask of the channels that use common_2
+ */
+uint32_t ADC_Select_Sampling(const uint8_t *required, uint32_t channels, const uint16_t *cycles, uint8_t *common_1, uint8_t *common_2) {
+	uint8_t longest = 0;
+	for (uint32_t i = 0; i < channels; i++) {
+		if (required[i] > longest) {
+			longest = required[i];
+		}
+	}
+
+	uint8_t best = longest;
+	uint32_t best_cost = UINT32_MAX;
+
+	for (uint8_t code = 0; code <= longest; code++) {
+		uint32_t cost = 0;
+		for (uint32_t i = 0; i < channels; i++) {
+			cost += (required[i] <= code) ? cycles[code] : cycles[longest];
+		}
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = code;
+		}
+	}
+
+	uint32_t mask = 0;
+	if (best != longest) {
+		for (uint32_t i = 0; i < channels; i++) {
+			if (required[i] <= best) {
+				mask |= (1UL << i);
+			}
+		}
+	}
+
+	*common_1 = longest;
+	*common_2 = (mask == 0) ? longest : best;
+
+	return mask;
+}
+
+/**
+ * @brief  Clears the slope history
+ */
+void ADC_Slope_Init(struct Adc_Slope *slope) {
+	memset(slope, 0, sizeof(struct Adc_Slope));
+}
+
+/**
+ * @brief  Tracks the rate of change of a filtered value. A point is stored every interval_ms and the rate is the
+ * change from the oldest to the newest stored point, so the baseline grows to (ADC_SLOPE_HISTORY - 1) intervals
+ * @param  value: Latest filtered value, 0 is treated as invalid and clears the history
+ * @param  timestamp_ms: Free running time of the value in ms, wraps at 32 bits
+ * @param  interval_ms: Minimum time between stored points
+ * @retval Rate of change in value units per second, 0 until two points are stored
+ */
+int32_t ADC_Slope_Update(struct Adc_Slope *slope, uint32_t value, uint32_t timestamp_ms, uint32_t interval_ms) {
+	if (value == 0) {
+		ADC_Slope_Init(slope);
+		return 0;
+	}
+
+	uint8_t newest = (slope->index - 1) & (ADC_SLOPE_HISTORY - 1);
+
+	if ((slope->count > 0) && ((timestamp_ms - slope->timestamp[newest]) < interval_ms)) {
+		return slope->rate;
+	}
+
+	slope->value[slope->index] = value;
+	slope->timestamp[slope->index] = timestamp_ms;
+	newest = slope->index;
+	slope->index = (slope->index + 1) & (ADC_SLOPE_HISTORY - 1);
+
+	if (slope->count < ADC_SLOPE_HISTORY) {
+		slope->count++;
+	}
+
+	if (slope->count < 2) {
+		slope->rate = 0;
+		return slope->rate;
+	}
+
+	/* Once the history is full the next slot to be written holds the oldest point */
+	uint8_t oldest = (slope->count < ADC_SLOPE_HISTORY) ? 0 : slope->index;
+
+	uint32_t elapsed_ms = slope->timestamp[newest] - slope->timestamp[oldest];
+	if (elapsed_ms == 0) {
+		return slope->rate;
+	}
+
+	int64_t change = (int64_t)slope->value[newest] - (int64_t)slope->value[oldest];
+
+	slope->rate = (int32_t)((change * 1000) / (int64_t)elapsed_ms);
+
+	return slope->rate;
+}
+
+/**
+ * @brief  Least squares fit of reference microvolts against readings, first or second order
+ * @param  codes: Reading of each point in 1/code_scale ADC codes
+ * @param  code_scale: Number of parts each code is split into, 16 for a 16 sequence block sum
+ * @param  voltages: Reference of each point in microvolts
+ * @param  points: Number of points, more than order and no more than ADC_CALIBRATION_MAX_POINTS
+ * @param  order: 1 fits scalar and intercept, 2 adds curvature
+ * @param  calibration: Fitted calibration, untouched on error
+ * @param  max_residual: Largest error over the points of the fit as it will be applied, in microvolts
+ * @param  rms_residual: RMS error over the points in microvolts
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t ADC_Calibration_Fit(const uint32_t *codes, uint32_t code_scale, const uint32_t *voltages, uint32_t points, uint8_t order,
+		struct Adc_Calibration *calibration, uint32_t *max_residual, uint32_t *rms_residual) {
+	if ((order < 1) || (order > 2) || (points <= order) || (points > ADC_CALIBRATION_MAX_POINTS) || (code_scale == 0)) {
+		return 0;
+	}
+
+	/* Runs once per calibration, so plain doubles. Codes are normalised to full scale to keep the sums near 1 */
+	const double full_scale = 4096.0;
+	const uint32_t terms = order + 1;
+	double matrix[3][4] = {{0}};
+
+	for (uint32_t p = 0; p < points; p++) {
+		double x = ((double)codes[p] / code_scale) / full_scale;
+		double power[3] = {1.0, x, x * x};
+
+		for (uint32_t r = 0; r < terms; r++) {
+			for (uint32_t c = 0; c < terms; c++) {
+				matrix[r][c] += power[r] * power[c];
+			}
+			matrix[r][terms] += power[r] * voltages[p];
+		}
+	}
+
+	/* Gauss-Jordan elimination with partial pivoting on the normal equations */
+	for (uint32_t col = 0; col < terms; col++) {
+		uint32_t pivot = col;
+		for (uint32_t r = col + 1; r < terms; r++) {
+			if (fabs(matrix[r][col]) > fabs(matrix[pivot][col])) {
+				pivot = r;
+			}
+		}
+
+		/* Too few distinct readings for the order asked for */
+		if (fabs(matrix[pivot][col]) < 1e-9) {
+			return 0;
+		}
+
+		for (uint32_t c = 0; c <= terms; c++) {
+			double temp = matrix[col][c];
+			matrix[col][c] = matrix[pivot][c];
+			matrix[pivot][c] = temp;
+		}
+
+		for (uint32_t r = 0; r < terms; r++) {
+			if (r == col) {
+				continue;
+			}
+			double factor = matrix[r][col] / matrix[col][col];
+			for (uint32_t c = col; c <= terms; c++) {
+				matrix[r][c] -= factor * matrix[col][c];
+			}
+		}
+	}
+
+	double intercept = matrix[0][terms] / matrix[0][0];
+	double scalar = (matrix[1][terms] / matrix[1][1]) * ((double)(1UL << ADC_SCALAR_FRACTIONAL_BITS) / full_scale);
+	double curvature = 0.0;
+	if (order == 2) {
+		curvature = (matrix[2][terms] / matrix[2][2]) * (4294967296.0 / (full_scale * full_scale));
+	}
+
+	if ((scalar < 1.0) || (scalar > (double)UINT32_MAX) || (fabs(intercept) > (double)INT32_MAX) || (fabs(curvature) > (double)INT32_MAX)) {
+		return 0;
+	}
+
+	struct Adc_Calibration fit;
+	fit.scalar = (uint32_t)(scalar + 0.5);
+	fit.intercept = (int32_t)lround(intercept);
+	fit.curvature = (int32_t)lround(curvature);
+
+	/* Residuals of the rounded fixed point coefficients, which is what the readings will see */
+	double worst = 0.0;
+	double square_sum = 0.0;
+	for (uint32_t p = 0; p < points; p++) {
+		double x = (double)codes[p] / code_scale;
+		double fitted = ((fit.scalar * x) / (double)(1UL << ADC_SCALAR_FRACTIONAL_BITS)) + fit.intercept + ((fit.curvature * x * x) / 4294967296.0);
+		double error = fabs((double)voltages[p] - fitted);
+
+		if (error > worst) {
+			worst = error;
+		}
+		square_sum += error * error;
+	}
+
+	*calibration = fit;
+	*max_residual = (uint32_t)(worst + 0.5);
+	*rms_residual = (uint32_t)(sqrt(square_sum / points) + 0.5);
+
+	return 1;
+}
+
+/**
+ * @brief  Clears a drift estimate
+ */
+void ADC_Drift_Init(struct Adc_Drift *drift) {
+	memset(drift, 0, sizeof(struct Adc_Drift));
+}
+
+/**
+ * @brief  Adds one difference to a drift estimate. The first 1 << shift differences are a plain average, after that each
+ * new difference has a weight of 1 / (1 << shift). The bound is ADC_DRIFT_BOUND_SIGMA standard errors of the mean
+ * @param  drift: Estimate to update
+ * @param  difference: Measurement minus reference
+ * @param  shift: Log2 of the number of differences the estimate spans
+ */
+void ADC_Drift_Update(struct Adc_Drift *drift, int32_t difference, uint8_t shift) {
+	if (drift->samples < UINT32_MAX) {
+		drift->samples++;
+	}
+
+	int64_t weight = 1LL << shift;
+	if (drift->samples < weight) {
+		weight = drift->samples;
+	}
+
+	/* Welford's update, the product of the errors before and after the mean moves is never negative */
+	int64_t error = (int64_t)difference - drift->mean;
+	drift->mean += (int32_t)(error / weight);
+	int64_t spread = error * ((int64_t)difference - drift->mean);
+	drift->variance += (spread - drift->variance) / weight;
+
+	drift->bound = ADC_DRIFT_BOUND_SIGMA * ADC_Square_Root((uint64_t)drift->variance / (uint64_t)weight);
+}
+
+/**
+ * @brief  Integer square root
+ * @param  value: Value to take the root of
+ * @retval Largest integer whose square is no more than value
+ */
+uint32_t ADC_Square_Root(uint64_t value) {
+	uint64_t root = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > value) {
+		bit >>= 2;
+	}
+
+	while (bit != 0) {
+		if (value >= root + bit) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return (uint32_t)root;
+}
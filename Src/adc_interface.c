@@ -7,6 +7,9 @@
 
 #include "adc_interface.h"
 #include "battery.h"
+#include "bq25703a_regulator.h"
+#include "flash_store.h"
+#include "measurement.h"
 
 #include "stm32g0xx_hal_flash.h"
 
@@ -15,6 +18,7 @@
 #include "string.h"
 
 extern ADC_HandleTypeDef hadc1;
+extern TIM_HandleTypeDef htim6;
 
 /* Private typedef -----------------------------------------------------------*/
 struct Adc {
@@ -28,13 +32,93 @@ struct Adc {
 	uint32_t four_s_battery_voltage;
 };
 
+struct Adc_Fast {
+	uint32_t bat_voltage;
+	uint32_t tap_voltage[4];
+	uint32_t cell_voltage[4];
+};
+
+/* Sampling time codes of the two common groups and the channels, bit 0 XT60 to bit 6 VREFINT, on Common2 */
+struct Adc_Sampling {
+	uint8_t common_1;
+	uint8_t common_2;
+	uint8_t common_2_mask;
+};
+
+/* Reference points collected by cal_point, readings are filtered block sums of the XT60 and balance taps */
+struct Adc_Calibration_Session {
+	uint32_t codes[SCALAR_ARRAY_SIZE][ADC_CALIBRATION_MAX_POINTS];
+	uint32_t voltage[ADC_CALIBRATION_MAX_POINTS];
+	uint8_t points;
+	uint8_t order;
+	uint32_t max_residual[SCALAR_ARRAY_SIZE];
+	uint32_t rms_residual[SCALAR_ARRAY_SIZE];
+};
+
+/* Calibration kept in the flash store, count is the number of calibrations saved over the life of the unit */
+struct Adc_Calibration_Record {
+	struct Adc_Calibration calibration[SCALAR_ARRAY_SIZE];
+	uint32_t max_residual[SCALAR_ARRAY_SIZE];
+	uint32_t rms_residual[SCALAR_ARRAY_SIZE];
+	uint8_t order;
+	uint8_t points;
+	uint16_t count;
+};
+
+/* One DMA block reduced by the ISR. Two are kept, the ISR fills one while vRead_ADC reads the other */
+struct Adc_Block {
+	uint16_t sum[ADC_NUMBER_OF_CHANNELS];
+	uint16_t fast[ADC_NUMBER_OF_CHANNELS];
+	TickType_t timestamp;
+	uint32_t sequence;
+};
+
 /* Private variables ---------------------------------------------------------*/
 struct Adc adc_values;
-uint32_t adc_buffer[7];
-static volatile uint32_t adc_scalars[SCALAR_ARRAY_SIZE], adc_offset[SCALAR_ARRAY_SIZE], adc_buffer_filtered[7], adc_filtered_output[7];
-static volatile uint32_t adc_sum_count;
+struct Adc_Fast adc_fast_values;
+uint16_t adc_buffer[ADC_DMA_BUFFER_SEQUENCES][ADC_NUMBER_OF_CHANNELS];
+static volatile uint32_t adc_scalars[SCALAR_ARRAY_SIZE], adc_offset[SCALAR_ARRAY_SIZE], adc_filtered_output[ADC_NUMBER_OF_CHANNELS];
+static uint32_t adc_filtered_sum[ADC_NUMBER_OF_CHANNELS];
+static struct Adc_Calibration adc_calibration[SCALAR_ARRAY_SIZE];
+static struct Adc_Calibration_Session adc_cal_session;
+static struct Adc_Block adc_blocks[2];
+static volatile uint8_t adc_block_ready;
+static uint32_t adc_block_sequence, adc_last_sequence, adc_block_overruns;
+static struct Adc_Slope adc_slopes[SCALAR_ARRAY_SIZE];
+static int32_t adc_dvdt[SCALAR_ARRAY_SIZE];
+static uint32_t adc_timestamp;
+static struct Adc_Filter adc_filters[ADC_NUMBER_OF_CHANNELS];
+static struct Adc_Filter_Config adc_filter_config[ADC_NUMBER_OF_CHANNELS];
+static volatile uint8_t adc_filter_reset_mask;
+static volatile uint8_t adc_filter_restart;
+static uint16_t adc_capture_buffer[ADC_CAPTURE_MAX_SEQUENCES][ADC_NUMBER_OF_CHANNELS];
+static volatile uint32_t adc_capture_index, adc_capture_length;
+static volatile uint8_t adc_capture_state;
+static volatile TickType_t adc_block_tick;
+static uint32_t adc_max_latency;
+static uint32_t adc_sample_rate;
+static volatile uint32_t adc_awd_trip_count;
+static volatile uint32_t adc_awd_xt60_high, adc_awd_xt60_low, adc_awd_cell_high;
+static volatile uint8_t adc_awd_armed;
 static volatile uint16_t vrefint_cal;
+static uint32_t vrefint_nominal;
 static volatile uint8_t cal_present;
+static struct Adc_Sampling adc_sampling = {ADC_SAMPLING_DEFAULT_COMMON_1, ADC_SAMPLING_DEFAULT_COMMON_2, ADC_SAMPLING_DEFAULT_COMMON_2_MASK};
+static volatile uint8_t adc_tuning;
+static uint16_t adc_diag_last_sum[ADC_NUMBER_OF_CHANNELS];
+static uint8_t adc_diag_stuck_count[ADC_NUMBER_OF_CHANNELS];
+static uint32_t adc_diag_clear_blocks;
+static uint32_t adc_diag_vrefint_min, adc_diag_vrefint_max;
+static struct Adc_Drift adc_xcal[ADC_XCAL_REFERENCES];
+static uint32_t adc_xcal_sequence;
+static volatile uint8_t adc_xcal_reset;
+static uint16_t adc_cal_count;
+
+/* Scan sequence order, matches the ranks set in MX_ADC1_Init */
+static const uint32_t adc_channels[ADC_NUMBER_OF_CHANNELS] = {ADC_CHANNEL_4, ADC_CHANNEL_3, ADC_CHANNEL_2, ADC_CHANNEL_1, ADC_CHANNEL_0, ADC_CHANNEL_TEMPSENSOR, ADC_CHANNEL_VREFINT};
+
+/* Sampling time of each SMPR code in half ADC clock cycles, 1.5 to 160.5 */
+static const uint16_t adc_sampling_half_cycles[ADC_SAMPLING_CODES] = {3, 7, 15, 25, 39, 79, 159, 321};
 
 /* Private function prototypes -----------------------------------------------*/
 uint8_t Set_Battery_Voltage(uint32_t adc_reading);
@@ -42,6 +126,37 @@ uint8_t Set_Cell_Voltage(uint8_t cell_number, uint32_t adc_reading);
 uint8_t Set_MCU_Temperature(uint32_t adc_reading);
 uint8_t Set_VDDa(uint32_t adc_reading);
 uint8_t Read_Scalars_From_Flash(void);
+uint8_t Read_Sampling_From_Flash(void);
+uint8_t Write_Sampling_To_Flash(void);
+uint8_t Read_Calibration_From_Flash(void);
+void ADC_Set_Linear_Calibration(void);
+uint8_t ADC_Tune_Measure(uint8_t code, uint32_t sample_rate_hz, uint32_t *mean, uint32_t *variance);
+void ADC_Restart_Acquisition(uint32_t sample_rate_hz);
+uint32_t ADC_Code_To_Voltage(uint8_t channel, uint32_t adc_reading);
+uint8_t Is_Valid_OTP_Scalar(uint32_t value);
+void ADC_Process_Block(const uint16_t (*block)[ADC_NUMBER_OF_CHANNELS]);
+void ADC_Notify_From_ISR(uint32_t notification);
+void ADC_Capture_Block(const uint16_t (*block)[ADC_NUMBER_OF_CHANNELS]);
+void Set_Fast_Voltages(const uint16_t *fast_output);
+void ADC_Start_Acquisition(uint32_t sample_rate_hz);
+void ADC_Filter_Defaults(void);
+uint8_t ADC_Filter_Block(const uint16_t *block_sum);
+void ADC_Watchdog_Init(void);
+void ADC_Watchdog_Update(void);
+void ADC_Watchdog_Trip(uint32_t watchdog_it, uint32_t error_bitmask);
+uint32_t ADC_Voltage_To_Code(uint8_t channel, uint32_t voltage);
+void ADC_Update_Slopes(uint32_t timestamp_ms);
+void ADC_Diagnostics(const struct Adc_Block *block);
+
+/**
+ * @brief  Converts a filtered ADC code to a voltage using the channel calibration. Integer only.
+ * @param  channel: Scalar index, 0 XT60, 1-4 balance taps
+ * @param  adc_reading: Filtered reading from ADC
+ * @retval Voltage in volts * BATTERY_ADC_MULTIPLIER
+ */
+uint32_t ADC_Code_To_Voltage(uint8_t channel, uint32_t adc_reading) {
+	return ADC_Calibrated_Voltage(adc_reading, &adc_calibration[channel]);
+}
 
 /**
  * @brief Gets the battery voltage that was read in from the ADC
@@ -62,7 +177,7 @@ uint8_t Set_Battery_Voltage(uint32_t adc_reading) {
 		return 0;
 	}
 
-	adc_values.bat_voltage = adc_reading * adc_scalars[0];
+	adc_values.bat_voltage = ADC_Code_To_Voltage(0, adc_reading);
 
 	return 1;
 }
@@ -97,7 +212,7 @@ uint8_t Set_Cell_Voltage(uint8_t cell_number, uint32_t adc_reading) {
 			return 0;
 		}
 		else {
-			adc_values.cell_voltage[0] = adc_reading * adc_scalars[1];
+			adc_values.cell_voltage[0] = ADC_Code_To_Voltage(1, adc_reading);
 
 			if (adc_values.cell_voltage[0] > CELL_MAX_VOLTAGE) {
 				adc_values.cell_voltage[0] = 0;
@@ -113,7 +228,7 @@ uint8_t Set_Cell_Voltage(uint8_t cell_number, uint32_t adc_reading) {
 			return 0;
 		}
 		else {
-			adc_values.two_s_battery_voltage = adc_reading * adc_scalars[2];
+			adc_values.two_s_battery_voltage = ADC_Code_To_Voltage(2, adc_reading);
 
 			if (adc_values.two_s_battery_voltage > TWO_S_MAX_VOLTAGE) {
 				adc_values.two_s_battery_voltage = 0;
@@ -136,7 +251,7 @@ uint8_t Set_Cell_Voltage(uint8_t cell_number, uint32_t adc_reading) {
 			return 0;
 		}
 		else {
-			adc_values.three_s_battery_voltage = adc_reading * adc_scalars[3];
+			adc_values.three_s_battery_voltage = ADC_Code_To_Voltage(3, adc_reading);
 
 			if (adc_values.three_s_battery_voltage > THREE_S_MAX_VOLTAGE) {
 				adc_values.three_s_battery_voltage = 0;
@@ -159,7 +274,7 @@ uint8_t Set_Cell_Voltage(uint8_t cell_number, uint32_t adc_reading) {
 			return 0;
 		}
 		else {
-			adc_values.four_s_battery_voltage = adc_reading * adc_scalars[4];
+			adc_values.four_s_battery_voltage = ADC_Code_To_Voltage(4, adc_reading);
 
 			if (adc_values.four_s_battery_voltage > FOUR_S_MAX_VOLTAGE) {
 				adc_values.four_s_battery_voltage = 0;
@@ -179,6 +294,66 @@ uint8_t Set_Cell_Voltage(uint8_t cell_number, uint32_t adc_reading) {
 	return 1;
 }
 
+/**
+ * @brief  Converts a voltage to the raw ADC code that would read as it. Inverse of ADC_Code_To_Voltage
+ * @param  channel: Scalar index, 0 XT60, 1-4 balance taps
+ * @param  voltage: Voltage in volts * BATTERY_ADC_MULTIPLIER
+ * @retval ADC code, limited to ADC_AWD_CODE_MAX
+ */
+uint32_t ADC_Voltage_To_Code(uint8_t channel, uint32_t voltage) {
+	uint32_t code = ADC_Calibrated_Code(voltage, &adc_calibration[channel], ADC_AWD_CODE_MAX);
+
+	/* The watchdogs see raw codes, undo the ratiometric correction at the last filtered VDDA */
+	code = ADC_Ratiometric_Correct(code, vrefint_nominal, adc_filtered_output[6]);
+	if (code > ADC_AWD_CODE_MAX) {
+		return ADC_AWD_CODE_MAX;
+	}
+	return code;
+}
+
+/**
+ * @brief Gets the battery voltage averaged over the fast window
+ * @retval Battery voltage in volts * BATTERY_ADC_MULTIPLIER
+ */
+uint32_t Get_Fast_Battery_Voltage(void) {
+	return adc_fast_values.bat_voltage;
+}
+
+/**
+ * @brief Gets cell X voltage averaged over the fast window
+ * @param  cell_number: Cell number 0-3 to get voltage
+ * @retval Cell voltage in volts * BATTERY_ADC_MULTIPLIER
+ */
+uint32_t Get_Fast_Cell_Voltage(uint8_t cell_number) {
+	if (cell_number > 3) {
+		return UINT32_MAX;
+	}
+	return adc_fast_values.cell_voltage[cell_number];
+}
+
+/**
+ * @brief  Converts the fast window readings of the XT60 and balance taps into voltages
+ */
+void Set_Fast_Voltages(const uint16_t *fast_output) {
+	uint32_t vrefint_reading = fast_output[6];
+
+	adc_fast_values.bat_voltage = ADC_Code_To_Voltage(0, ADC_Ratiometric_Correct(fast_output[0], vrefint_reading, vrefint_nominal));
+
+	uint32_t previous_tap_voltage = 0;
+	for (int i = 0; i < 4; i++) {
+		uint32_t tap_voltage = ADC_Code_To_Voltage(i+1, ADC_Ratiometric_Correct(fast_output[i+1], vrefint_reading, vrefint_nominal));
+		adc_fast_values.tap_voltage[i] = tap_voltage;
+
+		if (tap_voltage > previous_tap_voltage) {
+			adc_fast_values.cell_voltage[i] = tap_voltage - previous_tap_voltage;
+		}
+		else {
+			adc_fast_values.cell_voltage[i] = 0;
+		}
+		previous_tap_voltage = tap_voltage;
+	}
+}
+
 /**
  * @brief Gets mcu junction temperature that was read in from the ADC
  * @retval MCU junction temperature in celcius
@@ -225,13 +400,14 @@ uint8_t Set_VDDa(uint32_t adc_reading) {
 }
 
 /**
- * @brief  Calculates and sets the ADC scalars based on a reference voltage input
+ * @brief  Calculates and sets the ADC scalars based on a reference voltage input, a 0 mV reference records the offsets.
+ * Replaces any fitted calibration with the single point one
  * @param  reference_voltage: Reference voltage in milivolts
  * @retval uint8_t 1 if successful, 0 if error
  */
 uint8_t Calibrate_ADC(float reference_voltage_mv) {
 
-	if (reference_voltage_mv > 4200.0f) {
+	if (reference_voltage_mv > ADC_CALIBRATION_MAX_MV) {
 		return 0;
 	}
 
@@ -245,233 +421,1365 @@ uint8_t Calibrate_ADC(float reference_voltage_mv) {
 		}
 	}
 	else {
+		uint64_t reference_voltage = (uint64_t)(reference_voltage_mv * (BATTERY_ADC_MULTIPLIER / 1000));
+
 		for (int i = 0; i < 5; i++) {
-			float scale = (reference_voltage_mv * BATTERY_ADC_MULTIPLIER) / (adc_filtered_output[i] * 1000);
-			adc_scalars[i] = (uint32_t)scale;
+			if (adc_filtered_output[i] <= adc_offset[i]) {
+				return 0;
+			}
+			adc_scalars[i] = (uint32_t)((reference_voltage << ADC_SCALAR_FRACTIONAL_BITS) / (adc_filtered_output[i] - adc_offset[i]));
 
-			printf("ADC Channel %u scalar: %u\r\n", i, adc_scalars[i]);
+			printf("ADC Channel %u scalar (Q16): %u\r\n", i, adc_scalars[i]);
 		}
 	}
 
+	ADC_Set_Linear_Calibration();
+
 	return 1;
 }
 
-void vRead_ADC(void const *pvParameters) {
-	// calibrate ADC
-	vTaskDelay(500 / portTICK_PERIOD_MS);
-	while (HAL_ADCEx_Calibration_Start(&hadc1) != HAL_OK);
-	vTaskDelay(500 / portTICK_PERIOD_MS);
-	vrefint_cal = (uint32_t)(*VREFINT_CAL_ADDR); // VREFINT calibration value
+/**
+ * @brief  Sets every channel's calibration to the single point scalar and offset, no second order term
+ */
+void ADC_Set_Linear_Calibration(void) {
+	for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
+		struct Adc_Calibration calibration;
+		calibration.scalar = adc_scalars[i];
+		calibration.intercept = -(int32_t)ADC_Scale_Code(adc_offset[i], 0, adc_scalars[i]);
+		calibration.curvature = 0;
+
+		taskENTER_CRITICAL();
+		adc_calibration[i] = calibration;
+		taskEXIT_CRITICAL();
+	}
 
-	//Read the scalars out of OTP flash
-	Read_Scalars_From_Flash();
+	adc_xcal_reset = 1;
+}
 
-	adc_sum_count = 0;
+/**
+ * @brief  Records the filtered XT60 and balance tap readings against a reference voltage as one calibration point
+ * @param  reference_voltage_mv: Reference voltage on cells 1-4 and the XT60 in milivolts
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Add_ADC_Calibration_Point(float reference_voltage_mv) {
+	if ((reference_voltage_mv < 0.0f) || (reference_voltage_mv > ADC_CALIBRATION_MAX_MV) ||
+			(adc_cal_session.points >= ADC_CALIBRATION_MAX_POINTS)) {
+		return 0;
+	}
 
-	static uint32_t thread_notification;
-	const TickType_t xMaxBlockTime = pdMS_TO_TICKS(500);
+	uint8_t point = adc_cal_session.points;
 
-	// Start the DMA ADC
-	HAL_ADC_Start_DMA(&hadc1, adc_buffer, hadc1.Init.NbrOfConversion);
+	adc_cal_session.voltage[point] = (uint32_t)(reference_voltage_mv * (BATTERY_ADC_MULTIPLIER / 1000));
 
-	for (;;) {
-		/* Wait to be notified of an interrupt. */
-		thread_notification = ulTaskNotifyTake(pdTRUE, xMaxBlockTime);
+	/* vRead_ADC rewrites the sums every window, copy them out together */
+	uint32_t filtered_sum[SCALAR_ARRAY_SIZE];
 
-		if (thread_notification) {
+	taskENTER_CRITICAL();
+	for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
+		filtered_sum[i] = adc_filtered_sum[i];
+	}
+	taskEXIT_CRITICAL();
 
-			/* A notification was received. */
-			Set_Battery_Voltage(adc_filtered_output[0]);
+	for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
+		adc_cal_session.codes[i][point] = filtered_sum[i];
 
-			for (int i = 0; i < 4; i++) {
-				Set_Cell_Voltage(i, adc_filtered_output[i+1]);
-			}
+		printf("ADC Channel %u reading: %.3f\r\n", i, (float)filtered_sum[i] / ADC_DMA_BLOCK_SEQUENCES);
+	}
 
-			Set_MCU_Temperature(adc_filtered_output[5]);
+	adc_cal_session.points++;
 
-			Set_VDDa(adc_filtered_output[6]);
+	return 1;
+}
 
-			/* Determines battery connection state and performs balancing */
-			Battery_Connection_State();
+/**
+ * @brief  Discards the collected calibration points
+ */
+void Clear_ADC_Calibration_Points(void) {
+	memset(&adc_cal_session, 0, sizeof(adc_cal_session));
+}
 
-		} else {
-			/* Did not receive a notification within the expected time. */
-			printf("Did Not Receive an ADC Notification\r\n");
-		}
-	}
+/**
+ * @brief  Gets the number of calibration points collected
+ * @retval Number of points
+ */
+uint8_t Get_ADC_Calibration_Points(void) {
+	return adc_cal_session.points;
 }
 
-void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc) {
-	/* tCONV = Sampling time + 12.5 x ADC clock cycles
-	 For 160 sample time and 16MHz clock divided by 4
-	 tCONV = (160 + 12.5) x 1/(16MHz/4) = 43.125us
-	 For 6 reads = 258.75us or 3.864kHz */
+/**
+ * @brief  Fits every channel to the collected points by least squares and applies the result. Nothing is applied
+ * unless every channel fits with a scalar in range
+ * @param  order: 1 for scalar and intercept, 2 to add a second order correction
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Fit_ADC_Calibration(uint8_t order) {
+	struct Adc_Calibration fit[SCALAR_ARRAY_SIZE];
+
+	for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
+		if (ADC_Calibration_Fit(adc_cal_session.codes[i], ADC_DMA_BLOCK_SEQUENCES, adc_cal_session.voltage, adc_cal_session.points, order,
+				&fit[i], &adc_cal_session.max_residual[i], &adc_cal_session.rms_residual[i]) == 0) {
+			printf("ERROR: ADC Channel %u could not be fitted\r\n", i);
+			return 0;
+		}
 
-	unsigned length = sizeof(adc_buffer_filtered)/sizeof(adc_buffer_filtered[0]);
+		if ((fit[i].scalar < ADC_SCALAR_Q16_MIN) || (fit[i].scalar > ADC_SCALAR_Q16_MAX)) {
+			printf("ERROR: ADC Channel %u scalar out of range\r\n", i);
+			return 0;
+		}
 
-	for(unsigned i = 0; i < length; i++) {
-		adc_buffer_filtered[i] += adc_buffer[i];
+		printf("ADC Channel %u scalar (Q16): %u intercept (uV): %d curvature (Q32): %d max residual (uV): %u rms residual (uV): %u\r\n",
+				i, fit[i].scalar, fit[i].intercept, fit[i].curvature, adc_cal_session.max_residual[i], adc_cal_session.rms_residual[i]);
 	}
 
-	adc_sum_count++;
+	adc_cal_session.order = order;
 
-	if (adc_sum_count == ADC_FILTER_SUM_COUNT) {
+	for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
+		taskENTER_CRITICAL();
+		adc_calibration[i] = fit[i];
+		taskEXIT_CRITICAL();
+	}
 
-		length = sizeof(adc_filtered_output)/sizeof(adc_filtered_output[0]);
+	adc_xcal_reset = 1;
 
-		for(unsigned i = 0; i < length; i++) {
-			adc_filtered_output[i] = ( adc_buffer_filtered[i] / ADC_FILTER_SUM_COUNT );
-		}
+	return 1;
+}
 
-		adc_sum_count = 0;
+void vRead_ADC(void const *pvParameters) {
+	ADC_Task_Init();
 
-		// Clear the buffer
-		memset((uint32_t *)adc_buffer_filtered, 0, sizeof(adc_buffer_filtered));
+	static uint32_t thread_notification;
+	// Allow two blocks at the slowest sample rate
+	const TickType_t xMaxBlockTime = pdMS_TO_TICKS(((2 * ADC_DMA_BLOCK_SEQUENCES * 1000) / ADC_SAMPLE_RATE_MIN_HZ) + 500);
 
-		BaseType_t should_context_switch = pdFALSE;
-		vTaskNotifyGiveFromISR(adcTaskHandle, &should_context_switch);
-		portYIELD_FROM_ISR(should_context_switch);
+	for (;;) {
+		/* Wait to be notified of an interrupt. */
+		if (xTaskNotifyWait(0, ADC_NOTIFY_ALL, &thread_notification, xMaxBlockTime) == pdTRUE) {
+			ADC_Task_Process(thread_notification);
+		} else {
+			/* Did not receive a notification within the expected time. */
+			printf("Did Not Receive an ADC Notification\r\n");
+		}
 	}
 }
 
-uint32_t Get_Two_S_Voltage() {
-	return adc_values.two_s_battery_voltage;
-}
+/**
+ * @brief  Calibrates the ADC, loads the saved calibration and sampling times and starts acquisition.
+ * Called once by vRead_ADC before it waits for blocks
+ */
+void ADC_Task_Init(void) {
+	// calibrate ADC
+	vTaskDelay(500 / portTICK_PERIOD_MS);
+	while (HAL_ADCEx_Calibration_Start(&hadc1) != HAL_OK);
+	vTaskDelay(500 / portTICK_PERIOD_MS);
+	vrefint_cal = (uint32_t)(*VREFINT_CAL_ADDR); // VREFINT calibration value
 
-uint32_t Get_Three_S_Voltage() {
-	return adc_values.three_s_battery_voltage;
-}
+	// VREFINT code at the nominal VDDA, the reference for ratiometric correction
+	vrefint_nominal = ((uint32_t)vrefint_cal * VREFINT_CAL_VREF) / ADC_VDDA_NOMINAL_MV;
 
-uint32_t Get_Four_S_Voltage() {
-	return adc_values.four_s_battery_voltage;
+	// VREFINT reads higher as VDDA falls
+	adc_diag_vrefint_min = ((uint32_t)vrefint_cal * VREFINT_CAL_VREF) / ADC_DIAG_VDDA_MAX_MV;
+	adc_diag_vrefint_max = ((uint32_t)vrefint_cal * VREFINT_CAL_VREF) / ADC_DIAG_VDDA_MIN_MV;
+
+	//Index the flash store once, records are looked up from RAM after this
+	Flash_Store_Init();
+
+	//A calibration in the flash store replaces the OTP scalars, so OTP is only scanned without one
+	if (Read_Calibration_From_Flash() == 0) {
+		uint32_t start = Flash_Store_Time_Us();
+		Read_Scalars_From_Flash();
+		printf("OTP scan time (us): %u\r\n", Flash_Store_Time_Us() - start);
+	}
+
+	//Read tuned sampling times, the defaults stay if none were saved
+	Read_Sampling_From_Flash();
+
+	ADC_Filter_Defaults();
+
+	ADC_Start_Acquisition(ADC_SAMPLE_RATE_DEFAULT_HZ);
 }
 
 /**
- * @brief  Writes the cal result to OTP Flash
- * @retval uint8_t 1 if successful, 0 if error
+ * @brief  Runs the fast path for the block the ISR handed over and the slow path when it completes a filter window.
+ * Called by vRead_ADC for each notification
+ * @param  notification: Notification bits from the ISR
  */
-uint8_t Write_Cal_To_OTP_Flash() {
-	HAL_StatusTypeDef status;
+void ADC_Task_Process(uint32_t notification) {
+	uint32_t latency = (xTaskGetTickCount() - adc_block_tick) * portTICK_PERIOD_MS;
+	if (latency > adc_max_latency) {
+		adc_max_latency = latency;
+	}
 
-	/* Check input parameters */
-	for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
-		if ((adc_scalars[i] < 750) || (adc_scalars[i] > 5000)) {
-			printf("ERROR: ADC Scalar %u Not Set or Out of Range\r\n", i);
-			/* Return error */
-			return 1;
-		}
+	if ((notification & ADC_NOTIFY_BLOCK) == 0) {
+		return;
 	}
 
-	if (HAL_FLASH_Unlock() != HAL_OK) {
-		printf("ERROR: Could not unlock Flash\r\n");
-		return 1;
+	/* The ISR has moved on to the other buffer, this one stays put until the block after next. Work from a copy */
+	uint8_t ready = adc_block_ready;
+	struct Adc_Block block = adc_blocks[ready];
+
+	/* Notifications set bits, so blocks the task was too late for merge into one and are skipped. Count them */
+	if ((adc_last_sequence != 0) && ((block.sequence - adc_last_sequence) > 1)) {
+		adc_block_overruns += block.sequence - adc_last_sequence - 1;
 	}
+	adc_last_sequence = block.sequence;
 
-	uint32_t address = OTP_START_ADDR;
-	uint32_t temp_address = OTP_START_ADDR;
+	/* The ISR numbers a buffer before refilling it, a new number means it came round again during the copy */
+	__DMB();
+	if (*(volatile uint32_t *)&adc_blocks[ready].sequence != block.sequence) {
+		adc_block_overruns++;
+		return;
+	}
 
-	for (int i = 0; i < OTP_SIZE; i++) {
+	/* Readings taken during a sampling time sweep are not valid voltages */
+	if (adc_tuning == 1) {
+		return;
+	}
 
-		for (int x = 0; x < SCALAR_ARRAY_SIZE; x++) {
-			uint32_t value = *(uint32_t *)(temp_address + (i * BYTES_IN_UINT64) + (x * BYTES_IN_UINT32));
-			if ((value > 750) && (value < 5000)) {
-				printf("OTP Memory Value: %u\r\n", value);
-				address = temp_address + ((i + 1) * BYTES_IN_UINT64);
-			}
-			else {
-				break;
-			}
-		}
+	/* Fast path, over/under voltage and disconnect checks every block */
+	Set_Fast_Voltages(block.fast);
+
+	ADC_Diagnostics(&block);
+
+	Battery_Fast_Safety_Check();
+
+	/* Bleed PWM runs per block, its windows line up with the filter windows */
+	Balance_PWM_Update();
+
+	/* The charger sees a fast path disconnect or trip at its next poll, not a window later */
+	Publish_Battery_State();
+
+	if (ADC_Filter_Block(block.sum) == 0) {
+		return;
 	}
 
-	printf("OPT Scalar Start Address: 0x%08x\r\n", address);
+	/* Slow path, a complete filter window was received. */
+	Set_Battery_Voltage(adc_filtered_output[0]);
 
-	uint64_t data_in_64;
+	for (int i = 0; i < 4; i++) {
+		Set_Cell_Voltage(i, adc_filtered_output[i+1]);
+	}
 
-	//Write Calibration Values
-	for (int i = 0; i < 3; i++) {
-		/* Write double */
-		if (i < 2) {
-			data_in_64 = adc_scalars[i*2] | (uint64_t)adc_scalars[(i*2)+1] << 32;
+	Set_MCU_Temperature(adc_filtered_output[5]);
+
+	Set_VDDa(adc_filtered_output[6]);
+
+	ADC_Update_Slopes(block.timestamp * portTICK_PERIOD_MS);
+
+	/* Determines battery connection state and performs balancing */
+	Battery_Connection_State();
+
+	/* Follow the number of cells and connection state, re-arm tripped watchdogs */
+	ADC_Watchdog_Update();
+
+	Publish_Battery_Measurements();
+}
+
+/**
+ * @brief  Checks one block for saturated or stuck channels, impossible tap ordering and an out of range VREFINT.
+ * Called from vRead_ADC after Set_Fast_Voltages
+ * @param  block: Block sums and fast averages from the ISR
+ */
+void ADC_Diagnostics(const struct Adc_Block *block) {
+	uint32_t faults = 0;
+
+	for (int i = 0; i < ADC_NUMBER_OF_CHANNELS; i++) {
+		uint32_t sum = block->sum[i];
+
+		if (sum >= (ADC_DMA_BLOCK_SEQUENCES * ADC_DIAG_SATURATION_CODE)) {
+			faults |= ADC_SATURATION_ERROR;
+		}
+
+		if (sum == adc_diag_last_sum[i]) {
+			if (adc_diag_stuck_count[i] < UINT8_MAX) {
+				adc_diag_stuck_count[i]++;
+			}
 		}
 		else {
-			uint32_t mask = 0xFFFFFFFF;
-			data_in_64 = adc_scalars[i*2] | (uint64_t)mask << 32;
+			adc_diag_stuck_count[i] = 0;
 		}
+		adc_diag_last_sum[i] = sum;
 
-		printf("Writing 0x%016llx to address: 0x%08x\r\n", (uint64_t)data_in_64, (uint32_t)(address + (i * BYTES_IN_UINT64)));
+		if ((ADC_DIAG_STUCK_BLOCKS != 0) && (adc_diag_stuck_count[i] >= ADC_DIAG_STUCK_BLOCKS) &&
+				(sum >= (ADC_DMA_BLOCK_SEQUENCES * ADC_DIAG_STUCK_MIN_CODE)) && (sum < (ADC_DMA_BLOCK_SEQUENCES * ADC_DIAG_SATURATION_CODE))) {
+			faults |= ADC_STUCK_CHANNEL_ERROR;
+		}
+	}
 
-		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, (address + (i * BYTES_IN_UINT64)), data_in_64);
+	for (int i = 1; i < 4; i++) {
+		if ((adc_fast_values.tap_voltage[i] > ADC_DIAG_TAP_PRESENT_VOLTAGE) &&
+				((adc_fast_values.tap_voltage[i] + ADC_DIAG_TAP_ORDER_MARGIN) < adc_fast_values.tap_voltage[i-1])) {
+			faults |= TAP_ORDER_ERROR;
+		}
+	}
 
-		if (status != HAL_OK) {
-			printf("ERROR: Write scalar #%u to OTP Flash Failed\r\n", i);
+	if ((block->fast[6] < adc_diag_vrefint_min) || (block->fast[6] > adc_diag_vrefint_max)) {
+		faults |= VREFINT_ERROR;
+	}
 
-			if (HAL_FLASH_Lock() != HAL_OK) {
-				printf("ERROR: Could not lock Flash\r\n");
-				return 1;
-			}
+	if (faults != 0) {
+		adc_diag_clear_blocks = 0;
 
-			/* Return error */
-			return 1;
+		if ((faults & ~Get_Error_State()) != 0) {
+			Set_Error_State(faults);
+			Regulator_HI_Z(1);
 		}
 	}
+	else if ((Get_Error_State() & ADC_DIAGNOSTIC_ERRORS) != 0) {
+		adc_diag_clear_blocks++;
 
-	if (HAL_FLASH_Lock() != HAL_OK) {
-		printf("ERROR: Could not lock Flash\r\n");
-		return 1;
+		if (adc_diag_clear_blocks >= ADC_FILTER_OUTPUT_BLOCKS) {
+			Clear_Error_State(ADC_DIAGNOSTIC_ERRORS);
+			adc_diag_clear_blocks = 0;
+		}
 	}
-
-	return 0;
 }
 
 /**
- * @brief  Read the cal values from OTP Flash
- * @retval uint8_t 1 if successful, 0 if error
+ * @brief  Sets every channel's filter chain to the defaults
  */
-uint8_t Read_Scalars_From_Flash() {
-	uint32_t address = OTP_START_ADDR;
-
-	uint32_t temp_scalars[SCALAR_ARRAY_SIZE] = {0};
-
-	uint8_t t = SCALAR_ARRAY_SIZE - 1;
+void ADC_Filter_Defaults(void) {
+	for (int i = 0; i < ADC_NUMBER_OF_CHANNELS; i++) {
+		/* XT60 and balance taps are channels 0-4, MCU temperature and VREFINT follow */
+		if (i < SCALAR_ARRAY_SIZE) {
+			adc_filter_config[i].median_length = ADC_FILTER_DEFAULT_VOLTAGE_MEDIAN;
+			adc_filter_config[i].boxcar_shift = ADC_FILTER_DEFAULT_VOLTAGE_BOXCAR_SHIFT;
+		}
+		else {
+			adc_filter_config[i].median_length = ADC_FILTER_DEFAULT_INTERNAL_MEDIAN;
+			adc_filter_config[i].boxcar_shift = ADC_FILTER_DEFAULT_INTERNAL_BOXCAR_SHIFT;
+		}
+		adc_filter_config[i].iir_shift = ADC_FILTER_DEFAULT_IIR_SHIFT;
+	}
+	adc_filter_reset_mask = (1 << ADC_NUMBER_OF_CHANNELS) - 1;
+}
 
-	for (int i = OTP_SIZE; i >= 0; i--) {
+/**
+ * @brief  Runs one block of sums through each channel's filter chain. Called from vRead_ADC
+ * @param  block_sum: Sum of ADC_DMA_BLOCK_SEQUENCES readings for each channel
+ * @retval uint8_t 1 if a new filtered output is ready in adc_filtered_output, 0 if not
+ */
+uint8_t ADC_Filter_Block(const uint16_t *block_sum) {
+	static uint32_t block_count;
+
+	taskENTER_CRITICAL();
+	uint8_t reset_mask = adc_filter_reset_mask;
+	adc_filter_reset_mask = 0;
+	if (adc_filter_restart == 1) {
+		block_count = 0;
+		adc_filter_restart = 0;
+	}
+	taskEXIT_CRITICAL();
 
-		uint32_t value = *(uint32_t *)(address + (i * BYTES_IN_UINT32));
+	uint32_t filtered[ADC_NUMBER_OF_CHANNELS];
 
-		if ((value > 750) && (value < 5000)) {
-			printf("OTP Value %u at address: 0x%08x\r\n", value, (uint32_t)(address + (i * BYTES_IN_UINT32)));
+	for (int i = 0; i < ADC_NUMBER_OF_CHANNELS; i++) {
+		if (reset_mask & (1 << i)) {
+			ADC_Filter_Init(&adc_filters[i], &adc_filter_config[i]);
+		}
 
-			if (cal_present == 0) {
-				temp_scalars[t] = value;
-			}
+		uint32_t input = block_sum[i];
 
-			if(t == 0) {
-				cal_present = cal_present + 1;
-				t = SCALAR_ARRAY_SIZE;
+		/* Correct the XT60 and taps against the VREFINT sum of the same block. Temperature uses VREFINT directly */
+		if (i < SCALAR_ARRAY_SIZE) {
+			input = ADC_Ratiometric_Correct(input, block_sum[6], vrefint_nominal * ADC_DMA_BLOCK_SEQUENCES);
+			if (input > UINT16_MAX) {
+				input = UINT16_MAX;
 			}
-
-			t--;
 		}
+
+		filtered[i] = ADC_Filter_Run(&adc_filters[i], (uint16_t)input);
 	}
 
-	if (cal_present != 0) {
+	block_count++;
+	if (block_count < ADC_FILTER_OUTPUT_BLOCKS) {
+		return 0;
+	}
+	block_count = 0;
 
-		for (int y = 0; y < SCALAR_ARRAY_SIZE; y++) {
-			adc_scalars[y] = temp_scalars[y];
-		}
+	/* Add_ADC_Calibration_Point reads the sums from the CLI task, it must see all channels from one window */
+	taskENTER_CRITICAL();
+	for (int i = 0; i < ADC_NUMBER_OF_CHANNELS; i++) {
+		adc_filtered_sum[i] = filtered[i];
+		adc_filtered_output[i] = (filtered[i] + (ADC_DMA_BLOCK_SEQUENCES / 2)) / ADC_DMA_BLOCK_SEQUENCES;
+	}
+	taskEXIT_CRITICAL();
 
-		printf("Calibration values already present. 32 total calibrations can be performed. Number of calibrations performed: %u\r\n", cal_present);
-		printf("Using these calibration values:\r\n");
+	return 1;
+}
 
-		for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
-			printf("Scalar: %u  Value: %u\r\n", i, adc_scalars[i]);
-		}
+/**
+ * @brief  Sets the filter chain for one channel. The channel's history is cleared on the next block
+ * @param  channel: 0 XT60, 1-4 balance taps, 5 MCU temperature, 6 VREFINT
+ * @param  config: Median length 1, 3 or 5, boxcar shift 0 - ADC_FILTER_BOXCAR_SHIFT_MAX, IIR shift 0 - ADC_FILTER_IIR_SHIFT_MAX
+ * @retval uint8_t 1 if successful, 0 if the channel or settings are invalid
+ */
+uint8_t Set_ADC_Filter(uint8_t channel, const struct Adc_Filter_Config *config) {
+	if ((channel >= ADC_NUMBER_OF_CHANNELS) || (ADC_Filter_Config_Valid(config) == 0)) {
 		return 0;
 	}
 
-	cal_present = 0;
-	printf("NOT CALIBRATED. Connect known good voltage to cells 1-4 and XT60 in the range of 3.3V - 4V and run cal command.\r\nThen write then to flash with write_otp\r\n");
+	taskENTER_CRITICAL();
+	adc_filter_config[channel] = *config;
+	adc_filter_reset_mask |= (1 << channel);
+	taskEXIT_CRITICAL();
 
 	return 1;
 }
+
+/**
+ * @brief  Gets the filter chain settings for one channel
+ * @param  channel: 0 XT60, 1-4 balance taps, 5 MCU temperature, 6 VREFINT
+ * @param  config: Pointer to store the settings
+ * @retval uint8_t 1 if successful, 0 if the channel is invalid
+ */
+uint8_t Get_ADC_Filter(uint8_t channel, struct Adc_Filter_Config *config) {
+	if (channel >= ADC_NUMBER_OF_CHANNELS) {
+		return 0;
+	}
+
+	taskENTER_CRITICAL();
+	*config = adc_filter_config[channel];
+	taskEXIT_CRITICAL();
+
+	return 1;
+}
+
+/**
+ * @brief  Clears the history of some channels' filters on the next block, so the outputs from then on only hold new blocks
+ * @param  channel_mask: Bit n set clears channel n, 0 XT60, 1-4 balance taps, 5 MCU temperature, 6 VREFINT
+ */
+void Reset_ADC_Filters(uint8_t channel_mask) {
+	taskENTER_CRITICAL();
+	adc_filter_reset_mask |= channel_mask & ((1 << ADC_NUMBER_OF_CHANNELS) - 1);
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief  Sums one block of DMA scan sequences for the filter chains. Called from the DMA interrupt
+ * @param  block: First of ADC_DMA_BLOCK_SEQUENCES scan sequences in the circular DMA buffer
+ */
+void ADC_Process_Block(const uint16_t (*block)[ADC_NUMBER_OF_CHANNELS]) {
+	/* tCONV = Sampling time + 12.5 x ADC clock cycles
+	 For the default 160.5 sample time and 16MHz clock divided by 4
+	 tCONV = (160.5 + 12.5) x 1/(16MHz/4) = 43.25us, 13us for the internal channels at 39.5
+	 For 5 + 2 reads = 242.25us or 4.128kHz */
+
+	if (adc_capture_state == ADC_CAPTURE_RUNNING) {
+		ADC_Capture_Block(block);
+	}
+
+	/* Fill the buffer the task is not reading, then hand it over by flipping the index */
+	uint8_t fill = adc_block_ready ^ 1;
+	struct Adc_Block *output = &adc_blocks[fill];
+	output->timestamp = xTaskGetTickCountFromISR();
+	output->sequence = ++adc_block_sequence;
+
+#if (ADC_ACQUISITION_MODE == ADC_ACQUISITION_HW_OVERSAMPLING)
+	/* Each channel was already averaged by the oversampler, 256 x 242.25us = 62ms per sequence.
+	 Copy the block out before the next sequence overwrites it and hand it to the task */
+	for (unsigned i = 0; i < ADC_NUMBER_OF_CHANNELS; i++) {
+		output->sum[i] = block[0][i];
+		output->fast[i] = block[0][i];
+	}
+
+	__DMB();
+	adc_block_ready = fill;
+	ADC_Notify_From_ISR(ADC_NOTIFY_BLOCK);
+#else
+	/* 16 sequences at 2.5kHz = 6.4ms per block */
+	uint32_t sum[ADC_NUMBER_OF_CHANNELS] = {0};
+
+	ADC_Sum_Sequences(block[0], ADC_DMA_BLOCK_SEQUENCES - ADC_FAST_WINDOW_SEQUENCES, ADC_NUMBER_OF_CHANNELS, sum);
+
+	/* The newest sequences of the block form the fast window */
+	uint32_t fast_sum[ADC_NUMBER_OF_CHANNELS] = {0};
+
+	ADC_Sum_Sequences(block[ADC_DMA_BLOCK_SEQUENCES - ADC_FAST_WINDOW_SEQUENCES], ADC_FAST_WINDOW_SEQUENCES, ADC_NUMBER_OF_CHANNELS, fast_sum);
+
+	for (unsigned i = 0; i < ADC_NUMBER_OF_CHANNELS; i++) {
+		output->sum[i] = sum[i] + fast_sum[i];
+		output->fast[i] = fast_sum[i] / ADC_FAST_WINDOW_SEQUENCES;
+	}
+
+	__DMB();
+	adc_block_ready = fill;
+	ADC_Notify_From_ISR(ADC_NOTIFY_BLOCK);
+#endif
+}
+
+/**
+ * @brief  Copies one DMA block into the capture buffer. Called from the DMA interrupt
+ * @param  block: First of ADC_DMA_BLOCK_SEQUENCES scan sequences in the circular DMA buffer
+ */
+void ADC_Capture_Block(const uint16_t (*block)[ADC_NUMBER_OF_CHANNELS]) {
+	memcpy(adc_capture_buffer[adc_capture_index], block, sizeof(adc_buffer[0]) * ADC_DMA_BLOCK_SEQUENCES);
+
+	adc_capture_index += ADC_DMA_BLOCK_SEQUENCES;
+	if (adc_capture_index >= adc_capture_length) {
+		adc_capture_state = ADC_CAPTURE_DONE;
+	}
+}
+
+/**
+ * @brief  Starts capturing raw scan sequences from the next DMA block
+ * @param  sequences: Number of sequences, 1 - ADC_CAPTURE_MAX_SEQUENCES. Rounded up to whole blocks
+ * @retval uint8_t 1 if started, 0 if the length is invalid or a capture is in progress
+ */
+uint8_t Start_ADC_Capture(uint32_t sequences) {
+	if ((sequences == 0) || (sequences > ADC_CAPTURE_MAX_SEQUENCES) || (adc_capture_state == ADC_CAPTURE_RUNNING)) {
+		return 0;
+	}
+
+	adc_capture_length = ((sequences + ADC_DMA_BLOCK_SEQUENCES - 1) / ADC_DMA_BLOCK_SEQUENCES) * ADC_DMA_BLOCK_SEQUENCES;
+	adc_capture_index = 0;
+	adc_capture_state = ADC_CAPTURE_RUNNING;
+
+	return 1;
+}
+
+/**
+ * @brief  Gets the state of the raw capture
+ * @retval ADC_CAPTURE_IDLE, ADC_CAPTURE_RUNNING or ADC_CAPTURE_DONE
+ */
+uint8_t Get_ADC_Capture_State(void) {
+	return adc_capture_state;
+}
+
+/**
+ * @brief  Gets the finished capture in place. The buffer is not touched again until the next Start_ADC_Capture
+ * @param  sequences: Pointer to store the number of captured sequences
+ * @retval Interleaved samples, ADC_NUMBER_OF_CHANNELS per sequence. NULL if no capture is finished
+ */
+const uint16_t *Get_ADC_Capture(uint32_t *sequences) {
+	if (adc_capture_state != ADC_CAPTURE_DONE) {
+		*sequences = 0;
+		return NULL;
+	}
+
+	*sequences = adc_capture_length;
+	return adc_capture_buffer[0];
+}
+
+/**
+ * @brief  Stops a running capture and frees the capture buffer
+ */
+void Release_ADC_Capture(void) {
+	adc_capture_state = ADC_CAPTURE_IDLE;
+}
+
+/**
+ * @brief  Timestamps the block and wakes vRead_ADC
+ * @param  notification: ADC_NOTIFY_BLOCK
+ */
+void ADC_Notify_From_ISR(uint32_t notification) {
+	adc_block_tick = xTaskGetTickCountFromISR();
+
+	BaseType_t should_context_switch = pdFALSE;
+	xTaskNotifyFromISR(adcTaskHandle, notification, eSetBits, &should_context_switch);
+	portYIELD_FROM_ISR(should_context_switch);
+}
+
+/**
+ * @brief  Configures the ADC trigger and starts the circular DMA. Half and full transfer interrupts each hand over ADC_DMA_BLOCK_SEQUENCES sequences
+ * @param  sample_rate_hz: Scan sequence trigger rate, 0 for continuous conversions
+ */
+void ADC_Start_Acquisition(uint32_t sample_rate_hz) {
+	if (sample_rate_hz == 0) {
+		hadc1.Init.ContinuousConvMode = ENABLE;
+		hadc1.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+		hadc1.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+	}
+	else {
+		hadc1.Init.ContinuousConvMode = DISABLE;
+		hadc1.Init.ExternalTrigConv = ADC_EXTERNALTRIG_T6_TRGO;
+		hadc1.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+		__HAL_TIM_SET_AUTORELOAD(&htim6, (ADC_TRIGGER_TIMER_CLOCK_HZ / sample_rate_hz) - 1);
+		__HAL_TIM_SET_COUNTER(&htim6, 0);
+	}
+
+	hadc1.Init.SamplingTimeCommon1 = adc_sampling.common_1;
+	hadc1.Init.SamplingTimeCommon2 = adc_sampling.common_2;
+
+	HAL_ADC_Init(&hadc1);
+
+	/* Channel ranks are kept from MX_ADC1_Init, only the sampling time group changes */
+	for (int i = 0; i < ADC_NUMBER_OF_CHANNELS; i++) {
+		if (adc_sampling.common_2_mask & (1 << i)) {
+			LL_ADC_SetChannelSamplingTime(hadc1.Instance, adc_channels[i], LL_ADC_SAMPLINGTIME_COMMON_2);
+		}
+		else {
+			LL_ADC_SetChannelSamplingTime(hadc1.Instance, adc_channels[i], LL_ADC_SAMPLINGTIME_COMMON_1);
+		}
+	}
+
+	ADC_Watchdog_Init();
+
+	/* Start the filter chains and output window again on the next block */
+	adc_filter_reset_mask = (1 << ADC_NUMBER_OF_CHANNELS) - 1;
+	adc_filter_restart = 1;
+
+	adc_sample_rate = sample_rate_hz;
+
+	HAL_ADC_Start_DMA(&hadc1, (uint32_t *)adc_buffer, ADC_DMA_BUFFER_SEQUENCES * ADC_NUMBER_OF_CHANNELS);
+
+	if (sample_rate_hz != 0) {
+		HAL_TIM_Base_Start(&htim6);
+	}
+}
+
+/**
+ * @brief  Stops the trigger and DMA and starts acquisition again with the current settings
+ * @param  sample_rate_hz: Sample rate to restart at, 0 for continuous conversions
+ */
+void ADC_Restart_Acquisition(uint32_t sample_rate_hz) {
+	HAL_TIM_Base_Stop(&htim6);
+	HAL_ADC_Stop_DMA(&hadc1);
+
+	ADC_Start_Acquisition(sample_rate_hz);
+}
+
+/**
+ * @brief  Changes the rate scan sequences are triggered at. Restarts acquisition and the current filter window
+ * @param  sample_rate_hz: ADC_SAMPLE_RATE_MIN_HZ to 1 / Get_ADC_Sequence_Time(), or 0 for continuous conversions
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Set_ADC_Sample_Rate(uint32_t sample_rate_hz) {
+	if ((sample_rate_hz != 0) && ((sample_rate_hz < ADC_SAMPLE_RATE_MIN_HZ) || (sample_rate_hz > (1000000000UL / Get_ADC_Sequence_Time())))) {
+		return 0;
+	}
+
+	ADC_Restart_Acquisition(sample_rate_hz);
+
+	return 1;
+}
+
+/**
+ * @brief Gets the rate scan sequences are triggered at
+ * @retval Sample rate in Hz, 0 if the ADC is converting continuously
+ */
+uint32_t Get_ADC_Sample_Rate(void) {
+	return adc_sample_rate;
+}
+
+/**
+ * @brief Gets the time one conversion of a channel takes, sampling plus successive approximation
+ * @param  channel: 0 XT60, 1-4 balance taps, 5 MCU temperature, 6 VREFINT
+ * @retval Conversion time in ns, 0 if the channel is invalid
+ */
+uint32_t Get_ADC_Conversion_Time(uint8_t channel) {
+	if (channel >= ADC_NUMBER_OF_CHANNELS) {
+		return 0;
+	}
+
+	uint8_t code = adc_sampling.common_1;
+	if (adc_sampling.common_2_mask & (1 << channel)) {
+		code = adc_sampling.common_2;
+	}
+
+	return ((adc_sampling_half_cycles[code] + ADC_CONVERSION_HALF_CYCLES) * (1000000000UL / ADC_CLOCK_HZ)) / 2;
+}
+
+/**
+ * @brief Gets the time one triggered scan sequence takes, including hardware oversampling
+ * @retval Sequence time in ns
+ */
+uint32_t Get_ADC_Sequence_Time(void) {
+	uint32_t sequence_ns = 0;
+
+	for (uint8_t channel = 0; channel < ADC_NUMBER_OF_CHANNELS; channel++) {
+		sequence_ns += Get_ADC_Conversion_Time(channel);
+	}
+
+	return sequence_ns * ADC_SEQUENCE_OVERSAMPLING;
+}
+
+/**
+ * @brief  Captures ADC_TUNE_SEQUENCES with every channel on one sampling code. Called from Tune_ADC_Sampling
+ * @param  code: Sampling code 0 - ADC_SAMPLING_CODES - 1
+ * @param  sample_rate_hz: Rate to capture at
+ * @param  mean: Mean of each channel with ADC_STATISTICS_FRACTIONAL_BITS
+ * @param  variance: Variance of each channel with ADC_STATISTICS_FRACTIONAL_BITS
+ * @retval uint8_t 1 if successful, 0 if the capture did not complete
+ */
+uint8_t ADC_Tune_Measure(uint8_t code, uint32_t sample_rate_hz, uint32_t *mean, uint32_t *variance) {
+	adc_sampling.common_1 = code;
+	adc_sampling.common_2 = code;
+	adc_sampling.common_2_mask = 0;
+
+	ADC_Restart_Acquisition(sample_rate_hz);
+
+	/* Let the input dividers recover from the new sampling load before capturing */
+	vTaskDelay(pdMS_TO_TICKS(ADC_TUNE_SETTLE_MS));
+
+	if (Start_ADC_Capture(ADC_TUNE_SEQUENCES) == 0) {
+		return 0;
+	}
+
+	TickType_t xtimeout_start = xTaskGetTickCount();
+	const TickType_t xCaptureTimeout = pdMS_TO_TICKS(((ADC_TUNE_SEQUENCES * 1000) / ADC_SAMPLE_RATE_MIN_HZ) + 500);
+
+	while (Get_ADC_Capture_State() != ADC_CAPTURE_DONE) {
+		if ((xTaskGetTickCount() - xtimeout_start) > xCaptureTimeout) {
+			Release_ADC_Capture();
+			return 0;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+
+	uint32_t sequences;
+	const uint16_t *samples = Get_ADC_Capture(&sequences);
+
+	for (uint32_t channel = 0; channel < ADC_NUMBER_OF_CHANNELS; channel++) {
+		struct Adc_Channel_Statistics stats;
+		ADC_Channel_Statistics(samples, sequences, ADC_NUMBER_OF_CHANNELS, channel, &stats);
+
+		mean[channel] = stats.mean;
+		variance[channel] = stats.variance;
+	}
+
+	Release_ADC_Capture();
+
+	return 1;
+}
+
+/**
+ * @brief  Sweeps the sampling codes from shortest to longest and gives each channel the shortest code that settles
+ * to the same mean and noise as the longest one. Applies the result and saves it to flash.
+ * Charging is held off while tuning. Connect a stable voltage to cells 1-4 and the XT60 as for cal
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Tune_ADC_Sampling(void) {
+	uint32_t sample_rate_hz = adc_sample_rate;
+	struct Adc_Sampling previous = adc_sampling;
+
+	uint32_t reference_mean[ADC_NUMBER_OF_CHANNELS], reference_variance[ADC_NUMBER_OF_CHANNELS];
+	uint32_t mean[ADC_NUMBER_OF_CHANNELS], variance[ADC_NUMBER_OF_CHANNELS];
+	uint8_t required[ADC_NUMBER_OF_CHANNELS];
+
+	adc_tuning = 1;
+	Regulator_HI_Z(1);
+
+	/* The sweep runs at the current rate unless the longest code cannot keep up with it */
+	uint32_t longest_sequence_ns = ((adc_sampling_half_cycles[ADC_SAMPLING_CODES - 1] + ADC_CONVERSION_HALF_CYCLES) *
+			(1000000000UL / ADC_CLOCK_HZ) / 2) * ADC_NUMBER_OF_CHANNELS * ADC_SEQUENCE_OVERSAMPLING;
+	uint32_t tune_rate_hz = sample_rate_hz;
+	if ((tune_rate_hz != 0) && (tune_rate_hz > (1000000000UL / longest_sequence_ns))) {
+		tune_rate_hz = ADC_SAMPLE_RATE_DEFAULT_HZ;
+	}
+
+	uint8_t result = ADC_Tune_Measure(ADC_SAMPLING_CODES - 1, tune_rate_hz, reference_mean, reference_variance);
+
+	for (int i = 0; i < ADC_NUMBER_OF_CHANNELS; i++) {
+		required[i] = ADC_SAMPLING_CODES - 1;
+	}
+
+	for (uint8_t code = 0; (code < (ADC_SAMPLING_CODES - 1)) && (result == 1); code++) {
+		result = ADC_Tune_Measure(code, tune_rate_hz, mean, variance);
+
+		for (int i = 0; (i < ADC_NUMBER_OF_CHANNELS) && (result == 1); i++) {
+			if (required[i] != (ADC_SAMPLING_CODES - 1)) {
+				continue;
+			}
+
+			uint32_t error = (mean[i] > reference_mean[i]) ? (mean[i] - reference_mean[i]) : (reference_mean[i] - mean[i]);
+
+			if ((error <= ADC_TUNE_MAX_ERROR) && (variance[i] <= ((reference_variance[i] * ADC_TUNE_NOISE_RATIO) + ADC_TUNE_NOISE_FLOOR))) {
+				required[i] = code;
+			}
+		}
+	}
+
+	if (result == 1) {
+		adc_sampling.common_2_mask = (uint8_t)ADC_Select_Sampling(required, ADC_NUMBER_OF_CHANNELS, adc_sampling_half_cycles,
+				&adc_sampling.common_1, &adc_sampling.common_2);
+
+		for (int i = 0; i < ADC_NUMBER_OF_CHANNELS; i++) {
+			printf("ADC Channel %u shortest sampling code: %u\r\n", i, required[i]);
+		}
+		printf("Common1: %u Common2: %u Common2 Channels: 0x%02x\r\n", adc_sampling.common_1, adc_sampling.common_2, adc_sampling.common_2_mask);
+
+		result = Write_Sampling_To_Flash();
+	}
+	else {
+		printf("ERROR: ADC tuning capture did not complete\r\n");
+		adc_sampling = previous;
+	}
+
+	/* A faster rate may no longer fit the new sequence time */
+	if ((sample_rate_hz != 0) && (sample_rate_hz > (1000000000UL / Get_ADC_Sequence_Time()))) {
+		sample_rate_hz = ADC_SAMPLE_RATE_DEFAULT_HZ;
+	}
+
+	ADC_Restart_Acquisition(sample_rate_hz);
+
+	adc_tuning = 0;
+
+	return result;
+}
+
+/**
+ * @brief Gets whether a sampling time sweep is running, the voltages are not valid while it is
+ * @retval uint8_t 1 if tuning, 0 if not
+ */
+uint8_t Get_ADC_Tuning_State(void) {
+	return adc_tuning;
+}
+
+/**
+ * @brief  Writes the sampling times to the flash store
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Write_Sampling_To_Flash(void) {
+	return Flash_Store_Write(FLASH_STORE_KEY_SAMPLING, ADC_SAMPLING_RECORD_VERSION, &adc_sampling, sizeof(adc_sampling));
+}
+
+/**
+ * @brief  Writes the applied calibration and the residuals of the last fit to the flash store
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Write_Calibration_To_Flash(void) {
+	struct Adc_Calibration_Record record;
+
+	memset(&record, 0, sizeof(record));
+
+	for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
+		if ((adc_calibration[i].scalar < ADC_SCALAR_Q16_MIN) || (adc_calibration[i].scalar > ADC_SCALAR_Q16_MAX)) {
+			printf("ERROR: ADC Channel %u Not Calibrated\r\n", i);
+			return 0;
+		}
+
+		record.calibration[i] = adc_calibration[i];
+		record.max_residual[i] = adc_cal_session.max_residual[i];
+		record.rms_residual[i] = adc_cal_session.rms_residual[i];
+	}
+
+	record.order = adc_cal_session.order;
+	record.points = adc_cal_session.points;
+	record.count = adc_cal_count + 1;
+
+	if (Flash_Store_Write(FLASH_STORE_KEY_CALIBRATION, ADC_CALIBRATION_RECORD_VERSION, &record, sizeof(record)) == 0) {
+		printf("ERROR: Write calibration to Flash Failed\r\n");
+		return 0;
+	}
+
+	adc_cal_count = record.count;
+
+	return 1;
+}
+
+/**
+ * @brief  Reads the calibration from the flash store
+ * @retval uint8_t 1 if a valid record was found, 0 if the OTP scalars are needed
+ */
+uint8_t Read_Calibration_From_Flash(void) {
+	struct Adc_Calibration_Record record;
+
+	if (Flash_Store_Read(FLASH_STORE_KEY_CALIBRATION, ADC_CALIBRATION_RECORD_VERSION, &record, sizeof(record)) == 0) {
+		return 0;
+	}
+
+	for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
+		if ((record.calibration[i].scalar < ADC_SCALAR_Q16_MIN) || (record.calibration[i].scalar > ADC_SCALAR_Q16_MAX)) {
+			return 0;
+		}
+	}
+
+	adc_cal_count = record.count;
+
+	printf("Using calibration %u from flash, order %u over %u points:\r\n", record.count, record.order, record.points);
+
+	for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
+		adc_calibration[i] = record.calibration[i];
+
+		printf("Channel: %u  Scalar: %u  Intercept: %d  Curvature: %d  Max Residual: %u uV  RMS Residual: %u uV\r\n", i,
+				adc_calibration[i].scalar, adc_calibration[i].intercept, adc_calibration[i].curvature, record.max_residual[i], record.rms_residual[i]);
+	}
+
+	return 1;
+}
+
+/**
+ * @brief  Reads tuned sampling times from the flash store
+ * @retval uint8_t 1 if a valid record was found, 0 if the defaults are kept
+ */
+uint8_t Read_Sampling_From_Flash(void) {
+	struct Adc_Sampling record;
+
+	if (Flash_Store_Read(FLASH_STORE_KEY_SAMPLING, ADC_SAMPLING_RECORD_VERSION, &record, sizeof(record)) == 0) {
+		return 0;
+	}
+
+	if ((record.common_1 >= ADC_SAMPLING_CODES) || (record.common_2 >= ADC_SAMPLING_CODES) || (record.common_2_mask >= (1 << ADC_NUMBER_OF_CHANNELS))) {
+		return 0;
+	}
+
+	adc_sampling = record;
+
+	printf("Using tuned ADC sampling times. Common1: %u Common2: %u Common2 Channels: 0x%02x\r\n", record.common_1, record.common_2, record.common_2_mask);
+
+	return 1;
+}
+
+/**
+ * @brief  Assigns the analog watchdog channels with the thresholds wide open and interrupts off.
+ * The channels can only be set while the ADC is stopped, ADC_Watchdog_Update arms them once readings are valid
+ */
+void ADC_Watchdog_Init(void) {
+	ADC_AnalogWDGConfTypeDef awd_config = {0};
+
+	awd_config.WatchdogMode = ADC_ANALOGWATCHDOG_SINGLE_REG;
+	awd_config.ITMode = DISABLE;
+	awd_config.HighThreshold = ADC_AWD_CODE_MAX;
+	awd_config.LowThreshold = 0;
+
+	awd_config.WatchdogNumber = ADC_ANALOGWATCHDOG_1;
+	awd_config.Channel = ADC_AWD_XT60_CHANNEL;
+	HAL_ADC_AnalogWDGConfig(&hadc1, &awd_config);
+
+	awd_config.WatchdogNumber = ADC_ANALOGWATCHDOG_2;
+	awd_config.Channel = ADC_AWD_CELL_ONE_CHANNEL;
+	HAL_ADC_AnalogWDGConfig(&hadc1, &awd_config);
+
+	awd_config.WatchdogNumber = ADC_ANALOGWATCHDOG_3;
+	awd_config.Channel = ADC_AWD_XT60_CHANNEL;
+	HAL_ADC_AnalogWDGConfig(&hadc1, &awd_config);
+
+	adc_awd_armed = 0;
+}
+
+/**
+ * @brief  Reprograms the analog watchdog thresholds when the number of cells, XT60 state or calibration changes
+ * and re-arms any watchdog that tripped. Thresholds can be written while conversions are running
+ */
+void ADC_Watchdog_Update(void) {
+	uint8_t number_of_cells = Get_Number_Of_Cells();
+
+	uint32_t xt60_high = ADC_AWD_CODE_MAX;
+	uint32_t xt60_low = 0;
+	uint32_t cell_high = ADC_AWD_CODE_MAX;
+
+	if (number_of_cells > 1) {
+		xt60_high = ADC_Voltage_To_Code(0, number_of_cells * (CELL_OVER_VOLTAGE_DISABLE_CHARGING + ADC_AWD_OVER_VOLTAGE_MARGIN));
+		cell_high = ADC_Voltage_To_Code(1, CELL_OVER_VOLTAGE_DISABLE_CHARGING + ADC_AWD_OVER_VOLTAGE_MARGIN);
+	}
+
+	if (Get_XT60_Connection_State() == CONNECTED) {
+		xt60_low = ADC_Voltage_To_Code(0, VOLTAGE_CONNECTED_THRESHOLD);
+	}
+
+	if ((adc_awd_armed == 1) && (xt60_high == adc_awd_xt60_high) && (xt60_low == adc_awd_xt60_low) && (cell_high == adc_awd_cell_high)) {
+		return;
+	}
+
+	ADC_AnalogWDGConfTypeDef awd_config = {0};
+
+	awd_config.WatchdogMode = ADC_ANALOGWATCHDOG_SINGLE_REG;
+	awd_config.ITMode = ENABLE;
+
+	awd_config.WatchdogNumber = ADC_ANALOGWATCHDOG_1;
+	awd_config.Channel = ADC_AWD_XT60_CHANNEL;
+	awd_config.HighThreshold = xt60_high;
+	awd_config.LowThreshold = 0;
+	HAL_ADC_AnalogWDGConfig(&hadc1, &awd_config);
+
+	awd_config.WatchdogNumber = ADC_ANALOGWATCHDOG_2;
+	awd_config.Channel = ADC_AWD_CELL_ONE_CHANNEL;
+	awd_config.HighThreshold = cell_high;
+	awd_config.LowThreshold = 0;
+	HAL_ADC_AnalogWDGConfig(&hadc1, &awd_config);
+
+	awd_config.WatchdogNumber = ADC_ANALOGWATCHDOG_3;
+	awd_config.Channel = ADC_AWD_XT60_CHANNEL;
+	awd_config.HighThreshold = ADC_AWD_CODE_MAX;
+	awd_config.LowThreshold = xt60_low;
+	HAL_ADC_AnalogWDGConfig(&hadc1, &awd_config);
+
+	adc_awd_xt60_high = xt60_high;
+	adc_awd_xt60_low = xt60_low;
+	adc_awd_cell_high = cell_high;
+
+	__HAL_ADC_CLEAR_FLAG(&hadc1, ADC_FLAG_AWD1 | ADC_FLAG_AWD2 | ADC_FLAG_AWD3);
+	__HAL_ADC_ENABLE_IT(&hadc1, ADC_IT_AWD1 | ADC_IT_AWD2 | ADC_IT_AWD3);
+
+	adc_awd_armed = 1;
+}
+
+/**
+ * @brief  Puts the regulator in HI-Z and latches the error. Called from the ADC interrupt.
+ * The watchdog stays disarmed until the next filtered window
+ * @param  watchdog_it: ADC_IT_AWD1, ADC_IT_AWD2 or ADC_IT_AWD3
+ * @param  error_bitmask: Error to set, NO_ERROR for none
+ */
+void ADC_Watchdog_Trip(uint32_t watchdog_it, uint32_t error_bitmask) {
+	Regulator_HI_Z(1);
+
+	__HAL_ADC_DISABLE_IT(&hadc1, watchdog_it);
+	adc_awd_armed = 0;
+
+	Set_Error_State(error_bitmask);
+	adc_awd_trip_count++;
+}
+
+/**
+ * @brief  Called when the XT60 reading goes over the AWD1 pack over voltage threshold
+ */
+void HAL_ADC_LevelOutOfWindowCallback(ADC_HandleTypeDef* hadc) {
+	ADC_Watchdog_Trip(ADC_IT_AWD1, XT60_VOLTAGE_ERROR);
+}
+
+/**
+ * @brief  Called when the first balance tap leaves the AWD2 window
+ */
+void HAL_ADCEx_LevelOutOfWindow2Callback(ADC_HandleTypeDef* hadc) {
+	ADC_Watchdog_Trip(ADC_IT_AWD2, NO_ERROR);
+	Cell_Over_Voltage_Trip_From_ISR();
+}
+
+/**
+ * @brief  Called when the XT60 reading drops under the AWD3 connected threshold. A disconnect is not an error,
+ * Battery_Fast_Safety_Check and Battery_Connection_State track the connection from the readings
+ */
+void HAL_ADCEx_LevelOutOfWindow3Callback(ADC_HandleTypeDef* hadc) {
+	ADC_Watchdog_Trip(ADC_IT_AWD3, NO_ERROR);
+}
+
+/**
+ * @brief  Gets the number of analog watchdog trips since boot
+ * @retval Number of trips
+ */
+uint32_t Get_ADC_Watchdog_Trip_Count(void) {
+	return adc_awd_trip_count;
+}
+
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef* hadc) {
+	ADC_Process_Block(&adc_buffer[0]);
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc) {
+	ADC_Process_Block(&adc_buffer[ADC_DMA_BLOCK_SEQUENCES]);
+}
+
+/**
+ * @brief  Stamps the filtered output and updates the pack and cell dV/dt estimators. Called from vRead_ADC
+ * @param  timestamp_ms: Tick time of the last block in the filter window
+ */
+void ADC_Update_Slopes(uint32_t timestamp_ms) {
+	adc_timestamp = timestamp_ms;
+
+	adc_dvdt[0] = ADC_Slope_Update(&adc_slopes[0], adc_values.bat_voltage, timestamp_ms, ADC_DVDT_INTERVAL_MS);
+
+	for (int i = 0; i < 4; i++) {
+		adc_dvdt[i+1] = ADC_Slope_Update(&adc_slopes[i+1], adc_values.cell_voltage[i], timestamp_ms, ADC_DVDT_INTERVAL_MS);
+	}
+}
+
+/**
+ * @brief  Tracks the XT60 reading against the regulator VBAT ADC and the sum of the cells while the pack is quiet and
+ * flags drift between them. Called from vRegulator after each poll so both halves of the snapshot are fresh
+ */
+void ADC_Cross_Calibrate(void) {
+	struct Measurement_Snapshot snapshot;
+	Get_Measurement_Snapshot(&snapshot);
+
+	/* Differences taken under an old calibration say nothing about the new one */
+	if (adc_xcal_reset == 1) {
+		adc_xcal_reset = 0;
+		for (int i = 0; i < ADC_XCAL_REFERENCES; i++) {
+			ADC_Drift_Init(&adc_xcal[i]);
+		}
+	}
+
+	if ((snapshot.xt60_connected != CONNECTED) || (snapshot.regulator_charging != 0) || (snapshot.regulator_charge_current != 0) ||
+			(snapshot.balancing_state != 0) || (snapshot.adc_tuning != 0) ||
+			(snapshot.battery_dvdt > ADC_XCAL_QUIET_DVDT) || (snapshot.battery_dvdt < -ADC_XCAL_QUIET_DVDT)) {
+		return;
+	}
+
+	/* One difference per filtered window, the regulator polls faster than the ADC publishes */
+	if (snapshot.battery_sequence == adc_xcal_sequence) {
+		return;
+	}
+	adc_xcal_sequence = snapshot.battery_sequence;
+
+	/* A VBAT register of 0 reads as the offset, the regulator sees no battery */
+	if ((snapshot.regulator_connected == CONNECTED) && (snapshot.regulator_vbat_voltage > VBAT_ADC_OFFSET)) {
+		int32_t regulator_voltage = (int32_t)(snapshot.regulator_vbat_voltage * (BATTERY_ADC_MULTIPLIER / REG_ADC_MULTIPLIER));
+		ADC_Drift_Update(&adc_xcal[ADC_XCAL_REGULATOR], (int32_t)snapshot.battery_voltage - regulator_voltage, ADC_XCAL_SHIFT);
+	}
+
+	if ((snapshot.balance_port_connected == CONNECTED) && (snapshot.number_of_cells > 0) && (snapshot.number_of_cells <= 4)) {
+		uint32_t cell_sum = 0;
+		for (int i = 0; i < snapshot.number_of_cells; i++) {
+			cell_sum += snapshot.cell_voltage[i];
+		}
+		ADC_Drift_Update(&adc_xcal[ADC_XCAL_CELL_SUM], (int32_t)snapshot.battery_voltage - (int32_t)cell_sum, ADC_XCAL_SHIFT);
+	}
+
+	const uint32_t limits[ADC_XCAL_REFERENCES] = {ADC_XCAL_REGULATOR_LIMIT, ADC_XCAL_CELL_SUM_LIMIT};
+	uint8_t drifted = 0;
+	uint8_t settled = 1;
+
+	for (int i = 0; i < ADC_XCAL_REFERENCES; i++) {
+		if (adc_xcal[i].samples < (1UL << ADC_XCAL_SHIFT)) {
+			continue;
+		}
+
+		uint32_t magnitude = (adc_xcal[i].mean < 0) ? (uint32_t)(-adc_xcal[i].mean) : (uint32_t)adc_xcal[i].mean;
+
+		if (magnitude > (limits[i] + adc_xcal[i].bound)) {
+			drifted = 1;
+		}
+		if ((magnitude + adc_xcal[i].bound) >= limits[i]) {
+			settled = 0;
+		}
+	}
+
+	if ((drifted == 1) && ((snapshot.error_state & ADC_DRIFT_ERROR) == 0)) {
+		printf("ADC drift: XT60 - VBAT %d uV +/- %u, XT60 - cells %d uV +/- %u\r\n", adc_xcal[ADC_XCAL_REGULATOR].mean,
+				adc_xcal[ADC_XCAL_REGULATOR].bound, adc_xcal[ADC_XCAL_CELL_SUM].mean, adc_xcal[ADC_XCAL_CELL_SUM].bound);
+		Set_Error_State(ADC_DRIFT_ERROR);
+	}
+	else if ((settled == 1) && ((snapshot.error_state & ADC_DRIFT_ERROR) != 0)) {
+		Clear_Error_State(ADC_DRIFT_ERROR);
+	}
+}
+
+/**
+ * @brief  Gets one cross-calibration estimate. Subtracting the difference from the XT60 reading matches it to the reference
+ * @param  reference: ADC_XCAL_REGULATOR or ADC_XCAL_CELL_SUM
+ * @param  difference: Mean XT60 reading minus the reference in volts * BATTERY_ADC_MULTIPLIER
+ * @param  bound: Confidence bound of the mean in volts * BATTERY_ADC_MULTIPLIER
+ * @param  samples: Number of filtered windows compared
+ * @retval uint8_t 1 if the estimate spans a full 1 << ADC_XCAL_SHIFT windows, 0 if not or the reference is invalid
+ */
+uint8_t Get_ADC_Cross_Calibration(uint8_t reference, int32_t *difference, uint32_t *bound, uint32_t *samples) {
+	if (reference >= ADC_XCAL_REFERENCES) {
+		return 0;
+	}
+
+	*difference = adc_xcal[reference].mean;
+	*bound = adc_xcal[reference].bound;
+	*samples = adc_xcal[reference].samples;
+
+	return (adc_xcal[reference].samples >= (1UL << ADC_XCAL_SHIFT)) ? 1 : 0;
+}
+
+/**
+ * @brief Gets a channel's filtered code from the latest window, before calibration
+ * @param channel: 0 XT60, 1-4 balance taps, 5 MCU temperature, 6 VREFINT
+ * @retval Code, 0 for an invalid channel
+ */
+uint32_t Get_ADC_Filtered_Code(uint8_t channel) {
+	if (channel >= ADC_NUMBER_OF_CHANNELS) {
+		return 0;
+	}
+	return adc_filtered_output[channel];
+}
+
+/**
+ * @brief Gets the time the latest filtered voltages were sampled
+ * @retval Free running time in ms
+ */
+uint32_t Get_ADC_Timestamp(void) {
+	return adc_timestamp;
+}
+
+/**
+ * @brief Gets the rate of change of the battery voltage
+ * @retval dV/dt in volts per second * BATTERY_ADC_MULTIPLIER, 0 until enough history is collected
+ */
+int32_t Get_Battery_dVdt(void) {
+	return adc_dvdt[0];
+}
+
+/**
+ * @brief Gets the rate of change of cell X voltage
+ * @param  cell_number: Cell number 0-3
+ * @retval dV/dt in volts per second * BATTERY_ADC_MULTIPLIER, 0 until enough history is collected
+ */
+int32_t Get_Cell_dVdt(uint8_t cell_number) {
+	if (cell_number > 3) {
+		return 0;
+	}
+	return adc_dvdt[cell_number+1];
+}
+
+/**
+ * @brief Gets the worst case time between a filtered block completing and vRead_ADC processing it
+ * @retval Latency in ms
+ */
+uint32_t Get_ADC_Max_Latency(void) {
+	return adc_max_latency;
+}
+
+/**
+ * @brief Gets the number of blocks vRead_ADC missed because the ISR handed over the next one before it got to them,
+ * or dropped because the ISR refilled them while it was copying them
+ * @retval Missed blocks since boot
+ */
+uint32_t Get_ADC_Block_Overruns(void) {
+	return adc_block_overruns;
+}
+
+uint32_t Get_Two_S_Voltage() {
+	return adc_values.two_s_battery_voltage;
+}
+
+uint32_t Get_Three_S_Voltage() {
+	return adc_values.three_s_battery_voltage;
+}
+
+uint32_t Get_Four_S_Voltage() {
+	return adc_values.four_s_battery_voltage;
+}
+
+/**
+ * @brief  Writes the cal result to OTP Flash
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Write_Cal_To_OTP_Flash() {
+	HAL_StatusTypeDef status;
+
+	/* Check input parameters */
+	for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
+		if ((adc_scalars[i] < ADC_SCALAR_Q16_MIN) || (adc_scalars[i] > ADC_SCALAR_Q16_MAX)) {
+			printf("ERROR: ADC Scalar %u Not Set or Out of Range\r\n", i);
+			/* Return error */
+			return 1;
+		}
+	}
+
+	if (HAL_FLASH_Unlock() != HAL_OK) {
+		printf("ERROR: Could not unlock Flash\r\n");
+		return 1;
+	}
+
+	uint32_t address = OTP_START_ADDR;
+	uint32_t temp_address = OTP_START_ADDR;
+
+	for (int i = 0; i < OTP_SIZE; i++) {
+
+		for (int x = 0; x < SCALAR_ARRAY_SIZE; x++) {
+			uint32_t value = *(uint32_t *)(temp_address + (i * BYTES_IN_UINT64) + (x * BYTES_IN_UINT32));
+			if (Is_Valid_OTP_Scalar(value)) {
+				printf("OTP Memory Value: %u\r\n", value);
+				address = temp_address + ((i + 1) * BYTES_IN_UINT64);
+			}
+			else {
+				break;
+			}
+		}
+	}
+
+	printf("OPT Scalar Start Address: 0x%08x\r\n", address);
+
+	uint64_t data_in_64;
+
+	//Write Calibration Values
+	for (int i = 0; i < 3; i++) {
+		/* Write double */
+		if (i < 2) {
+			data_in_64 = adc_scalars[i*2] | (uint64_t)adc_scalars[(i*2)+1] << 32;
+		}
+		else {
+			uint32_t mask = 0xFFFFFFFF;
+			data_in_64 = adc_scalars[i*2] | (uint64_t)mask << 32;
+		}
+
+		printf("Writing 0x%016llx to address: 0x%08x\r\n", (uint64_t)data_in_64, (uint32_t)(address + (i * BYTES_IN_UINT64)));
+
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, (address + (i * BYTES_IN_UINT64)), data_in_64);
+
+		if (status != HAL_OK) {
+			printf("ERROR: Write scalar #%u to OTP Flash Failed\r\n", i);
+
+			if (HAL_FLASH_Lock() != HAL_OK) {
+				printf("ERROR: Could not lock Flash\r\n");
+				return 1;
+			}
+
+			/* Return error */
+			return 1;
+		}
+	}
+
+	if (HAL_FLASH_Lock() != HAL_OK) {
+		printf("ERROR: Could not lock Flash\r\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief  Read the cal values from OTP Flash
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Read_Scalars_From_Flash() {
+	uint32_t address = OTP_START_ADDR;
+
+	uint32_t temp_scalars[SCALAR_ARRAY_SIZE] = {0};
+
+	uint8_t t = SCALAR_ARRAY_SIZE - 1;
+
+	for (int i = OTP_SIZE; i >= 0; i--) {
+
+		uint32_t value = *(uint32_t *)(address + (i * BYTES_IN_UINT32));
+
+		if (Is_Valid_OTP_Scalar(value)) {
+			if (cal_present == 0) {
+				temp_scalars[t] = value;
+			}
+
+			if(t == 0) {
+				cal_present = cal_present + 1;
+				t = SCALAR_ARRAY_SIZE;
+			}
+
+			t--;
+		}
+	}
+
+	if (cal_present != 0) {
+
+		for (int y = 0; y < SCALAR_ARRAY_SIZE; y++) {
+			/* Calibrations written before the Q16 format stored whole microvolts per code */
+			if (temp_scalars[y] < ADC_SCALAR_MAX) {
+				adc_scalars[y] = temp_scalars[y] << ADC_SCALAR_FRACTIONAL_BITS;
+			}
+			else {
+				adc_scalars[y] = temp_scalars[y];
+			}
+		}
+
+		ADC_Set_Linear_Calibration();
+
+		printf("Calibration values already present. 32 total calibrations can be performed. Number of calibrations performed: %u\r\n", cal_present);
+		printf("Using these calibration values:\r\n");
+
+		for (int i = 0; i < SCALAR_ARRAY_SIZE; i++) {
+			printf("Scalar: %u  Value: %u\r\n", i, adc_scalars[i]);
+		}
+		return 0;
+	}
+
+	cal_present = 0;
+	printf("NOT CALIBRATED. Connect known good voltage to cells 1-4 and XT60 in the range of 3.3V - 4V and run cal command.\r\nThen save it to flash with cal_save\r\n");
+
+	return 1;
+}
+
+/**
+ * @brief  Checks if a word read from OTP is a calibration scalar, either legacy whole microvolts or Q16
+ * @param  value: Word read from OTP
+ * @retval uint8_t 1 if a scalar, 0 if not
+ */
+uint8_t Is_Valid_OTP_Scalar(uint32_t value) {
+	if ((value > ADC_SCALAR_MIN) && (value < ADC_SCALAR_MAX)) {
+		return 1;
+	}
+	if ((value > ADC_SCALAR_Q16_MIN) && (value < ADC_SCALAR_Q16_MAX)) {
+		return 1;
+	}
+	return 0;
+}
@@ -27,75 +27,256 @@ volatile struct Battery battery_state;
 
 static uint8_t cell_connected_bitmask = 0;
 
+/* Over voltage latched by the fast path and the tick of the last block over the limit */
+static uint8_t cell_over_voltage_fast_trip;
+static TickType_t cell_over_voltage_fast_tick;
+
+/* Cell count the fast readings agree on and for how many blocks in a row */
+static uint8_t balance_candidate;
+static uint16_t balance_candidate_blocks;
+static struct Balance_Connection_Stats balance_connection_stats;
+
+/* Bleed PWM. Duties are blocks out of BALANCE_PWM_BLOCKS, the active duties are those of the current window */
+static uint8_t balance_window;
+static uint16_t balance_block;
+static uint16_t balance_duty_blocks[4];
+static uint16_t balance_active_blocks[4];
+
 /* Private function prototypes -----------------------------------------------*/
 void Balance_Battery(void);
+void Balance_Set_Duty(void);
+void Balance_Start_Window(void);
+void Balance_PWM_Output(void);
 void Balance_Connection_State(void);
+uint8_t Balance_Cell_Count(uint8_t bitmask);
+void Balance_Connection_Debounce(void);
+void Balance_Set_Cells(uint8_t number_of_cells);
 void Balancing_GPIO_Control(uint8_t cell_balancing_gpio_bitmask);
 void MCU_Temperature_Safety_Check(void);
+void XT60_Voltage_Safety_Check(void);
 
 /**
- * @brief Based on ADC readings, determine if balancing is needed, if so, balance battery
+ * @brief Based on ADC readings, determine if balancing is needed, if so, balance battery.
+ * Called after each filtered window. Bleed duties are only worked out from windows with every bleed off
  */
 void Balance_Battery()
 {
-	if ( (battery_state.balance_port_connected == CONNECTED) && (Get_Error_State() == 0) ) {
+	if ( (battery_state.balance_port_connected == CONNECTED) && ((Get_Error_State() & ~ADC_ADVISORY_ERRORS) == 0) ) {
 
-		uint32_t min_cell_voltage = Get_Cell_Voltage(0);
-		uint32_t max_cell_voltage = Get_Cell_Voltage(0);
-		for(int i = 1; i < battery_state.number_of_cells; i++) {
-			if (Get_Cell_Voltage(i) < min_cell_voltage) {
-				min_cell_voltage = Get_Cell_Voltage(i);
-			}
-			if (Get_Cell_Voltage(i) > max_cell_voltage) {
-				max_cell_voltage = Get_Cell_Voltage(i);
-			}
+		// The window just read was unloaded if no bleed was on or it was the measurement window closing a period
+		if ((battery_state.cell_balance_bitmask == 0) || (balance_window >= (BALANCE_PERIOD_WINDOWS - 1))) {
+			Balance_Set_Duty();
+			balance_window = 0;
 		}
+		else {
+			balance_window++;
+		}
+	}
+	else {
+		battery_state.balancing_enabled = 0;
+		battery_state.cell_balance_bitmask = 0;
+		balance_window = 0;
+	}
 
-		float scalar = 0.0f;
+	Balance_Start_Window();
+}
 
-		// Scale the balancing thresholds tighter as the battery voltage increases. Allows for faster charging.
-		if (battery_state.xt60_connected == CONNECTED) {
-			scalar = (float)CELL_BALANCING_SCALAR_MAX * (1.0f - (((float)max_cell_voltage - (float)MIN_CELL_V_FOR_BALANCING)/((float)CELL_VOLTAGE_TO_ENABLE_CHARGING - (float)MIN_CELL_V_FOR_BALANCING)));
-			if (scalar < 1.0f) {
-				scalar = 1.0f;
-			}
+/**
+ * @brief Works out which cells to bleed and for how long from unloaded cell voltages
+ */
+void Balance_Set_Duty()
+{
+	uint32_t min_cell_voltage = Get_Cell_Voltage(0);
+	uint32_t max_cell_voltage = Get_Cell_Voltage(0);
+	for(int i = 1; i < battery_state.number_of_cells; i++) {
+		if (Get_Cell_Voltage(i) < min_cell_voltage) {
+			min_cell_voltage = Get_Cell_Voltage(i);
 		}
-		else {
-			scalar = 1.0f;
+		if (Get_Cell_Voltage(i) > max_cell_voltage) {
+			max_cell_voltage = Get_Cell_Voltage(i);
 		}
+	}
+
+	uint32_t scalar = BALANCING_SCALAR_ONE;
 
-		if ( ((max_cell_voltage - min_cell_voltage) >= ((float)CELL_DELTA_V_ENABLE_BALANCING * scalar)) && (min_cell_voltage > MIN_CELL_V_FOR_BALANCING) && (battery_state.balancing_enabled == 0)) {
-			battery_state.balancing_enabled = 1;
+	// Scale the balancing thresholds tighter as the battery voltage increases. Allows for faster charging.
+	if ((battery_state.xt60_connected == CONNECTED) && (max_cell_voltage < CELL_VOLTAGE_TO_ENABLE_CHARGING)) {
+		// Millivolts keep the Q8 product inside 32 bits
+		uint32_t headroom_mv = (CELL_VOLTAGE_TO_ENABLE_CHARGING - max_cell_voltage) / 1000;
+		uint32_t range_mv = (CELL_VOLTAGE_TO_ENABLE_CHARGING - MIN_CELL_V_FOR_BALANCING) / 1000;
+
+		scalar = (CELL_BALANCING_SCALAR_MAX * BALANCING_SCALAR_ONE * headroom_mv) / range_mv;
+		if (scalar < BALANCING_SCALAR_ONE) {
+			scalar = BALANCING_SCALAR_ONE;
 		}
-		else if ( (((max_cell_voltage - min_cell_voltage) < ((float)CELL_BALANCING_HYSTERESIS_V * scalar)) && (battery_state.balancing_enabled == 1)) || (min_cell_voltage < MIN_CELL_V_FOR_BALANCING) ) {
-			battery_state.balancing_enabled = 0;
+	}
+
+	uint32_t enable_threshold = (CELL_DELTA_V_ENABLE_BALANCING * scalar) >> BALANCING_SCALAR_BITS;
+	uint32_t hysteresis_threshold = (CELL_BALANCING_HYSTERESIS_V * scalar) >> BALANCING_SCALAR_BITS;
+	uint32_t full_duty_threshold = (CELL_BALANCING_FULL_DUTY_V * scalar) >> BALANCING_SCALAR_BITS;
+
+	if ( ((max_cell_voltage - min_cell_voltage) >= enable_threshold) && (min_cell_voltage > MIN_CELL_V_FOR_BALANCING) && (battery_state.balancing_enabled == 0)) {
+		battery_state.balancing_enabled = 1;
+	}
+	else if ( (((max_cell_voltage - min_cell_voltage) < hysteresis_threshold) && (battery_state.balancing_enabled == 1)) || (min_cell_voltage < MIN_CELL_V_FOR_BALANCING) ) {
+		battery_state.balancing_enabled = 0;
+	}
+
+	//Check each cell voltage. If XT60 is connected, then allow larger voltage differences that tighten as the battery voltage increases.
+	//If just the balance port is connected, then use the tightest balancing thresholds
+	//The bleed duty grows with the cell's lead over the lowest cell, so it eases off as the cells converge instead of overshooting
+	//If a cell is over CELL_OVER_VOLTAGE_ENABLE_DISCHARGE, then the discharging resistor will turn on at full duty
+	uint8_t bitmask = 0;
+	for(int i = 0; i < 4; i++) {
+		uint32_t excess = Get_Cell_Voltage(i) - min_cell_voltage;
+
+		balance_duty_blocks[i] = 0;
+
+		if (i >= battery_state.number_of_cells) {
+			continue;
 		}
 
-		//Check each cell voltage. If XT60 is connected, then allow larger voltage differences that tighten as the battery voltage increases.
-		//If just the balance port is connected, then use the tightest balancing thresholds
-		//If a cell is over CELL_OVER_VOLTAGE_ENABLE_DISCHARGE, then the discharging resistor will turn on
-		for(int i = 0; i < battery_state.number_of_cells; i++) {
-			if ( (battery_state.balancing_enabled == 1) && ((Get_Cell_Voltage(i) - min_cell_voltage) >= ((float)CELL_BALANCING_HYSTERESIS_V * scalar))) {
-				battery_state.cell_balance_bitmask |= (1<<i);
+		if ( (battery_state.balancing_enabled == 1) && (excess >= hysteresis_threshold)) {
+			uint32_t duty = (excess * BALANCE_PWM_BLOCKS) / full_duty_threshold;
+			if (duty < 1) {
+				duty = 1;
 			}
-			else if (Get_Cell_Voltage(i) >= CELL_OVER_VOLTAGE_ENABLE_DISCHARGE) {
-				battery_state.cell_balance_bitmask |= (1<<i);
+			if (duty > BALANCE_PWM_BLOCKS) {
+				duty = BALANCE_PWM_BLOCKS;
 			}
-			else {
-				battery_state.cell_balance_bitmask &= ~(1<<i);
+			balance_duty_blocks[i] = duty;
+			bitmask |= (1<<i);
+		}
+		else if (Get_Cell_Voltage(i) >= CELL_OVER_VOLTAGE_ENABLE_DISCHARGE) {
+			balance_duty_blocks[i] = BALANCE_PWM_BLOCKS;
+			bitmask |= (1<<i);
+		}
+	}
+	battery_state.cell_balance_bitmask = bitmask;
+}
+
+/**
+ * @brief Sets each cell's bleed on time for the window about to start. The last BALANCE_OFF_WINDOWS of a period are off,
+ * the tap filters are cleared for the last one
+ */
+void Balance_Start_Window()
+{
+	uint8_t measuring = (balance_window >= (BALANCE_PERIOD_WINDOWS - BALANCE_OFF_WINDOWS)) ? 1 : 0;
+
+	for (int i = 0; i < 4; i++) {
+		if ((battery_state.cell_balance_bitmask & (1<<i)) && (measuring == 0)) {
+			balance_active_blocks[i] = balance_duty_blocks[i];
+		}
+		else {
+			balance_active_blocks[i] = 0;
+		}
+	}
+
+	/* The tap filters still hold loaded blocks from before the bleeds went off, the window the duties come from starts clean */
+	if (balance_window == (BALANCE_PERIOD_WINDOWS - 1)) {
+		Reset_ADC_Filters(BALANCE_TAP_CHANNELS);
+	}
+
+	balance_block = 0;
+	Balance_PWM_Output();
+}
+
+/**
+ * @brief Advances the bleed PWM by one ADC block. Called from vRead_ADC for every block
+ */
+void Balance_PWM_Update()
+{
+	if (balance_block < BALANCE_PWM_BLOCKS) {
+		balance_block++;
+	}
+
+	Balance_PWM_Output();
+}
+
+/**
+ * @brief Drives the bleeds whose on time in this window has not run out
+ */
+void Balance_PWM_Output()
+{
+	uint8_t bitmask = 0;
+
+	if (battery_state.balance_port_connected == CONNECTED) {
+		for (int i = 0; i < 4; i++) {
+			if (balance_block < balance_active_blocks[i]) {
+				bitmask |= (1<<i);
 			}
 		}
-		Balancing_GPIO_Control(battery_state.cell_balance_bitmask);
+	}
+
+	Balancing_GPIO_Control(bitmask);
+}
+
+/**
+ * @brief Works out the number of cells from a bitmask of the taps reading a cell
+ * @param  bitmask: Bit n set if cell n+1 is above VOLTAGE_CONNECTED_THRESHOLD
+ * @retval 2, 3 or 4, 0 if no balance lead or BALANCE_CELLS_INVALID if the taps do not make a pack
+ */
+uint8_t Balance_Cell_Count(uint8_t bitmask)
+{
+	if ( bitmask & (1<<3) ) {
+		return ((bitmask & THREE_S_BITMASK) == THREE_S_BITMASK) ? 4 : BALANCE_CELLS_INVALID;
+	}
+	else if ( bitmask & (1<<2) ) {
+		return ((bitmask & TWO_S_BITMASK) == TWO_S_BITMASK) ? 3 : BALANCE_CELLS_INVALID;
+	}
+	else if ( bitmask & (1<<1) ) {
+		return ((bitmask & ONE_S_BITMASK) == ONE_S_BITMASK) ? 2 : BALANCE_CELLS_INVALID;
+	}
+	return 0;
+}
+
+/**
+ * @brief Tracks how long the fast readings have agreed on a cell count. Called from Battery_Fast_Safety_Check for every block
+ */
+void Balance_Connection_Debounce()
+{
+	uint8_t bitmask = 0;
+	for (int i = 0; i < 4; i++) {
+		if ( Get_Fast_Cell_Voltage(i) > VOLTAGE_CONNECTED_THRESHOLD ) {
+			bitmask |= (1<<i);
+		}
+	}
 
+	uint8_t candidate = Balance_Cell_Count(bitmask);
+
+	if (candidate == balance_candidate) {
+		if (balance_candidate_blocks < BALANCE_CONNECT_BLOCKS) {
+			balance_candidate_blocks++;
+		}
 	}
 	else {
-		Balancing_GPIO_Control(0);
-		battery_state.balancing_enabled = 0;
+		// A count that changes again before it was accepted is contact bounce
+		if ((balance_candidate_blocks < BALANCE_CONNECT_BLOCKS) && (balance_candidate != battery_state.number_of_cells)) {
+			balance_connection_stats.bounces++;
+		}
+		balance_candidate = candidate;
+		balance_candidate_blocks = 1;
+	}
+}
+
+/**
+ * @brief Sets the number of cells and counts the change in the connection telemetry
+ * @param  number_of_cells: 0, 2, 3 or 4
+ */
+void Balance_Set_Cells(uint8_t number_of_cells)
+{
+	if (number_of_cells > battery_state.number_of_cells) {
+		balance_connection_stats.connects++;
 	}
+	else if (number_of_cells < battery_state.number_of_cells) {
+		balance_connection_stats.disconnects++;
+	}
+	battery_state.number_of_cells = number_of_cells;
 }
 
 /**
- * @brief Determines the state of the balance connection based on ADC readings
+ * @brief Determines the state of the balance connection based on ADC readings.
+ * Fewer cells are taken at once, more cells or a bad tap pattern only once the fast readings agreed for BALANCE_CONNECT_BLOCKS
  */
 void Balance_Connection_State()
 {
@@ -124,38 +305,20 @@ void Balance_Connection_State()
 		cell_connected_bitmask &= ~0b0001;
 	}
 
-	if ( cell_connected_bitmask & (1<<3) ) {
-		if ( (cell_connected_bitmask & THREE_S_BITMASK) == THREE_S_BITMASK ) {
-			battery_state.number_of_cells = 4;
-			Clear_Error_State(CELL_CONNECTION_ERROR);
-		}
-		else {
-			battery_state.number_of_cells = 0;
-			Set_Error_State(CELL_CONNECTION_ERROR);
-		}
-	}
-	else if ( cell_connected_bitmask & (1<<2) ) {
-		if ( (cell_connected_bitmask & TWO_S_BITMASK) ==  TWO_S_BITMASK ) {
-			battery_state.number_of_cells = 3;
-			Clear_Error_State(CELL_CONNECTION_ERROR);
-		}
-		else {
-			battery_state.number_of_cells = 0;
+	uint8_t number_of_cells = Balance_Cell_Count(cell_connected_bitmask);
+	uint8_t settled = ((balance_candidate == number_of_cells) && (balance_candidate_blocks >= BALANCE_CONNECT_BLOCKS)) ? 1 : 0;
+
+	if (number_of_cells == BALANCE_CELLS_INVALID) {
+		if (settled == 1) {
+			Balance_Set_Cells(0);
 			Set_Error_State(CELL_CONNECTION_ERROR);
 		}
 	}
-	else if ( cell_connected_bitmask & (1<<1) ) {
-		if ( (cell_connected_bitmask & ONE_S_BITMASK) == ONE_S_BITMASK ) {
-			battery_state.number_of_cells = 2;
-			Clear_Error_State(CELL_CONNECTION_ERROR);
-		}
-		else {
-			battery_state.number_of_cells = 0;
-			Set_Error_State(CELL_CONNECTION_ERROR);
-		}
+	else if ((number_of_cells < battery_state.number_of_cells) || (settled == 1)) {
+		Balance_Set_Cells(number_of_cells);
+		Clear_Error_State(CELL_CONNECTION_ERROR);
 	}
-	else {
-		battery_state.number_of_cells = 0;
+	else if ((number_of_cells == battery_state.number_of_cells) && (number_of_cells == 0)) {
 		Clear_Error_State(CELL_CONNECTION_ERROR);
 	}
 
@@ -168,7 +331,7 @@ void Balance_Connection_State()
 }
 
 /**
- * @brief Checks if any cell is over or under voltage
+ * @brief Checks if any cell is over or under voltage. Also releases the over voltage latched by Battery_Fast_Safety_Check
  */
 void Cell_Voltage_Safety_Check()
 {
@@ -192,15 +355,98 @@ void Cell_Voltage_Safety_Check()
 		Clear_Error_State(CELL_VOLTAGE_ERROR);
 	}
 
+	// A fast path trip is only released once it has been clear for CELL_OVER_VOLTAGE_HOLD_MS
+	if (cell_over_voltage_fast_trip == 1) {
+		if (((xTaskGetTickCount() - cell_over_voltage_fast_tick) * portTICK_PERIOD_MS) < CELL_OVER_VOLTAGE_HOLD_MS) {
+			over_voltage_temp = 1;
+		}
+		else {
+			cell_over_voltage_fast_trip = 0;
+		}
+	}
+
 	battery_state.cell_over_voltage = over_voltage_temp;
 }
 
+/**
+ * @brief Checks the filtered XT60 reading against the pack over voltage limit AWD1 trips at.
+ * XT60_VOLTAGE_ERROR is held while the reading is over and only released once it is back inside
+ */
+void XT60_Voltage_Safety_Check()
+{
+	if ((battery_state.xt60_connected == CONNECTED) && (battery_state.number_of_cells > 1) &&
+			(Get_Battery_Voltage() > (battery_state.number_of_cells * (CELL_OVER_VOLTAGE_DISABLE_CHARGING + ADC_AWD_OVER_VOLTAGE_MARGIN)))) {
+		Set_Error_State(XT60_VOLTAGE_ERROR);
+	}
+	else {
+		Clear_Error_State(XT60_VOLTAGE_ERROR);
+	}
+}
+
+/**
+ * @brief Checks the fast window readings for over voltage, under voltage and disconnects.
+ * Trips are latched here and only released by the filtered readings in Battery_Connection_State
+ */
+void Battery_Fast_Safety_Check()
+{
+	if ((battery_state.xt60_connected == CONNECTED) && (Get_Fast_Battery_Voltage() < VOLTAGE_CONNECTED_THRESHOLD)) {
+		battery_state.xt60_connected = NOT_CONNECTED;
+		battery_state.requires_charging = 0;
+		Regulator_HI_Z(1);
+	}
+
+	Balance_Connection_Debounce();
+
+	if (battery_state.balance_port_connected != CONNECTED) {
+		return;
+	}
+
+	for (int i = 0; i < battery_state.number_of_cells; i++) {
+		uint32_t cell_voltage = Get_Fast_Cell_Voltage(i);
+
+		// Dropping the cell count makes the next connection go through the debounce in Balance_Connection_State
+		if (cell_voltage < VOLTAGE_CONNECTED_THRESHOLD) {
+			Balance_Set_Cells(0);
+			battery_state.balance_port_connected = NOT_CONNECTED;
+			battery_state.balancing_enabled = 0;
+			battery_state.requires_charging = 0;
+			Balancing_GPIO_Control(0);
+			Regulator_HI_Z(1);
+			return;
+		}
+
+		if (cell_voltage > CELL_OVER_VOLTAGE_DISABLE_CHARGING) {
+			battery_state.cell_over_voltage = 1;
+			cell_over_voltage_fast_trip = 1;
+			cell_over_voltage_fast_tick = xTaskGetTickCount();
+			Regulator_HI_Z(1);
+		}
+
+		if (cell_voltage < MIN_CELL_VOLTAGE_SAFE_LIMIT) {
+			Set_Error_State(CELL_VOLTAGE_ERROR);
+			Regulator_HI_Z(1);
+		}
+	}
+}
+
+/**
+ * @brief Latches a cell over voltage on an AWD2 trip. Called from the ADC interrupt,
+ * released by Cell_Voltage_Safety_Check like a trip from the fast window
+ */
+void Cell_Over_Voltage_Trip_From_ISR()
+{
+	battery_state.cell_over_voltage = 1;
+	cell_over_voltage_fast_trip = 1;
+	cell_over_voltage_fast_tick = xTaskGetTickCountFromISR();
+}
+
 /**
  * @brief Determines the state of connections based on ADC readings
  */
 void Battery_Connection_State()
 {
-	if ( Get_Battery_Voltage() > VOLTAGE_CONNECTED_THRESHOLD ) {
+	// The fast reading must agree so a window straddling a disconnect does not reconnect the XT60
+	if (( Get_Battery_Voltage() > VOLTAGE_CONNECTED_THRESHOLD ) && ( Get_Fast_Battery_Voltage() > VOLTAGE_CONNECTED_THRESHOLD )) {
 		battery_state.xt60_connected = CONNECTED;
 	}
 	else {
@@ -213,10 +459,10 @@ void Battery_Connection_State()
 
 	Cell_Voltage_Safety_Check();
 
-	//Only update the balancing state if charging is off
-	if (Get_Regulator_Charging_State() == 0) {
-		Balance_Battery();
-	}
+	XT60_Voltage_Safety_Check();
+
+	//Balancing runs alongside charging, Taper_Charge_Current keeps the high cells from running ahead of the bleeds
+	Balance_Battery();
 
 	if ((battery_state.xt60_connected == CONNECTED) && (battery_state.balance_port_connected == CONNECTED)){
 		if (Get_Battery_Voltage() < (battery_state.number_of_cells * CELL_VOLTAGE_TO_ENABLE_CHARGING)) {
@@ -231,6 +477,35 @@ void Battery_Connection_State()
 	}
 }
 
+/**
+ * @brief Tapers the charge current as the highest cell nears CELL_VOLTAGE_TO_ENABLE_CHARGING while the pack is balancing.
+ * A balanced pack is left to the regulator's constant voltage stage. Called from vRegulator with the snapshot the charger ran on
+ * @param charge_current_ma: Charge current the supply allows in mA
+ * @param max_cell_voltage: Highest cell voltage in volts * BATTERY_ADC_MULTIPLIER
+ * @param balancing: 1 if any bleed is on
+ * @retval Charge current in mA
+ */
+uint32_t Taper_Charge_Current(uint32_t charge_current_ma, uint32_t max_cell_voltage, uint8_t balancing)
+{
+	if (balancing == 0) {
+		return charge_current_ma;
+	}
+
+	if (max_cell_voltage >= CELL_VOLTAGE_TO_ENABLE_CHARGING) {
+		return 0;
+	}
+
+	// Millivolts keep the product inside 32 bits
+	uint32_t headroom_mv = (CELL_VOLTAGE_TO_ENABLE_CHARGING - max_cell_voltage) / 1000;
+	uint32_t window_mv = CHARGE_TAPER_WINDOW_V / 1000;
+
+	if (headroom_mv >= window_mv) {
+		return charge_current_ma;
+	}
+
+	return (charge_current_ma * headroom_mv) / window_mv;
+}
+
 /**
  * @brief Controls the GPIO outputs of the balancing circuit
  * @param  cell_balancing_gpio_bitmask: Four bit bitmask for cells 1-4. 1 balancing enabled, 0 disabled. Position 0 - cell 1, 1 - cell 2, etc.
@@ -278,6 +553,15 @@ void MCU_Temperature_Safety_Check() {
 	}
 }
 
+/**
+ * @brief Returns the balance connection telemetry
+ * @param  stats: Filled with the connection counters since boot
+ */
+void Get_Balance_Connection_Stats(struct Balance_Connection_Stats *stats)
+{
+	*stats = balance_connection_stats;
+}
+
 /**
  * @brief Returns the balance connection state
  * @retval uint8_t CONNECTED or NOT_CONNECTED
@@ -299,6 +583,19 @@ uint8_t Get_Balancing_State()
 	return 0;
 }
 
+/**
+ * @brief Returns the share of time a cell's bleed resistor is on
+ * @param  cell_number: Cell number 0-3
+ * @retval Duty over a whole balancing period in percent, 0 if the cell is not balancing
+ */
+uint8_t Get_Balancing_Duty(uint8_t cell_number)
+{
+	if ((cell_number > 3) || ((battery_state.cell_balance_bitmask & (1<<cell_number)) == 0)) {
+		return 0;
+	}
+	return (balance_duty_blocks[cell_number] * (BALANCE_PERIOD_WINDOWS - BALANCE_OFF_WINDOWS) * 100) / (BALANCE_PERIOD_WINDOWS * BALANCE_PWM_BLOCKS);
+}
+
 /**
  * @brief Returns the state of charging
  * @retval uint8_t 1 if charging is required or 0 if not required
@@ -8,7 +8,10 @@
 #include "adc_interface.h"
 #include "bq25703a_regulator.h"
 #include "battery.h"
+#include "charger.h"
+#include "resistance.h"
 #include "error.h"
+#include "measurement.h"
 #include "main.h"
 #include "string.h"
 #include "printf.h"
@@ -16,6 +19,10 @@
 
 extern I2C_HandleTypeDef hi2c1;
 
+#if (CHARGER_UV_PER_V != BATTERY_ADC_MULTIPLIER)
+#error "charger.h cell voltage units must match BATTERY_ADC_MULTIPLIER"
+#endif
+
 /* Private typedef -----------------------------------------------------------*/
 struct Regulator {
 	uint8_t connected;
@@ -49,10 +56,10 @@ uint8_t Read_Charge_Okay(void);
 void Read_Charge_Status(void);
 void Regulator_Set_ADC_Option(void);
 void Regulator_Read_ADC(void);
-void Regulator_HI_Z(uint8_t hi_z_en);
 void Regulator_OTG_EN(uint8_t otg_en);
 void Regulator_Set_Charge_Option_0(void);
 void Set_Charge_Voltage(uint8_t number_of_cells);
+uint32_t Calculate_Charge_Current(uint32_t charging_power_mw);
 
 /**
  * @brief Returns whether the regulator is connected over I2C
@@ -421,72 +428,129 @@ void Set_Charge_Voltage(uint8_t number_of_cells) {
  */
 uint32_t Calculate_Max_Charge_Power() {
 
-	//Account for system losses with ASSUME_EFFICIENCY fudge factor to not overload source
-	uint32_t charging_power_mw = (((float)(regulator.vbus_voltage/REG_ADC_MULTIPLIER) * Get_Max_Input_Current()) * ASSUME_EFFICIENCY);
+	//Account for system losses with ASSUME_EFFICIENCY_PERCENT fudge factor to not overload source
+	uint32_t vbus_voltage_mv = regulator.vbus_voltage / (REG_ADC_MULTIPLIER / 1000);
+	uint32_t charging_power_mw = (((vbus_voltage_mv * Get_Max_Input_Current()) / 1000) * ASSUME_EFFICIENCY_PERCENT) / 100;
 
 	if (charging_power_mw > MAX_CHARGING_POWER) {
 		charging_power_mw = MAX_CHARGING_POWER;
 	}
 
 	if (charging_power_mw > Get_Max_Input_Power()){
-		charging_power_mw = Get_Max_Input_Power() * ASSUME_EFFICIENCY;
+		charging_power_mw = (Get_Max_Input_Power() * ASSUME_EFFICIENCY_PERCENT) / 100;
 	}
 
 	//Throttle charging power if temperature is too high
 	if (Get_MCU_Temperature() > TEMP_THROTTLE_THRESH_C){
-		float temperature = (float)Get_MCU_Temperature();
-
-		float power_scalar = 1.0f - ((float)(0.0333 * temperature) - 1.33f);
+		int32_t power_scalar = TEMP_THROTTLE_INTERCEPT - (TEMP_THROTTLE_SLOPE * Get_MCU_Temperature());
 
-		if (power_scalar > 1.0f) {
-			power_scalar = 1.0f;
+		if (power_scalar > TEMP_THROTTLE_SCALE) {
+			power_scalar = TEMP_THROTTLE_SCALE;
 		}
-		if (power_scalar < 0.00f) {
-			power_scalar = 0.00f;
+		if (power_scalar < 0) {
+			power_scalar = 0;
 		}
 
-		charging_power_mw = charging_power_mw * power_scalar;
+		charging_power_mw = (charging_power_mw * (uint32_t)power_scalar) / TEMP_THROTTLE_SCALE;
 	}
 
 	return charging_power_mw;
 }
 
 /**
- * @brief Determines if charger output should be on and sets voltage and current parameters as needed
+ * @brief Calculates the charge current that delivers a given power at the present battery voltage
+ * @param charging_power_mw Charging power in mW
+ * @retval Charge current in mA, 0 if the battery voltage is unknown
+ */
+uint32_t Calculate_Charge_Current(uint32_t charging_power_mw) {
+
+	uint32_t battery_voltage_mv = Get_Battery_Voltage() / (BATTERY_ADC_MULTIPLIER / 1000);
+
+	if (battery_voltage_mv == 0) {
+		return 0;
+	}
+
+	return (charging_power_mw * 1000) / battery_voltage_mv;
+}
+
+/**
+ * @brief Runs the charger state machine and sets voltage and current parameters for its state
  */
 void Control_Charger_Output() {
 
 	TickType_t xDelay = 500 / portTICK_PERIOD_MS;
 
-	//Charging for USB PD enabled supplies
-	if ((Get_XT60_Connection_State() == CONNECTED) && (Get_Balance_Connection_State() == CONNECTED) && (Get_Error_State() == 0) && (Get_Input_Power_Ready() == READY) && (Get_Cell_Over_Voltage_State() == 0)) {
+	struct Measurement_Snapshot snapshot;
+	Get_Measurement_Snapshot(&snapshot);
+
+	uint8_t power_ready = Get_Input_Power_Ready();
+
+	struct Charger_Inputs inputs;
+	inputs.xt60_connected = snapshot.xt60_connected;
+	inputs.balance_port_connected = snapshot.balance_port_connected;
+	inputs.number_of_cells = snapshot.number_of_cells;
+	inputs.power_ready = ((power_ready == READY) || (power_ready == NO_USB_PD_SUPPLY)) ? 1 : 0;
+	inputs.requires_charging = snapshot.requires_charging;
+	inputs.balancing = (snapshot.balancing_state != 0) ? 1 : 0;
+	inputs.cell_over_voltage = snapshot.cell_over_voltage;
+	inputs.adc_tuning = snapshot.adc_tuning;
+	inputs.error_state = snapshot.error_state & ~ADC_ADVISORY_ERRORS;
+	inputs.min_cell_voltage = 0;
+	inputs.max_cell_voltage = 0;
+	inputs.charge_current_ma = Get_Charge_Current_ADC_Reading() / (REG_ADC_MULTIPLIER / 1000);
+
+	if (snapshot.number_of_cells > 0) {
+		inputs.min_cell_voltage = snapshot.cell_voltage[0];
+		inputs.max_cell_voltage = snapshot.cell_voltage[0];
+		for (int i = 1; i < snapshot.number_of_cells; i++) {
+			if (snapshot.cell_voltage[i] < inputs.min_cell_voltage) {
+				inputs.min_cell_voltage = snapshot.cell_voltage[i];
+			}
+			if (snapshot.cell_voltage[i] > inputs.max_cell_voltage) {
+				inputs.max_cell_voltage = snapshot.cell_voltage[i];
+			}
+		}
+	}
 
-		Set_Charge_Voltage(Get_Number_Of_Cells());
+	uint32_t now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
 
-		uint32_t charging_current_ma = ((Calculate_Max_Charge_Power()) / (float)(Get_Battery_Voltage() / BATTERY_ADC_MULTIPLIER));
+	Charger_Update(&inputs, now_ms);
 
-		Set_Charge_Current(charging_current_ma);
+	struct Charger_Output output;
+	Get_Charger_Output(&output);
 
-		Regulator_HI_Z(0);
+	/* The HI-Z rest steps the charge current, the snapshot is still from before this poll's output */
+	Resistance_Update(&snapshot, output.charge_enable, now_ms);
 
-		//Check if XT60 was disconnected
-		if (regulator.vbat_voltage > (BATTERY_DISCONNECT_THRESH * Get_Number_Of_Cells())) {
-			Regulator_HI_Z(1);
-			vTaskDelay(xDelay*2);
-			Regulator_HI_Z(0);
+	if (output.charge_enable == 1) {
+
+		Set_Charge_Voltage(snapshot.number_of_cells);
+
+		uint32_t charging_current_ma;
+		if (power_ready == READY) {
+			charging_current_ma = Calculate_Charge_Current(Calculate_Max_Charge_Power());
+		}
+		// Case to handle non USB PD supplies. Limited to 5V 500mA.
+		else {
+			charging_current_ma = Calculate_Charge_Current((NON_USB_PD_CHARGE_POWER * ASSUME_EFFICIENCY_PERCENT) / 100);
 		}
-	}
-	// Case to handle non USB PD supplies. Limited to 5V 500mA.
-	else if ((Get_XT60_Connection_State() == CONNECTED) && (Get_Balance_Connection_State() == CONNECTED) && (Get_Error_State() == 0) && (Get_Input_Power_Ready() == NO_USB_PD_SUPPLY) && (Get_Cell_Over_Voltage_State() == 0)) {
 
-		Set_Charge_Voltage(Get_Number_Of_Cells());
+		charging_current_ma = Taper_Charge_Current(charging_current_ma, inputs.max_cell_voltage, inputs.balancing);
 
-		uint32_t charging_current_ma = ((NON_USB_PD_CHARGE_POWER * ASSUME_EFFICIENCY) / (Get_Battery_Voltage() / BATTERY_ADC_MULTIPLIER));
+		if ((output.current_limit_ma != 0) && (charging_current_ma > output.current_limit_ma)) {
+			charging_current_ma = output.current_limit_ma;
+		}
 
 		Set_Charge_Current(charging_current_ma);
 
 		Regulator_HI_Z(0);
 
+		//Check if XT60 was disconnected
+		if ((power_ready == READY) && (regulator.vbat_voltage > (BATTERY_DISCONNECT_THRESH * snapshot.number_of_cells))) {
+			Regulator_HI_Z(1);
+			vTaskDelay(xDelay*2);
+			Regulator_HI_Z(0);
+		}
 	}
 	else {
 		Regulator_HI_Z(1);
@@ -502,6 +566,21 @@ void vRegulator(void const *pvParameters) {
 
 	TickType_t xDelay = 250 / portTICK_PERIOD_MS;
 
+	Regulator_Init();
+
+	for (;;) {
+
+		Regulator_Poll();
+
+		vTaskDelay(xDelay);
+	}
+}
+
+/**
+ * @brief Puts the regulator in a safe state and sets it up. Called once by vRegulator
+ */
+void Regulator_Init(void) {
+
 	/* Disable the output of the regulator for safety */
 	Regulator_HI_Z(1);
 
@@ -516,39 +595,34 @@ void vRegulator(void const *pvParameters) {
 
 	/* Setup the ADC on the Regulator */
 	Regulator_Set_ADC_Option();
+}
 
-	uint8_t timer_count = 0;
+/**
+ * @brief Reads the regulator, runs the charger and publishes the result. Called by vRegulator every 250ms
+ */
+void Regulator_Poll(void) {
 
-	for (;;) {
+	//Check if power into regulator is okay
+	if (Read_Charge_Okay() != 1) {
+		Set_Error_State(VOLTAGE_INPUT_ERROR);
+	}
+	else if ((Get_Error_State() & VOLTAGE_INPUT_ERROR) == VOLTAGE_INPUT_ERROR) {
+		Clear_Error_State(VOLTAGE_INPUT_ERROR);
+	}
 
-		//Check if power into regulator is okay
-		if (Read_Charge_Okay() != 1) {
-			Set_Error_State(VOLTAGE_INPUT_ERROR);
-		}
-		else if ((Get_Error_State() & VOLTAGE_INPUT_ERROR) == VOLTAGE_INPUT_ERROR) {
-			Clear_Error_State(VOLTAGE_INPUT_ERROR);
-		}
+	//Check if STM32G0 can communicate with regulator
+	if ((Get_Error_State() & REGULATOR_COMMUNICATION_ERROR) == REGULATOR_COMMUNICATION_ERROR) {
+		regulator.connected = 0;
+	}
 
-		//Check if STM32G0 can communicate with regulator
-		if ((Get_Error_State() & REGULATOR_COMMUNICATION_ERROR) == REGULATOR_COMMUNICATION_ERROR) {
-			regulator.connected = 0;
-		}
+	Read_Charge_Status();
 
-		Read_Charge_Status();
+	Regulator_Read_ADC();
 
-		Regulator_Read_ADC();
+	Control_Charger_Output();
 
-		timer_count++;
-		if (timer_count < 90) {
-			Control_Charger_Output();
-		}
-		else if (timer_count > 100){
-			timer_count = 0;
-		}
-		else {
-			Regulator_HI_Z(1);
-		}
+	Publish_Regulator_Measurements();
 
-		vTaskDelay(xDelay);
-	}
+	/* Compare the MCU pack reading with this poll's VBAT */
+	ADC_Cross_Calibrate();
 }
@@ -0,0 +1,371 @@
+/**
+ ******************************************************************************
+ * @file           : charger.c
+ * @brief          : Table driven battery and charger state machine
+ ******************************************************************************
+ */
+
+#include "charger.h"
+
+#include <stddef.h>
+
+/* Private typedef -----------------------------------------------------------*/
+struct Charger_Transition {
+	uint8_t from;
+	uint8_t to;
+	uint8_t (*condition)(const struct Charger_Inputs *inputs);
+	uint32_t debounce_ms;
+};
+
+struct Charger_State_Info {
+	const char *name;
+	uint32_t min_time_ms;
+	uint32_t timeout_ms;
+	uint8_t charge_enable;
+	uint32_t current_limit_ma;
+};
+
+struct Charger {
+	uint8_t state;
+	uint8_t timed_out;
+	uint32_t state_entry_ms;
+	uint32_t cycle_start_ms;
+	uint32_t now_ms;
+	uint32_t transitions;
+	const struct Charger_Transition *pending;
+	uint32_t pending_since_ms;
+};
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t Charger_Fault(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Fault_Cleared(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Disconnected(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Connected(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Power_Lost(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Needs_Precharge(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Needs_Charge(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Needs_Recharge(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Precharged(const struct Charger_Inputs *inputs);
+static uint8_t Charger_At_CV(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Below_CV(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Balancing(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Balancing_Only(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Balanced(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Finished(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Terminated(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Terminated_Balancing(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Terminated_Balanced(const struct Charger_Inputs *inputs);
+static uint8_t Charger_Resting(uint32_t settle_ms);
+static uint8_t Charger_From(uint8_t from);
+static void Charger_Enter(uint8_t state, uint32_t now_ms);
+
+/* Private variables ---------------------------------------------------------*/
+static struct Charger charger;
+
+/* Indexed by state. Minimum time, timeout, charger output and current limit, 0 for no timeout or limit */
+static const struct Charger_State_Info charger_states[CHARGER_STATES] = {
+	{ "DISCONNECTED",	0,		0,								0,	0 },
+	{ "DETECTING",		0,		0,								0,	0 },
+	{ "NEGOTIATING",	0,		0,								0,	0 },
+	{ "PRECHARGE",		5000,	CHARGER_PRECHARGE_TIMEOUT_MS,	1,	CHARGER_PRECHARGE_CURRENT_MA },
+	{ "CC",				5000,	0,								1,	0 },
+	{ "CV",				5000,	0,								1,	0 },
+	{ "BALANCING",		5000,	0,								0,	0 },
+	{ "DONE",			5000,	0,								0,	0 },
+	{ "FAULT",			2000,	0,								0,	0 },
+};
+
+/*
+ * Rows are checked in order and the first whose condition holds is the candidate. Rows from CHARGER_ANY and
+ * CHARGER_CHARGING are the safety moves, they skip the minimum time of the state being left. A transition to the current
+ * state is never taken.
+ * Charging ends in CV on the charge current, the cell voltages read under it are not the pack at rest. Once ended it only
+ * starts again below CHARGER_RECHARGE_CELL_V, so a full pack relaxing off the charger is not topped up over and over.
+ */
+static const struct Charger_Transition charger_transitions[] = {
+	{ CHARGER_ANY,			CHARGER_FAULT,			Charger_Fault,				0 },
+	{ CHARGER_ANY,			CHARGER_DISCONNECTED,	Charger_Disconnected,		0 },
+	{ CHARGER_CHARGING,		CHARGER_NEGOTIATING,	Charger_Power_Lost,			0 },
+	{ CHARGER_FAULT,		CHARGER_DISCONNECTED,	Charger_Fault_Cleared,		1000 },
+	{ CHARGER_DISCONNECTED,	CHARGER_DETECTING,		Charger_Connected,			0 },
+	{ CHARGER_DETECTING,	CHARGER_NEGOTIATING,	Charger_Connected,			500 },
+	{ CHARGER_NEGOTIATING,	CHARGER_PRECHARGE,		Charger_Needs_Precharge,	1000 },
+	{ CHARGER_NEGOTIATING,	CHARGER_CC,				Charger_Needs_Charge,		1000 },
+	{ CHARGER_NEGOTIATING,	CHARGER_BALANCING,		Charger_Balancing_Only,		1000 },
+	{ CHARGER_NEGOTIATING,	CHARGER_DONE,			Charger_Finished,			1000 },
+	{ CHARGER_PRECHARGE,	CHARGER_CC,				Charger_Precharged,			2000 },
+	{ CHARGER_CC,			CHARGER_CV,				Charger_At_CV,				2000 },
+	{ CHARGER_CV,			CHARGER_CC,				Charger_Below_CV,			2000 },
+	{ CHARGER_CV,			CHARGER_BALANCING,		Charger_Terminated_Balancing,	CHARGER_TERMINATION_MS },
+	{ CHARGER_CV,			CHARGER_DONE,			Charger_Terminated_Balanced,	CHARGER_TERMINATION_MS },
+	{ CHARGER_BALANCING,	CHARGER_NEGOTIATING,	Charger_Needs_Recharge,		5000 },
+	{ CHARGER_BALANCING,	CHARGER_DONE,			Charger_Balanced,			2000 },
+	{ CHARGER_DONE,			CHARGER_NEGOTIATING,	Charger_Needs_Recharge,		60000 },
+	{ CHARGER_DONE,			CHARGER_BALANCING,		Charger_Balancing,			2000 },
+};
+
+#define CHARGER_TRANSITIONS		(sizeof(charger_transitions) / sizeof(charger_transitions[0]))
+
+/**
+ * @brief Runs the state machine once. Called from vRegulator each poll
+ * @param inputs Measurements and flags for this poll
+ * @param now_ms Time in ms, only differences are used so it may wrap
+ */
+void Charger_Update(const struct Charger_Inputs *inputs, uint32_t now_ms)
+{
+	charger.now_ms = now_ms;
+
+	// A state timeout holds the charger in FAULT until the pack is unplugged
+	if (inputs->xt60_connected == 0) {
+		charger.timed_out = 0;
+	}
+
+	const struct Charger_State_Info *info = &charger_states[charger.state];
+	uint32_t time_in_state = now_ms - charger.state_entry_ms;
+
+	if ((info->timeout_ms != 0) && (time_in_state >= info->timeout_ms)) {
+		charger.timed_out = 1;
+	}
+
+	const struct Charger_Transition *match = NULL;
+	for (uint32_t i = 0; i < CHARGER_TRANSITIONS; i++) {
+		const struct Charger_Transition *transition = &charger_transitions[i];
+
+		if ((Charger_From(transition->from) == 0) || (transition->to == charger.state)) {
+			continue;
+		}
+		if (transition->condition(inputs) != 0) {
+			match = transition;
+			break;
+		}
+	}
+
+	if (match == NULL) {
+		charger.pending = NULL;
+		return;
+	}
+
+	// Debounce restarts whenever the candidate changes
+	if (match != charger.pending) {
+		charger.pending = match;
+		charger.pending_since_ms = now_ms;
+	}
+
+	if ((now_ms - charger.pending_since_ms) < match->debounce_ms) {
+		return;
+	}
+
+	if ((match->from == charger.state) && (time_in_state < info->min_time_ms)) {
+		return;
+	}
+
+	Charger_Enter(match->to, now_ms);
+}
+
+/**
+ * @brief Moves to a new state
+ * @param state State to enter
+ * @param now_ms Time in ms
+ */
+static void Charger_Enter(uint8_t state, uint32_t now_ms)
+{
+	// The HI-Z rest cycle starts when charging starts, not on every move between charging states
+	if ((charger_states[charger.state].charge_enable == 0) && (charger_states[state].charge_enable == 1)) {
+		charger.cycle_start_ms = now_ms;
+	}
+
+	charger.state = state;
+	charger.state_entry_ms = now_ms;
+	charger.pending = NULL;
+	charger.transitions++;
+}
+
+/**
+ * @brief Returns what the regulator should do in the current state
+ * @param output Filled with the charger enable and current limit, a limit of 0 is no limit
+ */
+void Get_Charger_Output(struct Charger_Output *output)
+{
+	const struct Charger_State_Info *info = &charger_states[charger.state];
+
+	output->charge_enable = info->charge_enable;
+	output->current_limit_ma = info->current_limit_ma;
+
+	if ((output->charge_enable == 1) && (Charger_Resting(0) == 1)) {
+		output->charge_enable = 0;
+	}
+}
+
+/**
+ * @brief Returns the charger state
+ * @retval One of CHARGER_DISCONNECTED to CHARGER_FAULT
+ */
+uint8_t Get_Charger_State(void)
+{
+	return charger.state;
+}
+
+/**
+ * @brief Returns how long the charger has been in its current state
+ * @retval Time in ms as of the last update
+ */
+uint32_t Get_Charger_Time_In_State(void)
+{
+	return charger.now_ms - charger.state_entry_ms;
+}
+
+/**
+ * @brief Returns the number of state changes since boot
+ * @retval Transition count
+ */
+uint32_t Get_Charger_Transition_Count(void)
+{
+	return charger.transitions;
+}
+
+/**
+ * @brief Returns the printable name of a state
+ * @param state Charger state
+ * @retval Name, "UNKNOWN" for an invalid state
+ */
+const char *Get_Charger_State_Name(uint8_t state)
+{
+	if (state >= CHARGER_STATES) {
+		return "UNKNOWN";
+	}
+	return charger_states[state].name;
+}
+
+/**
+ * @brief The from column of a row matches the current state
+ * @param from State, CHARGER_ANY or CHARGER_CHARGING
+ */
+static uint8_t Charger_From(uint8_t from)
+{
+	if (from == CHARGER_ANY) {
+		return 1;
+	}
+	if (from == CHARGER_CHARGING) {
+		return charger_states[charger.state].charge_enable;
+	}
+	return (from == charger.state) ? 1 : 0;
+}
+
+/**
+ * @brief The output is in its HI-Z rest, or came out of it less than settle_ms ago
+ * @param settle_ms Time after the rest still counted as resting
+ */
+static uint8_t Charger_Resting(uint32_t settle_ms)
+{
+	uint32_t cycle_ms = (charger.now_ms - charger.cycle_start_ms) % CHARGER_CYCLE_MS;
+
+	return ((cycle_ms >= (CHARGER_CYCLE_MS - CHARGER_REST_MS)) || (cycle_ms < settle_ms)) ? 1 : 0;
+}
+
+/**
+ * @brief An error is set, a cell is over voltage or a state timed out
+ */
+static uint8_t Charger_Fault(const struct Charger_Inputs *inputs)
+{
+	return ((inputs->error_state != 0) || (inputs->cell_over_voltage != 0) || (charger.timed_out != 0)) ? 1 : 0;
+}
+
+static uint8_t Charger_Fault_Cleared(const struct Charger_Inputs *inputs)
+{
+	return (Charger_Fault(inputs) == 0) ? 1 : 0;
+}
+
+/**
+ * @brief A connector is unplugged. A fault takes priority so FAULT is only left through Charger_Fault_Cleared
+ */
+static uint8_t Charger_Disconnected(const struct Charger_Inputs *inputs)
+{
+	return (((inputs->xt60_connected == 0) || (inputs->balance_port_connected == 0)) && (Charger_Fault(inputs) == 0)) ? 1 : 0;
+}
+
+static uint8_t Charger_Connected(const struct Charger_Inputs *inputs)
+{
+	return ((inputs->xt60_connected != 0) && (inputs->balance_port_connected != 0) && (inputs->number_of_cells >= 2)) ? 1 : 0;
+}
+
+/**
+ * @brief The supply is no longer usable, or the ADC is being tuned and its readings can not be trusted
+ */
+static uint8_t Charger_Power_Lost(const struct Charger_Inputs *inputs)
+{
+	return ((inputs->power_ready == 0) || (inputs->adc_tuning != 0)) ? 1 : 0;
+}
+
+static uint8_t Charger_Needs_Precharge(const struct Charger_Inputs *inputs)
+{
+	return ((Charger_Needs_Charge(inputs) == 1) && (inputs->min_cell_voltage < CHARGER_PRECHARGE_CELL_V)) ? 1 : 0;
+}
+
+static uint8_t Charger_Needs_Charge(const struct Charger_Inputs *inputs)
+{
+	return ((Charger_Power_Lost(inputs) == 0) && (inputs->requires_charging != 0)) ? 1 : 0;
+}
+
+/**
+ * @brief A finished pack has fallen far enough to charge again
+ */
+static uint8_t Charger_Needs_Recharge(const struct Charger_Inputs *inputs)
+{
+	return ((inputs->requires_charging != 0) && (inputs->max_cell_voltage < CHARGER_RECHARGE_CELL_V)) ? 1 : 0;
+}
+
+static uint8_t Charger_Precharged(const struct Charger_Inputs *inputs)
+{
+	return (inputs->min_cell_voltage >= CHARGER_PRECHARGE_EXIT_CELL_V) ? 1 : 0;
+}
+
+static uint8_t Charger_At_CV(const struct Charger_Inputs *inputs)
+{
+	return (inputs->max_cell_voltage >= CHARGER_CV_CELL_V) ? 1 : 0;
+}
+
+static uint8_t Charger_Below_CV(const struct Charger_Inputs *inputs)
+{
+	return (inputs->max_cell_voltage < CHARGER_CV_EXIT_CELL_V) ? 1 : 0;
+}
+
+static uint8_t Charger_Balancing(const struct Charger_Inputs *inputs)
+{
+	return (inputs->balancing != 0) ? 1 : 0;
+}
+
+static uint8_t Charger_Balancing_Only(const struct Charger_Inputs *inputs)
+{
+	return ((inputs->requires_charging == 0) && (inputs->balancing != 0)) ? 1 : 0;
+}
+
+static uint8_t Charger_Balanced(const struct Charger_Inputs *inputs)
+{
+	return (inputs->balancing == 0) ? 1 : 0;
+}
+
+/**
+ * @brief The pack reads full with the charger off. Only used before charging starts
+ */
+static uint8_t Charger_Finished(const struct Charger_Inputs *inputs)
+{
+	return ((inputs->requires_charging == 0) && (inputs->balancing == 0)) ? 1 : 0;
+}
+
+/**
+ * @brief The charge current has fallen below CHARGER_TERMINATION_CURRENT_MA with the output settled on
+ */
+static uint8_t Charger_Terminated(const struct Charger_Inputs *inputs)
+{
+	return ((inputs->charge_current_ma < CHARGER_TERMINATION_CURRENT_MA) && (Charger_Resting(CHARGER_TERMINATION_SETTLE_MS) == 0)) ? 1 : 0;
+}
+
+static uint8_t Charger_Terminated_Balancing(const struct Charger_Inputs *inputs)
+{
+	return ((Charger_Terminated(inputs) == 1) && (inputs->balancing != 0)) ? 1 : 0;
+}
+
+static uint8_t Charger_Terminated_Balanced(const struct Charger_Inputs *inputs)
+{
+	return ((Charger_Terminated(inputs) == 1) && (inputs->balancing == 0)) ? 1 : 0;
+}
@@ -17,10 +17,22 @@ uint32_t Get_Error_State(void) {
 	return error_state;
 }
 
+/**
+ * @brief Sets error bits. Safe to call from tasks and interrupts
+ * @param error_bitmask Errors to set
+ */
 void Set_Error_State(uint32_t error_bitmask) {
+	UBaseType_t interrupt_mask = portSET_INTERRUPT_MASK_FROM_ISR();
 	error_state |= error_bitmask;
+	portCLEAR_INTERRUPT_MASK_FROM_ISR(interrupt_mask);
 }
 
+/**
+ * @brief Clears error bits. Safe to call from tasks and interrupts
+ * @param error_bitmask Errors to clear
+ */
 void Clear_Error_State(uint32_t error_bitmask) {
+	UBaseType_t interrupt_mask = portSET_INTERRUPT_MASK_FROM_ISR();
 	error_state &= ~error_bitmask;
+	portCLEAR_INTERRUPT_MASK_FROM_ISR(interrupt_mask);
 }
@@ -0,0 +1,440 @@
+/**
+ ******************************************************************************
+ * @file           : flash_store.c
+ * @brief          : Wear leveled key/value store for calibration, settings and counters in main flash
+ ******************************************************************************
+ */
+
+#include "flash_store.h"
+
+#include "stm32g0xx_hal_flash.h"
+
+#include "task.h"
+#include "string.h"
+
+/* The maximum time to wait for another task to finish with the store */
+#define FLASH_STORE_MUTEX_WAIT	pdMS_TO_TICKS( 500 )
+
+#define FLASH_STORE_ERASED		0xFFFFFFFF
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t store_index[FLASH_STORE_KEYS];
+static uint8_t store_active_page;
+static uint32_t store_generation;
+static uint32_t store_write_offset;
+static uint8_t store_needs_compaction;
+static uint8_t store_initialised;
+static uint32_t store_compactions;
+static uint32_t store_init_time_us;
+static uint32_t store_write_time_us;
+
+/* Private function prototypes -----------------------------------------------*/
+uint32_t Flash_Store_CRC(uint32_t crc, const uint8_t *data, uint32_t length);
+uint32_t Flash_Store_Record_Bytes(uint32_t length);
+uint8_t Flash_Store_Record_Valid(uint32_t address);
+void Flash_Store_Scan(uint8_t page);
+uint8_t Flash_Store_Erase(uint8_t page);
+uint8_t Flash_Store_Program(uint32_t address, const uint8_t *data, uint32_t length);
+uint8_t Flash_Store_Program_Record(uint32_t address, uint32_t header, const uint8_t *data);
+uint8_t Flash_Store_Compact(uint32_t header, const uint8_t *data);
+uint8_t Flash_Store_Append(uint8_t key, uint8_t version, const uint8_t *data, uint32_t length);
+
+/**
+ * @brief  CRC32, reflected polynomial 0xEDB88320. Records are short and rarely written so it is done bitwise
+ * @param  crc: CRC so far, 0 to start
+ * @param  data: Bytes to add
+ * @param  length: Number of bytes
+ * @retval CRC including data
+ */
+uint32_t Flash_Store_CRC(uint32_t crc, const uint8_t *data, uint32_t length) {
+	crc = ~crc;
+	for (uint32_t i = 0; i < length; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+/**
+ * @brief  Flash used by a record, the header plus the data padded to double words
+ * @param  length: Data length in bytes
+ * @retval Bytes
+ */
+uint32_t Flash_Store_Record_Bytes(uint32_t length) {
+	return FLASH_STORE_HEADER_BYTES + ((length + 7) & ~7UL);
+}
+
+/**
+ * @brief  Checks the CRC of the record at an address
+ * @param  address: Start of the record header
+ * @retval uint8_t 1 if valid, 0 if not
+ */
+uint8_t Flash_Store_Record_Valid(uint32_t address) {
+	uint32_t header = *(volatile uint32_t *)address;
+	uint32_t crc = *(volatile uint32_t *)(address + 4);
+
+	uint32_t check = Flash_Store_CRC(0, (const uint8_t *)&header, sizeof(header));
+	check = Flash_Store_CRC(check, (const uint8_t *)(address + FLASH_STORE_HEADER_BYTES), header >> 16);
+
+	return (check == crc) ? 1 : 0;
+}
+
+/**
+ * @brief  Builds the RAM index from the records of one page and finds the end of the log
+ * @param  page: Store page, 0 to FLASH_STORE_PAGES - 1
+ */
+void Flash_Store_Scan(uint8_t page) {
+	uint32_t base = FLASH_STORE_PAGE_ADDR(page);
+	uint32_t offset = FLASH_STORE_HEADER_BYTES;
+
+	while ((offset + FLASH_STORE_HEADER_BYTES) <= FLASH_PAGE_SIZE) {
+		uint32_t header = *(volatile uint32_t *)(base + offset);
+		uint32_t crc = *(volatile uint32_t *)(base + offset + 4);
+
+		if ((header == FLASH_STORE_ERASED) && (crc == FLASH_STORE_ERASED)) {
+			break;
+		}
+
+		uint32_t length = header >> 16;
+		uint32_t bytes = Flash_Store_Record_Bytes(length);
+
+		/* A damaged header leaves no way to find the next record */
+		if ((length > FLASH_STORE_MAX_DATA) || ((offset + bytes) > FLASH_PAGE_SIZE)) {
+			store_needs_compaction = 1;
+			offset = FLASH_PAGE_SIZE;
+			break;
+		}
+
+		uint8_t key = header & 0xFF;
+		if ((key < FLASH_STORE_KEYS) && (Flash_Store_Record_Valid(base + offset) == 1)) {
+			store_index[key] = base + offset;
+		}
+
+		offset += bytes;
+	}
+
+	store_write_offset = offset;
+
+	/* A reset between programming a record's data and its header leaves data after the end of the log */
+	for (uint32_t address = offset; address < FLASH_PAGE_SIZE; address += 4) {
+		if (*(volatile uint32_t *)(base + address) != FLASH_STORE_ERASED) {
+			store_needs_compaction = 1;
+			break;
+		}
+	}
+}
+
+/**
+ * @brief  Finds the active page and builds the RAM index. Pages are only formatted by the first write
+ * @retval uint8_t 1 if a page with records was found, 0 if the store is empty
+ */
+uint8_t Flash_Store_Init(void) {
+	if (xSemaphoreTake(xMutex_Flash_Store, FLASH_STORE_MUTEX_WAIT) != pdPASS) {
+		return 0;
+	}
+
+	uint32_t start = Flash_Store_Time_Us();
+	uint8_t found = 0;
+
+	memset(store_index, 0, sizeof(store_index));
+	store_active_page = 0;
+	store_generation = 0;
+	store_write_offset = FLASH_PAGE_SIZE;
+
+	for (uint8_t page = 0; page < FLASH_STORE_PAGES; page++) {
+		uint32_t base = FLASH_STORE_PAGE_ADDR(page);
+		uint32_t magic = *(volatile uint32_t *)base;
+		uint32_t generation = *(volatile uint32_t *)(base + 4);
+
+		if ((magic == FLASH_STORE_MAGIC) && (generation != FLASH_STORE_ERASED) && ((found == 0) || (generation > store_generation))) {
+			store_active_page = page;
+			store_generation = generation;
+			found = 1;
+		}
+	}
+
+	/* With no valid page the first write compacts, which formats a page */
+	store_needs_compaction = (found == 0) ? 1 : 0;
+
+	if (found == 1) {
+		Flash_Store_Scan(store_active_page);
+	}
+
+	store_initialised = 1;
+	store_init_time_us = Flash_Store_Time_Us() - start;
+
+	xSemaphoreGive(xMutex_Flash_Store);
+
+	return found;
+}
+
+/**
+ * @brief  Erases one store page
+ * @param  page: Store page, 0 to FLASH_STORE_PAGES - 1
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Flash_Store_Erase(uint8_t page) {
+	FLASH_EraseInitTypeDef erase;
+	erase.TypeErase = FLASH_TYPEERASE_PAGES;
+	erase.Page = FLASH_STORE_FIRST_PAGE + page;
+	erase.NbPages = 1;
+	uint32_t page_error;
+
+	if (HAL_FLASH_Unlock() != HAL_OK) {
+		return 0;
+	}
+
+	uint8_t result = (HAL_FLASHEx_Erase(&erase, &page_error) == HAL_OK) ? 1 : 0;
+
+	if (HAL_FLASH_Lock() != HAL_OK) {
+		result = 0;
+	}
+
+	return result;
+}
+
+/**
+ * @brief  Programs bytes into erased flash, the last double word is padded with erased bytes
+ * @param  address: Double word aligned address
+ * @param  data: Bytes to program
+ * @param  length: Number of bytes
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Flash_Store_Program(uint32_t address, const uint8_t *data, uint32_t length) {
+	if (HAL_FLASH_Unlock() != HAL_OK) {
+		return 0;
+	}
+
+	uint8_t result = 1;
+
+	for (uint32_t offset = 0; offset < length; offset += 8) {
+		uint64_t double_word = UINT64_MAX;
+		uint32_t remaining = length - offset;
+		memcpy(&double_word, &data[offset], (remaining < 8) ? remaining : 8);
+
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, address + offset, double_word) != HAL_OK) {
+			result = 0;
+			break;
+		}
+	}
+
+	if (HAL_FLASH_Lock() != HAL_OK) {
+		result = 0;
+	}
+
+	return result;
+}
+
+/**
+ * @brief  Programs a record, the data first and the header with its CRC last
+ * @param  address: Double word aligned start of the record
+ * @param  header: Key, version and length word
+ * @param  data: Record data, header >> 16 bytes
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Flash_Store_Program_Record(uint32_t address, uint32_t header, const uint8_t *data) {
+	uint32_t length = header >> 16;
+	uint32_t record_header[2];
+	record_header[0] = header;
+	record_header[1] = Flash_Store_CRC(Flash_Store_CRC(0, (const uint8_t *)&header, sizeof(header)), data, length);
+
+	if ((Flash_Store_Program(address + FLASH_STORE_HEADER_BYTES, data, length) == 0) ||
+			(Flash_Store_Program(address, (const uint8_t *)record_header, sizeof(record_header)) == 0)) {
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief  Copies the latest record of every other key to the other page, adds the new record after them and makes the
+ * page active. The page header is programmed last, a reset part way through leaves the old page active with the old
+ * record of the key, so no key is ever lost
+ * @param  header: Key, version and length word of the new record
+ * @param  data: New record data
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Flash_Store_Compact(uint32_t header, const uint8_t *data) {
+	uint8_t target = store_active_page ^ 1;
+	uint8_t new_key = header & 0xFF;
+	uint32_t base = FLASH_STORE_PAGE_ADDR(target);
+	uint32_t offset = FLASH_STORE_HEADER_BYTES;
+	uint32_t index[FLASH_STORE_KEYS] = {0};
+
+	if (Flash_Store_Erase(target) == 0) {
+		return 0;
+	}
+
+	for (uint8_t key = 0; key < FLASH_STORE_KEYS; key++) {
+		if ((key == new_key) || (store_index[key] == 0)) {
+			continue;
+		}
+
+		uint32_t bytes = Flash_Store_Record_Bytes(*(volatile uint32_t *)store_index[key] >> 16);
+
+		if (Flash_Store_Program(base + offset, (const uint8_t *)store_index[key], bytes) == 0) {
+			return 0;
+		}
+
+		index[key] = base + offset;
+		offset += bytes;
+	}
+
+	uint32_t bytes = Flash_Store_Record_Bytes(header >> 16);
+
+	if (((offset + bytes) > FLASH_PAGE_SIZE) || (Flash_Store_Program_Record(base + offset, header, data) == 0)) {
+		return 0;
+	}
+
+	index[new_key] = base + offset;
+	offset += bytes;
+
+	uint32_t page_header[2] = {FLASH_STORE_MAGIC, store_generation + 1};
+	if (Flash_Store_Program(base, (const uint8_t *)page_header, sizeof(page_header)) == 0) {
+		return 0;
+	}
+
+	memcpy(store_index, index, sizeof(store_index));
+	store_active_page = target;
+	store_generation++;
+	store_write_offset = offset;
+	store_needs_compaction = 0;
+	store_compactions++;
+
+	return 1;
+}
+
+/**
+ * @brief  Appends a record to the active page. If it does not fit the page is compacted with the record in it
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Flash_Store_Append(uint8_t key, uint8_t version, const uint8_t *data, uint32_t length) {
+	uint32_t header = key | ((uint32_t)version << 8) | (length << 16);
+
+	/* Rewriting the same record would only wear the flash */
+	if ((store_index[key] != 0) && (*(volatile uint32_t *)store_index[key] == header) &&
+			(memcmp((const void *)(store_index[key] + FLASH_STORE_HEADER_BYTES), data, length) == 0)) {
+		return 1;
+	}
+
+	uint32_t bytes = Flash_Store_Record_Bytes(length);
+
+	if ((store_needs_compaction == 1) || ((store_write_offset + bytes) > FLASH_PAGE_SIZE)) {
+		return Flash_Store_Compact(header, data);
+	}
+
+	uint32_t address = FLASH_STORE_PAGE_ADDR(store_active_page) + store_write_offset;
+
+	/* Whatever happens the space is used, a failed record is dropped at the next compaction */
+	store_write_offset += bytes;
+
+	if (Flash_Store_Program_Record(address, header, data) == 0) {
+		store_needs_compaction = 1;
+		return 0;
+	}
+
+	store_index[key] = address;
+
+	return 1;
+}
+
+/**
+ * @brief  Writes a record, replacing any earlier record with the same key
+ * @param  key: FLASH_STORE_KEY_ value
+ * @param  version: Format version of the data, chosen by the owner of the key
+ * @param  data: Record data
+ * @param  length: Number of bytes, up to FLASH_STORE_MAX_DATA
+ * @retval uint8_t 1 if successful, 0 if error
+ */
+uint8_t Flash_Store_Write(uint8_t key, uint8_t version, const void *data, uint32_t length) {
+	if ((store_initialised == 0) || (key >= FLASH_STORE_KEYS) || (length > FLASH_STORE_MAX_DATA)) {
+		return 0;
+	}
+
+	if (xSemaphoreTake(xMutex_Flash_Store, FLASH_STORE_MUTEX_WAIT) != pdPASS) {
+		return 0;
+	}
+
+	uint32_t start = Flash_Store_Time_Us();
+
+	uint8_t result = Flash_Store_Append(key, version, (const uint8_t *)data, length);
+
+	store_write_time_us = Flash_Store_Time_Us() - start;
+
+	xSemaphoreGive(xMutex_Flash_Store);
+
+	return result;
+}
+
+/**
+ * @brief  Reads the latest record of a key through the RAM index
+ * @param  key: FLASH_STORE_KEY_ value
+ * @param  version: Format version the caller expects
+ * @param  data: Buffer for the record data
+ * @param  length: Number of bytes the caller expects
+ * @retval uint8_t 1 if a record of that version and length was read, 0 if not
+ */
+uint8_t Flash_Store_Read(uint8_t key, uint8_t version, void *data, uint32_t length) {
+	if ((store_initialised == 0) || (key >= FLASH_STORE_KEYS)) {
+		return 0;
+	}
+
+	if (xSemaphoreTake(xMutex_Flash_Store, FLASH_STORE_MUTEX_WAIT) != pdPASS) {
+		return 0;
+	}
+
+	uint8_t result = 0;
+	uint32_t address = store_index[key];
+
+	if (address != 0) {
+		uint32_t header = *(volatile uint32_t *)address;
+
+		if ((((header >> 8) & 0xFF) == version) && ((header >> 16) == length)) {
+			memcpy(data, (const void *)(address + FLASH_STORE_HEADER_BYTES), length);
+			result = 1;
+		}
+	}
+
+	xSemaphoreGive(xMutex_Flash_Store);
+
+	return result;
+}
+
+/**
+ * @brief  Gets the state of the store and the time the boot scan and the last write took
+ * @param  stats: Filled with the store state
+ */
+void Get_Flash_Store_Stats(struct Flash_Store_Stats *stats) {
+	stats->active_page = FLASH_STORE_FIRST_PAGE + store_active_page;
+	stats->generation = store_generation;
+	stats->used_bytes = (store_write_offset < FLASH_PAGE_SIZE) ? store_write_offset : FLASH_PAGE_SIZE;
+	stats->records = 0;
+	for (int i = 0; i < FLASH_STORE_KEYS; i++) {
+		if (store_index[i] != 0) {
+			stats->records++;
+		}
+	}
+	stats->compactions = store_compactions;
+	stats->init_time_us = store_init_time_us;
+	stats->write_time_us = store_write_time_us;
+}
+
+/**
+ * @brief  Free running time with the resolution of the SysTick counter, for timing flash access
+ * @retval Time in us, wraps every 71 minutes
+ */
+uint32_t Flash_Store_Time_Us(void) {
+	TickType_t ticks;
+	uint32_t count;
+
+	/* Read again if a tick landed between the two reads */
+	do {
+		ticks = xTaskGetTickCount();
+		count = SysTick->VAL;
+	} while (ticks != xTaskGetTickCount());
+
+	uint32_t reload = SysTick->LOAD + 1;
+	return (ticks * portTICK_PERIOD_MS * 1000) + (((reload - count) * portTICK_PERIOD_MS * 1000) / reload);
+}
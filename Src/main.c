@@ -61,6 +61,8 @@
 #include "adc_interface.h"
 #include "battery.h"
 #include "bq25703a_regulator.h"
+#include "flash_store.h"
+#include "measurement.h"
 #include "gui_api.h"
 
 // System
@@ -103,6 +105,7 @@ I2C_HandleTypeDef hi2c1;
 DMA_HandleTypeDef hdma_i2c1_tx;
 DMA_HandleTypeDef hdma_i2c1_rx;
 
+TIM_HandleTypeDef htim6;
 TIM_HandleTypeDef htim7;
 
 UART_HandleTypeDef huart1;
@@ -117,6 +120,7 @@ osThreadId blinkyTaskHandle;
 
 SemaphoreHandle_t xTxMutex_CLI;
 SemaphoreHandle_t xTxMutex_Regulator;
+SemaphoreHandle_t xMutex_Flash_Store;
 
 /* USER CODE END PV */
 
@@ -126,6 +130,7 @@ static void MX_GPIO_Init(void);
 static void MX_DMA_Init(void);
 static void MX_ADC1_Init(void);
 static void MX_I2C1_Init(void);
+static void MX_TIM6_Init(void);
 static void MX_TIM7_Init(void);
 static void MX_USART1_UART_Init(void);
 static void MX_UCPD2_Init(void);
@@ -186,6 +191,7 @@ int main(void)
   MX_DMA_Init();
   MX_ADC1_Init();
   MX_I2C1_Init();
+  MX_TIM6_Init();
   MX_TIM7_Init();
   MX_UCPD2_Init();
   /* USER CODE BEGIN 2 */
@@ -228,6 +234,9 @@ int main(void)
 
 	xTxMutex_CLI = xSemaphoreCreateMutex();
 	configASSERT(xTxMutex_CLI);
+
+	xMutex_Flash_Store = xSemaphoreCreateMutex();
+	configASSERT(xMutex_Flash_Store);
   /* USER CODE END RTOS_MUTEX */
 
   /* USER CODE BEGIN RTOS_SEMAPHORES */
@@ -385,8 +394,15 @@ static void MX_ADC1_Init(void)
   hadc1.Init.DMAContinuousRequests = ENABLE;
   hadc1.Init.Overrun = ADC_OVR_DATA_PRESERVED;
   hadc1.Init.SamplingTimeCommon1 = ADC_SAMPLETIME_160CYCLES_5;
-  hadc1.Init.SamplingTimeCommon2 = ADC_SAMPLETIME_1CYCLE_5;
+  hadc1.Init.SamplingTimeCommon2 = ADC_SAMPLETIME_39CYCLES_5;
+#if (ADC_ACQUISITION_MODE == ADC_ACQUISITION_HW_OVERSAMPLING)
+  hadc1.Init.OversamplingMode = ENABLE;
+  hadc1.Init.Oversampling.Ratio = ADC_HW_OVERSAMPLING_RATIO;
+  hadc1.Init.Oversampling.RightBitShift = ADC_HW_OVERSAMPLING_SHIFT;
+  hadc1.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+#else
   hadc1.Init.OversamplingMode = DISABLE;
+#endif
   hadc1.Init.TriggerFrequencyMode = ADC_TRIGGER_FREQ_HIGH;
   if (HAL_ADC_Init(&hadc1) != HAL_OK)
   {
@@ -437,6 +453,7 @@ static void MX_ADC1_Init(void)
   */
   sConfig.Channel = ADC_CHANNEL_TEMPSENSOR;
   sConfig.Rank = ADC_REGULAR_RANK_6;
+  sConfig.SamplingTime = ADC_SAMPLINGTIME_COMMON_2;
   if (HAL_ADC_ConfigChannel(&hadc1, &sConfig) != HAL_OK)
   {
     Error_Handler();
@@ -501,6 +518,46 @@ static void MX_I2C1_Init(void)
 
 }
 
+/**
+  * @brief TIM6 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM6_Init(void)
+{
+
+  /* USER CODE BEGIN TIM6_Init 0 */
+
+  /* USER CODE END TIM6_Init 0 */
+
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+  /* USER CODE BEGIN TIM6_Init 1 */
+
+  /* USER CODE END TIM6_Init 1 */
+  htim6.Instance = TIM6;
+  htim6.Init.Prescaler = 63;
+  htim6.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim6.Init.Period = 499;
+  htim6.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim6) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim6, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM6_Init 2 */
+
+	/* Triggers ADC scan sequences, started by vRead_ADC once the ADC is calibrated */
+
+  /* USER CODE END TIM6_Init 2 */
+
+}
+
 /**
   * @brief TIM7 Initialization Function
   * @param None
@@ -737,9 +794,13 @@ void vLED_Blinky(void const *pvParameters) {
 
 	vTaskDelay(xDelay*4);
 
+	struct Measurement_Snapshot snapshot;
+
 	for (;;) {
 
-		if ( (Get_Balance_Connection_State() != CONNECTED) && (Get_Error_State() == 0)) {
+		Get_Measurement_Snapshot(&snapshot);
+
+		if ( (snapshot.balance_port_connected != CONNECTED) && (snapshot.error_state == 0)) {
 			switch (count) {
 			case 0:
 				HAL_GPIO_WritePin(Red_LED_GPIO_Port, Red_LED_Pin, GPIO_PIN_SET);
@@ -764,12 +825,12 @@ void vLED_Blinky(void const *pvParameters) {
 				count++;
 			}
 		}
-		else if (Get_Error_State() != 0) {
+		else if (snapshot.error_state != 0) {
 			HAL_GPIO_WritePin(Red_LED_GPIO_Port, Red_LED_Pin, GPIO_PIN_SET);
 			HAL_GPIO_WritePin(Green_LED_GPIO_Port, Green_LED_Pin, GPIO_PIN_SET);
 			HAL_GPIO_WritePin(Blue_LED_GPIO_Port, Blue_LED_Pin, GPIO_PIN_SET);
 
-			for (int i = 0; i < (Get_Error_State()); i++) {
+			for (int i = 0; i < (snapshot.error_state); i++) {
 				vTaskDelay(200 / portTICK_PERIOD_MS);
 				HAL_GPIO_WritePin(Red_LED_GPIO_Port, Red_LED_Pin, GPIO_PIN_RESET);
 				vTaskDelay(200 / portTICK_PERIOD_MS);
@@ -778,21 +839,21 @@ void vLED_Blinky(void const *pvParameters) {
 			vTaskDelay(xDelay * 4);
 		}
 		else {
-			if (Get_Balancing_State() >= 1) {
+			if (snapshot.balancing_state >= 1) {
 				HAL_GPIO_WritePin(Blue_LED_GPIO_Port, Blue_LED_Pin, GPIO_PIN_RESET);
 			}
 			else {
 				HAL_GPIO_WritePin(Blue_LED_GPIO_Port, Blue_LED_Pin, GPIO_PIN_SET);
 			}
 
-			if (Get_Requires_Charging_State() == 1) {
+			if (snapshot.requires_charging == 1) {
 				HAL_GPIO_WritePin(Red_LED_GPIO_Port, Red_LED_Pin, GPIO_PIN_RESET);
 			}
 			else {
 				HAL_GPIO_WritePin(Red_LED_GPIO_Port, Red_LED_Pin, GPIO_PIN_SET);
 			}
 
-			if ((Get_Requires_Charging_State() == 0) && (Get_Balancing_State() == 0)) {
+			if ((snapshot.requires_charging == 0) && (snapshot.balancing_state == 0)) {
 				HAL_GPIO_WritePin(Green_LED_GPIO_Port, Green_LED_Pin, GPIO_PIN_RESET);
 			}
 			else {
@@ -0,0 +1,151 @@
+/**
+ ******************************************************************************
+ * @file           : measurement.c
+ * @brief          : Publishes a coherent snapshot of the ADC, battery and regulator state
+ ******************************************************************************
+ */
+
+#include "measurement.h"
+#include "adc_interface.h"
+#include "battery.h"
+#include "bq25703a_regulator.h"
+#include "error.h"
+
+#include "task.h"
+
+/*
+ * Each half of the snapshot has a single writer task and its own sequence counter.
+ * The counter is odd while the writer is updating, readers copy the snapshot and retry
+ * if either counter was odd or changed during the copy. No interrupts are masked and no
+ * mutex is taken, so a writer is never blocked by a slow reader. A reader that preempted a
+ * writer mid update sleeps for a tick so the lower priority writer can finish.
+ * The connection and over voltage flags of the battery half are also republished from
+ * the fast path as soon as they change, the rest of it only after each filtered window.
+ */
+
+/* Private variables ---------------------------------------------------------*/
+static struct Measurement_Snapshot published;
+static volatile uint32_t battery_sequence;
+static volatile uint32_t regulator_sequence;
+static uint32_t battery_windows;
+
+/* Private function prototypes -----------------------------------------------*/
+static void Publish_Battery_Flags(void);
+static uint8_t Battery_Flags_Changed(void);
+
+/**
+ * @brief Publishes the ADC and battery state. Called from vRead_ADC after each filtered window
+ */
+void Publish_Battery_Measurements(void) {
+	battery_sequence++;
+	__DMB();
+
+	published.battery_voltage = Get_Battery_Voltage();
+	for (int i = 0; i < 4; i++) {
+		published.cell_voltage[i] = Get_Cell_Voltage(i);
+	}
+	published.two_s_voltage = Get_Two_S_Voltage();
+	published.three_s_voltage = Get_Three_S_Voltage();
+	published.four_s_voltage = Get_Four_S_Voltage();
+	published.vdda = Get_VDDa();
+	published.mcu_temperature = Get_MCU_Temperature();
+	published.adc_timestamp = Get_ADC_Timestamp();
+	published.battery_dvdt = Get_Battery_dVdt();
+	for (int i = 0; i < 4; i++) {
+		published.cell_dvdt[i] = Get_Cell_dVdt(i);
+	}
+	published.battery_sequence = ++battery_windows;
+	Publish_Battery_Flags();
+
+	__DMB();
+	battery_sequence++;
+}
+
+/**
+ * @brief Republishes the connection and over voltage flags if they changed since the last publish.
+ * Called from vRead_ADC after the fast path of every block, so the charger never acts on a disconnect or trip a window late
+ */
+void Publish_Battery_State(void) {
+	if (Battery_Flags_Changed() == 0) {
+		return;
+	}
+
+	battery_sequence++;
+	__DMB();
+
+	Publish_Battery_Flags();
+
+	__DMB();
+	battery_sequence++;
+}
+
+/**
+ * @brief Copies the battery flags into the published snapshot. Called by the battery writer inside its update
+ */
+static void Publish_Battery_Flags(void) {
+	published.xt60_connected = Get_XT60_Connection_State();
+	published.balance_port_connected = Get_Balance_Connection_State();
+	published.number_of_cells = Get_Number_Of_Cells();
+	published.balancing_state = Get_Balancing_State();
+	published.requires_charging = Get_Requires_Charging_State();
+	published.cell_over_voltage = Get_Cell_Over_Voltage_State();
+}
+
+/**
+ * @brief Compares the battery flags with the published ones. Only the battery writer calls this, so no retry is needed
+ * @retval 1 if any changed
+ */
+static uint8_t Battery_Flags_Changed(void) {
+	return ((published.xt60_connected != Get_XT60_Connection_State()) ||
+			(published.balance_port_connected != Get_Balance_Connection_State()) ||
+			(published.number_of_cells != Get_Number_Of_Cells()) ||
+			(published.balancing_state != Get_Balancing_State()) ||
+			(published.requires_charging != Get_Requires_Charging_State()) ||
+			(published.cell_over_voltage != Get_Cell_Over_Voltage_State())) ? 1 : 0;
+}
+
+/**
+ * @brief Publishes the regulator state. Called from vRegulator after each poll
+ */
+void Publish_Regulator_Measurements(void) {
+	regulator_sequence++;
+	__DMB();
+
+	published.regulator_connected = Get_Regulator_Connection_State();
+	published.regulator_charging = Get_Regulator_Charging_State();
+	published.regulator_vbat_voltage = Get_VBAT_ADC_Reading();
+	published.regulator_vbus_voltage = Get_VBUS_ADC_Reading();
+	published.regulator_charge_current = Get_Charge_Current_ADC_Reading();
+	published.regulator_input_current = Get_Input_Current_ADC_Reading();
+	published.regulator_max_charge_current = Get_Max_Charge_Current();
+
+	__DMB();
+	regulator_sequence++;
+}
+
+/**
+ * @brief Copies a coherent snapshot of the measurements. Call from tasks only
+ * @param snapshot Pointer to the snapshot to fill
+ */
+void Get_Measurement_Snapshot(struct Measurement_Snapshot *snapshot) {
+	uint32_t battery_start, regulator_start;
+
+	do {
+		battery_start = battery_sequence;
+		regulator_start = regulator_sequence;
+
+		if ((battery_start & 1) || (regulator_start & 1)) {
+			vTaskDelay(1);
+			continue;
+		}
+		__DMB();
+
+		*snapshot = published;
+
+		__DMB();
+	} while ((battery_start & 1) || (regulator_start & 1) || (battery_start != battery_sequence) || (regulator_start != regulator_sequence));
+
+	snapshot->regulator_sequence = regulator_start >> 1;
+	snapshot->error_state = Get_Error_State();
+	snapshot->adc_tuning = Get_ADC_Tuning_State();
+}
@@ -0,0 +1,151 @@
+/**
+ ******************************************************************************
+ * @file           : resistance.c
+ * @brief          : Estimates cell and lead resistance from the charger's HI-Z steps
+ ******************************************************************************
+ */
+
+#include "resistance.h"
+#include "adc_interface.h"
+#include "bq25703a_regulator.h"
+#include "error.h"
+
+/* Private typedef -----------------------------------------------------------*/
+struct Resistance_Step {
+	uint8_t charge_enable;
+	uint8_t armed;
+	uint8_t number_of_cells;
+	uint32_t step_ms;
+	uint32_t current_ma;
+	uint32_t battery_voltage;
+	uint32_t cell_voltage[4];
+};
+
+/* Private function prototypes -----------------------------------------------*/
+void Resistance_Measure(const struct Measurement_Snapshot *snapshot);
+uint32_t Resistance_Smooth(uint32_t estimate, uint32_t sample);
+
+/* Private variables ---------------------------------------------------------*/
+static struct Resistance_Step resistance_step;
+static struct Cell_Resistance cell_resistance;
+
+/**
+ * @brief Captures the voltages either side of a HI-Z step. Called from Control_Charger_Output each regulator poll
+ * @param snapshot Snapshot taken at the start of this poll, before the charger output is changed
+ * @param charge_enable Charger output for this poll
+ * @param now_ms Time in ms
+ */
+void Resistance_Update(const struct Measurement_Snapshot *snapshot, uint8_t charge_enable, uint32_t now_ms)
+{
+	// A new pack starts from scratch
+	if ((snapshot->xt60_connected != CONNECTED) || (snapshot->balance_port_connected != CONNECTED)) {
+		for (int i = 0; i < 4; i++) {
+			cell_resistance.cell_uohm[i] = 0;
+		}
+		cell_resistance.lead_uohm = 0;
+		cell_resistance.samples = 0;
+		resistance_step.armed = 0;
+	}
+	// Charging up to now and resting from this poll, the snapshot is the loaded side of the step
+	else if ((resistance_step.charge_enable == 1) && (charge_enable == 0)) {
+		resistance_step.current_ma = Get_Charge_Current_ADC_Reading() / (REG_ADC_MULTIPLIER / 1000);
+
+		// The bleed current is not known, so steps taken while balancing would read low
+		if ((resistance_step.current_ma >= RESISTANCE_MIN_CURRENT_MA) && (snapshot->balancing_state == 0)) {
+			resistance_step.armed = 1;
+			resistance_step.step_ms = now_ms;
+			resistance_step.number_of_cells = snapshot->number_of_cells;
+			resistance_step.battery_voltage = snapshot->battery_voltage;
+			for (int i = 0; i < 4; i++) {
+				resistance_step.cell_voltage[i] = snapshot->cell_voltage[i];
+			}
+		}
+		else {
+			resistance_step.armed = 0;
+			cell_resistance.rejected++;
+		}
+	}
+	else if ((resistance_step.armed == 1) && (charge_enable == 0) && ((now_ms - resistance_step.step_ms) >= RESISTANCE_SETTLE_MS)) {
+		resistance_step.armed = 0;
+
+		if ((snapshot->balancing_state == 0) && (snapshot->number_of_cells == resistance_step.number_of_cells)) {
+			Resistance_Measure(snapshot);
+		}
+		else {
+			cell_resistance.rejected++;
+		}
+	}
+	// Charging resumed before the rest settled
+	else if (charge_enable == 1) {
+		resistance_step.armed = 0;
+	}
+
+	resistance_step.charge_enable = charge_enable;
+}
+
+/**
+ * @brief Works out the resistances from the loaded voltages in resistance_step and the rested ones in the snapshot
+ * @param snapshot Snapshot taken RESISTANCE_SETTLE_MS or more into the rest
+ */
+void Resistance_Measure(const struct Measurement_Snapshot *snapshot)
+{
+	uint32_t cell_drop_sum = 0;
+	uint32_t cell_uohm[4] = { 0 };
+
+	for (int i = 0; i < resistance_step.number_of_cells; i++) {
+		// Cells relax downwards once the current stops, a rise is noise and counts as no drop
+		uint32_t drop = 0;
+		if (resistance_step.cell_voltage[i] > snapshot->cell_voltage[i]) {
+			drop = resistance_step.cell_voltage[i] - snapshot->cell_voltage[i];
+		}
+		cell_drop_sum += drop;
+
+		// uV * 1000 / mA = uOhm
+		cell_uohm[i] = (uint32_t)(((uint64_t)drop * 1000) / resistance_step.current_ma);
+	}
+
+	uint32_t lead_drop = 0;
+	uint32_t battery_drop = 0;
+	if (resistance_step.battery_voltage > snapshot->battery_voltage) {
+		battery_drop = resistance_step.battery_voltage - snapshot->battery_voltage;
+	}
+	if (battery_drop > cell_drop_sum) {
+		lead_drop = battery_drop - cell_drop_sum;
+	}
+	uint32_t lead_uohm = (uint32_t)(((uint64_t)lead_drop * 1000) / resistance_step.current_ma);
+
+	if (cell_resistance.samples == 0) {
+		for (int i = 0; i < 4; i++) {
+			cell_resistance.cell_uohm[i] = cell_uohm[i];
+		}
+		cell_resistance.lead_uohm = lead_uohm;
+	}
+	else {
+		for (int i = 0; i < 4; i++) {
+			cell_resistance.cell_uohm[i] = Resistance_Smooth(cell_resistance.cell_uohm[i], cell_uohm[i]);
+		}
+		cell_resistance.lead_uohm = Resistance_Smooth(cell_resistance.lead_uohm, lead_uohm);
+	}
+	cell_resistance.samples++;
+}
+
+/**
+ * @brief Moves an estimate 1 / (1 << RESISTANCE_SHIFT) of the way to a new sample
+ * @param estimate Current estimate in uOhm
+ * @param sample New sample in uOhm
+ * @retval Smoothed estimate in uOhm
+ */
+uint32_t Resistance_Smooth(uint32_t estimate, uint32_t sample)
+{
+	int32_t difference = (int32_t)sample - (int32_t)estimate;
+	return (uint32_t)((int32_t)estimate + (difference / (1 << RESISTANCE_SHIFT)));
+}
+
+/**
+ * @brief Returns the smoothed resistance estimates
+ * @param resistance Filled with the cell and lead resistance in uOhm, 0 until the first step, and the step counts
+ */
+void Get_Cell_Resistance(struct Cell_Resistance *resistance)
+{
+	*resistance = cell_resistance;
+}
@@ -32,6 +32,7 @@
 
 #include "battery.h"
 #include "bq25703a_regulator.h"
+#include "measurement.h"
 #include "printf.h"
 #include <stdlib.h>
 
@@ -214,14 +215,18 @@ void vUSBPD_User(void const *pvParameters) {
 		}
 	}
 
+	struct Measurement_Snapshot snapshot;
+
 	for (;;) {
 
+		Get_Measurement_Snapshot(&snapshot);
+
 		//Find the best PDO from the source for the highest regulator efficiency
-		if ((Get_Balance_Connection_State() == CONNECTED)) {
+		if ((snapshot.balance_port_connected == CONNECTED)) {
 			if (match_found == 0) {
 				for (int i = 0; i < VOLTAGE_CHOICE_ARRAY_SIZE; i++) {
 					for (int t = 0; t < DPM_Ports[USBPD_PORT_0].DPM_NumberOfRcvSRCPDO; t++) {
-						if (voltage_choice_list_mv[Get_Number_Of_Cells() - 2][i] == source_pdo[t].voltage_mv) {
+						if (voltage_choice_list_mv[snapshot.number_of_cells - 2][i] == source_pdo[t].voltage_mv) {
 							printf("Voltage match found: %d\r\n", source_pdo[t].voltage_mv);
 							selected_source_pdo = t;
 							match_found = 1;
@@ -238,7 +243,7 @@ void vUSBPD_User(void const *pvParameters) {
 			match_found = 0;
 		}
 
-		if ((Get_XT60_Connection_State() == CONNECTED) && (Get_Balance_Connection_State() == CONNECTED) && (power_ready == NOT_READY) && (match_found == 1)) {
+		if ((snapshot.xt60_connected == CONNECTED) && (snapshot.balance_port_connected == CONNECTED) && (power_ready == NOT_READY) && (match_found == 1)) {
 			printf("Requesting %dV, Result: ", (source_pdo[selected_source_pdo].voltage_mv/1000));
 			status = USBPD_DPM_RequestMessageRequest(USBPD_PORT_0, (selected_source_pdo + 1), (uint16_t)source_pdo[selected_source_pdo].voltage_mv);
 			vTaskDelay(400 / portTICK_PERIOD_MS);
@@ -257,8 +262,8 @@ void vUSBPD_User(void const *pvParameters) {
 				power_ready = NOT_READY;
 			}
 		}
-		else if ((Get_XT60_Connection_State() == NOT_CONNECTED) || (Get_Balance_Connection_State() == NOT_CONNECTED)){
-			if (Get_VBUS_ADC_Reading() > (6 * REG_ADC_MULTIPLIER)) {
+		else if ((snapshot.xt60_connected == NOT_CONNECTED) || (snapshot.balance_port_connected == NOT_CONNECTED)){
+			if (snapshot.regulator_vbus_voltage > (6 * REG_ADC_MULTIPLIER)) {
 				printf("Requesting 5V, Result: ");
 				status = USBPD_DPM_RequestMessageRequest(USBPD_PORT_0, 1, (uint16_t)5000);
 				vTaskDelay(100 / portTICK_PERIOD_MS);